@@ -0,0 +1,151 @@
+// Keyframe Animation Clips
+// Imported animation tracks stored as flat per-bone key arrays, sampled into a PoseBuffer.
+// Sequential playback keeps one cursor per channel, so a sample costs O(1) per track.
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+#include <cmath>
+
+#include <glm/glm.hpp>
+
+#include "skeleton.h"
+
+#define ANIMATION_CHANNEL_NUM 3
+#define ANIMATION_CURSOR_MAX_STEP 4
+
+namespace SkeletalMesh {
+    enum AnimationChannel {
+        ChannelTranslation = 0,
+        ChannelRotation = 1,
+        ChannelScale = 2
+    };
+
+    // Channel c owns keys [keyOffset[c], keyOffset[c] + keyNum[c]) of its clip.
+    // A channel without keys keeps the bind pose value.
+    struct AnimationTrack {
+        BoneId bone;
+        uint32_t keyOffset[ANIMATION_CHANNEL_NUM];
+        uint32_t keyNum[ANIMATION_CHANNEL_NUM];
+        glm::fvec4 bindValue[ANIMATION_CHANNEL_NUM];
+        glm::fmat4 invBindLocal;
+    };
+
+    class AnimationClip;
+
+    // Last key interval of every channel of one playback. Each playing instance needs its own.
+    class AnimationCursor {
+    public:
+        std::vector<uint32_t> key;
+
+        void bind(const AnimationClip &_clip);
+
+        void bind(size_t _trackNum) { key.assign(_trackNum * ANIMATION_CHANNEL_NUM, 0u); }
+
+        void reset() { std::fill(key.begin(), key.end(), 0u); }
+    };
+
+    // Times are in seconds. Values are 4 floats per key: translations and scales (x, y, z, 0),
+    // rotations (x, y, z, w) with consecutive keys in the same hemisphere, so plain
+    // normalized lerp interpolates them without branching.
+    class AnimationClip {
+    public:
+        std::string name;
+        float duration;
+        std::vector<AnimationTrack> tracks;
+        std::vector<float> keyTime;
+        std::vector<glm::fvec4> keyValue;
+
+        AnimationClip() : duration(0.0f) {}
+
+        size_t memoryBytes() const {
+            return sizeof(AnimationClip) + name.size() + tracks.size() * sizeof(AnimationTrack) +
+                   keyTime.size() * sizeof(float) + keyValue.size() * sizeof(glm::fvec4);
+        }
+
+        // Writes bone modifiers for time _time (clamped to the keys) into _pose.
+        // The modifier is inverse(bind local) * animated local, since the skeleton applies it after the bind local.
+        void sample(float _time, AnimationCursor &_cursor, PoseBuffer &_pose) const {
+            if (_cursor.key.size() != tracks.size() * ANIMATION_CHANNEL_NUM) _cursor.bind(*this);
+            uint32_t *cursor = _cursor.key.data();
+            for (size_t i = 0; i < tracks.size(); i++, cursor += ANIMATION_CHANNEL_NUM)
+                _pose.set(tracks[i].bone, sampleTrack(tracks[i], _time, cursor));
+        }
+
+        // Same without a cursor, for random access (each channel is binary searched)
+        void sample(float _time, PoseBuffer &_pose) const {
+            uint32_t cursor[ANIMATION_CHANNEL_NUM];
+            for (size_t i = 0; i < tracks.size(); i++) {
+                for (int c = 0; c < ANIMATION_CHANNEL_NUM; c++)
+                    cursor[c] = seek(tracks[i].keyOffset[c], tracks[i].keyNum[c], _time);
+                _pose.set(tracks[i].bone, sampleTrack(tracks[i], _time, cursor));
+            }
+        }
+
+        // Animated local transform T * R * S of a track
+        glm::fmat4 sampleLocal(const AnimationTrack &_track, float _time, uint32_t *_cursor) const {
+            glm::fvec4 t = sampleChannel(_track, ChannelTranslation, _time, _cursor[ChannelTranslation]);
+            glm::fvec4 r = sampleChannel(_track, ChannelRotation, _time, _cursor[ChannelRotation]);
+            glm::fvec4 s = sampleChannel(_track, ChannelScale, _time, _cursor[ChannelScale]);
+            r /= std::sqrt(r.x * r.x + r.y * r.y + r.z * r.z + r.w * r.w);
+            return composeLocal(t, r, s);
+        }
+
+        static glm::fmat4 composeLocal(const glm::fvec4 &_t, const glm::fvec4 &_r, const glm::fvec4 &_s) {
+            float x = _r.x, y = _r.y, z = _r.z, w = _r.w;
+            glm::fmat4 m(1.0f);
+            m[0] = glm::fvec4(1.0f - 2.0f * (y * y + z * z), 2.0f * (x * y + w * z), 2.0f * (x * z - w * y), 0.0f) * _s.x;
+            m[1] = glm::fvec4(2.0f * (x * y - w * z), 1.0f - 2.0f * (x * x + z * z), 2.0f * (y * z + w * x), 0.0f) * _s.y;
+            m[2] = glm::fvec4(2.0f * (x * z + w * y), 2.0f * (y * z - w * x), 1.0f - 2.0f * (x * x + y * y), 0.0f) * _s.z;
+            m[3] = glm::fvec4(_t.x, _t.y, _t.z, 1.0f);
+            return m;
+        }
+
+    private:
+        glm::fmat4 sampleTrack(const AnimationTrack &_track, float _time, uint32_t *_cursor) const {
+            return _track.invBindLocal * sampleLocal(_track, _time, _cursor);
+        }
+
+        // Index (relative to the channel) of the key interval [k, k + 1] containing _time
+        uint32_t seek(uint32_t _offset, uint32_t _num, float _time) const {
+            if (_num < 2) return 0;
+            const float *times = keyTime.data() + _offset;
+            uint32_t k = (uint32_t) (std::upper_bound(times, times + _num, _time) - times);
+            return std::min(k > 0 ? k - 1 : 0, _num - 2);
+        }
+
+        glm::fvec4 sampleChannel(const AnimationTrack &_track, int _channel, float _time, uint32_t &_key) const {
+            uint32_t num = _track.keyNum[_channel];
+            if (num == 0) return _track.bindValue[_channel];
+            const float *times = keyTime.data() + _track.keyOffset[_channel];
+            const glm::fvec4 *values = keyValue.data() + _track.keyOffset[_channel];
+            if (num == 1 || _time <= times[0]) return values[0];
+            if (_time >= times[num - 1]) return values[num - 1];
+
+            // Playing forward usually stays in the same interval or moves to the next one
+            uint32_t k = std::min(_key, num - 2);
+            if (_time < times[k]) {
+                k = seek(_track.keyOffset[_channel], num, _time);
+            } else {
+                int step = 0;
+                while (_time >= times[k + 1] && step < ANIMATION_CURSOR_MAX_STEP) {
+                    k++;
+                    step++;
+                }
+                if (_time >= times[k + 1]) k = seek(_track.keyOffset[_channel], num, _time);
+            }
+            _key = k;
+
+            float span = times[k + 1] - times[k];
+            float f = span > 0.0f ? (_time - times[k]) / span : 0.0f;
+            return values[k] + (values[k + 1] - values[k]) * f;
+        }
+    };
+
+    inline void AnimationCursor::bind(const AnimationClip &_clip) {
+        bind(_clip.tracks.size());
+    }
+}
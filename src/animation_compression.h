@@ -0,0 +1,508 @@
+// Animation Clip Compression
+// Smallest-three quantized rotations, range-reduced 16-bit translations and scales,
+// constant channel elimination and keyframe reduction bounded by the error of measured
+// joints (the fingertips, for the Hand rig). Compressed clips sample straight into a PoseBuffer.
+
+#pragma once
+
+#include <cstdio>
+#include <cmath>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include "animation_clip.h"
+#include "file_util.h"
+
+#define ANIMATION_COMPRESSION_MAGIC 0x4C434E48u // "HNCL"
+#define ANIMATION_COMPRESSION_VERSION 1
+#define ANIMATION_COMPRESSION_SUFFIX ".hclip"
+#define ANIMATION_COMPRESSION_TIME_STEPS 65535.0f
+#define ANIMATION_COMPRESSION_VALUE_STEPS 65535.0f
+#define ANIMATION_COMPRESSION_ROTATION_STEPS 32767.0f
+#define ANIMATION_COMPRESSION_MEASURE_RATE 60.0f
+#define ANIMATION_COMPRESSION_MAX_ATTEMPTS 12
+
+namespace SkeletalMesh {
+    // keyNum 0: the channel keeps the bind value. keyNum 1: constant, the value is rangeMin
+    // (rotations x, y, z in rangeMin and w in rangeExtent[0]). Otherwise the channel owns keys
+    // [keyOffset, keyOffset + keyNum): 16-bit times and 3 words per value, dequantized as
+    // rangeMin + word / steps * rangeExtent (rotations use one range for all three small components).
+    struct CompressedChannel {
+        uint32_t keyOffset;
+        uint32_t keyNum;
+        float rangeMin[3];
+        float rangeExtent[3];
+    };
+
+    struct CompressedTrack {
+        BoneId bone;
+        CompressedChannel channel[ANIMATION_CHANNEL_NUM];
+        glm::fvec4 bindValue[ANIMATION_CHANNEL_NUM];
+        glm::fmat4 invBindLocal;
+    };
+
+    class CompressedClip {
+    public:
+        std::string name;
+        float duration;
+        std::vector<CompressedTrack> tracks;
+        std::vector<uint16_t> keyTime;
+        std::vector<uint16_t> keyValue;
+
+        CompressedClip() : duration(0.0f) {}
+
+        size_t memoryBytes() const {
+            return sizeof(CompressedClip) + name.size() + tracks.size() * sizeof(CompressedTrack) +
+                   keyTime.size() * sizeof(uint16_t) + keyValue.size() * sizeof(uint16_t);
+        }
+
+        // Same contract as AnimationClip::sample()
+        void sample(float _time, AnimationCursor &_cursor, PoseBuffer &_pose) const {
+            if (_cursor.key.size() != tracks.size() * ANIMATION_CHANNEL_NUM) _cursor.bind(tracks.size());
+            float step = toStep(_time);
+            uint32_t *cursor = _cursor.key.data();
+            for (size_t i = 0; i < tracks.size(); i++, cursor += ANIMATION_CHANNEL_NUM) {
+                const CompressedTrack &track = tracks[i];
+                glm::fvec4 t = sampleChannel(track, ChannelTranslation, step, cursor[ChannelTranslation]);
+                glm::fvec4 r = sampleChannel(track, ChannelRotation, step, cursor[ChannelRotation]);
+                glm::fvec4 s = sampleChannel(track, ChannelScale, step, cursor[ChannelScale]);
+                r /= std::sqrt(r.x * r.x + r.y * r.y + r.z * r.z + r.w * r.w);
+                _pose.set(track.bone, track.invBindLocal * AnimationClip::composeLocal(t, r, s));
+            }
+        }
+
+        float toStep(float _time) const {
+            if (duration <= 0.0f) return 0.0f;
+            return std::min(std::max(_time / duration, 0.0f), 1.0f) * ANIMATION_COMPRESSION_TIME_STEPS;
+        }
+
+        glm::fvec4 decode(const CompressedTrack &_track, int _channel, uint32_t _key) const {
+            const CompressedChannel &channel = _track.channel[_channel];
+            if (channel.keyNum == 1) {
+                if (_channel == ChannelRotation)
+                    return glm::fvec4(channel.rangeMin[0], channel.rangeMin[1], channel.rangeMin[2],
+                                      channel.rangeExtent[0]);
+                return glm::fvec4(channel.rangeMin[0], channel.rangeMin[1], channel.rangeMin[2], 0.0f);
+            }
+            const uint16_t *word = keyValue.data() + 3 * (size_t) (channel.keyOffset + _key);
+            if (_channel != ChannelRotation) {
+                glm::fvec4 value(0.0f);
+                for (int c = 0; c < 3; c++)
+                    value[c] = channel.rangeMin[c] + word[c] / ANIMATION_COMPRESSION_VALUE_STEPS * channel.rangeExtent[c];
+                return value;
+            }
+            // Smallest three: the top bits of the first two words hold the index of the dropped component
+            int largest = (word[0] >> 15) | ((word[1] >> 15) << 1);
+            glm::fvec4 q(0.0f);
+            float sum = 0.0f;
+            for (int c = 0, slot = 0; c < 4; c++) {
+                if (c == largest) continue;
+                float v = channel.rangeMin[0] + (word[slot] & 0x7FFF) / ANIMATION_COMPRESSION_ROTATION_STEPS *
+                                                channel.rangeExtent[0];
+                q[c] = v;
+                sum += v * v;
+                slot++;
+            }
+            q[largest] = std::sqrt(std::max(0.0f, 1.0f - sum));
+            return q;
+        }
+
+    private:
+        glm::fvec4 sampleChannel(const CompressedTrack &_track, int _channel, float _step, uint32_t &_key) const {
+            const CompressedChannel &channel = _track.channel[_channel];
+            uint32_t num = channel.keyNum;
+            if (num == 0) return _track.bindValue[_channel];
+            if (num == 1) return decode(_track, _channel, 0);
+            const uint16_t *times = keyTime.data() + channel.keyOffset;
+            if (_step <= times[0]) return decode(_track, _channel, 0);
+            if (_step >= times[num - 1]) return decode(_track, _channel, num - 1);
+
+            uint32_t k = std::min(_key, num - 2);
+            if (_step < times[k]) k = 0;
+            int stepNum = 0;
+            while (_step >= times[k + 1] && stepNum < ANIMATION_CURSOR_MAX_STEP) {
+                k++;
+                stepNum++;
+            }
+            if (_step >= times[k + 1]) {
+                const uint16_t *found = std::upper_bound(times, times + num, (uint16_t) std::min(_step, 65535.0f));
+                k = std::min((uint32_t) (found - times) - 1, num - 2);
+                while (k > 0 && _step < times[k]) k--;
+            }
+            _key = k;
+
+            glm::fvec4 a = decode(_track, _channel, k);
+            glm::fvec4 b = decode(_track, _channel, k + 1);
+            // Decoded rotations are not hemisphere-aligned any more
+            if (_channel == ChannelRotation && a.x * b.x + a.y * b.y + a.z * b.z + a.w * b.w < 0.0f) b = -b;
+            float span = (float) (times[k + 1] - times[k]);
+            float f = span > 0.0f ? (_step - times[k]) / span : 0.0f;
+            return a + (b - a) * f;
+        }
+    };
+
+    struct CompressionSettings {
+        // Largest allowed distance (in model units) between a measured joint in the original and the compressed clip
+        float maxError;
+        // Joints the error is measured at; empty means every leaf bone
+        std::vector<BoneId> measuredBones;
+
+        CompressionSettings() : maxError(0.01f), measuredBones() {}
+    };
+
+    struct CompressionReport {
+        size_t originalBytes;
+        size_t compressedBytes;
+        size_t originalKeyNum;
+        size_t compressedKeyNum;
+        size_t constantChannelNum;
+        float maxError;
+        float tolerance;
+
+        CompressionReport()
+                : originalBytes(0), compressedBytes(0), originalKeyNum(0), compressedKeyNum(0),
+                  constantChannelNum(0), maxError(0.0f), tolerance(0.0f) {}
+    };
+
+    namespace AnimationCompression {
+        // Bones whose node has no descendant bone, i.e. the tips of every chain
+        inline std::vector<BoneId> leafBones(const Skeleton &_skeleton) {
+            std::vector<bool> hasBoneChild(_skeleton.nodeNum(), false);
+            for (size_t i = _skeleton.nodeNum(); i-- > 1;) {
+                int parent = _skeleton.nodeParent[i];
+                if (parent >= 0 && (_skeleton.nodeBone[i] >= 0 || hasBoneChild[i])) hasBoneChild[parent] = true;
+            }
+            std::vector<BoneId> leaves;
+            for (size_t i = 0; i < _skeleton.nodeNum(); i++) {
+                if (_skeleton.nodeBone[i] >= 0 && !hasBoneChild[i]) leaves.push_back(_skeleton.nodeBone[i]);
+            }
+            return leaves;
+        }
+
+        // Root-relative positions of the measured joints at ANIMATION_COMPRESSION_MEASURE_RATE
+        template<class Clip>
+        void measure(const Clip &_clip, const Skeleton &_skeleton, const std::vector<BoneId> &_bones,
+                     std::vector<glm::fvec3> &_positions) {
+            PoseBuffer pose;
+            pose.bind(_skeleton);
+            std::vector<glm::fmat4> boneTransf(_skeleton.boneNum());
+            AnimationCursor cursor;
+            int frameNum = (int) std::ceil(_clip.duration * ANIMATION_COMPRESSION_MEASURE_RATE) + 1;
+            _positions.clear();
+            for (int f = 0; f < frameNum; f++) {
+                float time = std::min(f / ANIMATION_COMPRESSION_MEASURE_RATE, _clip.duration);
+                pose.reset();
+                _clip.sample(time, cursor, pose);
+                _skeleton.evaluate(pose.boneModifier.data(), boneTransf.data(), pose.nodeGlobal.data());
+                for (size_t b = 0; b < _bones.size(); b++) {
+                    int node = _skeleton.boneNode[_bones[b]];
+                    _positions.push_back(node < 0 ? glm::fvec3(0.0f) : glm::fvec3(pose.nodeGlobal[node][3]));
+                }
+            }
+        }
+
+        inline float distance(const glm::fvec4 &_a, const glm::fvec4 &_b) {
+            glm::fvec4 d = _a - _b;
+            return std::sqrt(d.x * d.x + d.y * d.y + d.z * d.z + d.w * d.w);
+        }
+
+        // Keeps the first and last key and greedily extends every segment while linear
+        // interpolation reproduces all skipped keys within _tolerance
+        inline void reduceKeys(const float *_times, const glm::fvec4 *_values, uint32_t _num, float _tolerance,
+                               bool _rotation, std::vector<uint32_t> &_kept) {
+            _kept.clear();
+            if (_num == 0) return;
+            _kept.push_back(0);
+            uint32_t anchor = 0;
+            while (anchor + 1 < _num) {
+                uint32_t end = anchor + 1;
+                while (end + 1 < _num) {
+                    uint32_t candidate = end + 1;
+                    float span = _times[candidate] - _times[anchor];
+                    bool fits = true;
+                    for (uint32_t k = anchor + 1; k < candidate && fits; k++) {
+                        float f = span > 0.0f ? (_times[k] - _times[anchor]) / span : 0.0f;
+                        glm::fvec4 v = _values[anchor] + (_values[candidate] - _values[anchor]) * f;
+                        if (_rotation) v /= std::sqrt(v.x * v.x + v.y * v.y + v.z * v.z + v.w * v.w);
+                        fits = distance(v, _values[k]) <= _tolerance;
+                    }
+                    if (!fits) break;
+                    end = candidate;
+                }
+                _kept.push_back(end);
+                anchor = end;
+            }
+        }
+
+        inline void encodeRotation(const glm::fvec4 &_q, const CompressedChannel &_channel, uint16_t *_word) {
+            int largest = 0;
+            for (int c = 1; c < 4; c++)
+                if (std::abs(_q[c]) > std::abs(_q[largest])) largest = c;
+            // q and -q are the same rotation, make the dropped component positive
+            float sign = _q[largest] < 0.0f ? -1.0f : 1.0f;
+            for (int c = 0, slot = 0; c < 4; c++) {
+                if (c == largest) continue;
+                float normalized = _channel.rangeExtent[0] > 0.0f
+                                   ? (_q[c] * sign - _channel.rangeMin[0]) / _channel.rangeExtent[0] : 0.0f;
+                float level = std::floor(std::min(std::max(normalized, 0.0f), 1.0f) * ANIMATION_COMPRESSION_ROTATION_STEPS + 0.5f);
+                _word[slot] = (uint16_t) level;
+                slot++;
+            }
+            _word[0] |= (uint16_t) ((largest & 1) << 15);
+            _word[1] |= (uint16_t) ((largest >> 1) << 15);
+        }
+
+        inline void compressChannel(const AnimationClip &_clip, const AnimationTrack &_track, int _channel,
+                                    float _tolerance, CompressedClip &_out, CompressedTrack &_outTrack,
+                                    CompressionReport &_report) {
+            CompressedChannel &channel = _outTrack.channel[_channel];
+            channel = CompressedChannel();
+            uint32_t num = _track.keyNum[_channel];
+            _report.originalKeyNum += num;
+            if (num == 0) return;
+            const float *times = _clip.keyTime.data() + _track.keyOffset[_channel];
+            const glm::fvec4 *values = _clip.keyValue.data() + _track.keyOffset[_channel];
+            bool rotation = _channel == ChannelRotation;
+
+            // Constant channels collapse to one exact value, or vanish if that value is the bind pose
+            bool constant = true;
+            for (uint32_t k = 1; k < num && constant; k++)
+                constant = distance(values[k], values[0]) <= _tolerance;
+            if (constant) {
+                _report.constantChannelNum++;
+                glm::fvec4 bind = _track.bindValue[_channel];
+                bool isBind = rotation ? std::min(distance(values[0], bind), distance(values[0], -bind)) <= _tolerance
+                                       : distance(values[0], bind) <= _tolerance;
+                if (isBind) return;
+                channel.keyNum = 1;
+                for (int c = 0; c < 3; c++)
+                    channel.rangeMin[c] = values[0][c];
+                channel.rangeExtent[0] = values[0][3];
+                _report.compressedKeyNum++;
+                return;
+            }
+
+            std::vector<uint32_t> kept;
+            reduceKeys(times, values, num, _tolerance, rotation, kept);
+
+            // Range reduction over the kept keys
+            if (rotation) {
+                float lo = 1.0f, hi = -1.0f;
+                for (size_t k = 0; k < kept.size(); k++) {
+                    const glm::fvec4 &q = values[kept[k]];
+                    int largest = 0;
+                    for (int c = 1; c < 4; c++)
+                        if (std::abs(q[c]) > std::abs(q[largest])) largest = c;
+                    float sign = q[largest] < 0.0f ? -1.0f : 1.0f;
+                    for (int c = 0; c < 4; c++) {
+                        if (c == largest) continue;
+                        lo = std::min(lo, q[c] * sign);
+                        hi = std::max(hi, q[c] * sign);
+                    }
+                }
+                channel.rangeMin[0] = lo;
+                channel.rangeExtent[0] = hi - lo;
+            } else {
+                for (int c = 0; c < 3; c++) {
+                    float lo = values[kept[0]][c], hi = lo;
+                    for (size_t k = 1; k < kept.size(); k++) {
+                        lo = std::min(lo, values[kept[k]][c]);
+                        hi = std::max(hi, values[kept[k]][c]);
+                    }
+                    channel.rangeMin[c] = lo;
+                    channel.rangeExtent[c] = hi - lo;
+                }
+            }
+
+            channel.keyOffset = (uint32_t) _out.keyTime.size();
+            channel.keyNum = (uint32_t) kept.size();
+            for (size_t k = 0; k < kept.size(); k++) {
+                float step = _out.duration > 0.0f ? times[kept[k]] / _out.duration * ANIMATION_COMPRESSION_TIME_STEPS : 0.0f;
+                _out.keyTime.push_back((uint16_t) std::min(std::max(std::floor(step + 0.5f), 0.0f),
+                                                           ANIMATION_COMPRESSION_TIME_STEPS));
+                uint16_t word[3];
+                if (rotation) {
+                    encodeRotation(values[kept[k]], channel, word);
+                } else {
+                    for (int c = 0; c < 3; c++) {
+                        float normalized = channel.rangeExtent[c] > 0.0f
+                                           ? (values[kept[k]][c] - channel.rangeMin[c]) / channel.rangeExtent[c] : 0.0f;
+                        word[c] = (uint16_t) std::floor(std::min(std::max(normalized, 0.0f), 1.0f) *
+                                                        ANIMATION_COMPRESSION_VALUE_STEPS + 0.5f);
+                    }
+                }
+                _out.keyValue.insert(_out.keyValue.end(), word, word + 3);
+            }
+            _report.compressedKeyNum += kept.size();
+        }
+
+        // Compresses with per-channel tolerance _tolerance (model units for translations,
+        // radians-ish for rotations and relative for scales, each scaled by _extent)
+        inline void compressWith(const AnimationClip &_clip, float _tolerance, float _extent,
+                                 CompressedClip &_out, CompressionReport &_report) {
+            _out.name = _clip.name;
+            _out.duration = _clip.duration;
+            _out.tracks.resize(_clip.tracks.size());
+            _out.keyTime.clear();
+            _out.keyValue.clear();
+            _report.originalKeyNum = 0;
+            _report.compressedKeyNum = 0;
+            _report.constantChannelNum = 0;
+            float channelTolerance[ANIMATION_CHANNEL_NUM] = {_tolerance, _tolerance / _extent * 0.5f,
+                                                             _tolerance / _extent};
+            for (size_t i = 0; i < _clip.tracks.size(); i++) {
+                const AnimationTrack &track = _clip.tracks[i];
+                CompressedTrack &outTrack = _out.tracks[i];
+                outTrack.bone = track.bone;
+                outTrack.invBindLocal = track.invBindLocal;
+                for (int c = 0; c < ANIMATION_CHANNEL_NUM; c++) {
+                    outTrack.bindValue[c] = track.bindValue[c];
+                    compressChannel(_clip, track, c, channelTolerance[c], _out, outTrack, _report);
+                }
+            }
+        }
+
+        inline float maxDistance(const std::vector<glm::fvec3> &_a, const std::vector<glm::fvec3> &_b) {
+            float maxDist = 0.0f;
+            for (size_t i = 0; i < _a.size() && i < _b.size(); i++)
+                maxDist = std::max(maxDist, glm::length(_a[i] - _b[i]));
+            return maxDist;
+        }
+
+        // Tightens the tolerance until the measured joints stay within _settings.maxError of the original.
+        // Returns false if even the tightest attempt exceeds the bound (quantization alone is too coarse);
+        // _out then holds that attempt.
+        inline bool compress(const AnimationClip &_clip, const Skeleton &_skeleton,
+                             const CompressionSettings &_settings, CompressedClip &_out,
+                             CompressionReport *_report = NULL) {
+            std::vector<BoneId> bones = _settings.measuredBones;
+            bones.erase(std::remove_if(bones.begin(), bones.end(), [&_skeleton](BoneId _bone) {
+                return _bone < 0 || (size_t) _bone >= _skeleton.boneNum();
+            }), bones.end());
+            if (bones.empty()) bones = leafBones(_skeleton);
+
+            std::vector<glm::fvec3> reference, compressed;
+            measure(_clip, _skeleton, bones, reference);
+
+            // Rotation errors are scaled by the distance of the measured joints from the root
+            float extent = 0.0f;
+            {
+                PoseBuffer bindPose;
+                bindPose.bind(_skeleton);
+                std::vector<glm::fmat4> boneTransf(_skeleton.boneNum());
+                _skeleton.evaluate(bindPose.boneModifier.data(), boneTransf.data(), bindPose.nodeGlobal.data());
+                for (size_t b = 0; b < bones.size(); b++) {
+                    int node = _skeleton.boneNode[bones[b]];
+                    if (node >= 0) extent = std::max(extent, glm::length(glm::fvec3(bindPose.nodeGlobal[node][3])));
+                }
+            }
+            if (extent <= 0.0f) extent = 1.0f;
+
+            CompressionReport report;
+            float tolerance = _settings.maxError;
+            bool bounded = false;
+            for (int attempt = 0; attempt < ANIMATION_COMPRESSION_MAX_ATTEMPTS && !bounded; attempt++) {
+                compressWith(_clip, tolerance, extent, _out, report);
+                measure(_out, _skeleton, bones, compressed);
+                report.maxError = maxDistance(reference, compressed);
+                report.tolerance = tolerance;
+                bounded = report.maxError <= _settings.maxError;
+                if (!bounded) tolerance *= 0.5f;
+            }
+            report.originalBytes = _clip.memoryBytes();
+            report.compressedBytes = _out.memoryBytes();
+            if (_report != NULL) *_report = report;
+            return bounded;
+        }
+
+        // Offline storage: header, then per clip its name, duration and the raw tables
+        struct FileHeader {
+            uint32_t magic;
+            uint32_t version;
+            uint32_t clipNum;
+            uint32_t trackSize;
+        };
+
+        template<class T>
+        void appendBytes(std::vector<char> &_blob, const T *_data, size_t _num) {
+            const char *bytes = (const char *) _data;
+            _blob.insert(_blob.end(), bytes, bytes + _num * sizeof(T));
+        }
+
+        inline bool writeFile(const std::string &_filename, const std::vector<CompressedClip> &_clips) {
+            std::vector<char> blob;
+            FileHeader header = FileHeader();
+            header.magic = ANIMATION_COMPRESSION_MAGIC;
+            header.version = ANIMATION_COMPRESSION_VERSION;
+            header.clipNum = (uint32_t) _clips.size();
+            header.trackSize = sizeof(CompressedTrack);
+            appendBytes(blob, &header, 1);
+            for (size_t i = 0; i < _clips.size(); i++) {
+                const CompressedClip &clip = _clips[i];
+                uint32_t count[4] = {(uint32_t) clip.name.size(), (uint32_t) clip.tracks.size(),
+                                     (uint32_t) clip.keyTime.size(), (uint32_t) clip.keyValue.size()};
+                appendBytes(blob, count, 4);
+                appendBytes(blob, &clip.duration, 1);
+                appendBytes(blob, clip.name.data(), clip.name.size());
+                appendBytes(blob, clip.tracks.data(), clip.tracks.size());
+                appendBytes(blob, clip.keyTime.data(), clip.keyTime.size());
+                appendBytes(blob, clip.keyValue.data(), clip.keyValue.size());
+            }
+            return FileUtil::writeFile(_filename, blob);
+        }
+
+        // Reads _num elements, failing before allocating when the file cannot hold them
+        template<class T>
+        bool readArray(FILE *_fi, std::vector<T> &_out, uint32_t _num, uint64_t &_remaining) {
+            uint64_t bytes = (uint64_t) _num * sizeof(T);
+            if (bytes > _remaining) return false;
+            _remaining -= bytes;
+            _out.resize(_num);
+            return _num == 0 || fread(&_out[0], sizeof(T), _num, _fi) == _num;
+        }
+
+        inline bool readFile(const std::string &_filename, std::vector<CompressedClip> &_clips) {
+            FILE *fi = fopen(_filename.c_str(), "rb");
+            if (fi == NULL) return false;
+            // Counts in the file are untrusted; every table is checked against the bytes left
+            long fileSize = fseek(fi, 0, SEEK_END) == 0 ? ftell(fi) : -1;
+            FileHeader header;
+            bool valid = fileSize >= (long) sizeof(header) && fseek(fi, 0, SEEK_SET) == 0 &&
+                         fread(&header, sizeof(header), 1, fi) == 1 &&
+                         header.magic == ANIMATION_COMPRESSION_MAGIC &&
+                         header.version == ANIMATION_COMPRESSION_VERSION &&
+                         header.trackSize == sizeof(CompressedTrack);
+            uint64_t remaining = valid ? (uint64_t) fileSize - sizeof(header) : 0;
+            const uint64_t clipHeaderSize = 4 * sizeof(uint32_t) + sizeof(float);
+            valid = valid && header.clipNum <= remaining / clipHeaderSize;
+            if (valid) _clips.resize(header.clipNum);
+            for (uint32_t i = 0; valid && i < header.clipNum; i++) {
+                CompressedClip &clip = _clips[i];
+                uint32_t count[4];
+                valid = remaining >= clipHeaderSize && fread(count, sizeof(uint32_t), 4, fi) == 4 &&
+                        fread(&clip.duration, sizeof(float), 1, fi) == 1;
+                if (valid) remaining -= clipHeaderSize;
+                std::vector<char> name;
+                valid = valid && readArray(fi, name, count[0], remaining) &&
+                        readArray(fi, clip.tracks, count[1], remaining) &&
+                        readArray(fi, clip.keyTime, count[2], remaining) &&
+                        readArray(fi, clip.keyValue, count[3], remaining);
+                if (!valid) break;
+                clip.name.assign(name.begin(), name.end());
+                // Channels must stay inside the key tables
+                for (size_t t = 0; valid && t < clip.tracks.size(); t++) {
+                    for (int c = 0; c < ANIMATION_CHANNEL_NUM; c++) {
+                        const CompressedChannel &channel = clip.tracks[t].channel[c];
+                        if (channel.keyNum < 2) continue;
+                        valid = valid && (uint64_t) channel.keyOffset + channel.keyNum <= clip.keyTime.size() &&
+                                3 * ((uint64_t) channel.keyOffset + channel.keyNum) <= clip.keyValue.size();
+                    }
+                }
+            }
+            fclose(fi);
+            if (!valid) _clips.clear();
+            return valid;
+        }
+    }
+}
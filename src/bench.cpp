@@ -0,0 +1,1005 @@
+// Hand Benchmarks
+// Runs without a window or GL context. Every result is printed and, with --output,
+// also written as JSON or CSV so runs can be compared by scripts.
+
+#include "gl_env.h"
+
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <config.h>
+
+#include <iostream>
+#include <chrono>
+#include <random>
+#include <cmath>
+#include <algorithm>
+#include <thread>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "skeletal_mesh.h"
+#include "hand_rig.h"
+#include "hand_pose.h"
+#include "instance_pose.h"
+#include "animation_compression.h"
+#include "cpu_skinning.h"
+#include "texture_cache.h"
+#include "quaternion_camera.h"
+#include "frame_clock.h"
+#include "triple_buffer.h"
+#include "spsc_queue.h"
+
+#include <glm/gtc/matrix_transform.hpp>
+
+typedef std::chrono::steady_clock BenchClock;
+
+static double elapsed_ns(BenchClock::time_point start) {
+    return (double) std::chrono::duration_cast<std::chrono::nanoseconds>(BenchClock::now() - start).count();
+}
+
+struct BenchOptions {
+    std::string output;
+    std::string filter;
+    size_t vertexNum;
+
+    BenchOptions() : output(), filter(), vertexNum(1000000) {}
+};
+
+// One measured value; size is the problem size it was measured at (bones, vertices, instances ...)
+struct BenchResult {
+    std::string group;
+    std::string name;
+    size_t size;
+    double value;
+    std::string unit;
+};
+
+static BenchOptions bench_options;
+static std::vector<BenchResult> bench_results;
+
+static bool bench_enabled(const char *group) {
+    return bench_options.filter.empty() || strstr(group, bench_options.filter.c_str()) != NULL;
+}
+
+static void bench_record(const char *group, const std::string &name, size_t size, double value, const char *unit) {
+    BenchResult result;
+    result.group = group;
+    result.name = name;
+    result.size = size;
+    result.value = value;
+    result.unit = unit;
+    bench_results.push_back(result);
+}
+
+// ".json" writes JSON, anything else CSV
+static bool write_results(const std::string &filename) {
+    bool json = filename.size() >= 5 && filename.compare(filename.size() - 5, 5, ".json") == 0;
+    FILE *fo = fopen(filename.c_str(), "w");
+    if (fo == NULL) return false;
+    if (json) fprintf(fo, "{\n  \"pose_kernel\": \"%s\",\n  \"skin_kernel\": \"%s\",\n  \"threads\": %u,\n  \"results\": [",
+                      SkeletalMesh::PoseKernel::activeKernel().name, SkeletalMesh::SkinKernel::activeKernel().name,
+                      std::max(1u, std::thread::hardware_concurrency()));
+    else fprintf(fo, "group,name,size,value,unit\n");
+    for (size_t i = 0; i < bench_results.size(); i++) {
+        const BenchResult &r = bench_results[i];
+        if (json)
+            fprintf(fo, "%s\n    {\"group\": \"%s\", \"name\": \"%s\", \"size\": %zu, \"value\": %.6g, \"unit\": \"%s\"}",
+                    i == 0 ? "" : ",", r.group.c_str(), r.name.c_str(), r.size, r.value, r.unit.c_str());
+        else
+            fprintf(fo, "%s,%s,%zu,%.6g,%s\n", r.group.c_str(), r.name.c_str(), r.size, r.value, r.unit.c_str());
+    }
+    if (json) fprintf(fo, "\n  ]\n}\n");
+    return fclose(fo) == 0;
+}
+
+static glm::fmat4 random_rotation(std::mt19937 &rng) {
+    std::uniform_real_distribution<float> angle(-1.0f, 1.0f);
+    glm::fvec3 axis(angle(rng), angle(rng), angle(rng));
+    if (glm::length(axis) < 1e-3f) axis = glm::fvec3(0.0f, 0.0f, 1.0f);
+    return glm::rotate(glm::identity<glm::fmat4>(), angle(rng), glm::normalize(axis));
+}
+
+// Random tree whose depth grows like a real rig: most nodes extend a recent chain
+static void make_synthetic_skeleton(SkeletalMesh::Skeleton &skeleton, int boneNum, unsigned int seed) {
+    std::mt19937 rng(seed);
+    std::vector<int> nodeParent(boneNum);
+    std::vector<glm::fmat4> nodeLocalTransf(boneNum);
+    std::vector<int> nodeBone(boneNum);
+    std::vector<glm::fmat4> boneOffset(boneNum);
+    for (int i = 0; i < boneNum; i++) {
+        nodeParent[i] = i == 0 ? -1 : (rng() % 4 != 0 ? i - 1 : (int) (rng() % i));
+        nodeLocalTransf[i] = glm::translate(random_rotation(rng), glm::fvec3(1.0f, 0.0f, 0.0f));
+        nodeBone[i] = i;
+        boneOffset[i] = glm::translate(glm::identity<glm::fmat4>(), glm::fvec3(-(float) i, 0.0f, 0.0f));
+    }
+    skeleton.build(nodeParent, nodeLocalTransf, nodeBone, boneOffset);
+}
+
+static float max_difference(const SkeletalMesh::Scene::SkeletonTransf &a, const SkeletalMesh::Scene::SkeletonTransf &b) {
+    float maxDiff = 0.0f;
+    for (size_t i = 0; i < a.size(); i++)
+        for (int c = 0; c < 4; c++)
+            for (int r = 0; r < 4; r++)
+                maxDiff = std::max(maxDiff, std::abs(a[i][c][r] - b[i][c][r]));
+    return maxDiff;
+}
+
+// Reports ns per bone of the reference glm path and of every pose kernel this CPU supports
+static void bench_pose(const std::string &label, const SkeletalMesh::Skeleton &skeleton) {
+    std::mt19937 rng(7);
+    SkeletalMesh::PoseBuffer pose;
+    pose.bind(skeleton);
+    for (size_t i = 0; i < skeleton.boneNum(); i++)
+        pose.set((SkeletalMesh::BoneId) i, random_rotation(rng));
+
+    size_t boneNum = skeleton.boneNum();
+    int iterations = (int) std::max<size_t>(200, 4000000 / std::max<size_t>(boneNum, 1));
+    SkeletalMesh::Scene::SkeletonTransf reference(boneNum), transf(boneNum);
+
+    skeleton.evaluateReference(pose.boneModifier.data(), reference.data(), pose.nodeGlobal.data());
+    BenchClock::time_point start = BenchClock::now();
+    for (int it = 0; it < iterations; it++)
+        skeleton.evaluateReference(pose.boneModifier.data(), reference.data(), pose.nodeGlobal.data());
+    double referenceNs = elapsed_ns(start) / iterations / boneNum;
+
+    printf("%-12s %6zu bones  %-10s %8.2f ns/bone\n", label.c_str(), boneNum, "reference", referenceNs);
+    bench_record("pose", label + " reference", boneNum, referenceNs, "ns/bone");
+
+    const std::vector<const SkeletalMesh::PoseKernel::Kernel *> &kernels =
+            SkeletalMesh::PoseKernel::availableKernels();
+    for (size_t k = 0; k < kernels.size(); k++) {
+        skeleton.evaluate(*kernels[k], pose.boneModifier.data(), transf.data(), pose.nodeGlobal.data());
+        start = BenchClock::now();
+        for (int it = 0; it < iterations; it++)
+            skeleton.evaluate(*kernels[k], pose.boneModifier.data(), transf.data(), pose.nodeGlobal.data());
+        double kernelNs = elapsed_ns(start) / iterations / boneNum;
+        printf("%-12s %6zu bones  %-10s %8.2f ns/bone  x%.2f  max err %.2e\n", label.c_str(), boneNum,
+               kernels[k]->name, kernelNs, referenceNs / kernelNs, max_difference(reference, transf));
+        bench_record("pose", label + " " + kernels[k]->name, boneNum, kernelNs, "ns/bone");
+    }
+}
+
+// PoseBuffer::evaluate() after nothing was written, after the app's reset() and rewrite of an unchanged
+// pose, and after one leaf or the root changed, against a full evaluation.
+// Changed modifiers alternate between two values so set() sees a change every frame.
+static void bench_dirty(const std::string &label, const SkeletalMesh::Skeleton &skeleton) {
+    std::mt19937 rng(13);
+    SkeletalMesh::PoseBuffer pose;
+    pose.bind(skeleton);
+    std::vector<glm::fmat4> still(skeleton.boneNum());
+    for (size_t i = 0; i < skeleton.boneNum(); i++) {
+        still[i] = random_rotation(rng);
+        pose.set((SkeletalMesh::BoneId) i, still[i]);
+    }
+    glm::fmat4 flip[2] = {random_rotation(rng), random_rotation(rng)};
+
+    size_t boneNum = skeleton.boneNum();
+    int iterations = (int) std::max<size_t>(200, 2000000 / std::max<size_t>(boneNum, 1));
+    SkeletalMesh::Scene::SkeletonTransf transf(boneNum), full(boneNum), fullGlobal(skeleton.nodeNum());
+
+    const char *cases[] = {"full", "idle", "static", "leaf", "root"};
+    double fullUs = 0.0;
+    for (int c = 0; c < 5; c++) {
+        SkeletalMesh::BoneId changed = c == 3 ? (SkeletalMesh::BoneId) (boneNum - 1) : 0;
+        pose.evaluate(skeleton, transf.data());
+        size_t composed = 0;
+        BenchClock::time_point start = BenchClock::now();
+        for (int it = 0; it < iterations; it++) {
+            if (c == 0) pose.invalidate();
+            if (c == 2) {
+                pose.reset();
+                for (size_t i = 0; i < boneNum; i++) pose.set((SkeletalMesh::BoneId) i, still[i]);
+            }
+            if (c >= 3) pose.set(changed, flip[it & 1]);
+            composed += pose.evaluate(skeleton, transf.data());
+        }
+        double frameUs = elapsed_ns(start) / iterations / 1000.0;
+        if (c == 0) fullUs = frameUs;
+
+        skeleton.evaluate(pose.boneModifier.data(), full.data(), fullGlobal.data());
+        printf("%-12s %6zu bones  %-10s %8.2f us/frame  x%.2f  %8.1f nodes  max err %.2e\n", label.c_str(), boneNum,
+               cases[c], frameUs, fullUs / frameUs, (double) composed / iterations, max_difference(full, transf));
+        bench_record("dirty", label + " " + cases[c], boneNum, frameUs, "us/frame");
+        pose.invalidate();
+    }
+}
+
+// One track per bone, every channel keyed at a fixed rate with random values
+static void make_synthetic_clip(SkeletalMesh::AnimationClip &clip, const SkeletalMesh::Skeleton &skeleton,
+                                int keyNum, float fps, unsigned int seed) {
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<float> value(-1.0f, 1.0f);
+    clip.name = "synthetic";
+    clip.duration = (keyNum - 1) / fps;
+    clip.tracks.resize(skeleton.boneNum());
+    clip.keyTime.clear();
+    clip.keyValue.clear();
+    for (size_t i = 0; i < skeleton.boneNum(); i++) {
+        SkeletalMesh::AnimationTrack &track = clip.tracks[i];
+        track.bone = (SkeletalMesh::BoneId) i;
+        track.invBindLocal = glm::fmat4(1.0f);
+        for (int c = 0; c < ANIMATION_CHANNEL_NUM; c++) {
+            track.keyOffset[c] = (uint32_t) clip.keyTime.size();
+            track.keyNum[c] = keyNum;
+            track.bindValue[c] = glm::fvec4(0.0f, 0.0f, 0.0f, c == SkeletalMesh::ChannelRotation ? 1.0f : 0.0f);
+            for (int k = 0; k < keyNum; k++) {
+                clip.keyTime.push_back(k / fps);
+                if (c == SkeletalMesh::ChannelScale)
+                    clip.keyValue.push_back(glm::fvec4(1.0f, 1.0f, 1.0f, 0.0f));
+                else
+                    clip.keyValue.push_back(glm::fvec4(value(rng), value(rng), value(rng), 1.0f));
+            }
+        }
+    }
+}
+
+// Sequential playback at 60 Hz with cached cursors against binary search per channel
+static void bench_clip(const std::string &label, const SkeletalMesh::AnimationClip &clip,
+                       const SkeletalMesh::Skeleton &skeleton) {
+    SkeletalMesh::PoseBuffer pose;
+    pose.bind(skeleton);
+    SkeletalMesh::AnimationCursor cursor;
+    cursor.bind(clip);
+    int frameNum = std::max(1, (int) (clip.duration * 60.0f));
+    int repeat = std::max(1, 200000 / (frameNum * (int) std::max<size_t>(clip.tracks.size(), 1)));
+
+    BenchClock::time_point start = BenchClock::now();
+    for (int r = 0; r < repeat; r++)
+        for (int f = 0; f < frameNum; f++)
+            clip.sample(f / 60.0f, cursor, pose);
+    double cursorNs = elapsed_ns(start) / repeat / frameNum / std::max<size_t>(clip.tracks.size(), 1);
+
+    start = BenchClock::now();
+    for (int r = 0; r < repeat; r++)
+        for (int f = 0; f < frameNum; f++)
+            clip.sample(f / 60.0f, pose);
+    double searchNs = elapsed_ns(start) / repeat / frameNum / std::max<size_t>(clip.tracks.size(), 1);
+
+    printf("%-12s %6zu tracks %6zu keys  cursor %8.2f ns/track  search %8.2f ns/track  %zu bytes\n",
+           label.c_str(), clip.tracks.size(), clip.keyTime.size(), cursorNs, searchNs, clip.memoryBytes());
+    bench_record("clip", label + " cursor", clip.tracks.size(), cursorNs, "ns/track");
+    bench_record("clip", label + " search", clip.tracks.size(), searchNs, "ns/track");
+}
+
+// Memory and error of the compressed clip, and its sequential sampling cost
+static void bench_compression(const std::string &label, const SkeletalMesh::AnimationClip &clip,
+                              const SkeletalMesh::Skeleton &skeleton, const std::vector<SkeletalMesh::BoneId> &bones) {
+    SkeletalMesh::CompressionSettings settings;
+    settings.measuredBones = bones;
+    SkeletalMesh::CompressedClip compressed;
+    SkeletalMesh::CompressionReport report;
+    BenchClock::time_point start = BenchClock::now();
+    bool bounded = SkeletalMesh::AnimationCompression::compress(clip, skeleton, settings, compressed, &report);
+    double compressMs = elapsed_ns(start) / 1e6;
+
+    SkeletalMesh::PoseBuffer pose;
+    pose.bind(skeleton);
+    SkeletalMesh::AnimationCursor cursor;
+    int frameNum = std::max(1, (int) (clip.duration * 60.0f));
+    int repeat = std::max(1, 200000 / (frameNum * (int) std::max<size_t>(clip.tracks.size(), 1)));
+    start = BenchClock::now();
+    for (int r = 0; r < repeat; r++)
+        for (int f = 0; f < frameNum; f++)
+            compressed.sample(f / 60.0f, cursor, pose);
+    double cursorNs = elapsed_ns(start) / repeat / frameNum / std::max<size_t>(clip.tracks.size(), 1);
+
+    printf("%-12s %6zu keys -> %6zu  %zu -> %zu bytes  x%.2f  max err %.2e%s  cursor %8.2f ns/track  %.1f ms\n",
+           label.c_str(), report.originalKeyNum, report.compressedKeyNum, report.originalBytes, report.compressedBytes,
+           (double) report.originalBytes / std::max<size_t>(report.compressedBytes, 1), report.maxError,
+           bounded ? "" : " (above bound)", cursorNs, compressMs);
+    bench_record("compression", label + " ratio", clip.tracks.size(),
+                 (double) report.originalBytes / std::max<size_t>(report.compressedBytes, 1), "x");
+    bench_record("compression", label + " max error", clip.tracks.size(), report.maxError, "units");
+    bench_record("compression", label + " cursor", clip.tracks.size(), cursorNs, "ns/track");
+}
+
+// Poses and palettes of many Hand instances on 1, 2, 4 ... hardware threads
+static void bench_instances(const SkeletalMesh::Skeleton &skeleton, const HandRig::Binding &rig, size_t instanceNum) {
+    size_t boneNum = skeleton.boneNum();
+    std::vector<glm::fmat4> serial(instanceNum * boneNum), palette(instanceNum * boneNum);
+    SkeletalMesh::InstancePoseFunc poseFunc = [&rig](size_t i, SkeletalMesh::PoseBuffer &pose) {
+        HandPose::completion_3(pose, rig, 0.37f * i);
+    };
+
+    size_t maxThreadNum = std::max(1u, std::thread::hardware_concurrency());
+    std::vector<size_t> threadNums;
+    for (size_t n = 1; n < maxThreadNum; n *= 2)
+        threadNums.push_back(n);
+    threadNums.push_back(maxThreadNum);
+
+    double serialUs = 0.0;
+    for (size_t t = 0; t < threadNums.size(); t++) {
+        Parallel::JobSystem jobs(threadNums[t]);
+        SkeletalMesh::InstanceEvaluator evaluator;
+        evaluator.bind(skeleton, jobs.threadNum());
+        std::vector<glm::fmat4> &out = t == 0 ? serial : palette;
+
+        evaluator.evaluate(&jobs, instanceNum, poseFunc, out.data(), boneNum);
+        int iterations = 50;
+        BenchClock::time_point start = BenchClock::now();
+        for (int it = 0; it < iterations; it++)
+            evaluator.evaluate(&jobs, instanceNum, poseFunc, out.data(), boneNum);
+        double frameUs = elapsed_ns(start) / iterations / 1000.0;
+        if (t == 0) serialUs = frameUs;
+
+        // Joined results must not depend on the thread count
+        bool identical = t == 0 || memcmp(serial.data(), palette.data(), serial.size() * sizeof(glm::fmat4)) == 0;
+        printf("%-12s %6zu inst.  %2zu threads %10.1f us/frame  x%.2f  %s\n", "instances", instanceNum,
+               jobs.threadNum(), frameUs, serialUs / frameUs, identical ? "identical" : "MISMATCH");
+        bench_record("instances", std::to_string((unsigned long long) jobs.threadNum()) + " threads", instanceNum,
+                     frameUs, "us/frame");
+    }
+}
+
+// ParametricVertex::addBone() with eight candidate influences per vertex, twice what a vertex keeps
+static void bench_add_bone(size_t vertexNum) {
+    const int candidateNum = 8;
+    std::mt19937 rng(11);
+    std::uniform_real_distribution<float> weight(0.0f, 1.0f);
+    std::vector<float> weights(vertexNum * candidateNum);
+    for (size_t i = 0; i < weights.size(); i++)
+        weights[i] = weight(rng);
+    std::vector<SkeletalMesh::ParametricVertex> vertices(vertexNum);
+
+    size_t accepted = 0;
+    BenchClock::time_point start = BenchClock::now();
+    for (size_t v = 0; v < vertexNum; v++)
+        for (int c = 0; c < candidateNum; c++)
+            accepted += vertices[v].addBone(c, weights[v * candidateNum + c]) ? 1 : 0;
+    double callNs = elapsed_ns(start) / (vertexNum * candidateNum);
+
+    printf("%-12s %8zu vert.  %8.2f ns/call  %.1f%% accepted\n", "addBone", vertexNum, callNs,
+           100.0 * accepted / (vertexNum * candidateNum));
+    bench_record("addBone", "8 candidates", vertexNum, callNs, "ns/call");
+}
+
+// Grid meshes of at most 65536 vertices. Vertex i is weighted to the four bones following
+// i * boneNum / vertexNum, every bone is a child of the root node.
+static aiScene *make_synthetic_scene(size_t boneNum, size_t vertexNum) {
+    const size_t columnNum = 256, meshVertexMax = 65536;
+    aiScene *scene = new aiScene();
+    scene->mRootNode = new aiNode("root");
+    scene->mRootNode->mNumChildren = (unsigned int) boneNum;
+    scene->mRootNode->mChildren = new aiNode *[boneNum];
+    for (size_t b = 0; b < boneNum; b++) {
+        aiNode *node = new aiNode("bone_" + std::to_string((unsigned long long) b));
+        node->mParent = scene->mRootNode;
+        scene->mRootNode->mChildren[b] = node;
+    }
+    scene->mNumMaterials = 1;
+    scene->mMaterials = new aiMaterial *[1];
+    scene->mMaterials[0] = new aiMaterial();
+
+    size_t meshNum = (vertexNum + meshVertexMax - 1) / meshVertexMax;
+    scene->mNumMeshes = (unsigned int) meshNum;
+    scene->mMeshes = new aiMesh *[meshNum];
+    for (size_t m = 0; m < meshNum; m++) {
+        size_t first = m * meshVertexMax;
+        size_t num = std::min(meshVertexMax, vertexNum - first);
+        aiMesh *mesh = new aiMesh();
+        scene->mMeshes[m] = mesh;
+        mesh->mMaterialIndex = 0;
+        mesh->mNumVertices = (unsigned int) num;
+        mesh->mVertices = new aiVector3D[num];
+        mesh->mNormals = new aiVector3D[num];
+        mesh->mTextureCoords[0] = new aiVector3D[num];
+        for (size_t v = 0; v < num; v++) {
+            float x = (float) (v % columnNum), y = (float) ((first + v) / columnNum);
+            mesh->mVertices[v] = aiVector3D(x, y, 0.0f);
+            mesh->mNormals[v] = aiVector3D(0.0f, 0.0f, 1.0f);
+            mesh->mTextureCoords[0][v] = aiVector3D(x / columnNum, y / columnNum, 0.0f);
+        }
+
+        size_t rowNum = num / columnNum;
+        size_t faceNum = rowNum > 1 ? 2 * (rowNum - 1) * (columnNum - 1) : 0;
+        mesh->mNumFaces = (unsigned int) faceNum;
+        mesh->mFaces = faceNum > 0 ? new aiFace[faceNum] : NULL;
+        for (size_t r = 0, f = 0; r + 1 < rowNum; r++) {
+            for (size_t c = 0; c + 1 < columnNum; c++) {
+                unsigned int v0 = (unsigned int) (r * columnNum + c), v1 = v0 + 1;
+                unsigned int v2 = v0 + (unsigned int) columnNum, v3 = v2 + 1;
+                unsigned int quad[2][3] = {{v0, v1, v2}, {v1, v3, v2}};
+                for (int t = 0; t < 2; t++, f++) {
+                    mesh->mFaces[f].mNumIndices = 3;
+                    mesh->mFaces[f].mIndices = new unsigned int[3];
+                    memcpy(mesh->mFaces[f].mIndices, quad[t], sizeof(quad[t]));
+                }
+            }
+        }
+
+        size_t boneBegin = first * boneNum / vertexNum;
+        size_t boneEnd = std::min(boneNum, (first + num - 1) * boneNum / vertexNum + SCENE_RESOURCE_BONE_PER_VERTEX);
+        std::vector<std::vector<aiVertexWeight> > boneWeights(boneEnd - boneBegin);
+        for (size_t v = 0; v < num; v++) {
+            size_t base = (first + v) * boneNum / vertexNum;
+            for (size_t k = 0; k < SCENE_RESOURCE_BONE_PER_VERTEX && base + k < boneNum; k++) {
+                aiVertexWeight vertexWeight;
+                vertexWeight.mVertexId = (unsigned int) v;
+                vertexWeight.mWeight = 0.4f - 0.1f * k;
+                boneWeights[base + k - boneBegin].push_back(vertexWeight);
+            }
+        }
+        mesh->mNumBones = (unsigned int) boneWeights.size();
+        mesh->mBones = new aiBone *[boneWeights.size()];
+        for (size_t b = 0; b < boneWeights.size(); b++) {
+            aiBone *bone = new aiBone();
+            bone->mName.Set("bone_" + std::to_string((unsigned long long) (boneBegin + b)));
+            bone->mNumWeights = (unsigned int) boneWeights[b].size();
+            bone->mWeights = new aiVertexWeight[boneWeights[b].size()];
+            std::copy(boneWeights[b].begin(), boneWeights[b].end(), bone->mWeights);
+            mesh->mBones[b] = bone;
+        }
+    }
+    return scene;
+}
+
+// Vertex / index assembly, cache optimization and serialization of an in-memory aiScene, serial and
+// on all threads.
+// The parallel bake is left in _baked for the skinning benchmark.
+static void bench_assembly(const aiScene *scene, size_t boneNum, size_t vertexNum, MeshCache::BakedFile &baked) {
+    MeshCache::SourceStamp stamp;
+    std::vector<char> blob;
+    BenchClock::time_point start = BenchClock::now();
+    SkeletalMesh::Scene::bakeScene(scene, stamp, blob);
+    double serialMs = elapsed_ns(start) / 1e6;
+
+    Parallel::JobSystem jobs;
+    MeshOptimizer::Report report;
+    blob.clear();
+    start = BenchClock::now();
+    SkeletalMesh::Scene::bakeScene(scene, stamp, blob, &jobs, &report);
+    double parallelMs = elapsed_ns(start) / 1e6;
+
+    printf("%-12s %6zu bones %8zu vert.  serial %8.2f ms  %2zu threads %8.2f ms  %zu bytes"
+           "  ACMR %.3f -> %.3f  ATVR %.3f -> %.3f\n", "assembly", boneNum, vertexNum, serialMs, jobs.threadNum(),
+           parallelMs, blob.size(), report.before.acmr(), report.after.acmr(), report.before.atvr(),
+           report.after.atvr());
+    std::string name = std::to_string((unsigned long long) boneNum) + " bones";
+    bench_record("assembly", name + " serial", vertexNum, serialMs * 1e6 / vertexNum, "ns/vertex");
+    bench_record("assembly", name + " parallel", vertexNum, parallelMs * 1e6 / vertexNum, "ns/vertex");
+    bench_record("assembly", name + " ACMR before", vertexNum, report.before.acmr(), "misses/triangle");
+    bench_record("assembly", name + " ACMR after", vertexNum, report.after.acmr(), "misses/triangle");
+    bench_record("assembly", name + " ATVR before", vertexNum, report.before.atvr(), "misses/vertex");
+    bench_record("assembly", name + " ATVR after", vertexNum, report.after.atvr(), "misses/vertex");
+    if (!baked.adopt(blob, sizeof(SkeletalMesh::ParametricVertex)))
+        std::cout << "Error occured adopting the synthetic bake" << std::endl;
+}
+
+// Every linear-blend kernel on one thread, then the active kernel and dual quaternions on all threads
+static void bench_skinning(const std::string &label, const MeshCache::BakedFile &baked,
+                           const SkeletalMesh::Skeleton &skeleton) {
+    if (!baked.available()) return;
+    std::mt19937 rng(13);
+    SkeletalMesh::PoseBuffer pose;
+    pose.bind(skeleton);
+    for (size_t i = 0; i < skeleton.boneNum(); i++)
+        pose.set((SkeletalMesh::BoneId) i, random_rotation(rng));
+    SkeletalMesh::Scene::SkeletonTransf transf(skeleton.boneNum());
+    skeleton.evaluate(pose.boneModifier.data(), transf.data(), pose.nodeGlobal.data());
+    SkeletalMesh::SkeletonDualQuat dualQuat;
+    SkeletalMesh::toDualQuat(transf, dualQuat);
+
+    const SkeletalMesh::ParametricVertex *vertices = (const SkeletalMesh::ParametricVertex *) baked.vertices();
+    size_t vertexNum = baked.header().vertexNum;
+    std::vector<float> positions(3 * vertexNum), normals(3 * vertexNum);
+    int iterations = (int) std::max<size_t>(3, 20000000 / std::max<size_t>(vertexNum, 1));
+
+    const std::vector<const SkeletalMesh::SkinKernel::Kernel *> &kernels =
+            SkeletalMesh::SkinKernel::availableKernels();
+    for (size_t k = 0; k < kernels.size(); k++) {
+        SkeletalMesh::CpuSkinner skinner(NULL, *kernels[k]);
+        BenchClock::time_point start = BenchClock::now();
+        for (int it = 0; it < iterations; it++)
+            skinner.skin(vertices, vertexNum, transf, positions.data(), normals.data());
+        double vertexNs = elapsed_ns(start) / iterations / vertexNum;
+        printf("%-12s %8zu vert.  %-10s %8.2f ns/vertex\n", label.c_str(), vertexNum, kernels[k]->name, vertexNs);
+        bench_record("skinning", label + " " + kernels[k]->name, vertexNum, vertexNs, "ns/vertex");
+    }
+
+    Parallel::JobSystem jobs;
+    SkeletalMesh::CpuSkinner skinner(&jobs);
+    BenchClock::time_point start = BenchClock::now();
+    for (int it = 0; it < iterations; it++)
+        skinner.skin(vertices, vertexNum, transf, positions.data(), normals.data());
+    double parallelNs = elapsed_ns(start) / iterations / vertexNum;
+    start = BenchClock::now();
+    for (int it = 0; it < iterations; it++)
+        skinner.skinDualQuat(vertices, vertexNum, dualQuat, positions.data(), normals.data());
+    double dualQuatNs = elapsed_ns(start) / iterations / vertexNum;
+    printf("%-12s %8zu vert.  %2zu threads %s %8.2f ns/vertex  dual-quat %8.2f ns/vertex\n", label.c_str(), vertexNum,
+           jobs.threadNum(), skinner.getKernel().name, parallelNs, dualQuatNs);
+    bench_record("skinning", label + " parallel", vertexNum, parallelNs, "ns/vertex");
+    bench_record("skinning", label + " parallel dual-quat", vertexNum, dualQuatNs, "ns/vertex");
+}
+
+// Packing cost and worst-case quantization error of the compact vertex format against the full one
+static void bench_vertex(const std::string &label, const MeshCache::BakedFile &baked) {
+    if (!baked.available() || baked.header().boneNum > COMPACT_VERTEX_MAX_BONES) return;
+    const SkeletalMesh::ParametricVertex *vertices = (const SkeletalMesh::ParametricVertex *) baked.vertices();
+    size_t vertexNum = baked.header().vertexNum;
+
+    std::vector<SkeletalMesh::CompactVertex> compact;
+    SkeletalMesh::PositionDecode decode;
+    BenchClock::time_point start = BenchClock::now();
+    SkeletalMesh::Scene::packVertices(vertices, vertexNum, compact, decode);
+    double packNs = elapsed_ns(start) / std::max<size_t>(vertexNum, 1);
+
+    float positionError = 0.0f, normalError = 0.0f, texcoordError = 0.0f, weightError = 0.0f;
+    for (size_t i = 0; i < vertexNum; i++) {
+        const SkeletalMesh::ParametricVertex &v = vertices[i];
+        const SkeletalMesh::CompactVertex &c = compact[i];
+        float position[3], normal[3], texcoord[2];
+        SkeletalMesh::CompactVertexCodec::decodePosition(decode, c.position, position);
+        SkeletalMesh::CompactVertexCodec::decodeNormal(c.normal, normal);
+        SkeletalMesh::CompactVertexCodec::decodeTexcoord(c.texcoord, texcoord);
+        float normalLength = glm::length(glm::fvec3(v.normal[0], v.normal[1], v.normal[2]));
+        for (int j = 0; j < 3; j++) {
+            positionError = std::max(positionError, std::abs(position[j] - v.position[j]));
+            if (normalLength > 0.0f)
+                normalError = std::max(normalError, std::abs(normal[j] - v.normal[j] / normalLength));
+        }
+        for (int j = 0; j < 2; j++)
+            texcoordError = std::max(texcoordError, std::abs(texcoord[j] - v.texcoord[j]));
+        float weightSum = 0.0f;
+        for (int j = 0; j < SCENE_RESOURCE_BONE_PER_VERTEX; j++) weightSum += v.boneWeight[j];
+        if (weightSum <= 0.0f) continue;
+        for (int j = 0; j < SCENE_RESOURCE_BONE_PER_VERTEX; j++)
+            weightError = std::max(weightError, std::abs(c.boneWeight[j] / (float) COMPACT_VERTEX_WEIGHT_SUM -
+                                                         v.boneWeight[j] / weightSum));
+    }
+
+    printf("%-12s %8zu vert.  %zu -> %zu bytes/vertex  pack %6.2f ns/vertex  max error position %.2e normal %.2e"
+           " uv %.2e weight %.2e\n", label.c_str(), vertexNum, sizeof(SkeletalMesh::ParametricVertex),
+           sizeof(SkeletalMesh::CompactVertex), packNs, positionError, normalError, texcoordError, weightError);
+    bench_record("vertex", label + " bytes", vertexNum, (double) sizeof(SkeletalMesh::CompactVertex), "bytes/vertex");
+    bench_record("vertex", label + " pack", vertexNum, packNs, "ns/vertex");
+    bench_record("vertex", label + " position error", vertexNum, positionError, "units");
+    bench_record("vertex", label + " normal error", vertexNum, normalError, "units");
+    bench_record("vertex", label + " uv error", vertexNum, texcoordError, "units");
+    bench_record("vertex", label + " weight error", vertexNum, weightError, "units");
+}
+
+// Element buffer size with per-mesh 16-bit indices against all 32-bit ones, and the cost of planning it
+static void bench_indices(const std::string &label, const MeshCache::BakedFile &baked) {
+    if (!baked.available()) return;
+    std::vector<SkeletalMesh::IndexRange> ranges;
+    BenchClock::time_point start = BenchClock::now();
+    size_t bytes = SkeletalMesh::Scene::planIndexRanges(baked, ranges);
+    double planNs = elapsed_ns(start);
+    size_t indexNum = baked.header().indexNum;
+    size_t shortNum = 0;
+    for (size_t i = 0; i < ranges.size(); i++)
+        if (ranges[i].type == GL_UNSIGNED_SHORT) shortNum++;
+
+    printf("%-12s %8zu indices  %zu / %zu meshes 16-bit  %zu -> %zu bytes  plan %8.2f ns/index\n", label.c_str(),
+           indexNum, shortNum, ranges.size(), sizeof(uint32_t) * indexNum, bytes, planNs / std::max<size_t>(indexNum, 1));
+    bench_record("index", label + " bytes", indexNum, (double) bytes / std::max<size_t>(indexNum, 1), "bytes/index");
+    bench_record("index", label + " plan", indexNum, planNs / std::max<size_t>(indexNum, 1), "ns/index");
+}
+
+// Triangles and error of every baked LOD level, and the cost of simplifying the first mesh to the last level
+static void bench_lod(const std::string &label, const MeshCache::BakedFile &baked) {
+    if (!baked.available() || baked.header().meshNum == 0) return;
+    const MeshCache::Header &header = baked.header();
+    uint64_t fullNum = 0;
+    for (uint32_t i = 0; i < header.meshNum; i++) fullNum += baked.meshes()[i].facetCornerNum / 3;
+    for (uint32_t l = 1; l <= header.lodNum; l++) {
+        uint64_t levelNum = 0;
+        for (uint32_t i = 0; i < header.meshNum; i++) levelNum += baked.lodMeshes(l)[i].facetCornerNum / 3;
+        const MeshCache::LodRecord &lod = baked.lods()[l - 1];
+        printf("%-12s LOD %u  target %5.3f  %8llu -> %8llu triangles  error %.2e\n", label.c_str(), l, lod.ratio,
+               (unsigned long long) fullNum, (unsigned long long) levelNum, lod.error);
+        std::string name = label + " LOD " + std::to_string((unsigned long long) l);
+        bench_record("lod", name + " ratio", (size_t) fullNum, fullNum ? (double) levelNum / fullNum : 0.0, "ratio");
+        bench_record("lod", name + " error", (size_t) fullNum, lod.error, "units");
+    }
+
+    const MeshCache::MeshRecord &mesh = baked.meshes()[0];
+    const SkeletalMesh::ParametricVertex *vertices =
+            (const SkeletalMesh::ParametricVertex *) baked.vertices() + mesh.vertexOffset;
+    const uint32_t *indices = baked.indices() + mesh.indexOffset;
+    size_t vertexNum = 0;
+    for (uint32_t j = 0; j < mesh.facetCornerNum; j++) vertexNum = std::max(vertexNum, (size_t) indices[j] + 1);
+    if (vertexNum == 0 || SkeletalMesh::Scene::lodSettings.ratio.empty()) return;
+    float ratio = SkeletalMesh::Scene::lodSettings.ratio.back();
+    std::vector<uint32_t> simplified;
+    BenchClock::time_point start = BenchClock::now();
+    MeshSimplifier::Simplifier simplifier(vertices[0].position, sizeof(SkeletalMesh::ParametricVertex), vertexNum,
+                                          NULL);
+    double error = simplifier.simplify(indices, mesh.facetCornerNum, (size_t) (mesh.facetCornerNum * ratio), 1e30,
+                                       simplified);
+    double triangleNs = elapsed_ns(start) / std::max<uint32_t>(mesh.facetCornerNum / 3, 1);
+    printf("%-12s simplify %8u -> %8zu triangles  %8.2f ns/triangle  error %.2e\n", label.c_str(),
+           mesh.facetCornerNum / 3, simplified.size() / 3, triangleNs, error);
+    bench_record("lod", label + " simplify", mesh.facetCornerNum / 3, triangleNs, "ns/triangle");
+}
+
+typedef void (*PresetFunc)(SkeletalMesh::PoseBuffer &pose, const HandRig::Binding &rig, float passed_time);
+
+static void preset_finger_move(SkeletalMesh::PoseBuffer &pose, const HandRig::Binding &rig, float passed_time) {
+    HandPose::finger_move(pose, rig, HandRig::Index, std::fmod(passed_time, 2.4f), 2.4f, 3.0f, 2.0f, 2.0f, 0.0f);
+}
+
+static void preset_keyboard(SkeletalMesh::PoseBuffer &pose, const HandRig::Binding &rig, float passed_time) {
+    bool finger_bent[HandRig::FingerNum] = {true, false, true, false, passed_time > 0.5f};
+    HandPose::keyboard_mouse_control(pose, rig, finger_bent);
+}
+
+// The finger_move preset generators, and getSkeletonTransform() on the poses they produce:
+// the PoseBuffer path and the string-keyed compatibility path
+static void bench_presets(const SkeletalMesh::Skeleton &skeleton, const SkeletalMesh::Scene::Name2Bone &nameBoneMap,
+                          const HandRig::Binding &rig) {
+    struct Preset {
+        const char *name;
+        PresetFunc func;
+    };
+    const Preset presets[] = {
+            {"finger_move",    &preset_finger_move},
+            {"completion_1",   &HandPose::completion_1},
+            {"completion_2",   &HandPose::completion_2},
+            {"completion_3",   &HandPose::completion_3},
+            {"default_rotate", &HandPose::default_rotate},
+            {"keyboard",       &preset_keyboard}};
+    const int iterations = 200000;
+    SkeletalMesh::PoseBuffer pose;
+    pose.bind(skeleton);
+    for (size_t p = 0; p < sizeof(presets) / sizeof(presets[0]); p++) {
+        BenchClock::time_point start = BenchClock::now();
+        for (int it = 0; it < iterations; it++)
+            presets[p].func(pose, rig, it * (1.0f / 60.0f));
+        double callNs = elapsed_ns(start) / iterations;
+        printf("%-12s %-16s %8.2f ns/call\n", "preset", presets[p].name, callNs);
+        bench_record("preset", presets[p].name, skeleton.boneNum(), callNs, "ns/call");
+    }
+
+    // Same work as Scene::getSkeletonTransform(), which needs a GL-backed Scene
+    SkeletalMesh::Scene::SkeletonTransf transf(skeleton.boneNum());
+    const int frameNum = 20000;
+    BenchClock::time_point start = BenchClock::now();
+    for (int f = 0; f < frameNum; f++) {
+        HandPose::completion_3(pose, rig, f * (1.0f / 60.0f));
+        transf.resize(skeleton.boneNum(), glm::fmat4(1.0f));
+        skeleton.evaluate(pose.boneModifier.data(), transf.data(), pose.nodeGlobal.data());
+    }
+    double poseNs = elapsed_ns(start) / frameNum;
+
+    SkeletalMesh::SkeletonModifier modifier;
+    start = BenchClock::now();
+    for (int f = 0; f < frameNum; f++) {
+        HandPose::completion_3(pose, rig, f * (1.0f / 60.0f));
+        for (SkeletalMesh::Scene::Name2Bone::const_iterator it = nameBoneMap.begin(); it != nameBoneMap.end(); ++it)
+            modifier[it->first] = pose.get((SkeletalMesh::BoneId) it->second);
+        SkeletalMesh::PoseBuffer resolved;
+        resolved.bind(skeleton);
+        SkeletalMesh::Scene::resolveModifier(nameBoneMap, modifier, resolved);
+        transf.assign(skeleton.boneNum(), glm::fmat4(1.0f));
+        skeleton.evaluate(resolved.boneModifier.data(), transf.data(), resolved.nodeGlobal.data());
+    }
+    double modifierNs = elapsed_ns(start) / frameNum;
+
+    printf("%-12s %-16s %8.2f ns/frame  string-keyed %8.2f ns/frame\n", "transform", "completion_3", poseNs,
+           modifierNs);
+    bench_record("transform", "pose buffer", skeleton.boneNum(), poseNs, "ns/frame");
+    bench_record("transform", "string-keyed", skeleton.boneNum(), modifierNs, "ns/frame");
+}
+
+static void bench_camera() {
+    QuaternionCamera camera;
+    CameraState start_state(glm::vec3(0.0f, 5.0f, 30.0f), glm::angleAxis(0.3f, glm::vec3(0.0f, 1.0f, 0.0f)), 45.0f);
+    CameraState end_state(glm::vec3(12.0f, -3.0f, 8.0f),
+                          glm::angleAxis(-1.1f, glm::normalize(glm::vec3(1.0f, 1.0f, 0.0f))), 30.0f);
+    const int iterations = 1000000;
+    float checksum = 0.0f;
+    BenchClock::time_point start = BenchClock::now();
+    for (int it = 0; it < iterations; it++) {
+        CameraState state = camera.getTransitionState(start_state, end_state, (it % 1000) * 0.001f);
+        checksum += state.position.x + state.orientation.w + state.fov;
+    }
+    double callNs = elapsed_ns(start) / iterations;
+    printf("%-12s %-16s %8.2f ns/call  (checksum %.1f)\n", "camera", "transition", callNs, checksum);
+    bench_record("camera", "getTransitionState", 1, callNs, "ns/call");
+}
+
+// FramePacer holding frameRate with an idle frame: deviation from the target interval, and the share of a
+// core the process used while waiting (the old loop spun at 100%)
+static void bench_pacing(double frameRate, int frameNum) {
+    Pacing::FramePacer pacer;
+    pacer.setTargetRate(frameRate);
+    pacer.wait();
+    std::clock_t cpuStart = std::clock();
+    BenchClock::time_point start = BenchClock::now();
+    for (int f = 0; f < frameNum; f++)
+        pacer.wait();
+    double wallMs = elapsed_ns(start) * 1e-6;
+    double cpuMs = 1000.0 * (std::clock() - cpuStart) / CLOCKS_PER_SEC;
+
+    const Profiling::History &jitter = pacer.getJitterHistory();
+    printf("%-12s %6.0f fps  interval %6.3f ms  jitter avg %6.3f p95 %6.3f max %6.3f ms  cpu %5.1f%%\n", "pacing",
+           frameRate, pacer.getIntervalHistory().average(), jitter.average(), jitter.percentile(0.95f),
+           jitter.maximum(), 100.0 * cpuMs / wallMs);
+    std::string label = std::to_string((long long) frameRate) + " fps";
+    bench_record("pacing", label + " jitter p95", frameNum, jitter.percentile(0.95f), "ms");
+    bench_record("pacing", label + " cpu", frameNum, 100.0 * cpuMs / wallMs, "%");
+}
+
+// The two hand-offs between the simulation and the GL thread, under contention: events through an SPSC
+// queue, and palettes of boneNum matrices through a triple buffer, checking every read is one whole publish
+static void bench_exchange(size_t boneNum) {
+    const size_t eventNum = 4000000;
+    Parallel::SpscQueue<uint64_t> queue(1024);
+    uint64_t sum = 0;
+    BenchClock::time_point start = BenchClock::now();
+    std::thread consumer([&queue, &sum, eventNum]() {
+        uint64_t value;
+        for (size_t received = 0; received < eventNum;) {
+            if (!queue.pop(value)) {
+                std::this_thread::yield();
+                continue;
+            }
+            sum += value;
+            received++;
+        }
+    });
+    for (uint64_t i = 0; i < eventNum;) {
+        if (queue.push(i)) i++;
+        else std::this_thread::yield();
+    }
+    consumer.join();
+    double eventNs = elapsed_ns(start) / eventNum;
+    bool queueOk = sum == (uint64_t) eventNum * (eventNum - 1) / 2;
+    printf("%-12s %-16s %8.2f ns/event  %s\n", "exchange", "spsc queue", eventNs, queueOk ? "ordered" : "MISMATCH");
+    bench_record("exchange", "spsc queue", eventNum, eventNs, "ns/event");
+
+    const int publishNum = 200000;
+    Parallel::TripleBuffer<std::vector<glm::fmat4> > frames;
+    std::atomic<bool> producing(true);
+    size_t torn = 0, taken = 0;
+    std::thread reader([&]() {
+        while (producing.load()) {
+            if (!frames.update()) {
+                std::this_thread::yield();
+                continue;
+            }
+            const std::vector<glm::fmat4> &palette = frames.read();
+            taken++;
+            for (size_t b = 0; b < palette.size(); b++) {
+                if (palette[b][3][3] != palette[0][3][3]) {
+                    torn++;
+                    break;
+                }
+            }
+        }
+    });
+    start = BenchClock::now();
+    for (int p = 1; p <= publishNum; p++) {
+        std::vector<glm::fmat4> &palette = frames.write();
+        palette.assign(boneNum, glm::fmat4((float) p));
+        frames.publish();
+    }
+    double publishNs = elapsed_ns(start) / publishNum;
+    producing.store(false);
+    reader.join();
+    printf("%-12s %-16s %8.2f ns/publish  %zu bones  %zu taken  %s\n", "exchange", "triple buffer", publishNs,
+           boneNum, taken, torn == 0 ? "whole" : "TORN");
+    bench_record("exchange", "triple buffer", boneNum, publishNs, "ns/publish");
+}
+
+// Sorting a frame of draw packets into runs: sceneNum scenes of meshNum meshes over three diffuse
+// arrays and both index types, half of the scenes drawn by an instanced program at three LODs
+static void bench_queue(int sceneNum, int meshNum) {
+    const TextureImage::Texture *diffuse[3] = {&TextureImage::Texture::error, &TextureImage::Texture::placeholder,
+                                               &TextureImage::Texture::placeholderArray};
+    std::mt19937 rng(42);
+    std::vector<SkeletalMesh::DrawPacket> packets;
+    for (int s = 0; s < sceneNum; s++) {
+        bool instanced = s % 2 == 1;
+        for (int l = 0; l < (instanced ? 3 : 1); l++) {
+            for (int m = 0; m < meshNum; m++) {
+                GLenum type = rng() % 4 == 0 ? GL_UNSIGNED_INT : GL_UNSIGNED_SHORT;
+                SkeletalMesh::DrawPacket packet = {instanced ? 2u : 1u, diffuse[rng() % 3], (GLuint) (s + 1), type,
+                                                   instanced ? l * 64 : 0, instanced ? 64 : 1,
+                                                   3 * (GLsizei) (rng() % 4096 + 1), (size_t) m * 8192, m * 1024};
+                packets.push_back(packet);
+            }
+        }
+    }
+    std::shuffle(packets.begin(), packets.end(), rng);
+
+    SkeletalMesh::RenderQueue queue;
+    const int iterations = 200;
+    BenchClock::time_point start = BenchClock::now();
+    for (int it = 0; it < iterations; it++) {
+        for (size_t i = 0; i < packets.size(); i++) queue.add(packets[i]);
+        queue.sort();
+        queue.clear();
+    }
+    double frameNs = elapsed_ns(start) / iterations;
+    printf("%-12s %-16s %8.2f us/frame  (%zu packets -> %zu runs)\n", "queue", "sort", frameNs * 1e-3,
+           packets.size(), queue.getRunNum());
+    bench_record("queue", "sort", packets.size(), frameNs, "ns/frame");
+    bench_record("queue", "runs", packets.size(), (double) queue.getRunNum(), "runs");
+}
+
+// Baking a mip chain from a synthetic image (smooth gradients plus noise, optionally a ragged alpha
+// channel), its size against the RGBA8 chain and the block-compression error of the top level
+static void bench_texture(uint32_t size) {
+    std::mt19937 rng(42);
+    std::uniform_int_distribution<int> noise(-4, 4);
+    for (int translucent = 0; translucent < 2; translucent++) {
+        std::vector<uint8_t> image((size_t) size * size * 4);
+        for (uint32_t y = 0; y < size; y++) {
+            for (uint32_t x = 0; x < size; x++) {
+                uint8_t *texel = &image[((size_t) y * size + x) * 4];
+                float wave = 100.0f * std::sin(x * 0.05f) * std::cos(y * 0.03f);
+                int color[3] = {(int) (x * 255 / size), (int) (y * 255 / size), (int) (128.0f + wave)};
+                for (int c = 0; c < 3; c++) texel[c] = (uint8_t) std::min(255, std::max(0, color[c] + noise(rng)));
+                texel[3] = translucent && (x / 8) % 2 ? (uint8_t) ((x + y) % 256) : 255;
+            }
+        }
+
+        for (int compress = 0; compress < 2; compress++) {
+            std::vector<char> blob;
+            BenchClock::time_point start = BenchClock::now();
+            TextureCache::bake(image.data(), size, size, compress != 0, MeshCache::SourceStamp(), blob);
+            double bakeMs = elapsed_ns(start) * 1e-6;
+            TextureCache::File file;
+            if (!file.adopt(blob)) continue;
+
+            // Root mean square error of the top level, colour and alpha
+            double colorError = 0.0, alphaError = 0.0;
+            if (file.format() != TextureCache::FormatRGBA8) {
+                const uint8_t *block = file.level(0);
+                size_t blockSize = file.format() == TextureCache::FormatBC1 ? 8 : 16;
+                uint8_t texels[64];
+                for (uint32_t by = 0; by < size; by += 4) {
+                    for (uint32_t bx = 0; bx < size; bx += 4, block += blockSize) {
+                        if (file.format() == TextureCache::FormatBC3) {
+                            TextureCache::Block::decodeColor(block + 8, texels);
+                            TextureCache::Block::decodeAlpha(block, texels);
+                        } else {
+                            TextureCache::Block::decodeColor(block, texels);
+                        }
+                        for (int i = 0; i < 16; i++) {
+                            uint32_t x = bx + (i & 3), y = by + (i >> 2);
+                            if (x >= size || y >= size) continue;
+                            const uint8_t *texel = &image[((size_t) y * size + x) * 4];
+                            for (int c = 0; c < 4; c++) {
+                                int difference = texels[i * 4 + c] - texel[c];
+                                (c < 3 ? colorError : alphaError) += difference * difference;
+                            }
+                        }
+                    }
+                }
+                colorError = std::sqrt(colorError / ((double) size * size * 3));
+                alphaError = std::sqrt(alphaError / ((double) size * size));
+            }
+
+            const char *formatName[] = {"RGBA8", "BC1", "BC3"};
+            std::string name = std::string(translucent ? "translucent " : "opaque ") + formatName[file.format()];
+            uint64_t rgbaBytes = 0;
+            for (uint32_t l = 0; l < file.header().levelNum; l++)
+                rgbaBytes += (uint64_t) file.levelRecord(l).width * file.levelRecord(l).height * 4;
+            double ratio = (double) rgbaBytes / file.dataBytes();
+            printf("%-12s %-18s %ux%u  %2u levels  %9llu bytes (%.1fx smaller)  bake %8.2f ms  rmse %.2f alpha %.2f\n",
+                   "texture", name.c_str(), size, size, file.header().levelNum, (unsigned long long) file.dataBytes(),
+                   ratio, bakeMs, colorError, alphaError);
+            bench_record("texture", name + " bake", (size_t) size * size, bakeMs, "ms");
+            bench_record("texture", name + " ratio", (size_t) size * size, ratio, "x");
+            bench_record("texture", name + " rmse", (size_t) size * size, colorError, "levels");
+            bench_record("texture", name + " alpha rmse", (size_t) size * size, alphaError, "levels");
+        }
+    }
+}
+
+static void print_usage() {
+    std::cout << "Usage: HandBench [options]" << std::endl;
+    std::cout << "  --output F    also write the results to F (.json for JSON, CSV otherwise)" << std::endl;
+    std::cout << "  --filter S    only run groups whose name contains S (pose, clip, compression, instances," << std::endl;
+    std::cout << "                addBone, assembly, skinning, vertex, index, lod, texture, preset, transform," << std::endl;
+    std::cout << "                camera, queue, dirty, pacing, exchange)" << std::endl;
+    std::cout << "  --vertices N  vertices of the synthetic meshes (default 1000000)" << std::endl;
+}
+
+static bool parse_options(int argc, char *argv[], BenchOptions &options) {
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--help" || arg == "-h") return false;
+        if (i + 1 >= argc) {
+            std::cout << "Missing value for " << arg << std::endl;
+            return false;
+        }
+        const char *value = argv[++i];
+        if (arg == "--output") options.output = value;
+        else if (arg == "--filter") options.filter = value;
+        else if (arg == "--vertices") options.vertexNum = (size_t) atol(value);
+        else {
+            std::cout << "Unknown option " << arg << std::endl;
+            return false;
+        }
+    }
+    return options.vertexNum > 0;
+}
+
+int main(int argc, char *argv[]) {
+    if (!parse_options(argc, argv, bench_options)) {
+        print_usage();
+        exit(EXIT_FAILURE);
+    }
+    printf("Pose kernel: %s, skin kernel: %s\n", SkeletalMesh::PoseKernel::activeKernel().name,
+           SkeletalMesh::SkinKernel::activeKernel().name);
+
+    MeshCache::BakedFile baked;
+    if (SkeletalMesh::Scene::openBaked(DATA_DIR"/Hand.fbx", baked)) {
+        SkeletalMesh::Skeleton hand;
+        SkeletalMesh::Scene::Name2Bone nameBoneMap;
+        if (SkeletalMesh::Scene::buildSkeleton(baked, hand, nameBoneMap)) {
+            HandRig::Binding rig;
+            rig.bind(nameBoneMap);
+            if (bench_enabled("pose")) bench_pose("Hand", hand);
+            if (bench_enabled("dirty")) bench_dirty("Hand", hand);
+            if (bench_enabled("preset") || bench_enabled("transform")) bench_presets(hand, nameBoneMap, rig);
+            if (bench_enabled("skinning")) bench_skinning("Hand", baked, hand);
+            if (bench_enabled("vertex")) bench_vertex("Hand", baked);
+            if (bench_enabled("index")) bench_indices("Hand", baked);
+            if (bench_enabled("lod")) bench_lod("Hand", baked);
+            if (bench_enabled("instances")) bench_instances(hand, rig, 4096);
+
+            std::vector<SkeletalMesh::AnimationClip> clips;
+            SkeletalMesh::Scene::buildAnimationClips(baked, hand, clips);
+            for (size_t i = 0; i < clips.size(); i++) {
+                if (bench_enabled("clip")) bench_clip("clip " + clips[i].name, clips[i], hand);
+                if (bench_enabled("compression"))
+                    bench_compression("compressed " + clips[i].name, clips[i], hand, rig.fingertips());
+            }
+        }
+    } else {
+        std::cout << "Error occured in openBaked()" << std::endl;
+    }
+    if (bench_enabled("camera")) bench_camera();
+    if (bench_enabled("queue")) bench_queue(64, 32);
+    if (bench_enabled("exchange")) bench_exchange(64);
+    if (bench_enabled("pacing")) {
+        bench_pacing(60.0, 120);
+        bench_pacing(240.0, 240);
+    }
+    if (bench_enabled("texture")) bench_texture(1024);
+    if (bench_enabled("addBone")) bench_add_bone(bench_options.vertexNum);
+
+    const int syntheticBoneNum[] = {100, 1000, 10000};
+    for (int i = 0; i < 3; i++) {
+        SkeletalMesh::Skeleton synthetic;
+        make_synthetic_skeleton(synthetic, syntheticBoneNum[i], 42 + i);
+        if (bench_enabled("pose")) bench_pose("synthetic", synthetic);
+        if (bench_enabled("dirty")) bench_dirty("synthetic", synthetic);
+        if (bench_enabled("clip") || bench_enabled("compression")) {
+            SkeletalMesh::AnimationClip clip;
+            make_synthetic_clip(clip, synthetic, std::max(30, 30000 / syntheticBoneNum[i]), 30.0f, 42 + i);
+            if (bench_enabled("clip")) bench_clip("synthetic", clip, synthetic);
+            if (bench_enabled("compression"))
+                bench_compression("compressed synthetic", clip, synthetic, std::vector<SkeletalMesh::BoneId>());
+        }
+        if (bench_enabled("assembly") || bench_enabled("skinning") || bench_enabled("vertex") ||
+            bench_enabled("index") || bench_enabled("lod")) {
+            std::unique_ptr<aiScene> scene(make_synthetic_scene(syntheticBoneNum[i], bench_options.vertexNum));
+            MeshCache::BakedFile syntheticBaked;
+            bench_assembly(scene.get(), syntheticBoneNum[i], bench_options.vertexNum, syntheticBaked);
+            if (bench_enabled("skinning")) bench_skinning("synthetic", syntheticBaked, synthetic);
+            if (bench_enabled("vertex")) bench_vertex("synthetic", syntheticBaked);
+            if (bench_enabled("index")) bench_indices("synthetic", syntheticBaked);
+            if (bench_enabled("lod")) bench_lod("synthetic", syntheticBaked);
+        }
+    }
+
+    if (!bench_options.output.empty()) {
+        if (!write_results(bench_options.output)) {
+            std::cout << "Error occured writing " << bench_options.output << std::endl;
+            exit(EXIT_FAILURE);
+        }
+        std::cout << bench_results.size() << " results written to " << bench_options.output << std::endl;
+    }
+    exit(EXIT_SUCCESS);
+}
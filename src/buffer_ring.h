@@ -0,0 +1,302 @@
+// Buffer Ring
+// One GL buffer split into BUFFER_RING_REGION_NUM regions. Each frame writes the next region while
+// the GPU may still read the previous ones; a fence per region keeps the CPU from overwriting data
+// that is still in flight, so neither side waits on the other in the steady state.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include <algorithm>
+
+#include "gl_env.h"
+
+#define BUFFER_RING_REGION_NUM 3
+#define BUFFER_RING_ALIGNMENT 256
+#define BUFFER_RING_WAIT_NS 1000000000ull
+
+namespace SkeletalMesh {
+    // With GL 4.4 buffer storage the buffer is mapped once, persistently and coherently, for its whole
+    // life. Older contexts map each region unsynchronized in begin() and unmap it in flush(); the
+    // fences make that just as safe.
+    class BufferRing {
+    public:
+        BufferRing() : target(0), buffer(0), persistent(false), mapped(NULL), regionBytes(0), region(0) {
+            memset(regionFence, 0, sizeof(regionFence));
+        }
+
+        ~BufferRing() { release(); }
+
+        static bool persistentSupported() { return GLEW_VERSION_4_4 || GLEW_ARB_buffer_storage; }
+
+        // Regions are rounded up to BUFFER_RING_ALIGNMENT bytes, which satisfies the offset alignment of
+        // uniform and texture buffers. Returns false when the persistent mapping fails.
+        bool create(GLenum _target, size_t _regionBytes) {
+            release();
+            if (_regionBytes == 0) return false;
+            target = _target;
+            regionBytes = (_regionBytes + BUFFER_RING_ALIGNMENT - 1) / BUFFER_RING_ALIGNMENT * BUFFER_RING_ALIGNMENT;
+            GLsizeiptr bytes = (GLsizeiptr) (regionBytes * BUFFER_RING_REGION_NUM);
+            glGenBuffers(1, &buffer);
+            glBindBuffer(target, buffer);
+            persistent = persistentSupported();
+            if (persistent) {
+                GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+                glBufferStorage(target, bytes, NULL, flags);
+                mapped = (char *) glMapBufferRange(target, 0, bytes, flags);
+            } else {
+                glBufferData(target, bytes, NULL, GL_STREAM_DRAW);
+            }
+            glBindBuffer(target, 0);
+            if (persistent && mapped == NULL) {
+                release();
+                return false;
+            }
+            region = 0;
+            return true;
+        }
+
+        // Frees the buffer after waiting for every region still in flight
+        void release() {
+            for (int i = 0; i < BUFFER_RING_REGION_NUM; i++) {
+                if (!regionFence[i]) continue;
+                // A failed wait leaves nothing to wait for; the buffer goes either way
+                if (!waitFence(regionFence[i])) glDeleteSync(regionFence[i]);
+                regionFence[i] = 0;
+            }
+            if (buffer) {
+                if (mapped) {
+                    glBindBuffer(target, buffer);
+                    glUnmapBuffer(target);
+                    glBindBuffer(target, 0);
+                }
+                glDeleteBuffers(1, &buffer);
+            }
+            buffer = 0;
+            persistent = false;
+            mapped = NULL;
+            regionBytes = 0;
+            region = 0;
+        }
+
+        bool available() const { return buffer != 0; }
+
+        bool isPersistent() const { return persistent; }
+
+        GLuint getBuffer() const { return buffer; }
+
+        size_t getRegionBytes() const { return regionBytes; }
+
+        // Advances to the next region, waiting until the GPU has finished the frame that last used it,
+        // and returns it for writing; NULL if it cannot be mapped or the wait failed, in which case the
+        // current region stays. Call flush() before drawing from it.
+        char *begin() {
+            if (!buffer) return NULL;
+            size_t next = (region + 1) % BUFFER_RING_REGION_NUM;
+            if (!waitFence(regionFence[next])) return NULL;
+            region = next;
+            if (persistent) return mapped + offset();
+            glBindBuffer(target, buffer);
+            // Not invalidated: a region keeps its contents, so callers may rewrite only part of it
+            mapped = (char *) glMapBufferRange(target, (GLintptr) offset(), (GLsizeiptr) regionBytes,
+                                               GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+            glBindBuffer(target, 0);
+            return mapped;
+        }
+
+        // The persistent mapping is coherent, so only the fallback has to unmap
+        void flush() {
+            if (persistent || mapped == NULL) return;
+            glBindBuffer(target, buffer);
+            glUnmapBuffer(target);
+            glBindBuffer(target, 0);
+            mapped = NULL;
+        }
+
+        size_t getRegion() const { return region; }
+
+        // Byte offset of the current region in the buffer
+        size_t offset() const { return region * regionBytes; }
+
+        // Call after the last command reading the current region
+        void fence() {
+            if (!buffer) return;
+            if (regionFence[region]) glDeleteSync(regionFence[region]);
+            regionFence[region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        }
+
+    private:
+        GLenum target;
+        GLuint buffer;
+        bool persistent;
+        char *mapped;
+        size_t regionBytes;
+        size_t region;
+        GLsync regionFence[BUFFER_RING_REGION_NUM];
+
+        // Blocks until _fence has signaled, however many timeouts that takes, then deletes it.
+        // Returns false if the wait failed, leaving the fence in place.
+        static bool waitFence(GLsync &_fence) {
+            if (!_fence) return true;
+            GLenum result;
+            do {
+                result = glClientWaitSync(_fence, GL_SYNC_FLUSH_COMMANDS_BIT, BUFFER_RING_WAIT_NS);
+            } while (result == GL_TIMEOUT_EXPIRED);
+            if (result == GL_WAIT_FAILED) return false;
+            glDeleteSync(_fence);
+            _fence = 0;
+            return true;
+        }
+
+        // Forbid copying GL objects
+        BufferRing(const BufferRing &_copy);
+
+        BufferRing &operator=(const BufferRing &_copy);
+    };
+
+    // A ring read by shaders through a samplerBuffer of RGBA32F texels. The texture spans the whole
+    // buffer, so it is set up once and shaders add texelOffset() of the current region to their fetches.
+    class TexelRing {
+    public:
+        TexelRing() : texture(0) {}
+
+        ~TexelRing() { release(); }
+
+        bool create(size_t _regionBytes) {
+            release();
+            if (!ring.create(GL_TEXTURE_BUFFER, _regionBytes)) return false;
+            glGenTextures(1, &texture);
+            glBindTexture(GL_TEXTURE_BUFFER, texture);
+            glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, ring.getBuffer());
+            glBindTexture(GL_TEXTURE_BUFFER, 0);
+            return true;
+        }
+
+        void release() {
+            if (texture) glDeleteTextures(1, &texture);
+            texture = 0;
+            ring.release();
+        }
+
+        bool available() const { return texture != 0; }
+
+        size_t getRegionBytes() const { return ring.getRegionBytes(); }
+
+        size_t getRegion() const { return ring.getRegion(); }
+
+        char *begin() { return ring.begin(); }
+
+        void flush() { ring.flush(); }
+
+        void fence() { ring.fence(); }
+
+        GLint texelOffset() const { return (GLint) (ring.offset() / (4 * sizeof(float))); }
+
+        bool bind(GLenum _channel) const {
+            if (!texture) return false;
+            glActiveTexture(GL_TEXTURE0 + _channel);
+            glBindTexture(GL_TEXTURE_BUFFER, texture);
+            glActiveTexture(GL_TEXTURE0);
+            return true;
+        }
+
+    private:
+        BufferRing ring;
+        GLuint texture;
+
+        // Forbid copying GL objects
+        TexelRing(const TexelRing &_copy);
+
+        TexelRing &operator=(const TexelRing &_copy);
+    };
+
+    // Fixed-size elements, bone matrices say, streamed through a TexelRing. Callers touch() what changed;
+    // upload() copies into the next region only the elements that changed since that region was last
+    // written, and a frame without changes keeps reading the current region.
+    class PaletteRing {
+    public:
+        PaletteRing() : elementBytes(0), version(0), pending(false) {
+            memset(regionVersion, 0, sizeof(regionVersion));
+        }
+
+        bool create(size_t _elementNum, size_t _elementBytes) {
+            release();
+            if (!ring.create(_elementNum * _elementBytes)) return false;
+            elementBytes = _elementBytes;
+            stamp.assign(_elementNum, 0);
+            touchAll();
+            return true;
+        }
+
+        void release() {
+            ring.release();
+            stamp.clear();
+            elementBytes = 0;
+            version = 0;
+            pending = false;
+            memset(regionVersion, 0, sizeof(regionVersion));
+        }
+
+        size_t getElementNum() const { return stamp.size(); }
+
+        void touch(size_t _element) {
+            if (_element >= stamp.size()) return;
+            stamp[_element] = version + 1;
+            pending = true;
+        }
+
+        void touchAll() {
+            std::fill(stamp.begin(), stamp.end(), version + 1);
+            pending = !stamp.empty();
+        }
+
+        // _elements holds getElementNum() elements. Returns how many were copied, 0 if nothing changed.
+        size_t upload(const void *_elements) {
+            if (!pending) return 0;
+            char *region = ring.begin();
+            if (region == NULL) return 0;
+            version++;
+            uint64_t since = regionVersion[ring.getRegion()];
+            const char *source = (const char *) _elements;
+            size_t copied = 0;
+            for (size_t begin = 0; begin < stamp.size();) {
+                if (stamp[begin] <= since) {
+                    begin++;
+                    continue;
+                }
+                size_t end = begin + 1;
+                while (end < stamp.size() && stamp[end] > since) end++;
+                memcpy(region + begin * elementBytes, source + begin * elementBytes, (end - begin) * elementBytes);
+                copied += end - begin;
+                begin = end;
+            }
+            ring.flush();
+            regionVersion[ring.getRegion()] = version;
+            pending = false;
+            return copied;
+        }
+
+        GLint texelOffset() const { return ring.texelOffset(); }
+
+        bool bind(GLenum _channel) const { return ring.bind(_channel); }
+
+        // Call after the last draw reading the current region, whether or not this frame uploaded
+        void fence() { ring.fence(); }
+
+    private:
+        TexelRing ring;
+        size_t elementBytes;
+        // Version of the upload that last changed each element; region r holds versions up to regionVersion[r]
+        std::vector<uint64_t> stamp;
+        uint64_t version;
+        uint64_t regionVersion[BUFFER_RING_REGION_NUM];
+        bool pending;
+
+        // Forbid copying GL objects
+        PaletteRing(const PaletteRing &_copy);
+
+        PaletteRing &operator=(const PaletteRing &_copy);
+    };
+}
@@ -0,0 +1,133 @@
+// Compact Vertex Format
+// Opt-in 24-byte GPU vertex: 16-bit positions normalized to the scene bounds, octahedral
+// normals, half-float texcoords and 8-bit bone indices / weights.
+
+#pragma once
+
+#include <cstdint>
+#include <cmath>
+#include <algorithm>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/packing.hpp>
+
+#define COMPACT_VERTEX_MAX_BONES 256
+#define COMPACT_VERTEX_WEIGHT_SUM 255
+
+namespace SkeletalMesh {
+    // position[3] is padding so the weights stay 4-byte aligned
+    struct CompactVertex {
+        uint16_t position[4];
+        int16_t normal[2];
+        uint16_t texcoord[2];
+        uint8_t boneId[4];
+        uint8_t boneWeight[4];
+    };
+
+    static_assert(sizeof(CompactVertex) == 24, "CompactVertex must stay 24 bytes");
+
+    // Bind position = min + unorm16 * extent, which is what the vertex shaders compute
+    // from u_position_min / u_position_extent. The full format decodes with min 0, extent 1.
+    struct PositionDecode {
+        glm::fvec3 min;
+        glm::fvec3 extent;
+
+        PositionDecode() : min(0.0f), extent(1.0f) {}
+    };
+
+    namespace CompactVertexCodec {
+        inline void encodePosition(const PositionDecode &_decode, const float *_position, uint16_t *_out) {
+            for (int c = 0; c < 3; c++) {
+                float normalized = _decode.extent[c] > 0.0f ? (_position[c] - _decode.min[c]) / _decode.extent[c] : 0.0f;
+                _out[c] = glm::packUnorm1x16(normalized);
+            }
+            _out[3] = 0;
+        }
+
+        inline void decodePosition(const PositionDecode &_decode, const uint16_t *_position, float *_out) {
+            for (int c = 0; c < 3; c++)
+                _out[c] = _decode.min[c] + glm::unpackUnorm1x16(_position[c]) * _decode.extent[c];
+        }
+
+        // Octahedral mapping of the unit sphere onto [-1, 1]^2
+        inline void encodeNormal(const float *_normal, int16_t *_out) {
+            float x = _normal[0], y = _normal[1], z = _normal[2];
+            float l1 = std::abs(x) + std::abs(y) + std::abs(z);
+            if (l1 <= 0.0f) {
+                _out[0] = _out[1] = 0;
+                return;
+            }
+            x /= l1;
+            y /= l1;
+            if (z < 0.0f) {
+                float fx = (1.0f - std::abs(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+                float fy = (1.0f - std::abs(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+                x = fx;
+                y = fy;
+            }
+            _out[0] = (int16_t) glm::packSnorm1x16(x);
+            _out[1] = (int16_t) glm::packSnorm1x16(y);
+        }
+
+        inline void decodeNormal(const int16_t *_normal, float *_out) {
+            float x = glm::unpackSnorm1x16((uint16_t) _normal[0]);
+            float y = glm::unpackSnorm1x16((uint16_t) _normal[1]);
+            float z = 1.0f - std::abs(x) - std::abs(y);
+            if (z < 0.0f) {
+                float fx = (1.0f - std::abs(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+                float fy = (1.0f - std::abs(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+                x = fx;
+                y = fy;
+            }
+            float len = std::sqrt(x * x + y * y + z * z);
+            _out[0] = x / len;
+            _out[1] = y / len;
+            _out[2] = z / len;
+        }
+
+        // Rescales to sum to COMPACT_VERTEX_WEIGHT_SUM, handing the rounding remainder to the largest
+        // fractions. All-zero weights stay zero, so unskinned vertices remain unskinned.
+        inline void encodeWeights(const float *_weight, uint8_t *_out) {
+            float sum = 0.0f;
+            for (int i = 0; i < 4; i++)
+                sum += std::max(_weight[i], 0.0f);
+            if (sum <= 0.0f) {
+                std::fill(_out, _out + 4, (uint8_t) 0);
+                return;
+            }
+            float fraction[4];
+            int total = 0;
+            for (int i = 0; i < 4; i++) {
+                float scaled = std::max(_weight[i], 0.0f) / sum * COMPACT_VERTEX_WEIGHT_SUM;
+                int level = (int) std::floor(scaled);
+                _out[i] = (uint8_t) level;
+                fraction[i] = scaled - level;
+                total += level;
+            }
+            for (; total < COMPACT_VERTEX_WEIGHT_SUM; total++) {
+                int largest = (int) (std::max_element(fraction, fraction + 4) - fraction);
+                _out[largest]++;
+                fraction[largest] = -1.0f;
+            }
+        }
+
+        inline void decodeTexcoord(const uint16_t *_texcoord, float *_out) {
+            _out[0] = glm::unpackHalf1x16(_texcoord[0]);
+            _out[1] = glm::unpackHalf1x16(_texcoord[1]);
+        }
+
+        // Bone indices must be below COMPACT_VERTEX_MAX_BONES
+        inline CompactVertex encode(const PositionDecode &_decode, const float *_position, const float *_texcoord,
+                                    const float *_normal, const unsigned int *_boneId, const float *_boneWeight) {
+            CompactVertex v;
+            encodePosition(_decode, _position, v.position);
+            encodeNormal(_normal, v.normal);
+            v.texcoord[0] = glm::packHalf1x16(_texcoord[0]);
+            v.texcoord[1] = glm::packHalf1x16(_texcoord[1]);
+            encodeWeights(_boneWeight, v.boneWeight);
+            for (int i = 0; i < 4; i++)
+                v.boneId[i] = v.boneWeight[i] > 0 ? (uint8_t) _boneId[i] : 0;
+            return v;
+        }
+    }
+}
@@ -0,0 +1,200 @@
+// CPU Profiler
+// Per-stage CPU timers over a rolling window of frames. Every frame can also be kept for a CSV / JSON
+// trace. Plain CPU code; frame_profiler.h adds GL timestamp queries on top of it.
+
+#pragma once
+
+#include <cstdio>
+#include <cstdint>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include "frame_history.h"
+
+#define FRAME_PROFILER_NOT_MEASURED (-1.0f)
+
+namespace Profiling {
+    typedef int StageId;
+
+    // One traced frame; stages that did not run this frame read 0, GPU times not measured read -1
+    struct FrameRecord {
+        uint64_t frame;
+        double startMs;
+        float frameMs;
+        std::vector<float> cpuMs;
+        std::vector<float> gpuMs;
+    };
+
+    // Times one stage of a profiler for the lifetime of the object
+    template<class Profiler>
+    class StageScope {
+    public:
+        StageScope(Profiler &_profiler, StageId _stage) : profiler(_profiler), stage(_stage) {
+            profiler.beginStage(stage);
+        }
+
+        ~StageScope() { profiler.endStage(stage); }
+
+    private:
+        Profiler &profiler;
+        StageId stage;
+
+        StageScope(const StageScope &);
+
+        StageScope &operator=(const StageScope &);
+    };
+
+    // Register the stages once, then per frame: beginFrame(), any number of (possibly repeated)
+    // stage scopes, endFrame(). GPU histories stay empty unless a subclass records into them.
+    class CpuProfiler {
+    public:
+        typedef StageScope<CpuProfiler> Scope;
+
+        CpuProfiler()
+                : inFrame(false), stageNames(), stageBegin(), frameCpuMs(), cpuHistory(), gpuHistory(), frameHistory(),
+                  trace(), frameIndex(0), firstTraceFrame(0), tracing(false) {}
+
+        StageId addStage(const std::string &_name) {
+            stageNames.push_back(_name);
+            stageBegin.push_back(Clock::time_point());
+            frameCpuMs.push_back(0.0f);
+            cpuHistory.push_back(History());
+            gpuHistory.push_back(History());
+            return (StageId) stageNames.size() - 1;
+        }
+
+        size_t getStageNum() const { return stageNames.size(); }
+
+        const std::string &getStageName(StageId _stage) const { return stageNames[_stage]; }
+
+        // Keeps every following frame for writeTrace()
+        void setTracing(bool _enabled) {
+            if (_enabled && !tracing) {
+                trace.clear();
+                firstTraceFrame = frameIndex;
+            }
+            tracing = _enabled;
+        }
+
+        bool getTracing() const { return tracing; }
+
+        uint64_t getFrameIndex() const { return frameIndex; }
+
+        const History &getCpuHistory(StageId _stage) const { return cpuHistory[_stage]; }
+
+        const History &getGpuHistory(StageId _stage) const { return gpuHistory[_stage]; }
+
+        const History &getFrameHistory() const { return frameHistory; }
+
+        void beginFrame() {
+            std::fill(frameCpuMs.begin(), frameCpuMs.end(), 0.0f);
+            frameBegin = Clock::now();
+            if (startTime == Clock::time_point()) startTime = frameBegin;
+            inFrame = true;
+        }
+
+        void endFrame() {
+            if (!inFrame) return;
+            float frameMs = elapsedMs(frameBegin);
+            frameHistory.push(frameMs);
+            for (size_t i = 0; i < stageNames.size(); i++)
+                cpuHistory[i].push(frameCpuMs[i]);
+            if (tracing) {
+                FrameRecord record;
+                record.frame = frameIndex;
+                record.startMs = std::chrono::duration<double, std::milli>(frameBegin - startTime).count();
+                record.frameMs = frameMs;
+                record.cpuMs = frameCpuMs;
+                record.gpuMs.assign(stageNames.size(), FRAME_PROFILER_NOT_MEASURED);
+                trace.push_back(record);
+            }
+            frameIndex++;
+            inFrame = false;
+        }
+
+        void beginStage(StageId _stage) {
+            if (inFrame) stageBegin[_stage] = Clock::now();
+        }
+
+        void endStage(StageId _stage) {
+            if (inFrame) frameCpuMs[_stage] += elapsedMs(stageBegin[_stage]);
+        }
+
+        // Format follows the extension: ".json" writes JSON, anything else CSV
+        bool writeTrace(const std::string &_filename) const {
+            bool json = _filename.size() >= 5 && _filename.compare(_filename.size() - 5, 5, ".json") == 0;
+            FILE *fo = fopen(_filename.c_str(), "w");
+            if (fo == NULL) return false;
+            if (json) writeJson(fo);
+            else writeCsv(fo);
+            return fclose(fo) == 0;
+        }
+
+    protected:
+        bool inFrame;
+
+        // GPU time of _stage in frame _frame, which may have been traced a few frames ago
+        void recordGpu(uint64_t _frame, StageId _stage, float _ms) {
+            gpuHistory[_stage].push(_ms);
+            if (tracing && _frame >= firstTraceFrame && _frame - firstTraceFrame < trace.size())
+                trace[_frame - firstTraceFrame].gpuMs[_stage] = _ms;
+        }
+
+    private:
+        std::vector<std::string> stageNames;
+        std::vector<Clock::time_point> stageBegin;
+        std::vector<float> frameCpuMs;
+        std::vector<History> cpuHistory;
+        std::vector<History> gpuHistory;
+        History frameHistory;
+        std::vector<FrameRecord> trace;
+        uint64_t frameIndex;
+        uint64_t firstTraceFrame;
+        Clock::time_point startTime;
+        Clock::time_point frameBegin;
+        bool tracing;
+
+        static float elapsedMs(Clock::time_point _begin) {
+            return std::chrono::duration<float, std::milli>(Clock::now() - _begin).count();
+        }
+
+        void writeCsv(FILE *_fo) const {
+            fprintf(_fo, "frame,start_ms,frame_ms");
+            for (size_t s = 0; s < stageNames.size(); s++)
+                fprintf(_fo, ",%s_cpu_ms,%s_gpu_ms", stageNames[s].c_str(), stageNames[s].c_str());
+            fprintf(_fo, "\n");
+            for (size_t i = 0; i < trace.size(); i++) {
+                const FrameRecord &record = trace[i];
+                fprintf(_fo, "%llu,%.4f,%.4f", (unsigned long long) record.frame, record.startMs, record.frameMs);
+                for (size_t s = 0; s < stageNames.size(); s++) {
+                    fprintf(_fo, ",%.4f,", record.cpuMs[s]);
+                    if (record.gpuMs[s] != FRAME_PROFILER_NOT_MEASURED) fprintf(_fo, "%.4f", record.gpuMs[s]);
+                }
+                fprintf(_fo, "\n");
+            }
+        }
+
+        void writeJson(FILE *_fo) const {
+            fprintf(_fo, "{\n  \"stages\": [");
+            for (size_t s = 0; s < stageNames.size(); s++)
+                fprintf(_fo, "%s\"%s\"", s == 0 ? "" : ", ", stageNames[s].c_str());
+            fprintf(_fo, "],\n  \"frames\": [");
+            for (size_t i = 0; i < trace.size(); i++) {
+                const FrameRecord &record = trace[i];
+                fprintf(_fo, "%s\n    {\"frame\": %llu, \"start_ms\": %.4f, \"frame_ms\": %.4f, \"cpu_ms\": [",
+                        i == 0 ? "" : ",", (unsigned long long) record.frame, record.startMs, record.frameMs);
+                for (size_t s = 0; s < stageNames.size(); s++)
+                    fprintf(_fo, "%s%.4f", s == 0 ? "" : ", ", record.cpuMs[s]);
+                fprintf(_fo, "], \"gpu_ms\": [");
+                for (size_t s = 0; s < stageNames.size(); s++) {
+                    if (record.gpuMs[s] == FRAME_PROFILER_NOT_MEASURED) fprintf(_fo, "%snull", s == 0 ? "" : ", ");
+                    else fprintf(_fo, "%s%.4f", s == 0 ? "" : ", ", record.gpuMs[s]);
+                }
+                fprintf(_fo, "]}");
+            }
+            fprintf(_fo, "\n  ]\n}\n");
+        }
+    };
+}
@@ -0,0 +1,342 @@
+// CPU Linear Blend Skinning
+// Deforms the ParametricVertex stream on the CPU exactly like vertex_shader_330,
+// so skinned geometry is available without a GL context.
+
+#pragma once
+
+#include <cmath>
+
+#include "scene_bake.h"
+#include "dual_quat.h"
+#include "job_system.h"
+
+#define CPU_SKINNING_GRAIN 4096
+
+namespace SkeletalMesh {
+    namespace SkinKernel {
+        // Bone matrices are column-major float[16], bone dual quaternions are DualQuat (only the
+        // palette the kernel reads must be set). positions / normals receive 3 floats per vertex,
+        // normals may be NULL. Vertices whose weights sum to (almost) zero keep their bind pose.
+        struct SkinArgs {
+            const ParametricVertex *vertices;
+            const float *boneTransf;
+            const DualQuat *boneDualQuat;
+            unsigned int boneNum;
+            float *positions;
+            float *normals;
+        };
+
+        // Skins vertices [_begin, _end)
+        typedef void (*SkinFunc)(const SkinArgs &_args, size_t _begin, size_t _end);
+
+        struct Kernel {
+            const char *name;
+            SkinFunc skin;
+        };
+
+        // Weights rescaled to sum to one, which is what the shader's adjust_factor amounts to after
+        // the homogeneous divide. Returns false for unskinned vertices. Out-of-range bones get no weight.
+        inline bool normalizedWeights(const SkinArgs &_args, const ParametricVertex &_v, float *_weight) {
+            float sum = 0.0f;
+            for (int i = 0; i < SCENE_RESOURCE_BONE_PER_VERTEX; i++) {
+                _weight[i] = _v.boneId[i] < _args.boneNum ? _v.boneWeight[i] : 0.0f;
+                sum += _v.boneWeight[i];
+            }
+            if (sum * 0.25f <= 1e-3f) return false;
+            for (int i = 0; i < SCENE_RESOURCE_BONE_PER_VERTEX; i++)
+                _weight[i] /= sum;
+            return true;
+        }
+
+        inline void copyBindPose(const SkinArgs &_args, size_t _i) {
+            const ParametricVertex &v = _args.vertices[_i];
+            memcpy(_args.positions + 3 * _i, v.position, sizeof(v.position));
+            if (_args.normals != NULL) memcpy(_args.normals + 3 * _i, v.normal, sizeof(v.normal));
+        }
+
+        inline void storeNormal(float *_out, float _x, float _y, float _z) {
+            float len = std::sqrt(_x * _x + _y * _y + _z * _z);
+            float inv = len > 1e-12f ? 1.0f / len : 0.0f;
+            _out[0] = _x * inv;
+            _out[1] = _y * inv;
+            _out[2] = _z * inv;
+        }
+
+        inline void skinScalar(const SkinArgs &_args, size_t _begin, size_t _end) {
+            float weight[SCENE_RESOURCE_BONE_PER_VERTEX];
+            float m[16];
+            for (size_t i = _begin; i < _end; i++) {
+                const ParametricVertex &v = _args.vertices[i];
+                if (!normalizedWeights(_args, v, weight)) {
+                    copyBindPose(_args, i);
+                    continue;
+                }
+                memset(m, 0, sizeof(m));
+                for (int b = 0; b < SCENE_RESOURCE_BONE_PER_VERTEX; b++) {
+                    if (weight[b] == 0.0f) continue;
+                    const float *bone = _args.boneTransf + 16 * v.boneId[b];
+                    for (int k = 0; k < 16; k++)
+                        m[k] += bone[k] * weight[b];
+                }
+                const float *p = v.position;
+                float *outP = _args.positions + 3 * i;
+                for (int r = 0; r < 3; r++)
+                    outP[r] = m[r] * p[0] + m[4 + r] * p[1] + m[8 + r] * p[2] + m[12 + r];
+                if (_args.normals != NULL) {
+                    const float *n = v.normal;
+                    storeNormal(_args.normals + 3 * i,
+                                m[0] * n[0] + m[4] * n[1] + m[8] * n[2],
+                                m[1] * n[0] + m[5] * n[1] + m[9] * n[2],
+                                m[2] * n[0] + m[6] * n[1] + m[10] * n[2]);
+                }
+            }
+        }
+
+        // Dual-quaternion blend, antipodal bones are flipped into the hemisphere of the heaviest one.
+        // Normalizing the blend replaces the division by the weight sum.
+        inline void skinDualQuat(const SkinArgs &_args, size_t _begin, size_t _end) {
+            float weight[SCENE_RESOURCE_BONE_PER_VERTEX];
+            for (size_t i = _begin; i < _end; i++) {
+                const ParametricVertex &v = _args.vertices[i];
+                if (!normalizedWeights(_args, v, weight)) {
+                    copyBindPose(_args, i);
+                    continue;
+                }
+                int pivot = 0;
+                for (int b = 1; b < SCENE_RESOURCE_BONE_PER_VERTEX; b++)
+                    if (weight[b] > weight[pivot]) pivot = b;
+                const float *pivotReal = _args.boneDualQuat[v.boneId[pivot]].real;
+
+                float r[4] = {0.0f, 0.0f, 0.0f, 0.0f}, d[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+                for (int b = 0; b < SCENE_RESOURCE_BONE_PER_VERTEX; b++) {
+                    if (weight[b] == 0.0f) continue;
+                    const DualQuat &bone = _args.boneDualQuat[v.boneId[b]];
+                    float hemisphere = bone.real[0] * pivotReal[0] + bone.real[1] * pivotReal[1] +
+                                       bone.real[2] * pivotReal[2] + bone.real[3] * pivotReal[3];
+                    float w = hemisphere < 0.0f ? -weight[b] : weight[b];
+                    for (int k = 0; k < 4; k++) {
+                        r[k] += bone.real[k] * w;
+                        d[k] += bone.dual[k] * w;
+                    }
+                }
+                float len = std::sqrt(r[0] * r[0] + r[1] * r[1] + r[2] * r[2] + r[3] * r[3]);
+                if (len < 1e-12f) {
+                    copyBindPose(_args, i);
+                    continue;
+                }
+                for (int k = 0; k < 4; k++) {
+                    r[k] /= len;
+                    d[k] /= len;
+                }
+
+                // p' = p + 2 r.xyz x (r.xyz x p + r.w p) + 2 (r.w d.xyz - d.w r.xyz + r.xyz x d.xyz)
+                glm::fvec3 rv(r[0], r[1], r[2]), dv(d[0], d[1], d[2]);
+                glm::fvec3 p(v.position[0], v.position[1], v.position[2]);
+                glm::fvec3 translation = 2.0f * (r[3] * dv - d[3] * rv + glm::cross(rv, dv));
+                glm::fvec3 outP = p + 2.0f * glm::cross(rv, glm::cross(rv, p) + r[3] * p) + translation;
+                memcpy(_args.positions + 3 * i, &outP[0], 3 * sizeof(float));
+                if (_args.normals != NULL) {
+                    glm::fvec3 n(v.normal[0], v.normal[1], v.normal[2]);
+                    glm::fvec3 outN = n + 2.0f * glm::cross(rv, glm::cross(rv, n) + r[3] * n);
+                    storeNormal(_args.normals + 3 * i, outN.x, outN.y, outN.z);
+                }
+            }
+        }
+
+#ifdef POSE_KERNEL_X86
+
+        // One vertex per iteration, one matrix column per register
+        inline void skinSse(const SkinArgs &_args, size_t _begin, size_t _end) {
+            float weight[SCENE_RESOURCE_BONE_PER_VERTEX];
+            float out[4];
+            for (size_t i = _begin; i < _end; i++) {
+                const ParametricVertex &v = _args.vertices[i];
+                if (!normalizedWeights(_args, v, weight)) {
+                    copyBindPose(_args, i);
+                    continue;
+                }
+                __m128 c0 = _mm_setzero_ps(), c1 = _mm_setzero_ps(), c2 = _mm_setzero_ps(), c3 = _mm_setzero_ps();
+                for (int b = 0; b < SCENE_RESOURCE_BONE_PER_VERTEX; b++) {
+                    if (weight[b] == 0.0f) continue;
+                    const float *bone = _args.boneTransf + 16 * v.boneId[b];
+                    __m128 w = _mm_set1_ps(weight[b]);
+                    c0 = _mm_add_ps(c0, _mm_mul_ps(_mm_loadu_ps(bone), w));
+                    c1 = _mm_add_ps(c1, _mm_mul_ps(_mm_loadu_ps(bone + 4), w));
+                    c2 = _mm_add_ps(c2, _mm_mul_ps(_mm_loadu_ps(bone + 8), w));
+                    c3 = _mm_add_ps(c3, _mm_mul_ps(_mm_loadu_ps(bone + 12), w));
+                }
+                const float *p = v.position;
+                __m128 pos = _mm_add_ps(_mm_mul_ps(c0, _mm_set1_ps(p[0])), _mm_mul_ps(c1, _mm_set1_ps(p[1])));
+                pos = _mm_add_ps(pos, _mm_add_ps(_mm_mul_ps(c2, _mm_set1_ps(p[2])), c3));
+                _mm_storeu_ps(out, pos);
+                memcpy(_args.positions + 3 * i, out, 3 * sizeof(float));
+                if (_args.normals != NULL) {
+                    const float *n = v.normal;
+                    __m128 nrm = _mm_add_ps(_mm_mul_ps(c0, _mm_set1_ps(n[0])), _mm_mul_ps(c1, _mm_set1_ps(n[1])));
+                    nrm = _mm_add_ps(nrm, _mm_mul_ps(c2, _mm_set1_ps(n[2])));
+                    _mm_storeu_ps(out, nrm);
+                    storeNormal(_args.normals + 3 * i, out[0], out[1], out[2]);
+                }
+            }
+        }
+
+        POSE_KERNEL_TARGET_AVX2 inline __m256 lanes(__m128 _lo, __m128 _hi) {
+            return _mm256_insertf128_ps(_mm256_castps128_ps256(_lo), _hi, 1);
+        }
+
+        // Two vertices per iteration: the low 128-bit lane blends the first vertex, the high lane the second
+        POSE_KERNEL_TARGET_AVX2 inline void skinAvx2(const SkinArgs &_args, size_t _begin, size_t _end) {
+            float weight[2][SCENE_RESOURCE_BONE_PER_VERTEX];
+            bool skinned[2];
+            float out[8];
+            size_t i = _begin;
+            for (; i + 1 < _end; i += 2) {
+                const ParametricVertex *v[2] = {&_args.vertices[i], &_args.vertices[i + 1]};
+                skinned[0] = normalizedWeights(_args, *v[0], weight[0]);
+                skinned[1] = normalizedWeights(_args, *v[1], weight[1]);
+                if (!skinned[0] || !skinned[1]) {
+                    skinSse(_args, i, i + 2);
+                    continue;
+                }
+                __m256 c0 = _mm256_setzero_ps(), c1 = _mm256_setzero_ps();
+                __m256 c2 = _mm256_setzero_ps(), c3 = _mm256_setzero_ps();
+                for (int b = 0; b < SCENE_RESOURCE_BONE_PER_VERTEX; b++) {
+                    // A zero weight reads bone 0 or a valid bone and contributes nothing
+                    const float *lo = _args.boneTransf + 16 * (weight[0][b] != 0.0f ? v[0]->boneId[b] : 0);
+                    const float *hi = _args.boneTransf + 16 * (weight[1][b] != 0.0f ? v[1]->boneId[b] : 0);
+                    __m256 w = lanes(_mm_set1_ps(weight[0][b]), _mm_set1_ps(weight[1][b]));
+                    c0 = _mm256_fmadd_ps(lanes(_mm_loadu_ps(lo), _mm_loadu_ps(hi)), w, c0);
+                    c1 = _mm256_fmadd_ps(lanes(_mm_loadu_ps(lo + 4), _mm_loadu_ps(hi + 4)), w, c1);
+                    c2 = _mm256_fmadd_ps(lanes(_mm_loadu_ps(lo + 8), _mm_loadu_ps(hi + 8)), w, c2);
+                    c3 = _mm256_fmadd_ps(lanes(_mm_loadu_ps(lo + 12), _mm_loadu_ps(hi + 12)), w, c3);
+                }
+                const float *p0 = v[0]->position, *p1 = v[1]->position;
+                __m256 pos = _mm256_fmadd_ps(c0, lanes(_mm_set1_ps(p0[0]), _mm_set1_ps(p1[0])), c3);
+                pos = _mm256_fmadd_ps(c1, lanes(_mm_set1_ps(p0[1]), _mm_set1_ps(p1[1])), pos);
+                pos = _mm256_fmadd_ps(c2, lanes(_mm_set1_ps(p0[2]), _mm_set1_ps(p1[2])), pos);
+                _mm256_storeu_ps(out, pos);
+                memcpy(_args.positions + 3 * i, out, 3 * sizeof(float));
+                memcpy(_args.positions + 3 * i + 3, out + 4, 3 * sizeof(float));
+                if (_args.normals != NULL) {
+                    const float *n0 = v[0]->normal, *n1 = v[1]->normal;
+                    __m256 nrm = _mm256_mul_ps(c0, lanes(_mm_set1_ps(n0[0]), _mm_set1_ps(n1[0])));
+                    nrm = _mm256_fmadd_ps(c1, lanes(_mm_set1_ps(n0[1]), _mm_set1_ps(n1[1])), nrm);
+                    nrm = _mm256_fmadd_ps(c2, lanes(_mm_set1_ps(n0[2]), _mm_set1_ps(n1[2])), nrm);
+                    _mm256_storeu_ps(out, nrm);
+                    storeNormal(_args.normals + 3 * i, out[0], out[1], out[2]);
+                    storeNormal(_args.normals + 3 * i + 3, out[4], out[5], out[6]);
+                }
+            }
+            if (i < _end) skinSse(_args, i, _end);
+        }
+
+#endif // POSE_KERNEL_X86
+
+        inline std::vector<const Kernel *> detectKernels() {
+            std::vector<const Kernel *> kernels;
+            static const Kernel scalar = {"scalar", &skinScalar};
+            kernels.push_back(&scalar);
+#ifdef POSE_KERNEL_X86
+            static const Kernel sse = {"sse", &skinSse};
+            kernels.push_back(&sse);
+            if (PoseKernel::cpuSupportsAvx2()) {
+                static const Kernel avx2 = {"avx2", &skinAvx2};
+                kernels.push_back(&avx2);
+            }
+#endif
+            return kernels;
+        }
+
+        // Every kernel usable on this CPU, best last
+        inline const std::vector<const Kernel *> &availableKernels() {
+            static const std::vector<const Kernel *> kernels = detectKernels();
+            return kernels;
+        }
+
+        // Best kernel for this CPU, or the one named by HAND_SKIN_KERNEL if it is available
+        inline const Kernel &selectKernel() {
+            const std::vector<const Kernel *> &kernels = availableKernels();
+            const char *forced = getenv("HAND_SKIN_KERNEL");
+            if (forced != NULL) {
+                for (size_t i = 0; i < kernels.size(); i++) {
+                    if (strcmp(kernels[i]->name, forced) == 0) return *kernels[i];
+                }
+            }
+            return *kernels.back();
+        }
+
+        inline const Kernel &activeKernel() {
+            static const Kernel &kernel = selectKernel();
+            return kernel;
+        }
+
+        inline const Kernel &dualQuatKernel() {
+            static const Kernel kernel = {"dual-quat", &skinDualQuat};
+            return kernel;
+        }
+    }
+
+    // Skins whole vertex streams, splitting them into ranges over an optional job system.
+    // _kernel is the linear-blend kernel, dual-quaternion skinning always uses SkinKernel::dualQuatKernel().
+    class CpuSkinner {
+    public:
+        explicit CpuSkinner(Parallel::JobSystem *_jobs = NULL,
+                            const SkinKernel::Kernel &_kernel = SkinKernel::activeKernel())
+                : jobs(_jobs), kernel(&_kernel) {}
+
+        const SkinKernel::Kernel &getKernel() const { return *kernel; }
+
+        // _positions (and _normals, if not NULL) must hold 3 * _vertexNum floats
+        void skin(const ParametricVertex *_vertices, size_t _vertexNum,
+                  const glm::fmat4 *_boneTransf, size_t _boneNum,
+                  float *_positions, float *_normals = NULL) const {
+            SkinKernel::SkinArgs args;
+            args.vertices = _vertices;
+            args.boneTransf = (const float *) _boneTransf;
+            args.boneDualQuat = NULL;
+            args.boneNum = (unsigned int) _boneNum;
+            args.positions = _positions;
+            args.normals = _normals;
+            run(*kernel, args, _vertexNum);
+        }
+
+        void skin(const ParametricVertex *_vertices, size_t _vertexNum, const SceneBaker::SkeletonTransf &_boneTransf,
+                  float *_positions, float *_normals = NULL) const {
+            skin(_vertices, _vertexNum, _boneTransf.data(), _boneTransf.size(), _positions, _normals);
+        }
+
+        void skinDualQuat(const ParametricVertex *_vertices, size_t _vertexNum,
+                          const DualQuat *_boneDualQuat, size_t _boneNum,
+                          float *_positions, float *_normals = NULL) const {
+            SkinKernel::SkinArgs args;
+            args.vertices = _vertices;
+            args.boneTransf = NULL;
+            args.boneDualQuat = _boneDualQuat;
+            args.boneNum = (unsigned int) _boneNum;
+            args.positions = _positions;
+            args.normals = _normals;
+            run(SkinKernel::dualQuatKernel(), args, _vertexNum);
+        }
+
+        void skinDualQuat(const ParametricVertex *_vertices, size_t _vertexNum, const SkeletonDualQuat &_boneDualQuat,
+                          float *_positions, float *_normals = NULL) const {
+            skinDualQuat(_vertices, _vertexNum, _boneDualQuat.data(), _boneDualQuat.size(), _positions, _normals);
+        }
+
+    private:
+        Parallel::JobSystem *jobs;
+        const SkinKernel::Kernel *kernel;
+
+        void run(const SkinKernel::Kernel &_kernel, const SkinKernel::SkinArgs &_args, size_t _vertexNum) const {
+            if (jobs == NULL) {
+                _kernel.skin(_args, 0, _vertexNum);
+                return;
+            }
+            SkinKernel::SkinFunc skinFunc = _kernel.skin;
+            jobs->parallelFor(_vertexNum, CPU_SKINNING_GRAIN,
+                              [&_args, skinFunc](size_t _begin, size_t _end, size_t _thread) {
+                                  skinFunc(_args, _begin, _end);
+                              });
+        }
+    };
+}
@@ -0,0 +1,108 @@
+// Instanced Crowd Buffer
+// Model matrices and bone palettes of many instances of one scene, streamed through a texture
+// buffer ring so a whole crowd is drawn with one instanced call per mesh.
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <cstring>
+#include <algorithm>
+
+#include "gl_env.h"
+
+#include "buffer_ring.h"
+
+#include <glm/glm.hpp>
+
+#define CROWD_SHADER_INSTANCE_CHANNEL 1
+
+namespace SkeletalMesh {
+    // Per instance the buffer holds (1 + boneNum) column-major mat4, one RGBA32F texel per column:
+    // the model matrix first, then the bone palette. Instance i starts at texel
+    // getTexelBase() + 4 * i * (1 + boneNum) of the region last uploaded.
+    class CrowdBuffer {
+    public:
+        CrowdBuffer() : instanceNum(0), boneNum(0) {}
+
+        ~CrowdBuffer() { clear(); }
+
+        void clear() {
+            ring.release();
+            staging.clear();
+            instanceNum = 0;
+            boneNum = 0;
+        }
+
+        // Allocates the CPU staging area; the ring is (re)created on the next upload()
+        void resize(size_t _instanceNum, size_t _boneNum) {
+            instanceNum = _instanceNum;
+            boneNum = _boneNum;
+            staging.assign(instanceNum * instanceStride(), glm::fmat4(1.0f));
+        }
+
+        size_t getInstanceNum() const { return instanceNum; }
+
+        size_t getBoneNum() const { return boneNum; }
+
+        // Matrices per instance, model matrix included
+        size_t instanceStride() const { return boneNum + 1; }
+
+        // Bones beyond getBoneNum() are dropped, missing ones keep their previous value
+        void setInstance(size_t _instance, const glm::fmat4 &_model, const std::vector<glm::fmat4> &_boneTransf) {
+            if (_instance >= instanceNum) return;
+            glm::fmat4 *slot = &staging[_instance * instanceStride()];
+            slot[0] = _model;
+            size_t copyNum = std::min(_boneTransf.size(), boneNum);
+            if (copyNum > 0) memcpy(slot + 1, _boneTransf.data(), copyNum * sizeof(glm::fmat4));
+        }
+
+        glm::fmat4 *instanceBones(size_t _instance) { return &staging[_instance * instanceStride() + 1]; }
+
+        void setModel(size_t _instance, const glm::fmat4 &_model) {
+            if (_instance < instanceNum) staging[_instance * instanceStride()] = _model;
+        }
+
+        // Copies the staging area into the next region of the ring, which the GPU no longer reads.
+        // With _order, slot i of the region receives instance _order[i], so instances sharing a draw
+        // (one LOD, say) can be made contiguous; the shader offsets gl_InstanceID to reach them.
+        void upload(const uint32_t *_order = NULL) {
+            if (!staging.empty()) upload(staging.data(), _order);
+        }
+
+        // Same from matrices laid out like the staging area, filled by another thread say
+        void upload(const glm::fmat4 *_source, const uint32_t *_order) {
+            size_t bytes = instanceNum * instanceStride() * sizeof(glm::fmat4);
+            if (bytes == 0) return;
+            if (ring.getRegionBytes() < bytes && !ring.create(bytes)) return;
+            glm::fmat4 *mapped = (glm::fmat4 *) ring.begin();
+            if (mapped == NULL) return;
+            if (_order == NULL) {
+                memcpy(mapped, _source, bytes);
+            } else {
+                size_t stride = instanceStride();
+                for (size_t i = 0; i < instanceNum; i++)
+                    memcpy(mapped + i * stride, _source + _order[i] * stride, stride * sizeof(glm::fmat4));
+            }
+            ring.flush();
+        }
+
+        GLint getTexelBase() const { return ring.texelOffset(); }
+
+        // Call after the last draw reading the uploaded region
+        void fence() { ring.fence(); }
+
+        bool bind(GLenum _channel) const { return ring.bind(_channel); }
+
+    private:
+        size_t instanceNum;
+        size_t boneNum;
+        TexelRing ring;
+        std::vector<glm::fmat4> staging;
+
+        // Forbid copying GL objects
+        CrowdBuffer(const CrowdBuffer &_copy);
+
+        CrowdBuffer &operator=(const CrowdBuffer &_copy);
+    };
+}
@@ -0,0 +1,74 @@
+// Dual Quaternion Bone Palette
+// Rigid bone transforms as unit dual quaternions (8 floats instead of a mat4),
+// the palette format of dual-quaternion skinning.
+
+#pragma once
+
+#include <cmath>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+namespace SkeletalMesh {
+    // real is the rotation, dual = 0.5 * translation * real. Both are stored (x, y, z, w),
+    // so one DualQuat is exactly one mat2x4 of the shader palette (column 0 real, column 1 dual).
+    struct DualQuat {
+        float real[4];
+        float dual[4];
+
+        // Scale and shear cannot be represented and are dropped
+        static DualQuat fromMatrix(const glm::fmat4 &_m) {
+            glm::fvec3 x = glm::normalize(glm::fvec3(_m[0]));
+            glm::fvec3 y = glm::normalize(glm::fvec3(_m[1]));
+            glm::fvec3 z = glm::normalize(glm::fvec3(_m[2]));
+
+            DualQuat dq;
+            float *q = dq.real;
+            float trace = x.x + y.y + z.z;
+            if (trace > 0.0f) {
+                float s = std::sqrt(trace + 1.0f) * 2.0f;
+                q[3] = 0.25f * s;
+                q[0] = (y.z - z.y) / s;
+                q[1] = (z.x - x.z) / s;
+                q[2] = (x.y - y.x) / s;
+            } else if (x.x > y.y && x.x > z.z) {
+                float s = std::sqrt(1.0f + x.x - y.y - z.z) * 2.0f;
+                q[3] = (y.z - z.y) / s;
+                q[0] = 0.25f * s;
+                q[1] = (y.x + x.y) / s;
+                q[2] = (z.x + x.z) / s;
+            } else if (y.y > z.z) {
+                float s = std::sqrt(1.0f + y.y - x.x - z.z) * 2.0f;
+                q[3] = (z.x - x.z) / s;
+                q[0] = (y.x + x.y) / s;
+                q[1] = 0.25f * s;
+                q[2] = (z.y + y.z) / s;
+            } else {
+                float s = std::sqrt(1.0f + z.z - x.x - y.y) * 2.0f;
+                q[3] = (x.y - y.x) / s;
+                q[0] = (z.x + x.z) / s;
+                q[1] = (z.y + y.z) / s;
+                q[2] = 0.25f * s;
+            }
+            float len = std::sqrt(q[0] * q[0] + q[1] * q[1] + q[2] * q[2] + q[3] * q[3]);
+            for (int i = 0; i < 4; i++)
+                q[i] /= len;
+
+            glm::fvec3 t(_m[3]);
+            dq.dual[0] = 0.5f * (t.x * q[3] + t.y * q[2] - t.z * q[1]);
+            dq.dual[1] = 0.5f * (t.y * q[3] + t.z * q[0] - t.x * q[2]);
+            dq.dual[2] = 0.5f * (t.z * q[3] + t.x * q[1] - t.y * q[0]);
+            dq.dual[3] = -0.5f * (t.x * q[0] + t.y * q[1] + t.z * q[2]);
+            return dq;
+        }
+    };
+
+    typedef std::vector<DualQuat> SkeletonDualQuat;
+
+    // Converts a bone palette such as Scene::SkeletonTransf, reusing _out's storage
+    inline void toDualQuat(const std::vector<glm::fmat4> &_boneTransf, SkeletonDualQuat &_out) {
+        _out.resize(_boneTransf.size());
+        for (size_t i = 0; i < _boneTransf.size(); i++)
+            _out[i] = DualQuat::fromMatrix(_boneTransf[i]);
+    }
+}
@@ -0,0 +1,36 @@
+// File Utilities
+// Small helpers shared by the on-disk formats (baked scenes, compressed clips, input traces).
+
+#pragma once
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#ifndef _WIN32
+
+#include <unistd.h>
+
+#endif
+
+namespace FileUtil {
+    // Writes to a temporary file first so a crashed or concurrent writer never leaves a torn file behind
+    inline bool writeFile(const std::string &_filename, const std::vector<char> &_blob) {
+        std::string tmpFilename = _filename + ".tmp";
+#ifndef _WIN32
+        tmpFilename += std::to_string((long long) getpid());
+#endif
+        FILE *fo = fopen(tmpFilename.c_str(), "wb");
+        if (fo == NULL) return false;
+        bool written = fwrite(_blob.data(), 1, _blob.size(), fo) == _blob.size();
+        written = (fclose(fo) == 0) && written;
+        if (written) {
+#ifdef _WIN32
+            remove(_filename.c_str());
+#endif
+            written = rename(tmpFilename.c_str(), _filename.c_str()) == 0;
+        }
+        if (!written) remove(tmpFilename.c_str());
+        return written;
+    }
+}
@@ -0,0 +1,164 @@
+// Frame Clock
+// Fixed-rate simulation steps decoupled from rendering, and a frame pacer that sleeps to a target
+// rate instead of spinning. Both work on plain seconds, so they need neither a window nor GL.
+
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <chrono>
+#include <thread>
+#include <algorithm>
+
+#include "frame_history.h"
+
+#define FRAME_CLOCK_MAX_STEPS 8
+// Length of the sleeps the pacer measures; the last stretch before a deadline is yielded away
+#define FRAME_CLOCK_SLEEP_QUANTUM_MS 1.0
+#define FRAME_CLOCK_INITIAL_SLEEP_MS 2.0
+
+namespace Pacing {
+    typedef Profiling::Clock Clock;
+
+    inline double elapsed_ms(Clock::time_point _from, Clock::time_point _to) {
+        return std::chrono::duration<double, std::milli>(_to - _from).count();
+    }
+
+    // Accumulates wall time and hands it out in steps of 1 / rate seconds. Rendering shows the state
+    // between the last two steps, alpha() of the way from the previous one to the latest.
+    class FixedStep {
+    public:
+        explicit FixedStep(double _rate = 60.0, int _maxSteps = FRAME_CLOCK_MAX_STEPS)
+                : step(1.0 / _rate), maxSteps(_maxSteps), accumulator(0.0), stepNum(0), droppedSeconds(0.0),
+                  lastSteps(0) {}
+
+        void setRate(double _rate) {
+            if (_rate > 0.0) step = 1.0 / _rate;
+        }
+
+        double getRate() const { return 1.0 / step; }
+
+        double getStep() const { return step; }
+
+        // Adds _seconds of wall time and returns how many steps to run now. At most _maxSteps run per
+        // call; time beyond that is dropped, so a long stall slows the simulation down instead of
+        // making every following frame catch up.
+        int advance(double _seconds) {
+            accumulator += std::max(_seconds, 0.0);
+            int steps = (int) std::floor(accumulator / step);
+            if (steps > maxSteps) {
+                droppedSeconds += (steps - maxSteps) * step;
+                steps = maxSteps;
+            }
+            accumulator -= std::floor(accumulator / step) * step;
+            stepNum += (uint64_t) steps;
+            lastSteps = steps;
+            return steps;
+        }
+
+        // Fraction of a step accumulated since the latest one, in [0, 1)
+        double alpha() const { return accumulator / step; }
+
+        // Simulated time of the latest step
+        double time() const { return stepNum * step; }
+
+        // Time at which the display samples the simulation: the previous step plus alpha() of one.
+        // Lags the wall clock by one step, which is what makes interpolation possible.
+        double displayTime() const { return std::max(time() - step + accumulator, 0.0); }
+
+        uint64_t getStepNum() const { return stepNum; }
+
+        int getLastSteps() const { return lastSteps; }
+
+        double getDroppedSeconds() const { return droppedSeconds; }
+
+    private:
+        double step;
+        int maxSteps;
+        double accumulator;
+        uint64_t stepNum;
+        double droppedSeconds;
+        int lastSteps;
+    };
+
+    // Call wait() once per frame, after the swap. It returns at the next deadline of the target rate,
+    // sleeping while the remaining time exceeds what one sleep is observed to take and yielding for the
+    // rest. A frame that misses its deadline resets the schedule rather than rushing the next ones.
+    class FramePacer {
+    public:
+        FramePacer()
+                : targetMs(0.0), sleepMean(FRAME_CLOCK_INITIAL_SLEEP_MS), sleepM2(0.0), sleepNum(1),
+                  started(false) {}
+
+        // 0 disables the limiter; wait() then only measures
+        void setTargetRate(double _rate) {
+            targetMs = _rate > 0.0 ? 1000.0 / _rate : 0.0;
+            started = false;
+        }
+
+        double getTargetRate() const { return targetMs > 0.0 ? 1000.0 / targetMs : 0.0; }
+
+        void wait() {
+            Clock::time_point now = Clock::now();
+            if (!started) {
+                started = true;
+                deadline = now;
+                lastWake = now;
+                return;
+            }
+            if (targetMs > 0.0) {
+                deadline += std::chrono::duration_cast<Clock::duration>(
+                        std::chrono::duration<double, std::milli>(targetMs));
+                if (deadline < now) deadline = now;
+                sleepUntil(deadline);
+            }
+            Clock::time_point wake = Clock::now();
+            float intervalMs = (float) elapsed_ms(lastWake, wake);
+            interval.push(intervalMs);
+            if (targetMs > 0.0) {
+                jitter.push((float) std::abs(intervalMs - targetMs));
+                lateness.push((float) std::max(elapsed_ms(deadline, wake), 0.0));
+            }
+            lastWake = wake;
+        }
+
+        // Time between consecutive returns of wait()
+        const Profiling::History &getIntervalHistory() const { return interval; }
+
+        // |interval - target| per frame, empty while the limiter is off
+        const Profiling::History &getJitterHistory() const { return jitter; }
+
+        // How late wait() returned after its deadline
+        const Profiling::History &getLatenessHistory() const { return lateness; }
+
+        // Estimated duration of one FRAME_CLOCK_SLEEP_QUANTUM_MS sleep, mean plus one standard deviation
+        double sleepEstimateMs() const { return sleepMean + std::sqrt(sleepM2 / sleepNum); }
+
+    private:
+        double targetMs;
+        // Welford's running mean and variance of the measured sleeps
+        double sleepMean;
+        double sleepM2;
+        uint64_t sleepNum;
+        bool started;
+        Clock::time_point deadline;
+        Clock::time_point lastWake;
+        Profiling::History interval;
+        Profiling::History jitter;
+        Profiling::History lateness;
+
+        void sleepUntil(Clock::time_point _deadline) {
+            while (elapsed_ms(Clock::now(), _deadline) > sleepEstimateMs()) {
+                Clock::time_point start = Clock::now();
+                std::this_thread::sleep_for(std::chrono::microseconds((int64_t) (FRAME_CLOCK_SLEEP_QUANTUM_MS * 1000)));
+                double sleptMs = elapsed_ms(start, Clock::now());
+                sleepNum++;
+                double delta = sleptMs - sleepMean;
+                sleepMean += delta / sleepNum;
+                sleepM2 += delta * (sleptMs - sleepMean);
+            }
+            while (Clock::now() < _deadline)
+                std::this_thread::yield();
+        }
+    };
+}
@@ -0,0 +1,77 @@
+// Frame History
+// Rolling window of per-frame millisecond samples and the clock they are taken with. Plain CPU code, so
+// the pacer and headless tools can keep histories without the GL side of the profiler.
+
+#pragma once
+
+#include <chrono>
+#include <vector>
+#include <algorithm>
+
+#define FRAME_PROFILER_HISTORY 240
+#define FRAME_PROFILER_BIN_NUM 32
+
+namespace Profiling {
+    typedef std::chrono::steady_clock Clock;
+
+    // The last FRAME_PROFILER_HISTORY samples in milliseconds
+    class History {
+    public:
+        History() : values(FRAME_PROFILER_HISTORY, 0.0f), next(0), count(0) {}
+
+        void push(float _ms) {
+            values[next] = _ms;
+            next = (next + 1) % values.size();
+            count = std::min(count + 1, values.size());
+        }
+
+        size_t size() const { return count; }
+
+        // Ring storage and the index of the oldest sample, as ImGui::PlotLines() takes them
+        const float *data() const { return values.data(); }
+
+        size_t offset() const { return count < values.size() ? 0 : next; }
+
+        // i-th sample, oldest first
+        float at(size_t _i) const { return values[(offset() + _i) % values.size()]; }
+
+        float average() const {
+            if (count == 0) return 0.0f;
+            double sum = 0.0;
+            for (size_t i = 0; i < count; i++)
+                sum += values[i];
+            return (float) (sum / count);
+        }
+
+        float maximum() const {
+            float maxMs = 0.0f;
+            for (size_t i = 0; i < count; i++)
+                maxMs = std::max(maxMs, values[i]);
+            return maxMs;
+        }
+
+        // _fraction in [0, 1], e.g. 0.95f for the 95th percentile
+        float percentile(float _fraction) const {
+            if (count == 0) return 0.0f;
+            std::vector<float> sorted(values.begin(), values.begin() + count);
+            size_t rank = std::min(count - 1, (size_t) (_fraction * (count - 1) + 0.5f));
+            std::nth_element(sorted.begin(), sorted.begin() + rank, sorted.end());
+            return sorted[rank];
+        }
+
+        // Sample counts of FRAME_PROFILER_BIN_NUM equal bins over [0, _maxMs]; larger samples go to the last bin
+        void histogram(float _maxMs, float *_bins) const {
+            std::fill(_bins, _bins + FRAME_PROFILER_BIN_NUM, 0.0f);
+            if (_maxMs <= 0.0f) return;
+            for (size_t i = 0; i < count; i++) {
+                int bin = (int) (values[i] / _maxMs * FRAME_PROFILER_BIN_NUM);
+                _bins[std::min(std::max(bin, 0), FRAME_PROFILER_BIN_NUM - 1)] += 1.0f;
+            }
+        }
+
+    private:
+        std::vector<float> values;
+        size_t next;
+        size_t count;
+    };
+}
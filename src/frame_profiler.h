@@ -0,0 +1,128 @@
+// Frame Profiler
+// Optional GL timestamp queries on top of the per-stage CPU timers and traces of cpu_profiler.h.
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "gl_env.h"
+
+#include "cpu_profiler.h"
+
+#define FRAME_PROFILER_GPU_LATENCY 4
+
+namespace Profiling {
+    // CpuProfiler with GL timing: it brackets every scope with two GL_TIMESTAMP queries
+    // and reads them FRAME_PROFILER_GPU_LATENCY frames later, so it never stalls the pipeline.
+    class FrameProfiler : public CpuProfiler {
+    public:
+        typedef StageScope<FrameProfiler> Scope;
+
+        FrameProfiler() : slots(), gpuTiming(false) {}
+
+        ~FrameProfiler() { release(); }
+
+        // Deletes the GL queries; needs the context that created them
+        void release() {
+            for (size_t i = 0; i < slots.size(); i++) {
+                if (!slots[i].queries.empty())
+                    glDeleteQueries((GLsizei) slots[i].queries.size(), slots[i].queries.data());
+            }
+            slots.clear();
+            gpuTiming = false;
+        }
+
+        // Timer queries are core since OpenGL 3.3
+        void setGpuTiming(bool _enabled) {
+            if (_enabled == gpuTiming) return;
+            if (!_enabled) release();
+            else slots.resize(FRAME_PROFILER_GPU_LATENCY);
+            gpuTiming = _enabled;
+        }
+
+        bool getGpuTiming() const { return gpuTiming; }
+
+        void beginFrame() {
+            if (gpuTiming) collect(slots[getFrameIndex() % slots.size()]);
+            CpuProfiler::beginFrame();
+        }
+
+        void beginStage(StageId _stage) {
+            CpuProfiler::beginStage(_stage);
+            if (!inFrame || !gpuTiming) return;
+            GpuSlot &slot = slots[getFrameIndex() % slots.size()];
+            GpuInterval interval;
+            interval.stage = _stage;
+            interval.beginQuery = acquireQuery(slot);
+            interval.endQuery = 0;
+            glQueryCounter(interval.beginQuery, GL_TIMESTAMP);
+            slot.intervals.push_back(interval);
+        }
+
+        void endStage(StageId _stage) {
+            CpuProfiler::endStage(_stage);
+            if (!inFrame || !gpuTiming) return;
+            GpuSlot &slot = slots[getFrameIndex() % slots.size()];
+            for (size_t i = slot.intervals.size(); i-- > 0;) {
+                GpuInterval &interval = slot.intervals[i];
+                if (interval.stage != _stage || interval.endQuery != 0) continue;
+                interval.endQuery = acquireQuery(slot);
+                glQueryCounter(interval.endQuery, GL_TIMESTAMP);
+                break;
+            }
+        }
+
+    private:
+        struct GpuInterval {
+            StageId stage;
+            GLuint beginQuery;
+            GLuint endQuery;
+        };
+
+        // Queries of one frame in flight; the pool only grows
+        struct GpuSlot {
+            uint64_t frame;
+            std::vector<GLuint> queries;
+            size_t usedNum;
+            std::vector<GpuInterval> intervals;
+
+            GpuSlot() : frame(0), queries(), usedNum(0), intervals() {}
+        };
+
+        std::vector<GpuSlot> slots;
+        bool gpuTiming;
+
+        GLuint acquireQuery(GpuSlot &_slot) {
+            if (_slot.usedNum == _slot.queries.size()) {
+                GLuint query = 0;
+                glGenQueries(1, &query);
+                _slot.queries.push_back(query);
+            }
+            return _slot.queries[_slot.usedNum++];
+        }
+
+        // Reads the results of the frame that last used this slot, then hands the slot to the current frame
+        void collect(GpuSlot &_slot) {
+            if (!_slot.intervals.empty()) {
+                size_t stageNum = getStageNum();
+                std::vector<float> gpuMs(stageNum, 0.0f);
+                std::vector<bool> measured(stageNum, false);
+                for (size_t i = 0; i < _slot.intervals.size(); i++) {
+                    const GpuInterval &interval = _slot.intervals[i];
+                    if (interval.endQuery == 0) continue;
+                    GLuint64 begin = 0, end = 0;
+                    glGetQueryObjectui64v(interval.beginQuery, GL_QUERY_RESULT, &begin);
+                    glGetQueryObjectui64v(interval.endQuery, GL_QUERY_RESULT, &end);
+                    gpuMs[interval.stage] += end > begin ? (float) ((end - begin) / 1e6) : 0.0f;
+                    measured[interval.stage] = true;
+                }
+                for (size_t s = 0; s < stageNum; s++)
+                    if (measured[s]) recordGpu(_slot.frame, (StageId) s, gpuMs[s]);
+            }
+            _slot.intervals.clear();
+            _slot.usedNum = 0;
+            _slot.frame = getFrameIndex();
+        }
+    };
+}
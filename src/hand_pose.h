@@ -0,0 +1,129 @@
+// Hand Pose Presets
+// Procedural poses of the Hand rig, written into a PoseBuffer through a HandRig::Binding.
+
+#pragma once
+
+#include <cmath>
+
+#include "skeleton.h"
+#include "hand_rig.h"
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#ifndef M_PI
+#define M_PI (3.1415926535897932)
+#endif
+
+namespace HandPose {
+    inline void finger_move_clear(SkeletalMesh::PoseBuffer &pose) {
+        pose.reset();
+    }
+
+    inline void finger_move(SkeletalMesh::PoseBuffer &pose, const HandRig::Binding &rig,
+                            HandRig::Finger finger, float time_in_period, float period,
+                            float proximal_frac, float intermediate_frac,
+                            float distal_frac, float fingertip_frac) {
+        const SkeletalMesh::BoneId *bone = rig.finger[finger];
+        float swing = std::abs(time_in_period / (period * 0.5f) - 1.0f);
+
+        if (proximal_frac != 0.0) {
+            float proximal_angle = swing * (M_PI / proximal_frac);
+            pose.set(bone[HandRig::Proximal], glm::rotate(
+                    glm::identity<glm::mat4>(), proximal_angle, glm::fvec3(0.0, 0.0, 1.0)));
+        }
+
+        if (intermediate_frac != 0.0) {
+            float intermediate_angle = swing * (M_PI / intermediate_frac);
+            pose.set(bone[HandRig::Intermediate], glm::rotate(
+                    glm::identity<glm::mat4>(), intermediate_angle, glm::fvec3(0.0, 0.0, 1.0)));
+        }
+
+        if (distal_frac != 0.0) {
+            float distal_angle = swing * (M_PI / distal_frac);
+            pose.set(bone[HandRig::Distal], glm::rotate(
+                    glm::identity<glm::mat4>(), distal_angle, glm::fvec3(0.0, 0.0, 1.0)));
+        }
+
+        if (fingertip_frac != 0.0) {
+            float fingertip_angle = swing * (M_PI / fingertip_frac);
+            pose.set(bone[HandRig::Fingertip], glm::rotate(
+                    glm::identity<glm::mat4>(), fingertip_angle, glm::fvec3(0.0, 0.0, 1.0)));
+        }
+    }
+
+    // Completion 1: grabing with 5 fingers
+    inline void completion_1(SkeletalMesh::PoseBuffer &pose, const HandRig::Binding &rig, float passed_time) {
+        float period = 2.4f;
+        float time_in_period = fmod(passed_time, period);
+
+        finger_move_clear(pose);
+        finger_move(pose, rig, HandRig::Thumb, time_in_period, period, 6.0, 12.0, 12.0, 0.0);
+        finger_move(pose, rig, HandRig::Index, time_in_period, period, 3.0, 3.0, 2.0, 0.0);
+        finger_move(pose, rig, HandRig::Middle, time_in_period, period, 3.0, 3.0, 2.0, 0.0);
+        finger_move(pose, rig, HandRig::Ring, time_in_period, period, 3.0, 3.0, 2.0, 0.0);
+        finger_move(pose, rig, HandRig::Pinky, time_in_period, period, 3.0, 3.0, 2.0, 0.0);
+    }
+
+    // Completion 2: OK
+    inline void completion_2(SkeletalMesh::PoseBuffer &pose, const HandRig::Binding &rig, float passed_time) {
+        float period = 2.4f;
+        float time_in_period = fmod(passed_time, period);
+
+        finger_move_clear(pose);
+        finger_move(pose, rig, HandRig::Thumb, time_in_period, period, 6.0, 12.0, 12.0, 12.0);
+        finger_move(pose, rig, HandRig::Index, time_in_period, period, 6.0, 6.0, 2.0, 0.0);
+    }
+
+    inline void completion_3(SkeletalMesh::PoseBuffer &pose, const HandRig::Binding &rig, float passed_time) {
+        finger_move_clear(pose);
+        float period = 2.4f;
+        float time_in_period = fmod(passed_time, period);
+
+        float metacarpals_angle = std::abs(time_in_period / (period * 0.5f) - 1.0f) * (M_PI / 2.3f);
+        // * target = metacarpals
+        // * rotation axis = (1, 0, 0)
+        pose.set(rig.metacarpals, glm::rotate(glm::identity<glm::mat4>(), metacarpals_angle, glm::fvec3(0.0, 1.0, 0.0)));
+
+        finger_move(pose, rig, HandRig::Thumb, time_in_period, period, 0.0, -6.0, -4.0, 0.0);
+        finger_move(pose, rig, HandRig::Index, time_in_period, period, 3.0, 3.0, 2.0, 0.0);
+        finger_move(pose, rig, HandRig::Middle, time_in_period, period, 3.0, 3.0, 2.0, 0.0);
+        finger_move(pose, rig, HandRig::Ring, time_in_period, period, 3.0, 3.0, 2.0, 0.0);
+        finger_move(pose, rig, HandRig::Pinky, time_in_period, period, 3.0, 3.0, 2.0, 0.0);
+    }
+
+    inline void default_rotate(SkeletalMesh::PoseBuffer &pose, const HandRig::Binding &rig, float passed_time) {
+        finger_move_clear(pose);
+        float metacarpals_angle = passed_time * (M_PI / 4.0f);
+        pose.set(rig.metacarpals, glm::rotate(glm::identity<glm::mat4>(), metacarpals_angle, glm::fvec3(1.0, 0.0, 0.0)));
+    }
+
+    inline void km_finger_move(SkeletalMesh::PoseBuffer &pose, const HandRig::Binding &rig,
+                               HandRig::Finger finger,
+                               bool should_bent,
+                               float proximal_angle,
+                               float intermediate_angle,
+                               float distal_angle) {
+        const SkeletalMesh::BoneId *bone = rig.finger[finger];
+
+        if (should_bent) {
+            pose.set(bone[HandRig::Proximal], glm::rotate(glm::identity<glm::mat4>(), proximal_angle, glm::fvec3(0.0, 0.0, 1.0)));
+            pose.set(bone[HandRig::Intermediate], glm::rotate(glm::identity<glm::mat4>(), intermediate_angle, glm::fvec3(0.0, 0.0, 1.0)));
+            pose.set(bone[HandRig::Distal], glm::rotate(glm::identity<glm::mat4>(), distal_angle, glm::fvec3(0.0, 0.0, 1.0)));
+        } else {
+            pose.set(bone[HandRig::Proximal], glm::identity<glm::mat4>());
+            pose.set(bone[HandRig::Intermediate], glm::identity<glm::mat4>());
+            pose.set(bone[HandRig::Distal], glm::identity<glm::mat4>());
+        }
+    }
+
+    // Control when KeyboardMouseControl, finger_bent is indexed by HandRig::Finger
+    inline void keyboard_mouse_control(SkeletalMesh::PoseBuffer &pose, const HandRig::Binding &rig,
+                                       const bool finger_bent[HandRig::FingerNum]) {
+        float bend_angle = M_PI / 3.0f;
+        km_finger_move(pose, rig, HandRig::Thumb, finger_bent[HandRig::Thumb], bend_angle * 0.2, bend_angle * 0.3, bend_angle * 0.5);
+        km_finger_move(pose, rig, HandRig::Index, finger_bent[HandRig::Index], bend_angle, bend_angle * 0.9, bend_angle * 0.8);
+        km_finger_move(pose, rig, HandRig::Middle, finger_bent[HandRig::Middle], bend_angle, bend_angle * 0.9, bend_angle * 0.8);
+        km_finger_move(pose, rig, HandRig::Ring, finger_bent[HandRig::Ring], bend_angle * 0.9, bend_angle * 0.8, bend_angle * 0.7);
+        km_finger_move(pose, rig, HandRig::Pinky, finger_bent[HandRig::Pinky], bend_angle * 0.9, bend_angle * 0.8, bend_angle * 0.7);
+    }
+}
@@ -0,0 +1,85 @@
+// Hand Rig Bindings
+// Compile-time hashed bone names of the Hand rig, resolved to bone IDs once at setup.
+
+#pragma once
+
+#include "scene_bake.h"
+
+namespace HandRig {
+    enum Finger {
+        Thumb = 0,
+        Index = 1,
+        Middle = 2,
+        Ring = 3,
+        Pinky = 4,
+        FingerNum = 5
+    };
+
+    enum Joint {
+        Proximal = 0,
+        Intermediate = 1,
+        Distal = 2,
+        Fingertip = 3,
+        JointNum = 4
+    };
+
+    namespace BoneName {
+        using SkeletalMesh::boneNameHash;
+
+        constexpr uint32_t metacarpals = boneNameHash("metacarpals");
+
+        constexpr uint32_t finger[FingerNum][JointNum] = {
+                {boneNameHash("thumb_proximal_phalange"), boneNameHash("thumb_intermediate_phalange"),
+                        boneNameHash("thumb_distal_phalange"), boneNameHash("thumb_fingertip")},
+                {boneNameHash("index_proximal_phalange"), boneNameHash("index_intermediate_phalange"),
+                        boneNameHash("index_distal_phalange"), boneNameHash("index_fingertip")},
+                {boneNameHash("middle_proximal_phalange"), boneNameHash("middle_intermediate_phalange"),
+                        boneNameHash("middle_distal_phalange"), boneNameHash("middle_fingertip")},
+                {boneNameHash("ring_proximal_phalange"), boneNameHash("ring_intermediate_phalange"),
+                        boneNameHash("ring_distal_phalange"), boneNameHash("ring_fingertip")},
+                {boneNameHash("pinky_proximal_phalange"), boneNameHash("pinky_intermediate_phalange"),
+                        boneNameHash("pinky_distal_phalange"), boneNameHash("pinky_fingertip")}
+        };
+    }
+
+    // Bone IDs of one loaded Hand scene. Unresolved bones stay SKELETON_INVALID_BONE,
+    // which PoseBuffer::set() ignores.
+    struct Binding {
+        SkeletalMesh::BoneId metacarpals;
+        SkeletalMesh::BoneId finger[FingerNum][JointNum];
+
+        Binding() : metacarpals(SKELETON_INVALID_BONE) {
+            for (int i = 0; i < FingerNum; i++)
+                for (int j = 0; j < JointNum; j++)
+                    finger[i][j] = SKELETON_INVALID_BONE;
+        }
+
+        // Resolves the rig in a bone name map (Scene::getNameBoneMap(), or SceneBaker::buildSkeleton() for a
+        // skeleton loaded without a Scene). Returns false if any bone of the rig is missing.
+        bool bind(const SkeletalMesh::SceneBaker::Name2Bone &_nameBoneMap) {
+            *this = Binding();
+            for (SkeletalMesh::SceneBaker::Name2Bone::const_iterator it = _nameBoneMap.begin();
+                 it != _nameBoneMap.end(); ++it) {
+                uint32_t hash = SkeletalMesh::boneNameHash(it->first.c_str());
+                SkeletalMesh::BoneId bone = (SkeletalMesh::BoneId) it->second;
+                if (hash == BoneName::metacarpals) metacarpals = bone;
+                for (int i = 0; i < FingerNum; i++)
+                    for (int j = 0; j < JointNum; j++)
+                        if (hash == BoneName::finger[i][j]) finger[i][j] = bone;
+            }
+            bool complete = metacarpals != SKELETON_INVALID_BONE;
+            for (int i = 0; i < FingerNum; i++)
+                for (int j = 0; j < JointNum; j++)
+                    complete = complete && finger[i][j] != SKELETON_INVALID_BONE;
+            return complete;
+        }
+
+        // Resolved fingertip bones, the joints clip compression measures its error at
+        std::vector<SkeletalMesh::BoneId> fingertips() const {
+            std::vector<SkeletalMesh::BoneId> bones;
+            for (int i = 0; i < FingerNum; i++)
+                if (finger[i][Fingertip] != SKELETON_INVALID_BONE) bones.push_back(finger[i][Fingertip]);
+            return bones;
+        }
+    };
+}
@@ -0,0 +1,222 @@
+// Input Trace
+// Input events stamped with the simulation step that applied them, stored compactly on disk. Fed back at
+// the same steps of the same fixed rate, a trace reproduces a session without a window, a clock or a user.
+
+#pragma once
+
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include "file_util.h"
+
+#define INPUT_TRACE_MAGIC 0x49444E48u // "HNDI"
+#define INPUT_TRACE_VERSION 1
+// 64-bit FNV-1a offset basis, the initial value of a state digest
+#define INPUT_TRACE_DIGEST_SEED 0xcbf29ce484222325ull
+
+namespace Replay {
+    // Raw input as the GLFW callbacks receive it
+    struct InputEvent {
+        enum Type { Key, Cursor, Scroll };
+        int type;
+        int key;
+        int action;
+        double x, y;
+    };
+
+    // Folds _bytes bytes of _data into a 64-bit FNV-1a hash
+    inline uint64_t digest(uint64_t _hash, const void *_data, size_t _bytes) {
+        const unsigned char *bytes = (const unsigned char *) _data;
+        for (size_t i = 0; i < _bytes; i++) {
+            _hash ^= bytes[i];
+            _hash *= 0x100000001b3ull;
+        }
+        return _hash;
+    }
+
+    // The header is followed by one record per event: the steps since the previous event as a varint,
+    // a byte of type and action, then the key as a zigzag varint or the two coordinates as doubles
+    struct TraceHeader {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t headerSize;
+        uint32_t eventNum;
+        double rate;
+        uint64_t stepNum;
+        uint64_t digest;
+    };
+
+    class InputTrace {
+    public:
+        InputTrace() : rate(0.0), stepNum(0), stateDigest(0), cursor(0) {}
+
+        void clear(double _rate) {
+            entry.clear();
+            rate = _rate;
+            stepNum = 0;
+            stateDigest = 0;
+            cursor = 0;
+        }
+
+        // Fixed steps per second of the recorded simulation
+        double getRate() const { return rate; }
+
+        // Steps the recorded session ran; a replay runs exactly as many
+        uint64_t getStepNum() const { return stepNum; }
+
+        void setStepNum(uint64_t _stepNum) { stepNum = _stepNum; }
+
+        // State digest at the end of the recorded session, 0 if none was stored
+        uint64_t getDigest() const { return stateDigest; }
+
+        void setDigest(uint64_t _digest) { stateDigest = _digest; }
+
+        size_t getEventNum() const { return entry.size(); }
+
+        // Recording: events arrive in the order they were applied, so steps never decrease
+        void record(uint64_t _step, const InputEvent &_event) {
+            Entry e = {_step, _event};
+            entry.push_back(e);
+            if (_step >= stepNum) stepNum = _step + 1;
+        }
+
+        // Playback: the next event applied at or before _step, false when there is none left for it
+        bool next(uint64_t _step, InputEvent &_event) {
+            if (cursor >= entry.size() || entry[cursor].step > _step) return false;
+            _event = entry[cursor++].event;
+            return true;
+        }
+
+        void rewind() { cursor = 0; }
+
+        bool save(const std::string &_filename) const {
+            TraceHeader header = TraceHeader();
+            header.magic = INPUT_TRACE_MAGIC;
+            header.version = INPUT_TRACE_VERSION;
+            header.headerSize = sizeof(TraceHeader);
+            header.eventNum = (uint32_t) entry.size();
+            header.rate = rate;
+            header.stepNum = stepNum;
+            header.digest = stateDigest;
+
+            std::vector<char> blob(sizeof(header));
+            memcpy(&blob[0], &header, sizeof(header));
+            uint64_t previous = 0;
+            for (size_t i = 0; i < entry.size(); i++) {
+                const InputEvent &event = entry[i].event;
+                putVarint(blob, entry[i].step - previous);
+                previous = entry[i].step;
+                blob.push_back((char) (event.type | event.action << 2));
+                if (event.type == InputEvent::Key) {
+                    // Zigzag, so GLFW_KEY_UNKNOWN (-1) stays one byte
+                    putVarint(blob, event.key < 0 ? (uint64_t) (-2 * (int64_t) event.key - 1)
+                                                  : (uint64_t) (2 * (int64_t) event.key));
+                } else {
+                    putBytes(blob, &event.x, sizeof(double));
+                    putBytes(blob, &event.y, sizeof(double));
+                }
+            }
+            return FileUtil::writeFile(_filename, blob);
+        }
+
+        // Rejects files of another version and truncated or malformed records
+        bool load(const std::string &_filename) {
+            clear(0.0);
+            FILE *fi = fopen(_filename.c_str(), "rb");
+            if (fi == NULL) return false;
+            std::vector<char> blob;
+            char buffer[1 << 16];
+            size_t readNum;
+            while ((readNum = fread(buffer, 1, sizeof(buffer), fi)) > 0)
+                blob.insert(blob.end(), buffer, buffer + readNum);
+            fclose(fi);
+
+            TraceHeader header;
+            if (blob.size() < sizeof(header)) return false;
+            memcpy(&header, blob.data(), sizeof(header));
+            if (header.magic != INPUT_TRACE_MAGIC || header.version != INPUT_TRACE_VERSION) return false;
+            if (header.headerSize != sizeof(TraceHeader) || !(header.rate > 0.0)) return false;
+
+            size_t offset = sizeof(header);
+            uint64_t step = 0;
+            // The count is untrusted; every record takes at least two bytes
+            entry.reserve(std::min<size_t>(header.eventNum, (blob.size() - offset) / 2));
+            for (uint32_t i = 0; i < header.eventNum; i++) {
+                uint64_t delta, key;
+                if (!getVarint(blob, offset, delta) || offset >= blob.size()) return fail();
+                step += delta;
+                unsigned char kind = (unsigned char) blob[offset++];
+                Entry e = {step, InputEvent()};
+                e.event.type = kind & 3;
+                e.event.action = kind >> 2;
+                if (e.event.type == InputEvent::Key) {
+                    if (!getVarint(blob, offset, key)) return fail();
+                    e.event.key = (key & 1) ? -(int) (key >> 1) - 1 : (int) (key >> 1);
+                } else if (e.event.type == InputEvent::Cursor || e.event.type == InputEvent::Scroll) {
+                    if (!getBytes(blob, offset, &e.event.x, sizeof(double))) return fail();
+                    if (!getBytes(blob, offset, &e.event.y, sizeof(double))) return fail();
+                } else {
+                    return fail();
+                }
+                entry.push_back(e);
+            }
+            if (offset != blob.size() || (!entry.empty() && entry.back().step >= header.stepNum)) return fail();
+            rate = header.rate;
+            stepNum = header.stepNum;
+            stateDigest = header.digest;
+            return true;
+        }
+
+    private:
+        struct Entry {
+            uint64_t step;
+            InputEvent event;
+        };
+
+        std::vector<Entry> entry;
+        double rate;
+        uint64_t stepNum;
+        uint64_t stateDigest;
+        // Playback position
+        size_t cursor;
+
+        bool fail() {
+            clear(0.0);
+            return false;
+        }
+
+        static void putVarint(std::vector<char> &_blob, uint64_t _value) {
+            while (_value >= 0x80) {
+                _blob.push_back((char) (_value | 0x80));
+                _value >>= 7;
+            }
+            _blob.push_back((char) _value);
+        }
+
+        static bool getVarint(const std::vector<char> &_blob, size_t &_offset, uint64_t &_value) {
+            _value = 0;
+            for (int shift = 0; shift < 64 && _offset < _blob.size(); shift += 7) {
+                unsigned char byte = (unsigned char) _blob[_offset++];
+                _value |= (uint64_t) (byte & 0x7F) << shift;
+                if (!(byte & 0x80)) return true;
+            }
+            return false;
+        }
+
+        static void putBytes(std::vector<char> &_blob, const void *_data, size_t _size) {
+            const char *bytes = (const char *) _data;
+            _blob.insert(_blob.end(), bytes, bytes + _size);
+        }
+
+        static bool getBytes(const std::vector<char> &_blob, size_t &_offset, void *_data, size_t _size) {
+            if (_blob.size() - _offset < _size) return false;
+            memcpy(_data, &_blob[_offset], _size);
+            _offset += _size;
+            return true;
+        }
+    };
+}
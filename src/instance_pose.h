@@ -0,0 +1,56 @@
+// Parallel Instance Poses
+// Evaluates the poses and bone palettes of many instances of one skeleton on a job system,
+// with one PoseBuffer of scratch per thread.
+
+#pragma once
+
+#include <vector>
+#include <functional>
+
+#include "skeleton.h"
+#include "job_system.h"
+
+#define INSTANCE_POSE_GRAIN 4
+
+namespace SkeletalMesh {
+    // Fills the modifiers of one instance; runs concurrently for different instances
+    typedef std::function<void(size_t, PoseBuffer &)> InstancePoseFunc;
+
+    class InstanceEvaluator {
+    public:
+        InstanceEvaluator() : skeleton(NULL) {}
+
+        // Sizes the per-thread scratch; call again when the skeleton or the job system changes
+        void bind(const Skeleton &_skeleton, size_t _threadNum) {
+            skeleton = &_skeleton;
+            scratch.resize(_threadNum);
+            for (size_t i = 0; i < _threadNum; i++)
+                scratch[i].bind(_skeleton);
+        }
+
+        // Palette of instance i is written to _palette + i * _paletteStride (boneNum() matrices).
+        // Every instance starts from a reset pose. Returns after all instances are done, so the
+        // palettes are complete and identical for any thread count.
+        void evaluate(Parallel::JobSystem *_jobs, size_t _instanceNum, const InstancePoseFunc &_poseFunc,
+                      glm::fmat4 *_palette, size_t _paletteStride) {
+            if (skeleton == NULL || scratch.empty()) return;
+            Parallel::RangeFunc body = [&](size_t _begin, size_t _end, size_t _thread) {
+                PoseBuffer &pose = scratch[_thread];
+                for (size_t i = _begin; i < _end; i++) {
+                    pose.reset();
+                    _poseFunc(i, pose);
+                    skeleton->evaluate(pose.boneModifier.data(), _palette + i * _paletteStride,
+                                       pose.nodeGlobal.data());
+                }
+            };
+            if (_jobs == NULL || scratch.size() < _jobs->threadNum())
+                body(0, _instanceNum, 0);
+            else
+                _jobs->parallelFor(_instanceNum, INSTANCE_POSE_GRAIN, body);
+        }
+
+    private:
+        const Skeleton *skeleton;
+        std::vector<PoseBuffer> scratch;
+    };
+}
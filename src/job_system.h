@@ -0,0 +1,195 @@
+// Work-Stealing Job System
+// Every thread owns a job deque: it pushes and pops at the back, idle threads steal from the front.
+// Waiting threads keep running jobs until their group is done, so a join never blocks a worker.
+
+#pragma once
+
+#include <cstddef>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <algorithm>
+
+namespace Parallel {
+    typedef std::function<void()> Job;
+
+    // Called with [begin, end) and the index of the executing thread, which selects per-thread scratch
+    typedef std::function<void(size_t, size_t, size_t)> RangeFunc;
+
+    // Counts the unfinished jobs of one fork / join
+    class JobGroup {
+    public:
+        JobGroup() : pending(0) {}
+
+        bool done() const { return pending.load() == 0; }
+
+    private:
+        friend class JobSystem;
+
+        std::atomic<size_t> pending;
+
+        // Forbid copying
+        JobGroup(const JobGroup &_copy);
+
+        JobGroup &operator=(const JobGroup &_copy);
+    };
+
+    // Slot 0 belongs to the thread that created the system (or any thread outside the pool),
+    // slots 1..threadNum()-1 to the workers. Only one outside thread may submit at a time.
+    class JobSystem {
+    public:
+        // _threadNum counts the calling thread, 0 means one per hardware thread
+        explicit JobSystem(size_t _threadNum = 0) : queued(0), stopping(false) {
+            if (_threadNum == 0) _threadNum = std::max(1u, std::thread::hardware_concurrency());
+            queues.resize(_threadNum);
+            for (size_t i = 0; i < _threadNum; i++)
+                queues[i] = new Queue();
+            for (size_t i = 1; i < _threadNum; i++)
+                workers.push_back(std::thread(&JobSystem::workerLoop, this, i));
+        }
+
+        ~JobSystem() {
+            {
+                std::lock_guard<std::mutex> lock(sleepMutex);
+                stopping = true;
+            }
+            wake.notify_all();
+            for (size_t i = 0; i < workers.size(); i++)
+                workers[i].join();
+            for (size_t i = 0; i < queues.size(); i++)
+                delete queues[i];
+        }
+
+        size_t threadNum() const { return queues.size(); }
+
+        // Scratch index of the calling thread, in [0, threadNum())
+        size_t threadIndex() const {
+            const ThreadSlot &slot = currentSlot();
+            return slot.system == this ? slot.index : 0;
+        }
+
+        void run(JobGroup &_group, const Job &_job) {
+            _group.pending.fetch_add(1);
+            // Counted before it becomes visible, so a thief never decrements below zero
+            {
+                std::lock_guard<std::mutex> lock(sleepMutex);
+                queued++;
+            }
+            Queue &queue = *queues[threadIndex()];
+            {
+                std::lock_guard<std::mutex> lock(queue.mutex);
+                queue.tasks.push_back(Task(_job, &_group));
+            }
+            wake.notify_one();
+        }
+
+        // Returns once every job of _group has finished, running queued jobs meanwhile
+        void wait(JobGroup &_group) {
+            size_t self = threadIndex();
+            while (!_group.done()) {
+                if (!runOne(self)) std::this_thread::yield();
+            }
+        }
+
+        // Splits [0, _count) into chunks of _grain and joins before returning
+        void parallelFor(size_t _count, size_t _grain, const RangeFunc &_body) {
+            if (_count == 0) return;
+            if (_grain == 0) _grain = 1;
+            if (queues.size() == 1 || _count <= _grain) {
+                _body(0, _count, threadIndex());
+                return;
+            }
+            JobGroup group;
+            const RangeFunc *body = &_body;
+            for (size_t begin = 0; begin < _count; begin += _grain) {
+                size_t end = std::min(begin + _grain, _count);
+                run(group, [this, body, begin, end] { (*body)(begin, end, threadIndex()); });
+            }
+            wait(group);
+        }
+
+    private:
+        struct Task {
+            Job job;
+            JobGroup *group;
+
+            Task() : job(), group(NULL) {}
+
+            Task(const Job &_job, JobGroup *_group) : job(_job), group(_group) {}
+        };
+
+        struct Queue {
+            std::mutex mutex;
+            std::deque<Task> tasks;
+        };
+
+        struct ThreadSlot {
+            const JobSystem *system;
+            size_t index;
+        };
+
+        std::vector<Queue *> queues;
+        std::vector<std::thread> workers;
+        std::mutex sleepMutex;
+        std::condition_variable wake;
+        size_t queued;
+        bool stopping;
+
+        // Forbid copying
+        JobSystem(const JobSystem &_copy);
+
+        JobSystem &operator=(const JobSystem &_copy);
+
+        static ThreadSlot &currentSlot() {
+            static thread_local ThreadSlot slot = {NULL, 0};
+            return slot;
+        }
+
+        // Own deque from the back (most recent, cache-warm), others from the front (oldest, largest)
+        bool take(size_t _self, Task &_task) {
+            for (size_t k = 0; k < queues.size(); k++) {
+                size_t victim = (_self + k) % queues.size();
+                Queue &queue = *queues[victim];
+                std::lock_guard<std::mutex> lock(queue.mutex);
+                if (queue.tasks.empty()) continue;
+                if (k == 0) {
+                    _task = queue.tasks.back();
+                    queue.tasks.pop_back();
+                } else {
+                    _task = queue.tasks.front();
+                    queue.tasks.pop_front();
+                }
+                return true;
+            }
+            return false;
+        }
+
+        bool runOne(size_t _self) {
+            Task task;
+            if (!take(_self, task)) return false;
+            {
+                std::lock_guard<std::mutex> lock(sleepMutex);
+                queued--;
+            }
+            task.job();
+            task.group->pending.fetch_sub(1);
+            return true;
+        }
+
+        void workerLoop(size_t _index) {
+            ThreadSlot &slot = currentSlot();
+            slot.system = this;
+            slot.index = _index;
+            for (;;) {
+                if (runOne(_index)) continue;
+                std::unique_lock<std::mutex> lock(sleepMutex);
+                wake.wait(lock, [this] { return stopping || queued > 0; });
+                if (stopping) return;
+            }
+        }
+    };
+}
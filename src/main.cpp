@@ -13,26 +13,69 @@
 #define M_PI (3.1415926535897932)
 #endif
 
+// Hands drawn when the crowd is enabled, and their distance on the grid
+#define CROWD_INSTANCE_NUM 256
+#define CROWD_SPACING 12.0f
+
+// Texture unit of the single hand's bone palette
+#define SKIN_SHADER_BONE_CHANNEL 1
+
 #include <iostream>
+#include <cmath>
+#include <cstring>
+#include <cfloat>
+#include <algorithm>
+#include <string>
+#include <atomic>
+#include <thread>
 
 #include "skeletal_mesh.h"
+#include "hand_rig.h"
+#include "hand_pose.h"
+#include "dual_quat.h"
+#include "crowd.h"
+#include "instance_pose.h"
+#include "frame_profiler.h"
+#include "quaternion_camera.h"
+#include "frame_clock.h"
+#include "triple_buffer.h"
+#include "spsc_queue.h"
+#include "input_trace.h"
+
+#include <imgui.h>
+#include <imgui_impl_glfw.h>
+#include <imgui_impl_opengl3.h>
 
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/quaternion.hpp>
 #include <glm/gtx/quaternion.hpp>
 
+// in_position is either float or unorm16 relative to the scene bounds (see compact_vertex.h),
+// so every vertex shader decodes it with u_position_min / u_position_extent.
+// Bone palettes come from a texture buffer ring; u_bone_base is the first texel of this frame's region.
 namespace SkeletalAnimation {
     const char *vertex_shader_330 =
             "#version 330 core\n"
-            "const int MAX_BONES = 100;\n"
-            "uniform mat4 u_bone_transf[MAX_BONES];\n"
+            "uniform samplerBuffer u_bone_data;\n"
+            "uniform int u_bone_base;\n"
             "uniform mat4 u_mvp;\n"
+            "uniform vec3 u_position_min;\n"
+            "uniform vec3 u_position_extent;\n"
             "layout(location = 0) in vec3 in_position;\n"
             "layout(location = 1) in vec2 in_texcoord;\n"
             "layout(location = 2) in vec3 in_normal;\n"
             "layout(location = 3) in ivec4 in_bone_index;\n"
             "layout(location = 4) in vec4 in_bone_weight;\n"
+            "layout(location = 5) in float in_diffuse_layer;\n"
             "out vec2 pass_texcoord;\n"
+            "flat out float pass_diffuse_layer;\n"
+            "mat4 fetch_bone(int bone) {\n"
+            "    int texel = u_bone_base + 4 * bone;\n"
+            "    return mat4(texelFetch(u_bone_data, texel),\n"
+            "                texelFetch(u_bone_data, texel + 1),\n"
+            "                texelFetch(u_bone_data, texel + 2),\n"
+            "                texelFetch(u_bone_data, texel + 3));\n"
+            "}\n"
             "void main() {\n"
             "    float adjust_factor = 0.0;\n"
             "    for (int i = 0; i < 4; i++) adjust_factor += in_bone_weight[i] * 0.25;\n"
@@ -40,20 +83,111 @@ namespace SkeletalAnimation {
             "    if (adjust_factor > 1e-3) {\n"
             "        bone_transform -= bone_transform;\n"
             "        for (int i = 0; i < 4; i++)\n"
-            "            bone_transform += u_bone_transf[in_bone_index[i]] * in_bone_weight[i] / adjust_factor;\n"
+            "            bone_transform += fetch_bone(in_bone_index[i]) * in_bone_weight[i] / adjust_factor;\n"
             "	 }\n"
-            "    gl_Position = u_mvp * bone_transform * vec4(in_position, 1.0);\n"
+            "    vec3 position = u_position_min + in_position * u_position_extent;\n"
+            "    gl_Position = u_mvp * bone_transform * vec4(position, 1.0);\n"
             "    pass_texcoord = in_texcoord;\n"
+            "    pass_diffuse_layer = in_diffuse_layer;\n"
+            "}\n";
+
+    // Instanced crowd: model matrix and bone palette of every instance come from a texture buffer,
+    // laid out as described in crowd.h
+    const char *vertex_shader_crowd_330 =
+            "#version 330 core\n"
+            "uniform samplerBuffer u_instance_data;\n"
+            "uniform int u_bone_base;\n"
+            "uniform int u_instance_base;\n"
+            "uniform int u_bone_num;\n"
+            "uniform mat4 u_mvp;\n"
+            "uniform vec3 u_position_min;\n"
+            "uniform vec3 u_position_extent;\n"
+            "layout(location = 0) in vec3 in_position;\n"
+            "layout(location = 1) in vec2 in_texcoord;\n"
+            "layout(location = 2) in vec3 in_normal;\n"
+            "layout(location = 3) in ivec4 in_bone_index;\n"
+            "layout(location = 4) in vec4 in_bone_weight;\n"
+            "layout(location = 5) in float in_diffuse_layer;\n"
+            "out vec2 pass_texcoord;\n"
+            "flat out float pass_diffuse_layer;\n"
+            "mat4 fetch_matrix(int texel) {\n"
+            "    return mat4(texelFetch(u_instance_data, texel),\n"
+            "                texelFetch(u_instance_data, texel + 1),\n"
+            "                texelFetch(u_instance_data, texel + 2),\n"
+            "                texelFetch(u_instance_data, texel + 3));\n"
+            "}\n"
+            "void main() {\n"
+            "    int base = u_bone_base + (u_instance_base + gl_InstanceID) * (u_bone_num + 1) * 4;\n"
+            "    mat4 model = fetch_matrix(base);\n"
+            "    float adjust_factor = 0.0;\n"
+            "    for (int i = 0; i < 4; i++) adjust_factor += in_bone_weight[i] * 0.25;\n"
+            "    mat4 bone_transform = mat4(1.0);\n"
+            "    if (adjust_factor > 1e-3) {\n"
+            "        bone_transform -= bone_transform;\n"
+            "        for (int i = 0; i < 4; i++)\n"
+            "            bone_transform += fetch_matrix(base + 4 * (in_bone_index[i] + 1)) * in_bone_weight[i] / adjust_factor;\n"
+            "    }\n"
+            "    vec3 position = u_position_min + in_position * u_position_extent;\n"
+            "    gl_Position = u_mvp * model * bone_transform * vec4(position, 1.0);\n"
+            "    pass_texcoord = in_texcoord;\n"
+            "    pass_diffuse_layer = in_diffuse_layer;\n"
+            "}\n";
+
+    // Dual-quaternion skinning: each bone is two texels, read as a mat2x4 (column 0 real, column 1 dual part)
+    const char *vertex_shader_dqs_330 =
+            "#version 330 core\n"
+            "uniform samplerBuffer u_bone_data;\n"
+            "uniform int u_bone_base;\n"
+            "uniform mat4 u_mvp;\n"
+            "uniform vec3 u_position_min;\n"
+            "uniform vec3 u_position_extent;\n"
+            "layout(location = 0) in vec3 in_position;\n"
+            "layout(location = 1) in vec2 in_texcoord;\n"
+            "layout(location = 2) in vec3 in_normal;\n"
+            "layout(location = 3) in ivec4 in_bone_index;\n"
+            "layout(location = 4) in vec4 in_bone_weight;\n"
+            "layout(location = 5) in float in_diffuse_layer;\n"
+            "out vec2 pass_texcoord;\n"
+            "flat out float pass_diffuse_layer;\n"
+            "mat2x4 fetch_bone(int bone) {\n"
+            "    int texel = u_bone_base + 2 * bone;\n"
+            "    return mat2x4(texelFetch(u_bone_data, texel), texelFetch(u_bone_data, texel + 1));\n"
+            "}\n"
+            "void main() {\n"
+            "    vec3 position = u_position_min + in_position * u_position_extent;\n"
+            "    if (dot(in_bone_weight, vec4(0.25)) > 1e-3) {\n"
+            "        int pivot = 0;\n"
+            "        for (int i = 1; i < 4; i++)\n"
+            "            if (in_bone_weight[i] > in_bone_weight[pivot]) pivot = i;\n"
+            "        vec4 pivot_real = fetch_bone(in_bone_index[pivot])[0];\n"
+            "        vec4 real = vec4(0.0);\n"
+            "        vec4 dual = vec4(0.0);\n"
+            "        for (int i = 0; i < 4; i++) {\n"
+            "            mat2x4 dq = fetch_bone(in_bone_index[i]);\n"
+            "            float w = dot(dq[0], pivot_real) < 0.0 ? -in_bone_weight[i] : in_bone_weight[i];\n"
+            "            real += dq[0] * w;\n"
+            "            dual += dq[1] * w;\n"
+            "        }\n"
+            "        float len = length(real);\n"
+            "        real /= len;\n"
+            "        dual /= len;\n"
+            "        position += 2.0 * cross(real.xyz, cross(real.xyz, position) + real.w * position);\n"
+            "        position += 2.0 * (real.w * dual.xyz - dual.w * real.xyz + cross(real.xyz, dual.xyz));\n"
+            "    }\n"
+            "    gl_Position = u_mvp * vec4(position, 1.0);\n"
+            "    pass_texcoord = in_texcoord;\n"
+            "    pass_diffuse_layer = in_diffuse_layer;\n"
             "}\n";
 
     const char *fragment_shader_330 =
             "#version 330 core\n"
-            "uniform sampler2D u_diffuse;\n"
+            "uniform sampler2DArray u_diffuse;\n"
             "in vec2 pass_texcoord;\n"
+            "flat in float pass_diffuse_layer;\n"
             "out vec4 out_color;\n"
             "void main() {\n"
             #ifdef DIFFUSE_TEXTURE_MAPPING
-            "    out_color = vec4(texture(u_diffuse, pass_texcoord).xyz, 1.0);\n"
+            "    out_color = vec4(texture(u_diffuse, vec3(pass_texcoord, pass_diffuse_layer)).xyz, 1.0);\n"
             #else
             "    out_color = vec4(pass_texcoord, 0.0, 1.0);\n"
             #endif
@@ -81,172 +215,22 @@ void print_help() {
     std::cout << "  1: Preset movement 1" << std::endl;
     std::cout << "  2: Preset movement 2" << std::endl;
     std::cout << "  3: Preset movement 3" << std::endl;
+    std::cout << "  4: Play the animation clip imported from the model" << std::endl;
     std::cout << "  9: Default rotating hand" << std::endl;
     std::cout << "  0: Default static hand" << std::endl;
     std::cout << "  Z/X/C/V/B: Control fingers when hand is default rotating / default static" << std::endl;
+    std::cout << "  M: Switch skinning between linear blend / dual quaternion" << std::endl;
+    std::cout << "  N: Show / hide the instanced crowd of hands (linear blend only)" << std::endl;
+    std::cout << "  I: Show / hide the frame profiler" << std::endl;
+    std::cout << "  L: Enable / disable distance-based level of detail" << std::endl;
     std::cout << "======================\n" << std::endl;
 }
 
+// State below, up to the GL thread's, belongs to the simulation: only the thread running
+// advance_simulation() and publish_simulation() touches it
 static double last_mouse_x = 400, last_mouse_y = 400;
 static bool first_mouse = true;
 
-struct CameraState {
-    glm::vec3 position;
-    glm::quat orientation;
-    float fov;
-
-    CameraState() : position(0.0f), orientation(1.0f, 0.0f, 0.0f, 0.0f), fov(45.0f) {}
-    CameraState(const glm::vec3& pos, const glm::quat& orient, float f)
-        : position(pos), orientation(orient), fov(f) {}
-};
-
-// Quaterion controlled camera
-class QuaternionCamera {
-public:
-    QuaternionCamera(glm::vec3 position = glm::vec3(0.0f, 0.0f, 15.0f))
-        : movementSpeed(25.0f),
-          mouseSensitivity(0.1f)
-    {
-        resetStatus();
-    }
-    
-    glm::mat4 getViewMatrix() const {
-        return glm::lookAt(position, position + front, up);
-    }
-    
-    glm::mat4 getProjectionMatrix(float aspectRatio, bool usePerspective = true) const {
-        if (usePerspective) {
-            return glm::perspective(glm::radians(fov), aspectRatio, 0.1f, 100.0f);
-        } else {
-            return glm::ortho(-12.5f * aspectRatio, 12.5f * aspectRatio, -5.f, 20.f, -20.f, 20.f);
-        }
-    }
-    
-    void processKeyboard(bool w, bool a, bool s, bool d, bool space, bool shift, float deltaTime) {
-        float velocity = movementSpeed * deltaTime;
-        if (w) position += front * velocity;
-        if (s) position -= front * velocity;
-        if (a) position -= right * velocity;
-        if (d) position += right * velocity;
-        if (space) position += worldUp * velocity;
-        if (shift) position -= worldUp * velocity;
-    }
-    
-    void processMouseMovement(double xoffset, double yoffset, bool constrainPitch = true) {
-        xoffset *= mouseSensitivity;
-        yoffset *= mouseSensitivity;
-        yaw += xoffset;
-        pitch += yoffset;
-
-        if (constrainPitch) {
-            if (pitch > 89.0f) pitch = 89.0f;
-            if (pitch < -89.0f) pitch = -89.0f;
-        }
-        
-        // Create quaterion from eular angle (Yaw -> Pitch)
-        glm::quat qYaw = glm::angleAxis(glm::radians(yaw), worldUp);
-        glm::quat qPitch = glm::angleAxis(glm::radians(pitch), glm::vec3(1.0f, 0.0f, 0.0f));
-        targetOrientation = qYaw * qPitch;
-        targetOrientation = glm::normalize(targetOrientation);
-    }
-    
-    void updateCameraOrientation(float deltaTime) {
-        // Quaterion slerp
-        float slerpFactor = glm::clamp(10.0f * deltaTime, 0.01f, 0.5f);
-        orientation = glm::slerp(orientation, targetOrientation, slerpFactor);
-        orientation = glm::normalize(orientation);
-        
-        updateVectors();
-    }
-    
-    void processMouseScroll(double yoffset) {
-        fov -= (float)yoffset;
-        if (fov < 1.0f) fov = 1.0f;
-        if (fov > 45.0f) fov = 45.0f;
-    }
-    
-    void setPosition(const glm::vec3& newPosition) { position = newPosition; }
-    glm::vec3 getPosition() const { return position; }
-    void reportStatus() const {
-        std::cout << "  Position: " << "[" << position[0] << ", " << position[1] << ", " << position[2] << "]" << std::endl;
-        std::cout << "  Orientation: " << "[" << orientation[0] << ", " << orientation[1] << ", " << orientation[2] << "]" << std::endl;
-        std::cout << "  yaw: " << yaw << std::endl;
-        std::cout << "  pitch: " << pitch << std::endl;
-    }
-    glm::vec3 getFront() const { return front; }
-    glm::vec3 getUp() const { return up; }
-    glm::vec3 getRight() const { return right; }
-    
-    void setMovementSpeed(float speed) { movementSpeed = speed; }
-    void incMovementSpeed() { 
-        movementSpeed = movementSpeed > 50.0 ? movementSpeed : movementSpeed + 1.0;
-        std::cout << "Camera movement speed: " << movementSpeed << std::endl;
-    }
-    void decMovementSpeed() {
-        movementSpeed = movementSpeed == 0.0 ? movementSpeed : movementSpeed - 1.0;
-        std::cout << "Camera movement speed: " << movementSpeed << std::endl;
-    }
-    void setMouseSensitivity(float sensitivity) { mouseSensitivity = sensitivity; }
-
-    CameraState getCurrentState() const {
-        return CameraState(position, orientation, fov);
-    }
-
-    void setState(const CameraState& state) {
-        position = state.position;
-        orientation = state.orientation;
-        targetOrientation = state.orientation;
-        fov = state.fov;
-        updateVectors();
-    }
-    
-    CameraState getTransitionState(const CameraState& start, const CameraState& end, float progress) {
-        // Smooth step function for smoother transition
-        float smoothProgress = progress * progress * (3.0f - 2.0f * progress);
-        
-        // Linear interpolation for position
-        glm::vec3 transPosition = glm::mix(start.position, end.position, smoothProgress);
-        
-        // Spherical linear interpolation for orientation
-        glm::quat transOrientation = glm::slerp(start.orientation, end.orientation, smoothProgress);
-        
-        // Linear interpolation for FOV
-        float transFov = glm::mix(start.fov, end.fov, smoothProgress);
-        
-        return CameraState(transPosition, transOrientation, transFov);
-    }
-
-    void resetStatus() {
-        position = glm::vec3(0.0f, 5.0f, 30.0f);
-        worldUp = glm::vec3(0.0f, 1.0f, 0.0f);
-        fov = 45.0f;
-        orientation = glm::quat(1.0f, 0.0f, 0.0f, 0.0f);
-        targetOrientation = orientation;
-        yaw = 0.0f;
-        pitch = 0.0f;
-        updateVectors();
-    }
-
-private:
-    void updateVectors() {
-        // Extra orientation vector from quaterion
-        glm::mat4 rotation = glm::mat4_cast(orientation);
-        front = -glm::vec3(rotation[2]);
-        right = glm::vec3(rotation[0]);
-        up = glm::vec3(rotation[1]);
-    }
-
-    glm::vec3 position;
-    glm::vec3 front, right, up, worldUp;
-    glm::quat orientation;
-    glm::quat targetOrientation;
-    float yaw;
-    float pitch;
-    float movementSpeed;
-    float mouseSensitivity;
-    float fov;
-};
-
 static QuaternionCamera camera;
 
 static CameraState stateA, stateB;
@@ -263,11 +247,16 @@ enum DisplayMode {
     Completion1 = 1,
     Completion2 = 2,
     Completion3 = 3,
+    ClipPlayback = 4,
     DefaultRotate = 9,
 };
 
 static DisplayMode current_mode = Default;
 static bool keyboard_mouse_enabled = false;
+static bool dual_quat_skinning = false;
+static bool crowd_enabled = false;
+// Keys down, from the forwarded press / release events
+static bool key_held[GLFW_KEY_LAST + 1];
 
 // Finger status for KeyboardMouseControl
 static bool thumb_bent = false;
@@ -276,21 +265,43 @@ static bool middle_bent = false;
 static bool ring_bent = false;
 static bool pinky_bent = false;
 
+// Bone IDs of the Hand rig, resolved once after loading
+static HandRig::Binding hand_rig;
+
+// Clip played by key 4, the first animation stack of Hand.fbx if it has one
+static const SkeletalMesh::AnimationClip *hand_clip = NULL;
+
+// GL thread state
+static bool profiler_overlay = false;
+static bool lod_enabled = true;
+
+// Raw input the GLFW callbacks forward to the simulation
+typedef Replay::InputEvent InputEvent;
+
+#define INPUT_QUEUE_CAPACITY 1024
+static Parallel::SpscQueue<InputEvent> input_queue(INPUT_QUEUE_CAPACITY);
+// Events lost because the simulation fell that far behind
+static int input_dropped = 0;
+
+static void forward_input(int type, int key, int action, double x, double y) {
+    InputEvent event = {type, key, action, x, y};
+    if (!input_queue.push(event)) input_dropped++;
+}
+
 static void error_callback(int error, const char *description) {
     fprintf(stderr, "Error: %s\n", description);
 }
 
-static void key_callback(GLFWwindow *window, int key, int scancode, int action, int mods) {
-    if (key == GLFW_KEY_ESCAPE && action == GLFW_PRESS)
-        glfwSetWindowShouldClose(window, GLFW_TRUE);
+// Simulation side of a key event; the GL thread has already handled its own keys
+static void handle_key(int key, int action) {
+    if (key >= 0 && key <= GLFW_KEY_LAST && action != GLFW_REPEAT)
+        key_held[key] = action == GLFW_PRESS;
 
     // F: switch KeyboardMouseControl
     if (key == GLFW_KEY_F && action == GLFW_PRESS) {
         keyboard_mouse_enabled = !keyboard_mouse_enabled;
-        if (keyboard_mouse_enabled) {
-            glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
+        if (keyboard_mouse_enabled)
             first_mouse = true;
-        }
         std::cout << "Keyboard/mouse control: " << (keyboard_mouse_enabled ? "ENABLED" : "DISABLED") << std::endl;
     }
 
@@ -309,6 +320,14 @@ static void key_callback(GLFWwindow *window, int key, int scancode, int action,
                 current_mode = Completion3;
                 std::cout << "Mode: Completion 3" << std::endl;
                 break;
+            case GLFW_KEY_4:
+                if (hand_clip == NULL) {
+                    std::cout << "No animation clip in the scene" << std::endl;
+                    break;
+                }
+                current_mode = ClipPlayback;
+                std::cout << "Mode: Clip " << hand_clip->name << std::endl;
+                break;
             case GLFW_KEY_9:
                 current_mode = DefaultRotate;
                 std::cout << "Mode: DefaultRotate" << std::endl;
@@ -320,6 +339,14 @@ static void key_callback(GLFWwindow *window, int key, int scancode, int action,
             case GLFW_KEY_H:
                 print_help();
                 break;
+            case GLFW_KEY_N:
+                crowd_enabled = !crowd_enabled;
+                std::cout << "Crowd: " << (crowd_enabled ? "ENABLED" : "DISABLED") << std::endl;
+                break;
+            case GLFW_KEY_M:
+                dual_quat_skinning = !dual_quat_skinning;
+                std::cout << "Skinning: " << (dual_quat_skinning ? "dual quaternion" : "linear blend") << std::endl;
+                break;
             case GLFW_KEY_R:
                 camera.resetStatus();
                 break;
@@ -412,7 +439,7 @@ static void key_callback(GLFWwindow *window, int key, int scancode, int action,
     }
 }
 
-static void cursor_position_callback(GLFWwindow *window, double xpos, double ypos) {
+static void handle_cursor(double xpos, double ypos) {
     if (!keyboard_mouse_enabled)
         return;
 
@@ -433,22 +460,644 @@ static void cursor_position_callback(GLFWwindow *window, double xpos, double ypo
     camera.processMouseMovement(xoffset, yoffset);
 }
 
-static void scroll_callback(GLFWwindow *window, double xoffset, double yoffset) {
+static void handle_scroll(double yoffset) {
     if (keyboard_mouse_enabled) {
         camera.processMouseScroll(yoffset);
     }
 }
 
-static void completion_1(SkeletalMesh::SkeletonModifier &modifier, float passed_time);
-static void completion_2(SkeletalMesh::SkeletonModifier &modifier, float passed_time);
-static void completion_3(SkeletalMesh::SkeletonModifier &modifier, float passed_time);
-static void default_rotate(SkeletalMesh::SkeletonModifier &modifier, float passed_time);
-static void keyboard_mouse_control(SkeletalMesh::SkeletonModifier &modifier);
-static void finger_move_clear(SkeletalMesh::SkeletonModifier &modifier);
+static void handle_input(const InputEvent &event) {
+    if (event.type == InputEvent::Key) handle_key(event.key, event.action);
+    else if (event.type == InputEvent::Cursor) handle_cursor(event.x, event.y);
+    else handle_scroll(event.y);
+}
+
+// The callbacks run on the GL thread. Keys of the renderer take effect at once, everything else is
+// queued for the simulation, which may run on its own thread.
+static void key_callback(GLFWwindow *window, int key, int scancode, int action, int mods) {
+    if (action == GLFW_PRESS) {
+        switch (key) {
+            case GLFW_KEY_ESCAPE:
+                glfwSetWindowShouldClose(window, GLFW_TRUE);
+                return;
+            case GLFW_KEY_I:
+                profiler_overlay = !profiler_overlay;
+                return;
+            case GLFW_KEY_L:
+                lod_enabled = !lod_enabled;
+                std::cout << "Level of detail: " << (lod_enabled ? "ENABLED" : "DISABLED") << std::endl;
+                return;
+            default:
+                break;
+        }
+    }
+    forward_input(InputEvent::Key, key, action, 0.0, 0.0);
+}
+
+static void cursor_position_callback(GLFWwindow *window, double xpos, double ypos) {
+    forward_input(InputEvent::Cursor, 0, 0, xpos, ypos);
+}
+
+static void scroll_callback(GLFWwindow *window, double xoffset, double yoffset) {
+    forward_input(InputEvent::Scroll, 0, 0, xoffset, yoffset);
+}
+
+static void keyboard_mouse_control(SkeletalMesh::PoseBuffer &pose) {
+    bool finger_bent[HandRig::FingerNum] = {thumb_bent, index_bent, middle_bent, ring_bent, pinky_bent};
+    HandPose::keyboard_mouse_control(pose, hand_rig, finger_bent);
+}
+
+static GLuint build_program(const char *vertex_source, const char *fragment_source) {
+    GLuint vertex_shader, fragment_shader, program;
+
+    vertex_shader = glCreateShader(GL_VERTEX_SHADER);
+    glShaderSource(vertex_shader, 1, &vertex_source, NULL);
+    glCompileShader(vertex_shader);
+
+    fragment_shader = glCreateShader(GL_FRAGMENT_SHADER);
+    glShaderSource(fragment_shader, 1, &fragment_source, NULL);
+    glCompileShader(fragment_shader);
+
+    program = glCreateProgram();
+    glAttachShader(program, vertex_shader);
+    glAttachShader(program, fragment_shader);
+    glLinkProgram(program);
+
+    int linkStatus;
+    if (glGetProgramiv(program, GL_LINK_STATUS, &linkStatus), linkStatus == GL_FALSE)
+        std::cout << "Error occured in glLinkProgram()" << std::endl;
+    return program;
+}
+
+// A skinning program with the locations of the uniforms set every frame
+struct SkinProgram {
+    GLuint program;
+    GLint mvp;
+    GLint bone_base;
+};
+
+// Locations are resolved once here, and the samplers, which never change, are set here as well
+static SkinProgram build_skin_program(const char *vertex_source, const char *bone_sampler, GLint bone_channel) {
+    SkinProgram skin;
+    skin.program = build_program(vertex_source, SkeletalAnimation::fragment_shader_330);
+    skin.mvp = glGetUniformLocation(skin.program, "u_mvp");
+    skin.bone_base = glGetUniformLocation(skin.program, "u_bone_base");
+    glUseProgram(skin.program);
+    glUniform1i(glGetUniformLocation(skin.program, "u_diffuse"), SCENE_RESOURCE_SHADER_DIFFUSE_CHANNEL);
+    glUniform1i(glGetUniformLocation(skin.program, bone_sampler), bone_channel);
+    glUseProgram(0);
+    return skin;
+}
+
+// cursor speeds up sequential clip playback; concurrent callers pass NULL
+static void apply_display_mode(SkeletalMesh::PoseBuffer &pose, float passed_time,
+                               SkeletalMesh::AnimationCursor *cursor = NULL) {
+    switch (current_mode) {
+        case Completion1:
+            HandPose::completion_1(pose, hand_rig, passed_time);
+            break;
+        case Completion2:
+            HandPose::completion_2(pose, hand_rig, passed_time);
+            break;
+        case Completion3:
+            HandPose::completion_3(pose, hand_rig, passed_time);
+            break;
+        case ClipPlayback:
+            HandPose::finger_move_clear(pose);
+            if (hand_clip != NULL && hand_clip->duration > 0.0f) {
+                float clip_time = fmod(passed_time, hand_clip->duration);
+                if (cursor != NULL)
+                    hand_clip->sample(clip_time, *cursor, pose);
+                else
+                    hand_clip->sample(clip_time, pose);
+            }
+            break;
+        case DefaultRotate:
+            HandPose::default_rotate(pose, hand_rig, passed_time);
+            keyboard_mouse_control(pose);
+            break;
+        case Default:
+            HandPose::finger_move_clear(pose);
+            keyboard_mouse_control(pose);
+            break;
+        default:
+            break;
+    }
+}
+
+// Crowd instances are laid out on a square grid in the z = 0 plane
+static glm::fmat4 crowd_model(int instance) {
+    int side = (int) std::ceil(std::sqrt((float) CROWD_INSTANCE_NUM));
+    float x = (float) (instance % side) - (side - 1) * 0.5f;
+    float y = (float) (instance / side) - (side - 1) * 0.5f;
+    return glm::translate(glm::identity<glm::mat4>(), glm::fvec3(x, y, 0.0f) * CROWD_SPACING);
+}
+
+// Comma-separated triangle ratios of the baked LOD levels, "none" for no levels
+static bool parse_lod_ratios(const char *text, std::vector<float> &ratios) {
+    ratios.clear();
+    if (strcmp(text, "none") == 0) return true;
+    std::string list(text);
+    size_t begin = 0;
+    while (begin <= list.size()) {
+        size_t end = list.find(',', begin);
+        if (end == std::string::npos) end = list.size();
+        float ratio = (float) atof(list.substr(begin, end - begin).c_str());
+        if (ratio <= 0.0f || ratio >= 1.0f) return false;
+        ratios.push_back(ratio);
+        begin = end + 1;
+    }
+    return true;
+}
+
+// Stages of one frame in the order they run
+struct FrameStages {
+    Profiling::StageId input, pose, upload, draw, overlay, swap, pace;
+
+    explicit FrameStages(Profiling::FrameProfiler &profiler)
+            : input(profiler.addStage("input")), pose(profiler.addStage("pose")),
+              upload(profiler.addStage("upload")), draw(profiler.addStage("draw")),
+              overlay(profiler.addStage("overlay")), swap(profiler.addStage("swap")),
+              pace(profiler.addStage("pace")) {}
+};
+
+// One fixed step of everything that moves with time except the hand poses, which are functions of
+// time and are sampled at the display time instead
+static void simulation_step(float step) {
+    if (isTransitioning) {
+        transitionProgress += step / transitionDuration;
+        if (transitionProgress >= 1.0f) {
+            // Transition complete
+            transitionProgress = 1.0f;
+            isTransitioning = false;
+            camera.setState(transitionEnd);
+            std::cout << "Transition complete" << std::endl;
+        } else {
+            // Update camera during transition
+            CameraState currentState = camera.getTransitionState(transitionStart, transitionEnd, transitionProgress);
+            camera.setState(currentState);
+        }
+    } else if (keyboard_mouse_enabled) {
+        camera.processKeyboard(
+            key_held[GLFW_KEY_W],
+            key_held[GLFW_KEY_A],
+            key_held[GLFW_KEY_S],
+            key_held[GLFW_KEY_D],
+            key_held[GLFW_KEY_SPACE],
+            key_held[GLFW_KEY_LEFT_SHIFT],
+            step
+        );
+        camera.updateCameraOrientation(step);
+    }
+}
+
+// Folds the state input can change into hash: the camera, the display mode and the toggles. Poses are left out,
+// since inline they are sampled at wall-clock display times.
+static uint64_t state_digest(uint64_t hash) {
+    CameraState state = camera.getCurrentState();
+    hash = Replay::digest(hash, &state.position, sizeof(state.position));
+    hash = Replay::digest(hash, &state.orientation, sizeof(state.orientation));
+    hash = Replay::digest(hash, &state.fov, sizeof(state.fov));
+    bool toggles[] = {keyboard_mouse_enabled, dual_quat_skinning, crowd_enabled, isTransitioning,
+                      thumb_bent, index_bent, middle_bent, ring_bent, pinky_bent};
+    int mode = (int) current_mode;
+    hash = Replay::digest(hash, &mode, sizeof(mode));
+    return Replay::digest(hash, toggles, sizeof(toggles));
+}
+
+// Everything the GL thread draws from one published simulation state
+struct SimFrame {
+    uint64_t version;
+    uint64_t step;
+    Pacing::Clock::time_point stamp;
+    CameraState camera_previous, camera;
+    bool bones_ready;
+    bool dual_quat;
+    bool crowd;
+    // The GL thread captures the cursor while keyboard / mouse control is on
+    bool mouse_control;
+    SkeletalMesh::Scene::SkeletonTransf bones;
+    SkeletalMesh::SkeletonDualQuat bones_dual_quat;
+    // Version of the frame in which each bone last changed
+    std::vector<uint64_t> bone_version;
+    // Per instance the model matrix, then the palette, as CrowdBuffer lays them out
+    std::vector<glm::fmat4> crowd_palette;
+    float evaluate_ms;
+
+    SimFrame() : version(0), step(0), bones_ready(false), dual_quat(false), crowd(false), mouse_control(false),
+                 evaluate_ms(0.0f) {}
+};
+
+// Pose state of the thread running the simulation, and the frames it hands to the GL thread
+struct Simulation {
+    const SkeletalMesh::Skeleton *skeleton;
+    Parallel::JobSystem *jobs;
+    SkeletalMesh::PoseBuffer pose;
+    SkeletalMesh::AnimationCursor clip_cursor;
+    SkeletalMesh::InstanceEvaluator crowd_evaluator;
+    SkeletalMesh::Scene::SkeletonTransf bones;
+    SkeletalMesh::SkeletonDualQuat bones_dual_quat;
+    bool dual_quat_valid;
+    std::vector<uint64_t> bone_version;
+    uint64_t version;
+    uint64_t step_num;
+    CameraState camera_previous;
+    Parallel::TripleBuffer<SimFrame> frames;
+    // Input applied at each step is appended to recording; a replay takes its input from replay instead
+    Replay::InputTrace *recording;
+    Replay::InputTrace *replay;
+    // state_digest() after every step so far
+    uint64_t digest;
+
+    Simulation()
+            : skeleton(NULL), jobs(NULL), dual_quat_valid(false), version(0), step_num(0), recording(NULL),
+              replay(NULL), digest(INPUT_TRACE_DIGEST_SEED) {}
+};
+
+static void bind_simulation(Simulation &sim, const SkeletalMesh::Skeleton &skeleton, Parallel::JobSystem &jobs) {
+    sim.skeleton = &skeleton;
+    sim.jobs = &jobs;
+    sim.pose.bind(skeleton);
+    if (hand_clip != NULL) sim.clip_cursor.bind(*hand_clip);
+    sim.crowd_evaluator.bind(skeleton, jobs.threadNum());
+    sim.bone_version.assign(skeleton.boneNum(), 0);
+    sim.camera_previous = camera.getCurrentState();
+}
+
+// True once a replay has run every step of its trace
+static bool replay_finished(const Simulation &sim) {
+    return sim.replay != NULL && sim.step_num >= sim.replay->getStepNum();
+}
+
+// Applies the input queued so far, or the replayed input of this step, then runs one fixed step
+static void advance_simulation(Simulation &sim, float step) {
+    InputEvent event;
+    while (input_queue.pop(event)) {
+        // Live input does not reach a replay
+        if (sim.replay != NULL) continue;
+        if (sim.recording != NULL) sim.recording->record(sim.step_num, event);
+        handle_input(event);
+    }
+    if (sim.replay != NULL) {
+        while (sim.replay->next(sim.step_num, event))
+            handle_input(event);
+    }
+    sim.camera_previous = camera.getCurrentState();
+    simulation_step(step);
+    sim.step_num++;
+    sim.digest = state_digest(sim.digest);
+}
+
+// Evaluates the poses at passed_time into the producer's frame and publishes it
+static void publish_simulation(Simulation &sim, float passed_time) {
+    Pacing::Clock::time_point start = Pacing::Clock::now();
+    SimFrame &frame = sim.frames.write();
+    frame.version = ++sim.version;
+    frame.step = sim.step_num;
+    frame.camera_previous = sim.camera_previous;
+    frame.camera = camera.getCurrentState();
+    frame.dual_quat = dual_quat_skinning;
+    frame.crowd = crowd_enabled;
+    frame.mouse_control = keyboard_mouse_enabled;
+    frame.bones_ready = false;
+
+    // --- You may edit below ---
+
+    // Example: Rotate the hand
+    // * turn around every 4 seconds
+    // float metacarpals_angle = passed_time * (M_PI / 4.0f);
+    // * target = metacarpals
+    // * rotation axis = (1, 0, 0)
+    // sim.pose.set(hand_rig.metacarpals, glm::rotate(glm::identity<glm::mat4>(), metacarpals_angle, glm::fvec3(1.0, 0.0, 0.0)));
+
+    /**********************************************************************************\
+    *
+    * To animate fingers, call sim.pose.set(bone, modifier) each frame, where bone is the
+    * ID of one of the bones in the Hand's Hierarchy (see hand_rig.h).
+    *
+    * A virtual hand's structure is like this: (slightly DIFFERENT from the real world)
+    *    5432 1
+    *    ....        1 = thumb           . = fingertip
+    *    |||| .      2 = index finger    | = distal phalange
+    *    $$$$ |      3 = middle finger   $ = intermediate phalange
+    *    #### $      4 = ring finger     # = proximal phalange
+    *    OOOO#       5 = pinky           O = metacarpals
+    *     OOO
+    * (Hand in the real world -> https://en.wikipedia.org/wiki/Hand)
+    *
+    * From the structure we can infer the Hand's Hierarchy:
+    *	- metacarpals
+    *		- thumb_proximal_phalange
+    *			- thumb_intermediate_phalange
+    *				- thumb_distal_phalange
+    *					- thumb_fingertip
+    *		- index_proximal_phalange
+    *			- index_intermediate_phalange
+    *				- index_distal_phalange
+    *					- index_fingertip
+    *		- middle_proximal_phalange
+    *			- middle_intermediate_phalange
+    *				- middle_distal_phalange
+    *					- middle_fingertip
+    *		- ring_proximal_phalange
+    *			- ring_intermediate_phalange
+    *				- ring_distal_phalange
+    *					- ring_fingertip
+    *		- pinky_proximal_phalange
+    *			- pinky_intermediate_phalange
+    *				- pinky_distal_phalange
+    *					- pinky_fingertip
+    *
+    * Notice that the modifier of a bone is a local transformation matrix,
+    * where (1, 0, 0) is the bone's direction, and apparently (0, 1, 0) / (0, 0, 1)
+    * is perpendicular to the bone.
+    * Particularly, (0, 0, 1) is the rotation axis of the nearer joint.
+    *
+    \**********************************************************************************/
+
+// #define EXAMPLE_CODE
+#ifdef EXAMPLE_CODE
+    // Example: Animate the index finger
+    // * period = 2.4 seconds
+    float period = 2.4f;
+    float time_in_period = fmod(passed_time, period);
+    // * angle: 0 -> PI/3 -> 0
+    float thumb_angle = abs(time_in_period / (period * 0.5f) - 1.0f) * (M_PI / 3.0);
+    // * target = proximal phalange of the index
+    // * rotation axis = (0, 0, 1)
+    sim.pose.set(hand_rig.finger[HandRig::Index][HandRig::Proximal],
+                 glm::rotate(glm::identity<glm::mat4>(), thumb_angle, glm::fvec3(0.0, 0.0, 1.0)));
+#endif // EXAMPLE_CODE
+
+    apply_display_mode(sim.pose, passed_time, &sim.clip_cursor);
+
+    // --- You may edit above ---
+
+    size_t bone_num = sim.skeleton->boneNum();
+    if (crowd_enabled) {
+        size_t stride = bone_num + 1;
+        if (frame.crowd_palette.size() != CROWD_INSTANCE_NUM * stride) {
+            frame.crowd_palette.assign(CROWD_INSTANCE_NUM * stride, glm::fmat4(1.0f));
+            for (int i = 0; i < CROWD_INSTANCE_NUM; i++)
+                frame.crowd_palette[i * stride] = crowd_model(i);
+        }
+        // Every hand runs the same mode with its own phase
+        sim.crowd_evaluator.evaluate(sim.jobs, CROWD_INSTANCE_NUM,
+                                     [passed_time](size_t i, SkeletalMesh::PoseBuffer &instance_pose) {
+                                         apply_display_mode(instance_pose, passed_time + 0.37f * i);
+                                     },
+                                     &frame.crowd_palette[1], stride);
+    } else if (bone_num > 0) {
+        // Same as Scene::getSkeletonTransform(), without needing a GL-backed Scene
+        if (sim.bones.size() != bone_num) {
+            sim.bones.assign(bone_num, glm::fmat4(1.0f));
+            sim.pose.invalidate();
+        }
+        sim.pose.evaluate(*sim.skeleton, sim.bones.data());
+        for (size_t i = 0; i < bone_num; i++)
+            if (sim.pose.boneChanged[i]) sim.bone_version[i] = frame.version;
+        // Dual quaternions follow the changed bones, or all of them after running without
+        if (dual_quat_skinning && !sim.dual_quat_valid) {
+            SkeletalMesh::toDualQuat(sim.bones, sim.bones_dual_quat);
+        } else if (dual_quat_skinning) {
+            for (size_t i = 0; i < bone_num; i++)
+                if (sim.pose.boneChanged[i])
+                    sim.bones_dual_quat[i] = SkeletalMesh::DualQuat::fromMatrix(sim.bones[i]);
+        }
+        sim.dual_quat_valid = dual_quat_skinning;
+        frame.bones = sim.bones;
+        if (dual_quat_skinning) frame.bones_dual_quat = sim.bones_dual_quat;
+        frame.bone_version = sim.bone_version;
+        frame.bones_ready = true;
+    }
+    frame.stamp = Pacing::Clock::now();
+    frame.evaluate_ms = (float) Pacing::elapsed_ms(start, frame.stamp);
+    sim.frames.publish();
+}
+
+// Bones of the single hand recomposed on the CPU and palette entries written to the GPU last frame
+struct PaletteStats {
+    size_t bone_num;
+    size_t bone_changed;
+    size_t bone_uploaded;
+};
+
+static void draw_profiler_overlay(Profiling::FrameProfiler &profiler, const SkeletalMesh::RenderStats &render_stats,
+                                  const PaletteStats &palette_stats, const Pacing::FixedStep &fixed_step,
+                                  const Pacing::FramePacer &pacer, const SimFrame &sim_frame, bool threaded) {
+    ImGui::SetNextWindowPos(ImVec2(10.0f, 10.0f), ImGuiCond_FirstUseEver);
+    ImGui::SetNextWindowBgAlpha(0.75f);
+    if (!ImGui::Begin("Frame profiler", &profiler_overlay, ImGuiWindowFlags_AlwaysAutoResize)) {
+        ImGui::End();
+        return;
+    }
+    const Profiling::History &frames = profiler.getFrameHistory();
+    ImGui::Text("frame  avg %.2f ms  p95 %.2f ms  max %.2f ms", frames.average(), frames.percentile(0.95f),
+                frames.maximum());
+    float max_ms = std::max(frames.maximum(), 1.0f);
+    ImGui::PlotLines("##frame", frames.data(), (int) frames.size(), (int) frames.offset(), NULL, 0.0f, max_ms,
+                     ImVec2(320.0f, 48.0f));
+    float bins[FRAME_PROFILER_BIN_NUM];
+    frames.histogram(max_ms, bins);
+    ImGui::PlotHistogram("##frame_histogram", bins, FRAME_PROFILER_BIN_NUM, 0, "0 .. max ms", 0.0f, FLT_MAX,
+                         ImVec2(320.0f, 48.0f));
+
+    bool gpu_timing = profiler.getGpuTiming();
+    if (ImGui::Checkbox("GL timer queries", &gpu_timing))
+        profiler.setGpuTiming(gpu_timing);
+
+    ImGui::Text("draws %d  state changes %d  (program %d, texture %d, vao %d, uniform %d)  packets %d",
+                render_stats.drawNum, render_stats.stateChange(), render_stats.programChange,
+                render_stats.textureChange, render_stats.vaoChange, render_stats.uniformChange,
+                render_stats.packetNum);
+    ImGui::Text("bones changed %zu / %zu  palette entries uploaded %zu", palette_stats.bone_changed,
+                palette_stats.bone_num, palette_stats.bone_uploaded);
+    if (threaded)
+        ImGui::Text("simulation thread  tick %.0f Hz  step %llu  evaluate %.3f ms  input dropped %d",
+                    fixed_step.getRate(), (unsigned long long) sim_frame.step, sim_frame.evaluate_ms, input_dropped);
+    else
+        ImGui::Text("tick %.0f Hz  steps %d  alpha %.2f  dropped %.2f s  evaluate %.3f ms", fixed_step.getRate(),
+                    fixed_step.getLastSteps(), fixed_step.alpha(), fixed_step.getDroppedSeconds(),
+                    sim_frame.evaluate_ms);
+    const Profiling::History &jitter = pacer.getJitterHistory();
+    if (pacer.getTargetRate() > 0.0)
+        ImGui::Text("pacing %.0f fps  jitter avg %.3f ms  p95 %.3f ms  max %.3f ms  sleep %.2f ms",
+                    pacer.getTargetRate(), jitter.average(), jitter.percentile(0.95f), jitter.maximum(),
+                    pacer.sleepEstimateMs());
+    else
+        ImGui::Text("pacing off  interval avg %.2f ms  p95 %.2f ms", pacer.getIntervalHistory().average(),
+                    pacer.getIntervalHistory().percentile(0.95f));
+
+    for (size_t i = 0; i < profiler.getStageNum(); i++) {
+        Profiling::StageId stage = (Profiling::StageId) i;
+        const Profiling::History &cpu = profiler.getCpuHistory(stage);
+        const Profiling::History &gpu = profiler.getGpuHistory(stage);
+        const char *name = profiler.getStageName(stage).c_str();
+        if (gpu_timing && gpu.size() > 0)
+            ImGui::Text("%-8s cpu %6.3f ms (max %6.3f)  gl %6.3f ms", name, cpu.average(), cpu.maximum(),
+                        gpu.average());
+        else
+            ImGui::Text("%-8s cpu %6.3f ms (max %6.3f)", name, cpu.average(), cpu.maximum());
+        ImGui::PushID((int) i);
+        ImGui::PlotLines("##cpu", cpu.data(), (int) cpu.size(), (int) cpu.offset(), NULL, 0.0f,
+                         std::max(cpu.maximum(), 0.1f), ImVec2(320.0f, 24.0f));
+        ImGui::PopID();
+    }
+    ImGui::End();
+}
+
+// Compares the state a finished replay ended in with the one its recording ended in
+static bool check_replay(const Replay::InputTrace &trace, const Simulation &sim) {
+    if (!replay_finished(sim)) {
+        std::cout << "Replay stopped at step " << sim.step_num << " of " << trace.getStepNum() << std::endl;
+        return false;
+    }
+    char digest[17];
+    snprintf(digest, sizeof(digest), "%016llx", (unsigned long long) sim.digest);
+    if (trace.getDigest() == 0) {
+        std::cout << "Replay digest " << digest << std::endl;
+        return true;
+    }
+    if (trace.getDigest() != sim.digest) {
+        std::cout << "Error occured: replay digest " << digest << " differs from the recording" << std::endl;
+        return false;
+    }
+    std::cout << "Replay digest " << digest << " matches the recording" << std::endl;
+    return true;
+}
+
+// Replays trace without a window or GL, for regression runs. The skeleton and clips come straight from the
+// baked file, and steps run back to back, each timed like a frame with its input and pose stages.
+static bool replay_headless(Replay::InputTrace &trace, const std::string &trace_filename) {
+    MeshCache::BakedFile baked;
+    if (!SkeletalMesh::Scene::openBaked(DATA_DIR"/Hand.fbx", baked)) {
+        std::cout << "Error occured in openBaked()" << std::endl;
+        return false;
+    }
+    SkeletalMesh::Skeleton skeleton;
+    SkeletalMesh::Scene::Name2Bone name_bone_map;
+    if (!SkeletalMesh::Scene::buildSkeleton(baked, skeleton, name_bone_map)) {
+        std::cout << "Error occured in buildSkeleton()" << std::endl;
+        return false;
+    }
+    if (!hand_rig.bind(name_bone_map))
+        std::cout << "Error occured in HandRig::Binding::bind()" << std::endl;
+    std::vector<SkeletalMesh::AnimationClip> clips;
+    SkeletalMesh::Scene::buildAnimationClips(baked, skeleton, clips);
+    if (!clips.empty()) hand_clip = &clips[0];
+
+    Parallel::JobSystem jobs;
+    Simulation sim;
+    bind_simulation(sim, skeleton, jobs);
+    sim.replay = &trace;
+
+    Profiling::FrameProfiler profiler;
+    Profiling::StageId input = profiler.addStage("input");
+    Profiling::StageId pose = profiler.addStage("pose");
+    profiler.setTracing(!trace_filename.empty());
+    float step = (float) (1.0 / trace.getRate());
+    Pacing::Clock::time_point start = Pacing::Clock::now();
+    publish_simulation(sim, 0.0f);
+    while (!replay_finished(sim)) {
+        profiler.beginFrame();
+        {
+            Profiling::FrameProfiler::Scope scope(profiler, input);
+            advance_simulation(sim, step);
+        }
+        {
+            Profiling::FrameProfiler::Scope scope(profiler, pose);
+            publish_simulation(sim, (float) (sim.step_num * step));
+        }
+        profiler.endFrame();
+    }
+    double total_ms = Pacing::elapsed_ms(start, Pacing::Clock::now());
+    printf("Replayed %llu steps, %zu events in %.2f ms (%.3f ms per step)\n", (unsigned long long) sim.step_num,
+           trace.getEventNum(), total_ms, sim.step_num > 0 ? total_ms / sim.step_num : 0.0);
+    hand_clip = NULL;
+
+    if (!trace_filename.empty()) {
+        if (profiler.writeTrace(trace_filename))
+            std::cout << "Frame trace written to " << trace_filename << std::endl;
+        else
+            std::cout << "Error occured writing " << trace_filename << std::endl;
+    }
+    return check_replay(trace, sim);
+}
 
 int main(int argc, char *argv[]) {
+    // --trace FILE writes every frame's stage times to FILE (.json for JSON, CSV otherwise) on exit,
+    // --gpu-timing starts with GL timer queries enabled, --compact-vertices uploads the 24-byte vertex format,
+    // --lod R1,R2,... bakes LOD levels with these triangle ratios ("none" for none),
+    // --texture-budget MS caps the per-frame texture upload time (0 loads textures synchronously),
+    // --no-texture-compression bakes textures as RGBA8 instead of BC1 / BC3,
+    // --no-indirect submits draws with glMultiDrawElementsBaseVertex even where indirect draws exist,
+    // --tick-rate HZ sets the fixed simulation rate, --fps N caps the frame rate (0 for no cap, default
+    // the monitor's refresh rate), --vsync waits for vertical sync instead of capping,
+    // --single-thread runs the simulation on the GL thread instead of its own,
+    // --record FILE writes the input of the session to FILE on exit, --replay FILE plays such a trace back
+    // instead of live input and exits at its end, --headless replays without a window
+    std::string trace_filename;
+    std::string record_filename, replay_filename;
+    bool headless = false;
+    bool gpu_timing = false;
+    double texture_budget_ms = 2.0;
+    double tick_rate = 60.0;
+    double frame_rate = -1.0;
+    bool vsync = false;
+    bool threaded = true;
+    SkeletalMesh::VertexFormat vertex_format = SkeletalMesh::VertexFull;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc) trace_filename = argv[++i];
+        else if (strcmp(argv[i], "--gpu-timing") == 0) gpu_timing = true;
+        else if (strcmp(argv[i], "--compact-vertices") == 0) vertex_format = SkeletalMesh::VertexCompact;
+        else if (strcmp(argv[i], "--lod") == 0 && i + 1 < argc) {
+            if (!parse_lod_ratios(argv[++i], SkeletalMesh::Scene::lodSettings.ratio))
+                std::cout << "Invalid LOD ratios " << argv[i] << std::endl;
+        }
+        else if (strcmp(argv[i], "--texture-budget") == 0 && i + 1 < argc)
+            texture_budget_ms = std::max(atof(argv[++i]), 0.0);
+        else if (strcmp(argv[i], "--no-texture-compression") == 0) TextureImage::Texture::compression = false;
+        else if (strcmp(argv[i], "--no-indirect") == 0) SkeletalMesh::RenderQueue::indirect = false;
+        else if (strcmp(argv[i], "--tick-rate") == 0 && i + 1 < argc) {
+            tick_rate = atof(argv[++i]);
+            if (tick_rate <= 0.0) {
+                std::cout << "Invalid tick rate " << argv[i] << std::endl;
+                tick_rate = 60.0;
+            }
+        }
+        else if (strcmp(argv[i], "--fps") == 0 && i + 1 < argc) frame_rate = std::max(atof(argv[++i]), 0.0);
+        else if (strcmp(argv[i], "--vsync") == 0) vsync = true;
+        else if (strcmp(argv[i], "--single-thread") == 0) threaded = false;
+        else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc) record_filename = argv[++i];
+        else if (strcmp(argv[i], "--replay") == 0 && i + 1 < argc) replay_filename = argv[++i];
+        else if (strcmp(argv[i], "--headless") == 0) headless = true;
+        else std::cout << "Unknown option " << argv[i] << std::endl;
+    }
+
+    // A replay runs at the rate it was recorded at
+    Replay::InputTrace recording, replay;
+    if (!replay_filename.empty()) {
+        if (!replay.load(replay_filename)) {
+            std::cout << "Error occured reading " << replay_filename << std::endl;
+            exit(EXIT_FAILURE);
+        }
+        if (replay.getRate() != tick_rate)
+            std::cout << "Replaying at the recorded tick rate " << replay.getRate() << " Hz" << std::endl;
+        tick_rate = replay.getRate();
+        if (!record_filename.empty()) {
+            std::cout << "Not recording while replaying" << std::endl;
+            record_filename.clear();
+        }
+    } else if (headless) {
+        std::cout << "--headless needs --replay FILE" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    recording.clear(tick_rate);
+    if (headless)
+        exit(replay_headless(replay, trace_filename) ? EXIT_SUCCESS : EXIT_FAILURE);
+
     GLFWwindow *window;
-    GLuint vertex_shader, fragment_shader, program;
+    SkinProgram skin, skin_dqs, skin_crowd;
 
     glfwSetErrorCallback(error_callback);
 
@@ -473,36 +1122,81 @@ int main(int argc, char *argv[]) {
     glfwSetScrollCallback(window, scroll_callback);
 
     glfwMakeContextCurrent(window);
-    glfwSwapInterval(0);
+    glfwSwapInterval(vsync ? 1 : 0);
+    if (frame_rate < 0.0) {
+        GLFWmonitor *monitor = glfwGetPrimaryMonitor();
+        const GLFWvidmode *video_mode = monitor != NULL ? glfwGetVideoMode(monitor) : NULL;
+        bool refresh_known = video_mode != NULL && video_mode->refreshRate > 0;
+        frame_rate = vsync ? 0.0 : (refresh_known ? video_mode->refreshRate : 60.0);
+    }
 
     if (glewInit() != GLEW_OK)
         exit(EXIT_FAILURE);
 
-    vertex_shader = glCreateShader(GL_VERTEX_SHADER);
-    glShaderSource(vertex_shader, 1, &SkeletalAnimation::vertex_shader_330, NULL);
-    glCompileShader(vertex_shader);
+    // Installs its callbacks in front of ours and chains to them
+    ImGui::CreateContext();
+    ImGui_ImplGlfw_InitForOpenGL(window, true);
+    ImGui_ImplOpenGL3_Init("#version 330");
 
-    fragment_shader = glCreateShader(GL_FRAGMENT_SHADER);
-    glShaderSource(fragment_shader, 1, &SkeletalAnimation::fragment_shader_330, NULL);
-    glCompileShader(fragment_shader);
-
-    program = glCreateProgram();
-    glAttachShader(program, vertex_shader);
-    glAttachShader(program, fragment_shader);
-    glLinkProgram(program);
+    skin = build_skin_program(SkeletalAnimation::vertex_shader_330, "u_bone_data", SKIN_SHADER_BONE_CHANNEL);
+    skin_dqs = build_skin_program(SkeletalAnimation::vertex_shader_dqs_330, "u_bone_data", SKIN_SHADER_BONE_CHANNEL);
+    skin_crowd = build_skin_program(SkeletalAnimation::vertex_shader_crowd_330, "u_instance_data",
+                                    CROWD_SHADER_INSTANCE_CHANNEL);
 
-    int linkStatus;
-    if (glGetProgramiv(program, GL_LINK_STATUS, &linkStatus), linkStatus == GL_FALSE)
-        std::cout << "Error occured in glLinkProgram()" << std::endl;
+    // Materials bind a placeholder until their images are decoded and streamed in
+    TextureImage::Streamer texture_streamer;
+    if (texture_budget_ms > 0.0) TextureImage::Texture::streamer = &texture_streamer;
 
-    SkeletalMesh::Scene &sr = SkeletalMesh::Scene::loadScene("Hand", DATA_DIR"/Hand.fbx");
+    SkeletalMesh::Scene &sr = SkeletalMesh::Scene::loadScene("Hand", DATA_DIR"/Hand.fbx", vertex_format);
     if (&sr == &SkeletalMesh::Scene::error)
         std::cout << "Error occured in loadMesh()" << std::endl;
 
-    sr.setShaderInput(program, "in_position", "in_texcoord", "in_normal", "in_bone_index", "in_bone_weight");
-
-    float passed_time;
-    SkeletalMesh::SkeletonModifier modifier;
+    sr.setShaderInput(skin.program, "in_position", "in_texcoord", "in_normal", "in_bone_index", "in_bone_weight",
+                      "in_diffuse_layer");
+    sr.setPositionDecode(skin.program, "u_position_min", "u_position_extent");
+    sr.setPositionDecode(skin_dqs.program, "u_position_min", "u_position_extent");
+    sr.setPositionDecode(skin_crowd.program, "u_position_min", "u_position_extent");
+
+    if (!hand_rig.bind(sr.getNameBoneMap()))
+        std::cout << "Error occured in HandRig::Binding::bind()" << std::endl;
+
+    if (sr.getAnimationClipNum() > 0)
+        hand_clip = &sr.getAnimationClip(0);
+
+    // Palettes of the single hand, one per skinning method; each uploads only the bones it has not seen yet
+    size_t palette_bone_num = std::max(sr.getSkeleton().boneNum(), (size_t) 1);
+    SkeletalMesh::PaletteRing matrix_palette, dual_quat_palette;
+    matrix_palette.create(palette_bone_num, sizeof(glm::fmat4));
+    dual_quat_palette.create(palette_bone_num, sizeof(SkeletalMesh::DualQuat));
+    bool palette_dual_quat = dual_quat_skinning;
+    // Version of the last frame whose bones were taken
+    uint64_t palette_version = 0;
+    PaletteStats palette_stats = {sr.getSkeleton().boneNum(), 0, 0};
+
+    Parallel::JobSystem jobs;
+    Simulation sim;
+    bind_simulation(sim, sr.getSkeleton(), jobs);
+    if (!replay_filename.empty()) sim.replay = &replay;
+    if (!record_filename.empty()) sim.recording = &recording;
+    // Instance data arrives with the simulation frames
+    SkeletalMesh::CrowdBuffer crowd;
+    crowd.resize(CROWD_INSTANCE_NUM, sr.getSkeleton().boneNum());
+    glUseProgram(skin_crowd.program);
+    glUniform1i(glGetUniformLocation(skin_crowd.program, "u_bone_num"), (GLint) crowd.getBoneNum());
+    glUseProgram(0);
+    // Instances grouped by LOD each frame, drawn with one instanced call per level
+    std::vector<int> crowd_lod(CROWD_INSTANCE_NUM);
+    std::vector<uint32_t> crowd_order(CROWD_INSTANCE_NUM);
+    std::vector<GLsizei> crowd_lod_count, crowd_lod_base;
+
+    // Draws of every scene and instance, sorted by state and submitted once per frame
+    SkeletalMesh::RenderQueue render_queue(SCENE_RESOURCE_SHADER_DIFFUSE_CHANNEL);
+    render_queue.setInstanceBaseUniform("u_instance_base");
+
+    Profiling::FrameProfiler profiler;
+    FrameStages stages(profiler);
+    profiler.setGpuTiming(gpu_timing);
+    profiler.setTracing(!trace_filename.empty());
 
     glEnable(GL_DEPTH_TEST);
     
@@ -510,139 +1204,92 @@ int main(int argc, char *argv[]) {
 
     static int ticked_time_sec = 0;
 
-    while (!glfwWindowShouldClose(window)) {
-        passed_time = (float) glfwGetTime();
+    // The camera and transitions advance in fixed steps; frames show them interpolated between the last two.
+    // Threaded, the simulation paces itself at the tick rate and the GL thread draws its latest frame.
+    Pacing::FixedStep fixed_step(tick_rate);
+    Pacing::FramePacer pacer;
+    pacer.setTargetRate(frame_rate);
+    QuaternionCamera display_camera;
+    bool cursor_captured = false;
+    double last_frame = glfwGetTime();
+
+    publish_simulation(sim, 0.0f);
+    std::atomic<bool> simulating(threaded);
+    std::thread simulation_thread;
+    if (threaded) {
+        float step = (float) fixed_step.getStep();
+        simulation_thread = std::thread([&sim, &simulating, step, tick_rate]() {
+            Pacing::FramePacer tick_pacer;
+            tick_pacer.setTargetRate(tick_rate);
+            while (simulating.load() && !replay_finished(sim)) {
+                advance_simulation(sim, step);
+                publish_simulation(sim, (float) (sim.step_num * step));
+                tick_pacer.wait();
+            }
+        });
+    }
 
-        static float last_frame = 0.0f;
-        float current_frame = passed_time;
-        float delta_time = current_frame - last_frame;
-        last_frame = current_frame;
+    while (!glfwWindowShouldClose(window)) {
+        profiler.beginFrame();
+        double current_frame = glfwGetTime();
 // #define DEV_DEBUGGING
 #ifdef DEV_DEBUGGING
-        if (passed_time >= ticked_time_sec) {
-            std::cout << "At " << passed_time << std::endl;
+        if (current_frame >= ticked_time_sec) {
+            std::cout << "At " << current_frame << std::endl;
             ticked_time_sec += 1;
-            camera.reportStatus();
+            display_camera.reportStatus();
         }
 #endif // DEV_DEBUGGING
 
-        // --- You may edit below ---
-
-        if (isTransitioning) {
-            transitionProgress += delta_time / transitionDuration;
-            if (transitionProgress >= 1.0f) {
-                // Transition complete
-                transitionProgress = 1.0f;
-                isTransitioning = false;
-                camera.setState(transitionEnd);
-                std::cout << "Transition complete" << std::endl;
-            } else {
-                // Update camera during transition
-                CameraState currentState = camera.getTransitionState(transitionStart, transitionEnd, transitionProgress);
-                camera.setState(currentState);
-            }
-        } else if (keyboard_mouse_enabled) {
-            camera.processKeyboard(
-                glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS,
-                glfwGetKey(window, GLFW_KEY_A) == GLFW_PRESS,
-                glfwGetKey(window, GLFW_KEY_S) == GLFW_PRESS,
-                glfwGetKey(window, GLFW_KEY_D) == GLFW_PRESS,
-                glfwGetKey(window, GLFW_KEY_SPACE) == GLFW_PRESS,
-                glfwGetKey(window, GLFW_KEY_LEFT_SHIFT) == GLFW_PRESS,
-                delta_time
-            );
-            camera.updateCameraOrientation(delta_time);
+        if (!threaded) {
+            Profiling::FrameProfiler::Scope scope(profiler, stages.input);
+            int step_num = fixed_step.advance(current_frame - last_frame);
+            for (int i = 0; i < step_num && !replay_finished(sim); i++)
+                advance_simulation(sim, (float) fixed_step.getStep());
         }
+        last_frame = current_frame;
 
-        // Example: Rotate the hand
-        // * turn around every 4 seconds
-        // float metacarpals_angle = passed_time * (M_PI / 4.0f);
-        // * target = metacarpals
-        // * rotation axis = (1, 0, 0)
-        // modifier["metacarpals"] = glm::rotate(glm::identity<glm::mat4>(), metacarpals_angle, glm::fvec3(1.0, 0.0, 0.0));
-
-        /**********************************************************************************\
-        *
-        * To animate fingers, modify modifier["HAND_SECTION"] each frame,
-        * where HAND_SECTION can only be one of the bone names in the Hand's Hierarchy.
-        *
-        * A virtual hand's structure is like this: (slightly DIFFERENT from the real world)
-        *    5432 1
-        *    ....        1 = thumb           . = fingertip
-        *    |||| .      2 = index finger    | = distal phalange
-        *    $$$$ |      3 = middle finger   $ = intermediate phalange
-        *    #### $      4 = ring finger     # = proximal phalange
-        *    OOOO#       5 = pinky           O = metacarpals
-        *     OOO
-        * (Hand in the real world -> https://en.wikipedia.org/wiki/Hand)
-        *
-        * From the structure we can infer the Hand's Hierarchy:
-        *	- metacarpals
-        *		- thumb_proximal_phalange
-        *			- thumb_intermediate_phalange
-        *				- thumb_distal_phalange
-        *					- thumb_fingertip
-        *		- index_proximal_phalange
-        *			- index_intermediate_phalange
-        *				- index_distal_phalange
-        *					- index_fingertip
-        *		- middle_proximal_phalange
-        *			- middle_intermediate_phalange
-        *				- middle_distal_phalange
-        *					- middle_fingertip
-        *		- ring_proximal_phalange
-        *			- ring_intermediate_phalange
-        *				- ring_distal_phalange
-        *					- ring_fingertip
-        *		- pinky_proximal_phalange
-        *			- pinky_intermediate_phalange
-        *				- pinky_distal_phalange
-        *					- pinky_fingertip
-        *
-        * Notice that modifier["HAND_SECTION"] is a local transformation matrix,
-        * where (1, 0, 0) is the bone's direction, and apparently (0, 1, 0) / (0, 0, 1)
-        * is perpendicular to the bone.
-        * Particularly, (0, 0, 1) is the rotation axis of the nearer joint.
-        *
-        \**********************************************************************************/
-
-// #define EXAMPLE_CODE
-#ifdef EXAMPLE_CODE
-        // Example: Animate the index finger
-        // * period = 2.4 seconds
-        float period = 2.4f;
-        float time_in_period = fmod(passed_time, period);
-        // * angle: 0 -> PI/3 -> 0
-        float thumb_angle = abs(time_in_period / (period * 0.5f) - 1.0f) * (M_PI / 3.0);
-        // * target = proximal phalange of the index
-        // * rotation axis = (0, 0, 1)
-        modifier["index_proximal_phalange"] = glm::rotate(glm::identity<glm::mat4>(), thumb_angle,
-                                                          glm::fvec3(0.0, 0.0, 1.0));
-#endif // EXAMPLE_CODE
+        if (texture_streamer.getPendingNum() > 0) {
+            Profiling::FrameProfiler::Scope scope(profiler, stages.upload);
+            texture_streamer.update(texture_budget_ms);
+        }
 
-        switch (current_mode) {
-            case Completion1:
-                completion_1(modifier, passed_time);
-                break;
-            case Completion2:
-                completion_2(modifier, passed_time);
-                break;
-            case Completion3:
-                completion_3(modifier, passed_time);
-                break;
-            case DefaultRotate:
-                default_rotate(modifier, passed_time);
-                keyboard_mouse_control(modifier);
-                break;
-            case Default:
-                finger_move_clear(modifier);
-                keyboard_mouse_control(modifier);
-                break;
-            default:
-                break;
+        {
+            Profiling::FrameProfiler::Scope scope(profiler, stages.pose);
+            // Inline, poses are sampled at the display time, between the same two steps as the camera
+            if (!threaded) publish_simulation(sim, (float) fixed_step.displayTime());
+            sim.frames.update();
+        }
+        const SimFrame &frame = sim.frames.read();
+        float alpha = (float) fixed_step.alpha();
+        if (threaded)
+            alpha = (float) std::min(Pacing::elapsed_ms(frame.stamp, Pacing::Clock::now()) * 1e-3 /
+                                     fixed_step.getStep(), 1.0);
+        display_camera.setState(QuaternionCamera::interpolateState(frame.camera_previous, frame.camera, alpha));
+        if (sim.replay != NULL && frame.step >= replay.getStepNum()) glfwSetWindowShouldClose(window, GLFW_TRUE);
+        // Follows the simulation, which may never see an F press that was dropped or replaced by a replay
+        if (frame.mouse_control != cursor_captured) {
+            cursor_captured = frame.mouse_control;
+            glfwSetInputMode(window, GLFW_CURSOR, cursor_captured ? GLFW_CURSOR_DISABLED : GLFW_CURSOR_NORMAL);
         }
 
-        // --- You may edit above ---
+        // Bones changed since the last frame taken; the other palette missed every change made while it was idle
+        palette_stats.bone_changed = 0;
+        if (frame.bones_ready && frame.version != palette_version) {
+            SkeletalMesh::PaletteRing &palette = frame.dual_quat ? dual_quat_palette : matrix_palette;
+            if (palette_dual_quat != frame.dual_quat) {
+                palette.touchAll();
+                palette_dual_quat = frame.dual_quat;
+                palette_stats.bone_changed = frame.bones.size();
+            } else {
+                for (size_t i = 0; i < frame.bone_version.size(); i++) {
+                    if (frame.bone_version[i] <= palette_version) continue;
+                    palette.touch(i);
+                    palette_stats.bone_changed++;
+                }
+            }
+            palette_version = frame.version;
+        }
 
         float ratio;
         int width, height;
@@ -650,34 +1297,127 @@ int main(int argc, char *argv[]) {
         glfwGetFramebufferSize(window, &width, &height);
         ratio = width / (float) height;
 
+        profiler.beginStage(stages.draw);
         glClearColor(0.5, 0.5, 0.5, 1.0);
 
         glViewport(0, 0, width, height);
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        profiler.endStage(stages.draw);
+
+        // Using perspective
+        glm::fmat4 view = display_camera.getViewMatrix();
+        glm::fmat4 projection = display_camera.getProjectionMatrix(ratio, true);
+        glm::fmat4 mvp = projection * view;
+
+        if (frame.crowd) {
+            profiler.beginStage(stages.upload);
+            glUseProgram(skin_crowd.program);
+            glUniformMatrix4fv(skin_crowd.mvp, 1, GL_FALSE, (const GLfloat *) &mvp);
+            // Counting sort of the instances by LOD
+            crowd_lod_count.assign(std::max(sr.getLodNum(), 1), 0);
+            for (int i = 0; i < CROWD_INSTANCE_NUM; i++) {
+                crowd_lod[i] = lod_enabled ? sr.selectLod(projection, view * crowd_model(i), (float) height) : 0;
+                crowd_lod_count[crowd_lod[i]]++;
+            }
+            crowd_lod_base.assign(crowd_lod_count.size(), 0);
+            for (size_t l = 1; l < crowd_lod_base.size(); l++)
+                crowd_lod_base[l] = crowd_lod_base[l - 1] + crowd_lod_count[l - 1];
+            for (int i = 0; i < CROWD_INSTANCE_NUM; i++) crowd_order[crowd_lod_base[crowd_lod[i]]++] = (uint32_t) i;
+            crowd.upload(frame.crowd_palette.data(), crowd_order.data());
+            glUniform1i(skin_crowd.bone_base, crowd.getTexelBase());
+            crowd.bind(CROWD_SHADER_INSTANCE_CHANNEL);
+            profiler.endStage(stages.upload);
+
+            Profiling::FrameProfiler::Scope scope(profiler, stages.draw);
+            GLint instance_base = 0;
+            for (int l = 0; l < (int) crowd_lod_count.size(); l++) {
+                sr.enqueue(render_queue, skin_crowd.program, l, crowd_lod_count[l], instance_base);
+                instance_base += crowd_lod_count[l];
+            }
+            render_queue.submit();
+            crowd.fence();
+        } else {
+            profiler.beginStage(stages.upload);
+            // All programs share the attribute locations, so the scene's VAO serves any of them
+            const SkinProgram &active = frame.dual_quat ? skin_dqs : skin;
+            glUseProgram(active.program);
+
+            glUniformMatrix4fv(active.mvp, 1, GL_FALSE, (const GLfloat *) &mvp);
+            SkeletalMesh::PaletteRing &palette = frame.dual_quat ? dual_quat_palette : matrix_palette;
+            palette_stats.bone_uploaded = 0;
+            if (frame.bones_ready) {
+                const void *bones = frame.dual_quat ? (const void *) frame.bones_dual_quat.data()
+                                                    : (const void *) frame.bones.data();
+                palette_stats.bone_uploaded = palette.upload(bones);
+            }
+            // Frames without changes keep drawing from the region uploaded last
+            glUniform1i(active.bone_base, palette.texelOffset());
+            palette.bind(SKIN_SHADER_BONE_CHANNEL);
+            profiler.endStage(stages.upload);
+
+            Profiling::FrameProfiler::Scope scope(profiler, stages.draw);
+            sr.enqueue(render_queue, active.program, lod_enabled ? sr.selectLod(projection, view, (float) height) : 0);
+            render_queue.submit();
+            palette.fence();
+        }
 
-        glUseProgram(program);
+        if (profiler_overlay) {
+            Profiling::FrameProfiler::Scope scope(profiler, stages.overlay);
+            ImGui_ImplOpenGL3_NewFrame();
+            ImGui_ImplGlfw_NewFrame();
+            ImGui::NewFrame();
+            draw_profiler_overlay(profiler, render_queue.getStats(), palette_stats, fixed_step, pacer, frame,
+                                  threaded);
+            ImGui::Render();
+            ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+        }
 
-        glm::fmat4 mvp;
         {
-            // Using perspective
-            glm::mat4 view = camera.getViewMatrix();
-            glm::mat4 projection = camera.getProjectionMatrix(ratio, true);
-            mvp = projection * view;
+            Profiling::FrameProfiler::Scope scope(profiler, stages.swap);
+            glfwSwapBuffers(window);
         }
+        {
+            Profiling::FrameProfiler::Scope scope(profiler, stages.pace);
+            pacer.wait();
+        }
+        {
+            Profiling::FrameProfiler::Scope scope(profiler, stages.input);
+            glfwPollEvents();
+        }
+        profiler.endFrame();
+    }
 
-        glUniformMatrix4fv(glGetUniformLocation(program, "u_mvp"), 1, GL_FALSE, (const GLfloat *) &mvp);
-        glUniform1i(glGetUniformLocation(program, "u_diffuse"), SCENE_RESOURCE_SHADER_DIFFUSE_CHANNEL);
-        SkeletalMesh::Scene::SkeletonTransf bonesTransf;
-        sr.getSkeletonTransform(bonesTransf, modifier);
-        if (!bonesTransf.empty())
-            glUniformMatrix4fv(glGetUniformLocation(program, "u_bone_transf"), bonesTransf.size(), GL_FALSE,
-                               (float *) bonesTransf.data());
-        sr.render();
-
-        glfwSwapBuffers(window);
-        glfwPollEvents();
+    simulating.store(false);
+    if (simulation_thread.joinable()) simulation_thread.join();
+
+    if (sim.replay != NULL) check_replay(replay, sim);
+    if (sim.recording != NULL) {
+        recording.setStepNum(sim.step_num);
+        recording.setDigest(sim.digest);
+        if (recording.save(record_filename))
+            std::cout << "Input trace written to " << record_filename << " (" << recording.getEventNum()
+                      << " events, " << sim.step_num << " steps)" << std::endl;
+        else
+            std::cout << "Error occured writing " << record_filename << std::endl;
     }
 
+    if (!trace_filename.empty()) {
+        if (profiler.writeTrace(trace_filename))
+            std::cout << "Frame trace written to " << trace_filename << std::endl;
+        else
+            std::cout << "Error occured writing " << trace_filename << std::endl;
+    }
+    profiler.release();
+
+    ImGui_ImplOpenGL3_Shutdown();
+    ImGui_ImplGlfw_Shutdown();
+    ImGui::DestroyContext();
+
+    render_queue.clear();
+    matrix_palette.release();
+    dual_quat_palette.release();
+    crowd.clear();
+    texture_streamer.release();
     SkeletalMesh::Scene::unloadScene("Hand");
 
     glfwDestroyWindow(window);
@@ -685,147 +1425,3 @@ int main(int argc, char *argv[]) {
     glfwTerminate();
     exit(EXIT_SUCCESS);
 }
-
-static void finger_move_clear(SkeletalMesh::SkeletonModifier &modifier) {
-    modifier["metacarpals"] = glm::identity<glm::mat4>();
-
-    modifier["thumb_proximal_phalange"] = glm::identity<glm::mat4>();
-    modifier["thumb_intermediate_phalange"] = glm::identity<glm::mat4>();
-    modifier["thumb_distal_phalange"] = glm::identity<glm::mat4>();
-    modifier["thumb_fingertip"] = glm::identity<glm::mat4>();
-
-    modifier["index_proximal_phalange"] = glm::identity<glm::mat4>();
-    modifier["index_intermediate_phalange"] = glm::identity<glm::mat4>();
-    modifier["index_distal_phalange"] = glm::identity<glm::mat4>();
-    modifier["index_fingertip"] = glm::identity<glm::mat4>();
-
-    modifier["middle_proximal_phalange"] = glm::identity<glm::mat4>();
-    modifier["middle_intermediate_phalange"] = glm::identity<glm::mat4>();
-    modifier["middle_distal_phalange"] = glm::identity<glm::mat4>();
-    modifier["middle_fingertip"] = glm::identity<glm::mat4>();
-    
-    modifier["ring_proximal_phalange"] = glm::identity<glm::mat4>();
-    modifier["ring_intermediate_phalange"] = glm::identity<glm::mat4>();
-    modifier["ring_distal_phalange"] = glm::identity<glm::mat4>();
-    modifier["ring_fingertip"] = glm::identity<glm::mat4>();
-
-    modifier["pinky_proximal_phalange"] = glm::identity<glm::mat4>();
-    modifier["pinky_intermediate_phalange"] = glm::identity<glm::mat4>();
-    modifier["pinky_distal_phalange"] = glm::identity<glm::mat4>();
-    modifier["pinky_fingertip"] = glm::identity<glm::mat4>();
-}
-
-static void finger_move(SkeletalMesh::SkeletonModifier &modifier,
-                        std::string finger, float time_in_period, float period,
-                        float proximal_frac, float intermediate_frac,
-                        float distal_frac, float fingertip_frac) {
-  if (proximal_frac != 0.0) {
-    float proximal_angle =
-        abs(time_in_period / (period * 0.5f) - 1.0f) * (M_PI / proximal_frac);
-    std::string proximal_s = finger + "_proximal_phalange";
-    modifier[proximal_s] = glm::rotate(
-        glm::identity<glm::mat4>(), proximal_angle, glm::fvec3(0.0, 0.0, 1.0));
-  }
-
-  if (intermediate_frac != 0.0) {
-    float intermediate_angle = abs(time_in_period / (period * 0.5f) - 1.0f) *
-                               (M_PI / intermediate_frac);
-    std::string intermediate_s = finger + "_intermediate_phalange";
-    modifier[intermediate_s] =
-        glm::rotate(glm::identity<glm::mat4>(), intermediate_angle,
-                    glm::fvec3(0.0, 0.0, 1.0));
-  }
-
-  if (distal_frac != 0.0) {
-    float distal_angle =
-        abs(time_in_period / (period * 0.5f) - 1.0f) * (M_PI / distal_frac);
-    std::string distal_s = finger + "_distal_phalange";
-    modifier[distal_s] = glm::rotate(glm::identity<glm::mat4>(), distal_angle,
-                                     glm::fvec3(0.0, 0.0, 1.0));
-  }
-
-  if (fingertip_frac != 0.0) {
-    float fingertip_angle =
-        abs(time_in_period / (period * 0.5f) - 1.0f) * (M_PI / fingertip_frac);
-    std::string fingertip_s = finger + "_fingertip_phalange";
-    modifier[fingertip_s] = glm::rotate(
-        glm::identity<glm::mat4>(), fingertip_angle, glm::fvec3(0.0, 0.0, 1.0));
-  }
-}
-
-// Completion 1: grabing with 5 fingers
-static void completion_1(SkeletalMesh::SkeletonModifier &modifier, float passed_time) {
-    float period = 2.4f;
-    float time_in_period = fmod(passed_time, period);
-
-    finger_move_clear(modifier);
-    finger_move(modifier, "thumb", time_in_period, period, 6.0, 12.0, 12.0, 0.0);
-    finger_move(modifier, "index", time_in_period, period, 3.0, 3.0, 2.0, 0.0);
-    finger_move(modifier, "middle", time_in_period, period, 3.0, 3.0, 2.0, 0.0);
-    finger_move(modifier, "ring", time_in_period, period, 3.0, 3.0, 2.0, 0.0);
-    finger_move(modifier, "pinky", time_in_period, period, 3.0, 3.0, 2.0, 0.0);
-}
-
-// Completion 2: OK
-static void completion_2(SkeletalMesh::SkeletonModifier &modifier, float passed_time) {
-    float period = 2.4f;
-    float time_in_period = fmod(passed_time, period);
-
-    finger_move_clear(modifier);
-    finger_move(modifier, "thumb", time_in_period, period, 6.0, 12.0, 12.0, 12.0);
-    finger_move(modifier, "index", time_in_period, period, 6.0, 6.0, 2.0, 0.0);
-}
-
-static void completion_3(SkeletalMesh::SkeletonModifier &modifier, float passed_time) {
-    finger_move_clear(modifier);
-    float period = 2.4f;
-    float time_in_period = fmod(passed_time, period);
-
-    float metacarpals_angle = abs(time_in_period / (period * 0.5f) - 1.0f) * (M_PI / 2.3f);
-    // * target = metacarpals
-    // * rotation axis = (1, 0, 0)
-    modifier["metacarpals"] = glm::rotate(glm::identity<glm::mat4>(), metacarpals_angle, glm::fvec3(0.0, 1.0, 0.0));
-
-    finger_move(modifier, "thumb", time_in_period, period, 0.0, -6.0, -4.0, 0.0);
-    finger_move(modifier, "index", time_in_period, period, 3.0, 3.0, 2.0, 0.0);
-    finger_move(modifier, "middle", time_in_period, period, 3.0, 3.0, 2.0, 0.0);
-    finger_move(modifier, "ring", time_in_period, period, 3.0, 3.0, 2.0, 0.0);
-    finger_move(modifier, "pinky", time_in_period, period, 3.0, 3.0, 2.0, 0.0);
-}
-
-static void default_rotate(SkeletalMesh::SkeletonModifier &modifier, float passed_time) {
-    finger_move_clear(modifier);
-    float metacarpals_angle = passed_time * (M_PI / 4.0f);
-    modifier["metacarpals"] = glm::rotate(glm::identity<glm::mat4>(), metacarpals_angle, glm::fvec3(1.0, 0.0, 0.0));
-}
-
-static void km_finger_move(SkeletalMesh::SkeletonModifier &modifier,
-                           std::string finger,
-                           bool should_bent,
-                           float proximal_angle,
-                           float intermediate_angle,
-                           float distal_angle) {
-    std::string proximal_s = finger + "_proximal_phalange";
-    std::string intermediate_s = finger + "_intermediate_phalange";
-    std::string distal_s = finger + "_distal_phalange";
-
-    if (should_bent) {
-        modifier[proximal_s] = glm::rotate(glm::identity<glm::mat4>(), proximal_angle, glm::fvec3(0.0, 0.0, 1.0));
-        modifier[intermediate_s] = glm::rotate(glm::identity<glm::mat4>(), intermediate_angle, glm::fvec3(0.0, 0.0, 1.0));
-        modifier[distal_s] = glm::rotate(glm::identity<glm::mat4>(), distal_angle, glm::fvec3(0.0, 0.0, 1.0));
-    } else {
-        modifier[proximal_s] = glm::identity<glm::mat4>();
-        modifier[intermediate_s] = glm::identity<glm::mat4>();
-        modifier[distal_s] = glm::identity<glm::mat4>();
-    }
-}
-
-// Control when KeyboardMouseControl
-static void keyboard_mouse_control(SkeletalMesh::SkeletonModifier &modifier) {
-    float bend_angle = M_PI / 3.0f;
-    km_finger_move(modifier, "thumb", thumb_bent, bend_angle * 0.2, bend_angle * 0.3, bend_angle * 0.5);
-    km_finger_move(modifier, "index", index_bent, bend_angle, bend_angle * 0.9, bend_angle * 0.8);
-    km_finger_move(modifier, "middle", middle_bent, bend_angle, bend_angle * 0.9, bend_angle * 0.8);
-    km_finger_move(modifier, "ring", ring_bent, bend_angle * 0.9, bend_angle * 0.8, bend_angle * 0.7);
-    km_finger_move(modifier, "pinky", pinky_bent, bend_angle * 0.9, bend_angle * 0.8, bend_angle * 0.7);
-}
@@ -0,0 +1,467 @@
+// Baked Skeletal Mesh Cache
+// A versioned, memory-mappable snapshot of everything loadScene() extracts
+// from an imported file, so later runs can skip Assimp entirely.
+
+#pragma once
+
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <sys/stat.h>
+
+#ifndef _WIN32
+
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#endif
+
+#define MESH_CACHE_MAGIC 0x4B424E48u // "HNBK"
+#define MESH_CACHE_VERSION 5
+#define MESH_CACHE_SUFFIX ".bake"
+#define MESH_CACHE_ALIGNMENT 16
+#define MESH_CACHE_NO_STRING 0xFFFFFFFFu
+#define MESH_CACHE_CHANNEL_NUM 3
+
+namespace MeshCache {
+    // Identifies the source file a cache was baked from.
+    // Size and mtime reject stale caches cheaply, the checksum is authoritative.
+    struct SourceStamp {
+        uint64_t size;
+        int64_t mtime;
+        uint64_t checksum;
+
+        SourceStamp() : size(0), mtime(0), checksum(0) {}
+
+        bool operator==(const SourceStamp &_other) const {
+            return size == _other.size && mtime == _other.mtime && checksum == _other.checksum;
+        }
+
+        static bool query(const std::string &_filename, SourceStamp &_stamp) {
+            struct stat st;
+            if (stat(_filename.c_str(), &st) != 0) return false;
+            _stamp.size = (uint64_t) st.st_size;
+            _stamp.mtime = (int64_t) st.st_mtime;
+
+            FILE *fi = fopen(_filename.c_str(), "rb");
+            if (fi == NULL) return false;
+            // 64-bit FNV-1a over the whole file
+            uint64_t hash = 0xcbf29ce484222325ull;
+            unsigned char buffer[1 << 16];
+            size_t readNum;
+            while ((readNum = fread(buffer, 1, sizeof(buffer), fi)) > 0) {
+                for (size_t i = 0; i < readNum; i++) {
+                    hash ^= buffer[i];
+                    hash *= 0x100000001b3ull;
+                }
+            }
+            fclose(fi);
+            _stamp.checksum = hash;
+            return true;
+        }
+    };
+
+    struct Header {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t vertexStride;
+        uint32_t headerSize;
+        SourceStamp source;
+        uint32_t vertexNum;
+        uint32_t indexNum;
+        uint32_t meshNum;
+        uint32_t boneNum;
+        uint32_t nodeNum;
+        uint32_t materialNum;
+        uint32_t clipNum;
+        uint32_t trackNum;
+        uint32_t keyNum;
+        uint32_t lodNum;
+        uint64_t vertexOffset;
+        uint64_t indexOffset;
+        uint64_t meshOffset;
+        uint64_t boneOffset;
+        uint64_t nodeOffset;
+        uint64_t materialOffset;
+        uint64_t clipOffset;
+        uint64_t trackOffset;
+        uint64_t keyTimeOffset;
+        uint64_t keyValueOffset;
+        uint64_t lodOffset;
+        uint64_t lodMeshOffset;
+        uint64_t stringOffset;
+        uint64_t stringSize;
+    };
+
+    // Same layout as SkeletalMesh::MeshEntry
+    struct MeshRecord {
+        uint32_t facetCornerNum;
+        uint32_t indexOffset;
+        uint32_t vertexOffset;
+        uint32_t materialIndex;
+    };
+
+    // Matrices are stored as 16 floats in aiMatrix4x4 (row-major) order
+    struct BoneRecord {
+        float offsetMatrix[16];
+        uint32_t nameOffset;
+        uint32_t padding[3];
+    };
+
+    // Nodes are stored in pre-order, so parent < self and children keep their file order
+    struct NodeRecord {
+        float transformation[16];
+        int32_t parent;
+        uint32_t nameOffset;
+        uint32_t padding[2];
+    };
+
+    // One aiAnimation, its tracks are [trackOffset, trackOffset + trackNum) of the track table
+    struct ClipRecord {
+        uint32_t nameOffset;
+        uint32_t trackOffset;
+        uint32_t trackNum;
+        float duration;
+    };
+
+    // Keys of one bone: channel 0 translation, 1 rotation, 2 scale. Channel c owns keys
+    // [keyOffset[c], keyOffset[c] + keyNum[c]) of the key tables. Times are in seconds,
+    // values are 4 floats (rotations x, y, z, w, hemisphere-aligned with the previous key).
+    // bindLocal is the bone's local transform in aiMatrix4x4 order with any FBX pivot helpers above it folded in,
+    // which is what the channels animate
+    struct TrackRecord {
+        float bindLocal[16];
+        int32_t bone;
+        uint32_t keyOffset[MESH_CACHE_CHANNEL_NUM];
+        uint32_t keyNum[MESH_CACHE_CHANNEL_NUM];
+        uint32_t padding;
+    };
+
+    // One simplified level of every mesh. Level l (from 1) owns records [(l - 1) * meshNum, l * meshNum)
+    // of the LOD mesh table, which index into the shared index table over the base meshes' vertices.
+    // ratio and maxError are the requested target, error the largest collapse error actually accepted: the
+    // area-weighted RMS distance of a moved vertex to its original planes (see MeshSimplifier::Quadric), not a
+    // maximum surface deviation.
+    struct LodRecord {
+        float ratio;
+        float maxError;
+        float error;
+        uint32_t padding;
+    };
+
+    // Collects the sections of a cache and serializes them into one blob
+    class Builder {
+    public:
+        std::vector<char> vertexBlob;
+        std::vector<uint32_t> indices;
+        std::vector<MeshRecord> meshes;
+        std::vector<BoneRecord> bones;
+        std::vector<NodeRecord> nodes;
+        std::vector<uint32_t> materials;
+        std::vector<ClipRecord> clips;
+        std::vector<TrackRecord> tracks;
+        std::vector<float> keyTimes;
+        std::vector<float> keyValues;
+        std::vector<LodRecord> lods;
+        std::vector<MeshRecord> lodMeshes;
+
+        Builder() : strings() {}
+
+        uint32_t addString(const std::string &_s) {
+            uint32_t offset = (uint32_t) strings.size();
+            strings.insert(strings.end(), _s.begin(), _s.end());
+            strings.push_back('\0');
+            return offset;
+        }
+
+        void serialize(const SourceStamp &_source, uint32_t _vertexStride, std::vector<char> &_blob) const {
+            Header header = Header();
+            header.magic = MESH_CACHE_MAGIC;
+            header.version = MESH_CACHE_VERSION;
+            header.vertexStride = _vertexStride;
+            header.headerSize = sizeof(Header);
+            header.source = _source;
+            header.vertexNum = _vertexStride ? (uint32_t) (vertexBlob.size() / _vertexStride) : 0;
+            header.indexNum = (uint32_t) indices.size();
+            header.meshNum = (uint32_t) meshes.size();
+            header.boneNum = (uint32_t) bones.size();
+            header.nodeNum = (uint32_t) nodes.size();
+            header.materialNum = (uint32_t) materials.size();
+            header.clipNum = (uint32_t) clips.size();
+            header.trackNum = (uint32_t) tracks.size();
+            header.keyNum = (uint32_t) keyTimes.size();
+            header.lodNum = (uint32_t) lods.size();
+
+            uint64_t cursor = align(sizeof(Header));
+            header.vertexOffset = cursor;
+            cursor = align(cursor + vertexBlob.size());
+            header.indexOffset = cursor;
+            cursor = align(cursor + indices.size() * sizeof(uint32_t));
+            header.meshOffset = cursor;
+            cursor = align(cursor + meshes.size() * sizeof(MeshRecord));
+            header.boneOffset = cursor;
+            cursor = align(cursor + bones.size() * sizeof(BoneRecord));
+            header.nodeOffset = cursor;
+            cursor = align(cursor + nodes.size() * sizeof(NodeRecord));
+            header.materialOffset = cursor;
+            cursor = align(cursor + materials.size() * sizeof(uint32_t));
+            header.clipOffset = cursor;
+            cursor = align(cursor + clips.size() * sizeof(ClipRecord));
+            header.trackOffset = cursor;
+            cursor = align(cursor + tracks.size() * sizeof(TrackRecord));
+            header.keyTimeOffset = cursor;
+            cursor = align(cursor + keyTimes.size() * sizeof(float));
+            header.keyValueOffset = cursor;
+            cursor = align(cursor + keyValues.size() * sizeof(float));
+            header.lodOffset = cursor;
+            cursor = align(cursor + lods.size() * sizeof(LodRecord));
+            header.lodMeshOffset = cursor;
+            cursor = align(cursor + lodMeshes.size() * sizeof(MeshRecord));
+            header.stringOffset = cursor;
+            header.stringSize = strings.size();
+            cursor += strings.size();
+
+            _blob.assign(cursor, 0);
+            memcpy(&_blob[0], &header, sizeof(header));
+            copySection(_blob, header.vertexOffset, vertexBlob.data(), vertexBlob.size());
+            copySection(_blob, header.indexOffset, indices.data(), indices.size() * sizeof(uint32_t));
+            copySection(_blob, header.meshOffset, meshes.data(), meshes.size() * sizeof(MeshRecord));
+            copySection(_blob, header.boneOffset, bones.data(), bones.size() * sizeof(BoneRecord));
+            copySection(_blob, header.nodeOffset, nodes.data(), nodes.size() * sizeof(NodeRecord));
+            copySection(_blob, header.materialOffset, materials.data(), materials.size() * sizeof(uint32_t));
+            copySection(_blob, header.clipOffset, clips.data(), clips.size() * sizeof(ClipRecord));
+            copySection(_blob, header.trackOffset, tracks.data(), tracks.size() * sizeof(TrackRecord));
+            copySection(_blob, header.keyTimeOffset, keyTimes.data(), keyTimes.size() * sizeof(float));
+            copySection(_blob, header.keyValueOffset, keyValues.data(), keyValues.size() * sizeof(float));
+            copySection(_blob, header.lodOffset, lods.data(), lods.size() * sizeof(LodRecord));
+            copySection(_blob, header.lodMeshOffset, lodMeshes.data(), lodMeshes.size() * sizeof(MeshRecord));
+            copySection(_blob, header.stringOffset, strings.data(), strings.size());
+        }
+
+        static uint64_t align(uint64_t _offset) {
+            return (_offset + MESH_CACHE_ALIGNMENT - 1) / MESH_CACHE_ALIGNMENT * MESH_CACHE_ALIGNMENT;
+        }
+
+    private:
+        std::vector<char> strings;
+
+        static void copySection(std::vector<char> &_blob, uint64_t _offset, const void *_data, size_t _size) {
+            if (_size > 0) memcpy(&_blob[_offset], _data, _size);
+        }
+    };
+
+    // Read-only bytes of a file, memory-mapped where the platform allows it, or adopted from memory
+    class MappedFile {
+    public:
+        MappedFile() : base(NULL), size(0), mapped(false), owned() {}
+
+        ~MappedFile() { close(); }
+
+        void close() {
+#ifndef _WIN32
+            if (mapped && base != NULL) munmap((void *) base, size);
+#endif
+            base = NULL;
+            size = 0;
+            mapped = false;
+            std::vector<char>().swap(owned);
+        }
+
+        // Fails on files shorter than _minSize
+        bool open(const std::string &_filename, size_t _minSize) {
+            close();
+#ifndef _WIN32
+            int fd = ::open(_filename.c_str(), O_RDONLY);
+            if (fd < 0) return false;
+            struct stat st;
+            if (fstat(fd, &st) != 0 || st.st_size < (off_t) _minSize) {
+                ::close(fd);
+                return false;
+            }
+            void *mapping = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            ::close(fd);
+            if (mapping == MAP_FAILED) return false;
+            base = (const char *) mapping;
+            size = (size_t) st.st_size;
+            mapped = true;
+#else
+            FILE *fi = fopen(_filename.c_str(), "rb");
+            if (fi == NULL) return false;
+            fseek(fi, 0, SEEK_END);
+            long fileSize = ftell(fi);
+            fseek(fi, 0, SEEK_SET);
+            if (fileSize < (long) _minSize) {
+                fclose(fi);
+                return false;
+            }
+            owned.resize((size_t) fileSize);
+            bool complete = fread(&owned[0], 1, owned.size(), fi) == owned.size();
+            fclose(fi);
+            if (!complete) {
+                close();
+                return false;
+            }
+            base = owned.data();
+            size = owned.size();
+#endif
+            return true;
+        }
+
+        void adopt(std::vector<char> &_blob) {
+            close();
+            owned.swap(_blob);
+            base = owned.data();
+            size = owned.size();
+        }
+
+        const char *data() const { return base; }
+
+        size_t bytes() const { return size; }
+
+        bool fits(uint64_t _offset, uint64_t _bytes) const {
+            return _offset <= size && _bytes <= size - _offset;
+        }
+
+    private:
+        const char *base;
+        size_t size;
+        bool mapped;
+        std::vector<char> owned;
+
+        // Forbid copying a mapping
+        MappedFile(const MappedFile &_copy);
+
+        MappedFile &operator=(const MappedFile &_copy);
+    };
+
+    // Read-only view over a cache, either memory-mapped from disk or adopted from a fresh bake.
+    // All accessors point straight into the mapping.
+    class BakedFile {
+    public:
+        BakedFile() : file(), base(NULL) {}
+
+        ~BakedFile() { close(); }
+
+        void close() {
+            file.close();
+            base = NULL;
+        }
+
+        bool open(const std::string &_filename, const SourceStamp &_source, uint32_t _vertexStride) {
+            close();
+            if (!file.open(_filename, sizeof(Header))) return false;
+            base = file.data();
+            if (!validate(_vertexStride) || !(header().source == _source)) {
+                close();
+                return false;
+            }
+            return true;
+        }
+
+        bool adopt(std::vector<char> &_blob, uint32_t _vertexStride) {
+            close();
+            file.adopt(_blob);
+            base = file.data();
+            if (!validate(_vertexStride)) {
+                close();
+                return false;
+            }
+            return true;
+        }
+
+        bool available() const { return base != NULL; }
+
+        const Header &header() const { return *(const Header *) base; }
+
+        const void *vertices() const { return base + header().vertexOffset; }
+
+        const uint32_t *indices() const { return (const uint32_t *) (base + header().indexOffset); }
+
+        const MeshRecord *meshes() const { return (const MeshRecord *) (base + header().meshOffset); }
+
+        const BoneRecord *bones() const { return (const BoneRecord *) (base + header().boneOffset); }
+
+        const NodeRecord *nodes() const { return (const NodeRecord *) (base + header().nodeOffset); }
+
+        const uint32_t *materials() const { return (const uint32_t *) (base + header().materialOffset); }
+
+        const ClipRecord *clips() const { return (const ClipRecord *) (base + header().clipOffset); }
+
+        const TrackRecord *tracks() const { return (const TrackRecord *) (base + header().trackOffset); }
+
+        const float *keyTimes() const { return (const float *) (base + header().keyTimeOffset); }
+
+        const float *keyValues() const { return (const float *) (base + header().keyValueOffset); }
+
+        const LodRecord *lods() const { return (const LodRecord *) (base + header().lodOffset); }
+
+        // Level _lod (from 1) of every mesh, meshNum records
+        const MeshRecord *lodMeshes(uint32_t _lod) const {
+            return (const MeshRecord *) (base + header().lodMeshOffset) + (size_t) (_lod - 1) * header().meshNum;
+        }
+
+        const char *string(uint32_t _offset) const {
+            if (_offset == MESH_CACHE_NO_STRING || _offset >= header().stringSize) return NULL;
+            return base + header().stringOffset + _offset;
+        }
+
+        size_t vertexBytes() const { return (size_t) header().vertexNum * header().vertexStride; }
+
+    private:
+        MappedFile file;
+        const char *base;
+
+        // Forbid copying a mapping
+        BakedFile(const BakedFile &_copy);
+
+        BakedFile &operator=(const BakedFile &_copy);
+
+        bool sectionFits(uint64_t _offset, uint64_t _bytes) const {
+            return file.fits(_offset, _bytes);
+        }
+
+        bool validate(uint32_t _vertexStride) const {
+            if (file.bytes() < sizeof(Header)) return false;
+            const Header &h = header();
+            if (h.magic != MESH_CACHE_MAGIC || h.version != MESH_CACHE_VERSION) return false;
+            if (h.headerSize != sizeof(Header) || h.vertexStride != _vertexStride) return false;
+            if (!sectionFits(h.vertexOffset, (uint64_t) h.vertexNum * h.vertexStride)) return false;
+            if (!sectionFits(h.indexOffset, (uint64_t) h.indexNum * sizeof(uint32_t))) return false;
+            if (!sectionFits(h.meshOffset, (uint64_t) h.meshNum * sizeof(MeshRecord))) return false;
+            if (!sectionFits(h.boneOffset, (uint64_t) h.boneNum * sizeof(BoneRecord))) return false;
+            if (!sectionFits(h.nodeOffset, (uint64_t) h.nodeNum * sizeof(NodeRecord))) return false;
+            if (!sectionFits(h.materialOffset, (uint64_t) h.materialNum * sizeof(uint32_t))) return false;
+            if (!sectionFits(h.clipOffset, (uint64_t) h.clipNum * sizeof(ClipRecord))) return false;
+            if (!sectionFits(h.trackOffset, (uint64_t) h.trackNum * sizeof(TrackRecord))) return false;
+            if (!sectionFits(h.keyTimeOffset, (uint64_t) h.keyNum * sizeof(float))) return false;
+            if (!sectionFits(h.keyValueOffset, (uint64_t) h.keyNum * 4 * sizeof(float))) return false;
+            if (!sectionFits(h.lodOffset, (uint64_t) h.lodNum * sizeof(LodRecord))) return false;
+            if (!sectionFits(h.lodMeshOffset, (uint64_t) h.lodNum * h.meshNum * sizeof(MeshRecord))) return false;
+            if (!sectionFits(h.stringOffset, h.stringSize)) return false;
+            // Every string must be terminated inside the table
+            if (h.stringSize > 0 && base[h.stringOffset + h.stringSize - 1] != '\0') return false;
+            // Clips and tracks must only reference their own tables
+            for (uint32_t i = 0; i < h.clipNum; i++) {
+                const ClipRecord &clip = clips()[i];
+                if ((uint64_t) clip.trackOffset + clip.trackNum > h.trackNum) return false;
+            }
+            for (uint32_t i = 0; i < h.trackNum; i++) {
+                const TrackRecord &track = tracks()[i];
+                for (int c = 0; c < MESH_CACHE_CHANNEL_NUM; c++)
+                    if ((uint64_t) track.keyOffset[c] + track.keyNum[c] > h.keyNum) return false;
+            }
+            // LOD meshes must stay inside the index table
+            for (uint32_t l = 1; l <= h.lodNum; l++) {
+                for (uint32_t i = 0; i < h.meshNum; i++) {
+                    const MeshRecord &mesh = lodMeshes(l)[i];
+                    if ((uint64_t) mesh.indexOffset + mesh.facetCornerNum > h.indexNum) return false;
+                }
+            }
+            return true;
+        }
+    };
+}
@@ -0,0 +1,296 @@
+// Mesh Optimizer
+// Load-time triangle and vertex reordering: Tipsify (Sander et al. 2007) for post-transform
+// vertex cache locality, cluster sorting to reduce overdraw, and first-use vertex order for fetch
+// locality. Works on one mesh's local index range, so meshes can be optimized in parallel.
+
+#pragma once
+
+#include <cstdint>
+#include <cmath>
+#include <vector>
+#include <algorithm>
+
+#include <glm/glm.hpp>
+
+#define MESH_OPTIMIZER_CACHE_SIZE 16
+#define MESH_OPTIMIZER_OVERDRAW_THRESHOLD 1.05f
+
+namespace MeshOptimizer {
+    // Transformed-vertex counts of a FIFO cache simulation.
+    // ACMR: misses per triangle (0.5 ideal for large regular meshes, 3 worst case).
+    // ATVR: misses per referenced vertex (1 ideal).
+    struct CacheStats {
+        uint64_t triangleNum;
+        uint64_t vertexNum;
+        uint64_t missNum;
+
+        CacheStats() : triangleNum(0), vertexNum(0), missNum(0) {}
+
+        void add(const CacheStats &_other) {
+            triangleNum += _other.triangleNum;
+            vertexNum += _other.vertexNum;
+            missNum += _other.missNum;
+        }
+
+        float acmr() const { return triangleNum ? (float) missNum / triangleNum : 0.0f; }
+
+        float atvr() const { return vertexNum ? (float) missNum / vertexNum : 0.0f; }
+    };
+
+    struct Report {
+        CacheStats before;
+        CacheStats after;
+
+        void add(const Report &_other) {
+            before.add(_other.before);
+            after.add(_other.after);
+        }
+    };
+
+    struct Settings {
+        unsigned int cacheSize;
+        // Clusters may be split while their ACMR stays within this factor of the unsplit one,
+        // 0 disables overdraw sorting
+        float overdrawThreshold;
+        bool vertexFetch;
+
+        Settings() : cacheSize(MESH_OPTIMIZER_CACHE_SIZE), overdrawThreshold(MESH_OPTIMIZER_OVERDRAW_THRESHOLD),
+                     vertexFetch(true) {}
+    };
+
+    // Simulates a FIFO cache of _cacheSize entries over [_begin, _end) triangles, starting empty.
+    // _stamp holds one entry per vertex and is left dirty; _time must grow across calls sharing it.
+    inline unsigned int simulateCache(const uint32_t *_indices, size_t _begin, size_t _end, unsigned int _cacheSize,
+                                      std::vector<unsigned int> &_stamp, unsigned int &_time) {
+        unsigned int missNum = 0;
+        _time += _cacheSize + 1;
+        for (size_t i = 3 * _begin; i < 3 * _end; i++) {
+            uint32_t v = _indices[i];
+            if (_time - _stamp[v] > _cacheSize) {
+                _stamp[v] = _time++;
+                missNum++;
+            }
+        }
+        return missNum;
+    }
+
+    inline CacheStats analyzeCache(const uint32_t *_indices, size_t _indexNum, size_t _vertexNum,
+                                   unsigned int _cacheSize = MESH_OPTIMIZER_CACHE_SIZE) {
+        CacheStats stats;
+        stats.triangleNum = _indexNum / 3;
+        std::vector<unsigned int> stamp(_vertexNum, 0);
+        std::vector<bool> used(_vertexNum, false);
+        for (size_t i = 0; i < _indexNum; i++) {
+            if (!used[_indices[i]]) stats.vertexNum++;
+            used[_indices[i]] = true;
+        }
+        unsigned int time = 0;
+        stats.missNum = simulateCache(_indices, 0, stats.triangleNum, _cacheSize, stamp, time);
+        return stats;
+    }
+
+    // Tipsify: fans around a focus vertex, then moves to the in-cache neighbour that keeps the most
+    // of its remaining triangles in cache. Writes the reordered triangles to _out (must not alias
+    // _indices) and the first triangle of every hard cluster (a cache restart) to _clusters.
+    inline void optimizeCache(const uint32_t *_indices, size_t _indexNum, size_t _vertexNum, unsigned int _cacheSize,
+                              uint32_t *_out, std::vector<size_t> &_clusters) {
+        size_t triangleNum = _indexNum / 3;
+        _clusters.clear();
+        if (triangleNum == 0) return;
+
+        // Vertex -> triangle adjacency
+        std::vector<uint32_t> liveNum(_vertexNum, 0);
+        for (size_t i = 0; i < _indexNum; i++) liveNum[_indices[i]]++;
+        std::vector<uint32_t> adjacencyOffset(_vertexNum + 1, 0);
+        for (size_t v = 0; v < _vertexNum; v++) adjacencyOffset[v + 1] = adjacencyOffset[v] + liveNum[v];
+        std::vector<uint32_t> adjacency(_indexNum);
+        {
+            std::vector<uint32_t> fill(adjacencyOffset.begin(), adjacencyOffset.end() - 1);
+            for (size_t i = 0; i < _indexNum; i++) adjacency[fill[_indices[i]]++] = (uint32_t) (i / 3);
+        }
+
+        std::vector<unsigned int> stamp(_vertexNum, 0);
+        std::vector<bool> emitted(triangleNum, false);
+        std::vector<uint32_t> deadEnd;
+        std::vector<uint32_t> candidates;
+        unsigned int time = _cacheSize + 1;
+        size_t inputCursor = 0;
+        size_t outputTriangle = 0;
+
+        int64_t focus = 0;
+        while (liveNum[focus] == 0) focus++;
+        bool restart = true;
+        while (focus >= 0) {
+            if (restart) _clusters.push_back(outputTriangle);
+            candidates.clear();
+            for (uint32_t a = adjacencyOffset[focus]; a < adjacencyOffset[focus + 1]; a++) {
+                uint32_t t = adjacency[a];
+                if (emitted[t]) continue;
+                emitted[t] = true;
+                for (int k = 0; k < 3; k++) {
+                    uint32_t v = _indices[3 * t + k];
+                    _out[3 * outputTriangle + k] = v;
+                    deadEnd.push_back(v);
+                    candidates.push_back(v);
+                    liveNum[v]--;
+                    if (time - stamp[v] > _cacheSize) stamp[v] = time++;
+                }
+                outputTriangle++;
+            }
+
+            // Prefer candidates still in cache after their remaining fan would be emitted
+            int64_t next = -1;
+            int bestPriority = -1;
+            for (size_t c = 0; c < candidates.size(); c++) {
+                uint32_t v = candidates[c];
+                if (liveNum[v] == 0) continue;
+                int priority = 0;
+                if (time - stamp[v] + 2 * liveNum[v] <= _cacheSize) priority = (int) (time - stamp[v]);
+                if (priority > bestPriority) {
+                    bestPriority = priority;
+                    next = v;
+                }
+            }
+            restart = false;
+            if (next < 0) {
+                while (!deadEnd.empty() && next < 0) {
+                    uint32_t v = deadEnd.back();
+                    deadEnd.pop_back();
+                    if (liveNum[v] > 0) next = v;
+                }
+            }
+            if (next < 0) {
+                while (inputCursor < _vertexNum && liveNum[inputCursor] == 0) inputCursor++;
+                if (inputCursor < _vertexNum) next = (int64_t) inputCursor;
+                restart = true;
+            }
+            focus = next;
+        }
+    }
+
+    // Splits the hard clusters wherever the ACMR since the last split is already within _threshold of
+    // the cluster's own, then orders clusters outward-facing first so they tend to occlude the rest
+    inline void optimizeOverdraw(const uint32_t *_indices, size_t _indexNum, const float *_positions, size_t _stride,
+                                 size_t _vertexNum, const std::vector<size_t> &_hardClusters, unsigned int _cacheSize,
+                                 float _threshold, uint32_t *_out) {
+        size_t triangleNum = _indexNum / 3;
+        if (triangleNum == 0) return;
+
+        std::vector<unsigned int> stamp(_vertexNum, 0);
+        unsigned int time = 0;
+        std::vector<size_t> clusters;
+        for (size_t c = 0; c < _hardClusters.size(); c++) {
+            size_t begin = _hardClusters[c];
+            size_t end = c + 1 < _hardClusters.size() ? _hardClusters[c + 1] : triangleNum;
+            float clusterAcmr = (float) simulateCache(_indices, begin, end, _cacheSize, stamp, time) / (end - begin);
+
+            clusters.push_back(begin);
+            size_t softBegin = begin;
+            unsigned int missNum = 0;
+            time += _cacheSize + 1;
+            for (size_t t = begin; t + 1 < end; t++) {
+                for (int k = 0; k < 3; k++) {
+                    uint32_t v = _indices[3 * t + k];
+                    if (time - stamp[v] > _cacheSize) {
+                        stamp[v] = time++;
+                        missNum++;
+                    }
+                }
+                if ((float) missNum / (t + 1 - softBegin) <= _threshold * clusterAcmr) {
+                    clusters.push_back(t + 1);
+                    softBegin = t + 1;
+                    missNum = 0;
+                    time += _cacheSize + 1;
+                }
+            }
+        }
+
+        const float *p = _positions;
+        glm::fvec3 meshCentroid(0.0f);
+        for (size_t v = 0; v < _vertexNum; v++, p = (const float *) ((const char *) p + _stride))
+            meshCentroid += glm::fvec3(p[0], p[1], p[2]);
+        meshCentroid /= (float) std::max<size_t>(_vertexNum, 1);
+
+        std::vector<std::pair<float, size_t> > order(clusters.size());
+        for (size_t c = 0; c < clusters.size(); c++) {
+            size_t end = c + 1 < clusters.size() ? clusters[c + 1] : triangleNum;
+            glm::fvec3 centroid(0.0f), normal(0.0f);
+            float area = 0.0f;
+            for (size_t t = clusters[c]; t < end; t++) {
+                glm::fvec3 corner[3];
+                for (int k = 0; k < 3; k++) {
+                    const float *q = (const float *) ((const char *) _positions + _stride * _indices[3 * t + k]);
+                    corner[k] = glm::fvec3(q[0], q[1], q[2]);
+                }
+                glm::fvec3 n = glm::cross(corner[1] - corner[0], corner[2] - corner[0]);
+                float a = glm::length(n);
+                centroid += (corner[0] + corner[1] + corner[2]) * (a / 3.0f);
+                normal += n;
+                area += a;
+            }
+            float normalLength = glm::length(normal);
+            float key = 0.0f;
+            if (area > 0.0f && normalLength > 0.0f)
+                key = glm::dot(centroid / area - meshCentroid, normal / normalLength);
+            order[c] = std::make_pair(-key, c);
+        }
+        std::stable_sort(order.begin(), order.end());
+
+        size_t outputTriangle = 0;
+        for (size_t i = 0; i < order.size(); i++) {
+            size_t c = order[i].second;
+            size_t end = c + 1 < clusters.size() ? clusters[c + 1] : triangleNum;
+            for (size_t t = clusters[c]; t < end; t++, outputTriangle++)
+                for (int k = 0; k < 3; k++) _out[3 * outputTriangle + k] = _indices[3 * t + k];
+        }
+    }
+
+    // Renumbers vertices in order of first use and permutes _vertices to match.
+    // Unreferenced vertices keep their relative order at the end.
+    template<typename Vertex>
+    void optimizeFetch(uint32_t *_indices, size_t _indexNum, Vertex *_vertices, size_t _vertexNum) {
+        const uint32_t unassigned = 0xFFFFFFFFu;
+        std::vector<uint32_t> remap(_vertexNum, unassigned);
+        uint32_t next = 0;
+        for (size_t i = 0; i < _indexNum; i++) {
+            if (remap[_indices[i]] == unassigned) remap[_indices[i]] = next++;
+            _indices[i] = remap[_indices[i]];
+        }
+        for (size_t v = 0; v < _vertexNum; v++)
+            if (remap[v] == unassigned) remap[v] = next++;
+
+        std::vector<Vertex> reordered(_vertexNum);
+        for (size_t v = 0; v < _vertexNum; v++) reordered[remap[v]] = _vertices[v];
+        std::copy(reordered.begin(), reordered.end(), _vertices);
+    }
+
+    // Cache and overdraw passes in place, for index lists sharing a vertex order (such as LODs)
+    inline void optimizeTriangles(uint32_t *_indices, size_t _indexNum, const float *_positions, size_t _stride,
+                                  size_t _vertexNum, const Settings &_settings = Settings()) {
+        if (_indexNum < 3 || _vertexNum == 0) return;
+        std::vector<uint32_t> reordered(_indexNum);
+        std::vector<size_t> clusters;
+        optimizeCache(_indices, _indexNum, _vertexNum, _settings.cacheSize, reordered.data(), clusters);
+        if (_settings.overdrawThreshold > 0.0f)
+            optimizeOverdraw(reordered.data(), _indexNum, _positions, _stride, _vertexNum, clusters,
+                             _settings.cacheSize, _settings.overdrawThreshold, _indices);
+        else
+            std::copy(reordered.begin(), reordered.end(), _indices);
+    }
+
+    // Runs all passes in place over one mesh. Vertex must start with float position[3].
+    template<typename Vertex>
+    Report optimize(uint32_t *_indices, size_t _indexNum, Vertex *_vertices, size_t _vertexNum,
+                    const Settings &_settings = Settings()) {
+        Report report;
+        report.before = analyzeCache(_indices, _indexNum, _vertexNum, _settings.cacheSize);
+        report.after = report.before;
+        if (_indexNum < 3 || _vertexNum == 0) return report;
+
+        optimizeTriangles(_indices, _indexNum, _vertices[0].position, sizeof(Vertex), _vertexNum, _settings);
+        if (_settings.vertexFetch) optimizeFetch(_indices, _indexNum, _vertices, _vertexNum);
+
+        report.after = analyzeCache(_indices, _indexNum, _vertexNum, _settings.cacheSize);
+        return report;
+    }
+}
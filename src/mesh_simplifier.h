@@ -0,0 +1,290 @@
+// Mesh Simplifier
+// Quadric error (Garland & Heckbert 1997) half-edge collapse over an existing vertex buffer:
+// simplified levels are new index lists referencing a subset of the original vertices, so
+// texcoords and bone weights are never interpolated. Vertices on open borders, UV seams (several
+// vertices at one position) and region boundaries (the dominant bone changes) are never removed.
+
+#pragma once
+
+#include <cstdint>
+#include <cmath>
+#include <vector>
+#include <algorithm>
+
+#include <glm/glm.hpp>
+
+#define MESH_SIMPLIFIER_NO_REGION 0xFFFFFFFFu
+#define MESH_SIMPLIFIER_MAX_PASSES 64
+
+namespace MeshSimplifier {
+    // Symmetric 4x4 matrix of summed squared plane distances, plus the summed plane weight
+    struct Quadric {
+        double a00, a01, a02, a03, a11, a12, a13, a22, a23, a33;
+        double weight;
+
+        Quadric() : a00(0), a01(0), a02(0), a03(0), a11(0), a12(0), a13(0), a22(0), a23(0), a33(0), weight(0) {}
+
+        // Plane n.p + d = 0 with unit n
+        static Quadric fromPlane(const glm::dvec3 &_n, double _d, double _weight) {
+            Quadric q;
+            q.a00 = _weight * _n.x * _n.x;
+            q.a01 = _weight * _n.x * _n.y;
+            q.a02 = _weight * _n.x * _n.z;
+            q.a03 = _weight * _n.x * _d;
+            q.a11 = _weight * _n.y * _n.y;
+            q.a12 = _weight * _n.y * _n.z;
+            q.a13 = _weight * _n.y * _d;
+            q.a22 = _weight * _n.z * _n.z;
+            q.a23 = _weight * _n.z * _d;
+            q.a33 = _weight * _d * _d;
+            q.weight = _weight;
+            return q;
+        }
+
+        Quadric &operator+=(const Quadric &_q) {
+            a00 += _q.a00;
+            a01 += _q.a01;
+            a02 += _q.a02;
+            a03 += _q.a03;
+            a11 += _q.a11;
+            a12 += _q.a12;
+            a13 += _q.a13;
+            a22 += _q.a22;
+            a23 += _q.a23;
+            a33 += _q.a33;
+            weight += _q.weight;
+            return *this;
+        }
+
+        // Root of the weighted mean squared distance of _p to the accumulated planes
+        double error(const glm::dvec3 &_p) const {
+            if (weight <= 0.0) return 0.0;
+            double x = _p.x, y = _p.y, z = _p.z;
+            double e = a00 * x * x + a11 * y * y + a22 * z * z + a33
+                       + 2.0 * (a01 * x * y + a02 * x * z + a03 * x + a12 * y * z + a13 * y + a23 * z);
+            return std::sqrt(std::max(e / weight, 0.0));
+        }
+    };
+
+    struct Collapse {
+        double error;
+        uint32_t from;
+        uint32_t to;
+
+        bool operator<(const Collapse &_other) const { return error < _other.error; }
+    };
+
+    class Simplifier {
+    public:
+        // _region may be NULL; otherwise vertices bordering a different region are locked
+        Simplifier(const float *_positions, size_t _stride, size_t _vertexNum, const uint32_t *_region)
+                : positions(_positions), stride(_stride), vertexNum(_vertexNum), region(_region) {
+            weldPositions();
+        }
+
+        // Collapses edges of _indices until at most _targetIndexNum indices remain or the next collapse
+        // would exceed _maxError. Writes the result to _out and returns the largest Quadric::error() of the
+        // collapses made, an RMS plane distance rather than a bound on the surface deviation.
+        double simplify(const uint32_t *_indices, size_t _indexNum, size_t _targetIndexNum, double _maxError,
+                        std::vector<uint32_t> &_out) {
+            _out.assign(_indices, _indices + _indexNum);
+            if (_indexNum < 3 || vertexNum == 0) return 0.0;
+            lockVertices(_out);
+            buildQuadrics(_out);
+
+            double maxError = 0.0;
+            size_t triangleNum = _out.size() / 3;
+            size_t targetTriangleNum = _targetIndexNum / 3;
+            std::vector<uint32_t> remap(vertexNum);
+            std::vector<bool> touched(vertexNum);
+            std::vector<Collapse> candidates;
+            for (int pass = 0; pass < MESH_SIMPLIFIER_MAX_PASSES && triangleNum > targetTriangleNum; pass++) {
+                buildAdjacency(_out);
+                collectCandidates(_out, _maxError, candidates);
+                if (candidates.empty()) break;
+                std::sort(candidates.begin(), candidates.end());
+
+                for (size_t v = 0; v < vertexNum; v++) remap[v] = (uint32_t) v;
+                std::fill(touched.begin(), touched.end(), false);
+                size_t collapseNum = 0;
+                for (size_t c = 0; c < candidates.size() && triangleNum > targetTriangleNum; c++) {
+                    const Collapse &collapse = candidates[c];
+                    if (touched[collapse.from] || touched[collapse.to]) continue;
+                    size_t removed = 0;
+                    if (!collapseKeepsOrientation(_out, collapse.from, collapse.to, removed)) continue;
+
+                    // The one-ring changes shape, so it waits for the next pass
+                    for (uint32_t a = adjacencyOffset[collapse.from]; a < adjacencyOffset[collapse.from + 1]; a++) {
+                        uint32_t t = adjacency[a];
+                        for (int k = 0; k < 3; k++) touched[_out[3 * t + k]] = true;
+                    }
+                    remap[collapse.from] = collapse.to;
+                    quadric[collapse.to] += quadric[collapse.from];
+                    maxError = std::max(maxError, collapse.error);
+                    triangleNum -= std::min(removed, triangleNum);
+                    collapseNum++;
+                }
+                if (collapseNum == 0) break;
+                compact(_out, remap);
+                triangleNum = _out.size() / 3;
+            }
+            return maxError;
+        }
+
+    private:
+        const float *positions;
+        size_t stride;
+        size_t vertexNum;
+        const uint32_t *region;
+        // Lowest vertex ID sharing the same position
+        std::vector<uint32_t> weld;
+        std::vector<bool> locked;
+        std::vector<Quadric> quadric;
+        std::vector<uint32_t> adjacencyOffset;
+        std::vector<uint32_t> adjacency;
+
+        glm::dvec3 position(uint32_t _v) const {
+            const float *p = (const float *) ((const char *) positions + stride * _v);
+            return glm::dvec3(p[0], p[1], p[2]);
+        }
+
+        void weldPositions() {
+            std::vector<uint32_t> order(vertexNum);
+            for (size_t v = 0; v < vertexNum; v++) order[v] = (uint32_t) v;
+            std::sort(order.begin(), order.end(), [this](uint32_t _a, uint32_t _b) {
+                const float *pa = (const float *) ((const char *) positions + stride * _a);
+                const float *pb = (const float *) ((const char *) positions + stride * _b);
+                if (pa[0] != pb[0]) return pa[0] < pb[0];
+                if (pa[1] != pb[1]) return pa[1] < pb[1];
+                if (pa[2] != pb[2]) return pa[2] < pb[2];
+                return _a < _b;
+            });
+            weld.resize(vertexNum);
+            for (size_t i = 0; i < vertexNum; i++) {
+                bool same = i > 0 && position(order[i]) == position(order[i - 1]);
+                weld[order[i]] = same ? weld[order[i - 1]] : order[i];
+            }
+        }
+
+        void lockVertices(const std::vector<uint32_t> &_indices) {
+            locked.assign(vertexNum, false);
+            // UV seams: more than one vertex at a position
+            std::vector<uint32_t> wedgeNum(vertexNum, 0);
+            for (size_t v = 0; v < vertexNum; v++) wedgeNum[weld[v]]++;
+            for (size_t v = 0; v < vertexNum; v++)
+                if (wedgeNum[weld[v]] > 1) locked[v] = true;
+
+            // Open borders: welded edges used by a single triangle
+            std::vector<uint64_t> edges;
+            edges.reserve(_indices.size());
+            for (size_t i = 0; i < _indices.size(); i += 3) {
+                for (int k = 0; k < 3; k++) {
+                    uint32_t a = weld[_indices[i + k]], b = weld[_indices[i + (k + 1) % 3]];
+                    edges.push_back(a < b ? ((uint64_t) a << 32 | b) : ((uint64_t) b << 32 | a));
+                }
+            }
+            std::sort(edges.begin(), edges.end());
+            std::vector<bool> borderWeld(vertexNum, false);
+            for (size_t i = 0; i < edges.size();) {
+                size_t j = i;
+                while (j < edges.size() && edges[j] == edges[i]) j++;
+                if (j - i == 1) {
+                    borderWeld[edges[i] >> 32] = true;
+                    borderWeld[edges[i] & 0xFFFFFFFFu] = true;
+                }
+                i = j;
+            }
+            for (size_t v = 0; v < vertexNum; v++)
+                if (borderWeld[weld[v]]) locked[v] = true;
+
+            // Region boundaries: a triangle spanning regions locks all its corners
+            if (region != NULL) {
+                for (size_t i = 0; i < _indices.size(); i += 3) {
+                    uint32_t r0 = region[_indices[i]], r1 = region[_indices[i + 1]], r2 = region[_indices[i + 2]];
+                    if (r0 != r1 || r1 != r2)
+                        for (int k = 0; k < 3; k++) locked[_indices[i + k]] = true;
+                }
+            }
+        }
+
+        void buildQuadrics(const std::vector<uint32_t> &_indices) {
+            quadric.assign(vertexNum, Quadric());
+            for (size_t i = 0; i < _indices.size(); i += 3) {
+                glm::dvec3 p0 = position(_indices[i]), p1 = position(_indices[i + 1]), p2 = position(_indices[i + 2]);
+                glm::dvec3 n = glm::cross(p1 - p0, p2 - p0);
+                double area = glm::length(n);
+                if (area <= 0.0) continue;
+                n /= area;
+                Quadric q = Quadric::fromPlane(n, -glm::dot(n, p0), area);
+                for (int k = 0; k < 3; k++) quadric[_indices[i + k]] += q;
+            }
+        }
+
+        void buildAdjacency(const std::vector<uint32_t> &_indices) {
+            adjacencyOffset.assign(vertexNum + 1, 0);
+            for (size_t i = 0; i < _indices.size(); i++) adjacencyOffset[_indices[i] + 1]++;
+            for (size_t v = 0; v < vertexNum; v++) adjacencyOffset[v + 1] += adjacencyOffset[v];
+            adjacency.resize(_indices.size());
+            std::vector<uint32_t> fill(adjacencyOffset.begin(), adjacencyOffset.end() - 1);
+            for (size_t i = 0; i < _indices.size(); i++) adjacency[fill[_indices[i]]++] = (uint32_t) (i / 3);
+        }
+
+        void collectCandidates(const std::vector<uint32_t> &_indices, double _maxError,
+                               std::vector<Collapse> &_candidates) const {
+            _candidates.clear();
+            for (size_t i = 0; i < _indices.size(); i += 3) {
+                for (int k = 0; k < 3; k++) {
+                    uint32_t a = _indices[i + k], b = _indices[i + (k + 1) % 3];
+                    for (int direction = 0; direction < 2; direction++, std::swap(a, b)) {
+                        if (locked[a]) continue;
+                        Quadric q = quadric[a];
+                        q += quadric[b];
+                        Collapse collapse;
+                        collapse.error = q.error(position(b));
+                        collapse.from = a;
+                        collapse.to = b;
+                        if (collapse.error <= _maxError) _candidates.push_back(collapse);
+                    }
+                }
+            }
+        }
+
+        // Rejects collapses that would flip a surviving triangle around _from; counts the ones removed
+        bool collapseKeepsOrientation(const std::vector<uint32_t> &_indices, uint32_t _from, uint32_t _to,
+                                      size_t &_removed) const {
+            glm::dvec3 target = position(_to);
+            _removed = 0;
+            for (uint32_t a = adjacencyOffset[_from]; a < adjacencyOffset[_from + 1]; a++) {
+                const uint32_t *tri = &_indices[3 * adjacency[a]];
+                bool removed = false;
+                for (int k = 0; k < 3; k++) removed = removed || weld[tri[k]] == weld[_to];
+                if (removed) {
+                    _removed++;
+                    continue;
+                }
+                glm::dvec3 p[3], q[3];
+                for (int k = 0; k < 3; k++) {
+                    p[k] = position(tri[k]);
+                    q[k] = tri[k] == _from ? target : p[k];
+                }
+                glm::dvec3 before = glm::cross(p[1] - p[0], p[2] - p[0]);
+                glm::dvec3 after = glm::cross(q[1] - q[0], q[2] - q[0]);
+                if (glm::dot(before, after) <= 0.0) return false;
+            }
+            return true;
+        }
+
+        // Applies remap and drops triangles that became degenerate
+        void compact(std::vector<uint32_t> &_indices, const std::vector<uint32_t> &_remap) const {
+            size_t write = 0;
+            for (size_t i = 0; i < _indices.size(); i += 3) {
+                uint32_t a = _remap[_indices[i]], b = _remap[_indices[i + 1]], c = _remap[_indices[i + 2]];
+                if (weld[a] == weld[b] || weld[b] == weld[c] || weld[c] == weld[a]) continue;
+                _indices[write++] = a;
+                _indices[write++] = b;
+                _indices[write++] = c;
+            }
+            _indices.resize(write);
+        }
+    };
+}
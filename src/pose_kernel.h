@@ -0,0 +1,204 @@
+// Pose Composition Kernels
+// Bone matrix composition over ranges of the flattened skeleton, selected by runtime CPU detection.
+// Nodes are composed one after another; SSE / AVX2 vectorize each 4x4 product, not across nodes.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define POSE_KERNEL_X86 1
+
+#include <immintrin.h>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+#if defined(POSE_KERNEL_X86) && (defined(__GNUC__) || defined(__clang__))
+#define POSE_KERNEL_TARGET_AVX2 __attribute__((target("avx2,fma")))
+#else
+#define POSE_KERNEL_TARGET_AVX2
+#endif
+
+namespace SkeletalMesh {
+    namespace PoseKernel {
+        // Inputs of one composition pass. All matrices are column-major float[16] (glm / GPU layout).
+        // The inverse root transform is folded in as the parent of the root, so nodeGlobal holds
+        // root-relative transforms and boneTransf = nodeGlobal * boneOffset needs no extra product.
+        struct ComposeArgs {
+            const int *nodeParent;
+            const float *nodeLocalTransf;
+            const int *nodeBone;
+            const float *boneModifier; // may be NULL
+            const float *boneOffset;
+            const float *rootParent;
+            float *nodeGlobal;
+            float *boneTransf;
+        };
+
+        // Composes nodes [_begin, _end); their parents must already be composed
+        typedef void (*ComposeFunc)(const ComposeArgs &_args, size_t _begin, size_t _end);
+
+        struct Kernel {
+            const char *name;
+            ComposeFunc compose;
+        };
+
+        // r = a * b, r must not alias a or b
+        inline void mulScalar(const float *a, const float *b, float *r) {
+            for (int j = 0; j < 4; j++) {
+                const float *bj = b + 4 * j;
+                for (int i = 0; i < 4; i++)
+                    r[4 * j + i] = a[i] * bj[0] + a[4 + i] * bj[1] + a[8 + i] * bj[2] + a[12 + i] * bj[3];
+            }
+        }
+
+        template<void (*Mul)(const float *, const float *, float *)>
+        void composeRange(const ComposeArgs &_args, size_t _begin, size_t _end) {
+            float localGlobal[16];
+            for (size_t i = _begin; i < _end; i++) {
+                int parent = _args.nodeParent[i];
+                const float *parentGlobal = parent < 0 ? _args.rootParent : _args.nodeGlobal + 16 * parent;
+                const float *local = _args.nodeLocalTransf + 16 * i;
+                float *global = _args.nodeGlobal + 16 * i;
+                int bone = _args.nodeBone[i];
+                if (bone < 0 || _args.boneModifier == NULL) {
+                    Mul(parentGlobal, local, global);
+                } else {
+                    Mul(parentGlobal, local, localGlobal);
+                    Mul(localGlobal, _args.boneModifier + 16 * bone, global);
+                }
+                if (bone >= 0)
+                    Mul(global, _args.boneOffset + 16 * bone, _args.boneTransf + 16 * bone);
+            }
+        }
+
+#ifdef POSE_KERNEL_X86
+
+        // SSE is part of x86-64, so this path needs no detection
+        inline void mulSse(const float *a, const float *b, float *r) {
+            __m128 a0 = _mm_loadu_ps(a);
+            __m128 a1 = _mm_loadu_ps(a + 4);
+            __m128 a2 = _mm_loadu_ps(a + 8);
+            __m128 a3 = _mm_loadu_ps(a + 12);
+            for (int j = 0; j < 4; j++) {
+                const float *bj = b + 4 * j;
+                __m128 col = _mm_mul_ps(a0, _mm_set1_ps(bj[0]));
+                col = _mm_add_ps(col, _mm_mul_ps(a1, _mm_set1_ps(bj[1])));
+                col = _mm_add_ps(col, _mm_mul_ps(a2, _mm_set1_ps(bj[2])));
+                col = _mm_add_ps(col, _mm_mul_ps(a3, _mm_set1_ps(bj[3])));
+                _mm_storeu_ps(r + 4 * j, col);
+            }
+        }
+
+        // Two result columns per instruction: every 128-bit lane holds one column of b
+        POSE_KERNEL_TARGET_AVX2 inline void mulAvx2(const float *a, const float *b, float *r) {
+            __m256 a0 = _mm256_broadcast_ps((const __m128 *) a);
+            __m256 a1 = _mm256_broadcast_ps((const __m128 *) (a + 4));
+            __m256 a2 = _mm256_broadcast_ps((const __m128 *) (a + 8));
+            __m256 a3 = _mm256_broadcast_ps((const __m128 *) (a + 12));
+            __m256 b01 = _mm256_loadu_ps(b);
+            __m256 b23 = _mm256_loadu_ps(b + 8);
+            __m256 r01 = _mm256_mul_ps(a0, _mm256_shuffle_ps(b01, b01, 0x00));
+            __m256 r23 = _mm256_mul_ps(a0, _mm256_shuffle_ps(b23, b23, 0x00));
+            r01 = _mm256_fmadd_ps(a1, _mm256_shuffle_ps(b01, b01, 0x55), r01);
+            r23 = _mm256_fmadd_ps(a1, _mm256_shuffle_ps(b23, b23, 0x55), r23);
+            r01 = _mm256_fmadd_ps(a2, _mm256_shuffle_ps(b01, b01, 0xAA), r01);
+            r23 = _mm256_fmadd_ps(a2, _mm256_shuffle_ps(b23, b23, 0xAA), r23);
+            r01 = _mm256_fmadd_ps(a3, _mm256_shuffle_ps(b01, b01, 0xFF), r01);
+            r23 = _mm256_fmadd_ps(a3, _mm256_shuffle_ps(b23, b23, 0xFF), r23);
+            _mm256_storeu_ps(r, r01);
+            _mm256_storeu_ps(r + 8, r23);
+        }
+
+        // Same loop as composeRange(), spelled out so mulAvx2() can be inlined under the AVX2 target
+        POSE_KERNEL_TARGET_AVX2 inline void composeRangeAvx2(const ComposeArgs &_args, size_t _begin, size_t _end) {
+            float localGlobal[16];
+            for (size_t i = _begin; i < _end; i++) {
+                int parent = _args.nodeParent[i];
+                const float *parentGlobal = parent < 0 ? _args.rootParent : _args.nodeGlobal + 16 * parent;
+                const float *local = _args.nodeLocalTransf + 16 * i;
+                float *global = _args.nodeGlobal + 16 * i;
+                int bone = _args.nodeBone[i];
+                if (bone < 0 || _args.boneModifier == NULL) {
+                    mulAvx2(parentGlobal, local, global);
+                } else {
+                    mulAvx2(parentGlobal, local, localGlobal);
+                    mulAvx2(localGlobal, _args.boneModifier + 16 * bone, global);
+                }
+                if (bone >= 0)
+                    mulAvx2(global, _args.boneOffset + 16 * bone, _args.boneTransf + 16 * bone);
+            }
+        }
+
+#endif // POSE_KERNEL_X86
+
+        inline bool cpuSupportsAvx2() {
+#if defined(POSE_KERNEL_X86) && (defined(__GNUC__) || defined(__clang__))
+            __builtin_cpu_init();
+            return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#elif defined(POSE_KERNEL_X86) && defined(_MSC_VER)
+            int info[4];
+            __cpuid(info, 0);
+            if (info[0] < 7) return false;
+            __cpuid(info, 1);
+            bool fma = (info[2] & (1 << 12)) != 0;
+            bool osxsave = (info[2] & (1 << 27)) != 0;
+            bool avx = (info[2] & (1 << 28)) != 0;
+            // The OS must save the YMM registers
+            if (!fma || !osxsave || !avx || (_xgetbv(0) & 6) != 6) return false;
+            __cpuidex(info, 7, 0);
+            return (info[1] & (1 << 5)) != 0;
+#else
+            return false;
+#endif
+        }
+
+        inline const Kernel &scalarKernel() {
+            static const Kernel kernel = {"scalar", &composeRange<mulScalar>};
+            return kernel;
+        }
+
+        inline std::vector<const Kernel *> detectKernels() {
+            std::vector<const Kernel *> kernels;
+            kernels.push_back(&scalarKernel());
+#ifdef POSE_KERNEL_X86
+            static const Kernel sse = {"sse", &composeRange<mulSse>};
+            kernels.push_back(&sse);
+            if (cpuSupportsAvx2()) {
+                static const Kernel avx2 = {"avx2", &composeRangeAvx2};
+                kernels.push_back(&avx2);
+            }
+#endif
+            return kernels;
+        }
+
+        // Every kernel usable on this CPU, best last
+        inline const std::vector<const Kernel *> &availableKernels() {
+            static const std::vector<const Kernel *> kernels = detectKernels();
+            return kernels;
+        }
+
+        // Best kernel for this CPU, or the one named by HAND_POSE_KERNEL if it is available
+        inline const Kernel &selectKernel() {
+            const std::vector<const Kernel *> &kernels = availableKernels();
+            const char *forced = getenv("HAND_POSE_KERNEL");
+            if (forced != NULL) {
+                for (size_t i = 0; i < kernels.size(); i++) {
+                    if (strcmp(kernels[i]->name, forced) == 0) return *kernels[i];
+                }
+            }
+            return *kernels.back();
+        }
+
+        inline const Kernel &activeKernel() {
+            static const Kernel &kernel = selectKernel();
+            return kernel;
+        }
+    }
+}
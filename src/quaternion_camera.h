@@ -0,0 +1,175 @@
+// Quaternion Camera
+// Free-flying camera driven by quaternions, with smooth transitions between recorded states.
+
+#pragma once
+
+#include <iostream>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/quaternion.hpp>
+#include <glm/gtx/quaternion.hpp>
+
+struct CameraState {
+    glm::vec3 position;
+    glm::quat orientation;
+    float fov;
+
+    CameraState() : position(0.0f), orientation(1.0f, 0.0f, 0.0f, 0.0f), fov(45.0f) {}
+    CameraState(const glm::vec3& pos, const glm::quat& orient, float f)
+        : position(pos), orientation(orient), fov(f) {}
+};
+
+// Quaterion controlled camera
+class QuaternionCamera {
+public:
+    QuaternionCamera(glm::vec3 position = glm::vec3(0.0f, 0.0f, 15.0f))
+        : movementSpeed(25.0f),
+          mouseSensitivity(0.1f)
+    {
+        resetStatus();
+    }
+    
+    glm::mat4 getViewMatrix() const {
+        return glm::lookAt(position, position + front, up);
+    }
+    
+    glm::mat4 getProjectionMatrix(float aspectRatio, bool usePerspective = true) const {
+        if (usePerspective) {
+            return glm::perspective(glm::radians(fov), aspectRatio, 0.1f, 100.0f);
+        } else {
+            return glm::ortho(-12.5f * aspectRatio, 12.5f * aspectRatio, -5.f, 20.f, -20.f, 20.f);
+        }
+    }
+    
+    void processKeyboard(bool w, bool a, bool s, bool d, bool space, bool shift, float deltaTime) {
+        float velocity = movementSpeed * deltaTime;
+        if (w) position += front * velocity;
+        if (s) position -= front * velocity;
+        if (a) position -= right * velocity;
+        if (d) position += right * velocity;
+        if (space) position += worldUp * velocity;
+        if (shift) position -= worldUp * velocity;
+    }
+    
+    void processMouseMovement(double xoffset, double yoffset, bool constrainPitch = true) {
+        xoffset *= mouseSensitivity;
+        yoffset *= mouseSensitivity;
+        yaw += xoffset;
+        pitch += yoffset;
+
+        if (constrainPitch) {
+            if (pitch > 89.0f) pitch = 89.0f;
+            if (pitch < -89.0f) pitch = -89.0f;
+        }
+        
+        // Create quaterion from eular angle (Yaw -> Pitch)
+        glm::quat qYaw = glm::angleAxis(glm::radians(yaw), worldUp);
+        glm::quat qPitch = glm::angleAxis(glm::radians(pitch), glm::vec3(1.0f, 0.0f, 0.0f));
+        targetOrientation = qYaw * qPitch;
+        targetOrientation = glm::normalize(targetOrientation);
+    }
+    
+    void updateCameraOrientation(float deltaTime) {
+        // Quaterion slerp
+        float slerpFactor = glm::clamp(10.0f * deltaTime, 0.01f, 0.5f);
+        orientation = glm::slerp(orientation, targetOrientation, slerpFactor);
+        orientation = glm::normalize(orientation);
+        
+        updateVectors();
+    }
+    
+    void processMouseScroll(double yoffset) {
+        fov -= (float)yoffset;
+        if (fov < 1.0f) fov = 1.0f;
+        if (fov > 45.0f) fov = 45.0f;
+    }
+    
+    void setPosition(const glm::vec3& newPosition) { position = newPosition; }
+    glm::vec3 getPosition() const { return position; }
+    void reportStatus() const {
+        std::cout << "  Position: " << "[" << position[0] << ", " << position[1] << ", " << position[2] << "]" << std::endl;
+        std::cout << "  Orientation: " << "[" << orientation[0] << ", " << orientation[1] << ", " << orientation[2] << "]" << std::endl;
+        std::cout << "  yaw: " << yaw << std::endl;
+        std::cout << "  pitch: " << pitch << std::endl;
+    }
+    glm::vec3 getFront() const { return front; }
+    glm::vec3 getUp() const { return up; }
+    glm::vec3 getRight() const { return right; }
+    
+    void setMovementSpeed(float speed) { movementSpeed = speed; }
+    void incMovementSpeed() { 
+        movementSpeed = movementSpeed > 50.0 ? movementSpeed : movementSpeed + 1.0;
+        std::cout << "Camera movement speed: " << movementSpeed << std::endl;
+    }
+    void decMovementSpeed() {
+        movementSpeed = movementSpeed == 0.0 ? movementSpeed : movementSpeed - 1.0;
+        std::cout << "Camera movement speed: " << movementSpeed << std::endl;
+    }
+    void setMouseSensitivity(float sensitivity) { mouseSensitivity = sensitivity; }
+
+    CameraState getCurrentState() const {
+        return CameraState(position, orientation, fov);
+    }
+
+    void setState(const CameraState& state) {
+        position = state.position;
+        orientation = state.orientation;
+        targetOrientation = state.orientation;
+        fov = state.fov;
+        updateVectors();
+    }
+    
+    CameraState getTransitionState(const CameraState& start, const CameraState& end, float progress) {
+        // Smooth step function for smoother transition
+        float smoothProgress = progress * progress * (3.0f - 2.0f * progress);
+        
+        // Linear interpolation for position
+        glm::vec3 transPosition = glm::mix(start.position, end.position, smoothProgress);
+        
+        // Spherical linear interpolation for orientation
+        glm::quat transOrientation = glm::slerp(start.orientation, end.orientation, smoothProgress);
+        
+        // Linear interpolation for FOV
+        float transFov = glm::mix(start.fov, end.fov, smoothProgress);
+        
+        return CameraState(transPosition, transOrientation, transFov);
+    }
+
+    // Plain interpolation between two consecutive states, for displaying between simulation steps
+    static CameraState interpolateState(const CameraState& previous, const CameraState& current, float alpha) {
+        return CameraState(glm::mix(previous.position, current.position, alpha),
+                           glm::slerp(previous.orientation, current.orientation, alpha),
+                           glm::mix(previous.fov, current.fov, alpha));
+    }
+
+    void resetStatus() {
+        position = glm::vec3(0.0f, 5.0f, 30.0f);
+        worldUp = glm::vec3(0.0f, 1.0f, 0.0f);
+        fov = 45.0f;
+        orientation = glm::quat(1.0f, 0.0f, 0.0f, 0.0f);
+        targetOrientation = orientation;
+        yaw = 0.0f;
+        pitch = 0.0f;
+        updateVectors();
+    }
+
+private:
+    void updateVectors() {
+        // Extra orientation vector from quaterion
+        glm::mat4 rotation = glm::mat4_cast(orientation);
+        front = -glm::vec3(rotation[2]);
+        right = glm::vec3(rotation[0]);
+        up = glm::vec3(rotation[1]);
+    }
+
+    glm::vec3 position;
+    glm::vec3 front, right, up, worldUp;
+    glm::quat orientation;
+    glm::quat targetOrientation;
+    float yaw;
+    float pitch;
+    float movementSpeed;
+    float mouseSensitivity;
+    float fov;
+};
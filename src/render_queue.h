@@ -0,0 +1,296 @@
+// Render Queue
+// Draw packets of every scene and instance of a frame, sorted by program, diffuse array and VAO so
+// that state only changes between runs of packets. Each run is one multi-draw; with GL 4.3 its
+// commands are read from an indirect buffer ring (see buffer_ring.h), so instanced runs merge too.
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+
+#include "gl_env.h"
+
+#include "texture_image.h"
+#include "buffer_ring.h"
+
+#define RENDER_QUEUE_MIN_COMMAND_NUM 256
+
+namespace SkeletalMesh {
+    // One mesh of one scene. The instance base uniform receives instanceBase before the draw, and the
+    // shader adds it to gl_InstanceID; packets of non-instanced programs leave both at 0 and 1.
+    struct DrawPacket {
+        GLuint program;
+        const TextureImage::Texture *diffuse;
+        GLuint vao;
+        GLenum type;
+        GLint instanceBase;
+        GLsizei instanceNum;
+        GLsizei count;
+        size_t byteOffset;
+        GLint baseVertex;
+    };
+
+    // Layout of GL's DrawElementsIndirectCommand
+    struct IndirectCommand {
+        GLuint count;
+        GLuint instanceCount;
+        GLuint firstIndex;
+        GLint baseVertex;
+        GLuint baseInstance;
+    };
+
+    // Packet state in sort order: program, diffuse array, VAO, instance base, index type, then arrival
+    struct SortKey {
+        uint64_t program;
+        uint64_t diffuse;
+        uint64_t vao;
+        uint64_t index;
+
+        bool operator<(const SortKey &_other) const {
+            if (program != _other.program) return program < _other.program;
+            if (diffuse != _other.diffuse) return diffuse < _other.diffuse;
+            if (vao != _other.vao) return vao < _other.vao;
+            return index < _other.index;
+        }
+    };
+
+    // Sorted packets [first, first + num) sharing every piece of state
+    struct DrawRun {
+        size_t first;
+        GLsizei num;
+        bool instanced;
+    };
+
+    // Work of the last RenderQueue::submit()
+    struct RenderStats {
+        int packetNum;
+        int drawNum;
+        int programChange;
+        int textureChange;
+        int vaoChange;
+        int uniformChange;
+
+        RenderStats() { memset(this, 0, sizeof(RenderStats)); }
+
+        int stateChange() const { return programChange + textureChange + vaoChange + uniformChange; }
+    };
+
+    class RenderQueue {
+    public:
+        // Cleared to submit every run with glMultiDrawElementsBaseVertex even where indirect draws exist
+        static bool indirect;
+
+        explicit RenderQueue(GLenum _diffuseChannel = 0)
+                : diffuseChannel(_diffuseChannel), ringFailed(false) {}
+
+        ~RenderQueue() { clear(); }
+
+        void clear() {
+            ring.release();
+            ringFailed = false;
+            packet.clear();
+            instanceBaseLocation.clear();
+        }
+
+        bool indirectSupported() const {
+            return indirect && !ringFailed && (GLEW_VERSION_4_3 || GLEW_ARB_multi_draw_indirect);
+        }
+
+        // Uniform that receives the instanceBase of packets, looked up once per program
+        void setInstanceBaseUniform(const std::string &_name) {
+            instanceBaseName = _name;
+            instanceBaseLocation.clear();
+        }
+
+        void add(const DrawPacket &_packet) {
+            if (_packet.instanceNum > 0 && _packet.count > 0) packet.push_back(_packet);
+        }
+
+        size_t getPacketNum() const { return packet.size(); }
+
+        // Sorts the packets and cuts them into runs, filling the draw tables of both submit paths.
+        // Touches no GL state; submit() calls it.
+        void sort() {
+            size_t packetNum = packet.size();
+            key.resize(packetNum);
+            for (size_t i = 0; i < packetNum; i++) {
+                const DrawPacket &p = packet[i];
+                SortKey &k = key[i];
+                k.program = p.program;
+                k.diffuse = (uintptr_t) p.diffuse;
+                k.vao = (uint64_t) p.vao << 32 | (uint32_t) p.instanceBase;
+                k.index = (uint64_t) (p.type == GL_UNSIGNED_INT) << 32 | i;
+            }
+            // Keys are contiguous and unique, so the sort neither chases packets nor needs to be stable
+            std::sort(key.begin(), key.end());
+            order.resize(packetNum);
+            for (size_t k = 0; k < packetNum; k++) order[k] = (size_t) (key[k].index & 0xffffffffu);
+
+            run.clear();
+            command.resize(packetNum);
+            drawCount.resize(packetNum);
+            drawOffset.resize(packetNum);
+            drawBaseVertex.resize(packetNum);
+            for (size_t k = 0; k < packetNum; k++) {
+                const DrawPacket &p = packet[order[k]];
+                if (k == 0 || !sameState(packet[order[k - 1]], p)) {
+                    DrawRun r = {k, 0, false};
+                    run.push_back(r);
+                }
+                run.back().num++;
+                run.back().instanced = run.back().instanced || p.instanceNum != 1;
+                IndirectCommand &c = command[k];
+                c.count = (GLuint) p.count;
+                c.instanceCount = (GLuint) p.instanceNum;
+                size_t indexBytes = p.type == GL_UNSIGNED_SHORT ? sizeof(uint16_t) : sizeof(uint32_t);
+                c.firstIndex = (GLuint) (p.byteOffset / indexBytes);
+                c.baseVertex = p.baseVertex;
+                c.baseInstance = 0;
+                drawCount[k] = p.count;
+                drawOffset[k] = (const void *) p.byteOffset;
+                drawBaseVertex[k] = p.baseVertex;
+            }
+        }
+
+        size_t getRunNum() const { return run.size(); }
+
+        // Draws every packet and empties the queue. Leaves the last program bound and no VAO.
+        void submit() {
+            sort();
+            stats = RenderStats();
+            stats.packetNum = (int) packet.size();
+            if (run.empty()) return;
+
+            bool useIndirect = indirectSupported() && reserveCommands(command.size());
+            size_t commandOffset = 0;
+            if (useIndirect) {
+                char *commands = ring.begin();
+                useIndirect = commands != NULL;
+                if (useIndirect) {
+                    memcpy(commands, command.data(), command.size() * sizeof(IndirectCommand));
+                    ring.flush();
+                    commandOffset = ring.offset();
+                    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, ring.getBuffer());
+                }
+            }
+
+            const DrawPacket *bound = NULL;
+            GLint baseLocation = -1;
+            bool baseSet = false;
+            for (size_t r = 0; r < run.size(); r++) {
+                const DrawRun &curRun = run[r];
+                const DrawPacket &p = packet[order[curRun.first]];
+                if (bound == NULL || p.program != bound->program) {
+                    glUseProgram(p.program);
+                    stats.programChange++;
+                    baseLocation = instanceBaseUniform(p.program);
+                    baseSet = false;
+                }
+                if (bound == NULL || p.diffuse != bound->diffuse) {
+                    bindDiffuse(p.diffuse);
+                    stats.textureChange++;
+                }
+                if (bound == NULL || p.vao != bound->vao) {
+                    glBindVertexArray(p.vao);
+                    stats.vaoChange++;
+                }
+                if (baseLocation >= 0 && (!baseSet || p.instanceBase != bound->instanceBase)) {
+                    glUniform1i(baseLocation, p.instanceBase);
+                    stats.uniformChange++;
+                    baseSet = true;
+                }
+                bound = &p;
+
+                if (useIndirect) {
+                    glMultiDrawElementsIndirect(GL_TRIANGLES, p.type,
+                                                (const void *) (commandOffset + curRun.first * sizeof(IndirectCommand)),
+                                                curRun.num, 0);
+                    stats.drawNum++;
+                } else if (!curRun.instanced) {
+                    glMultiDrawElementsBaseVertex(GL_TRIANGLES, &drawCount[curRun.first], p.type,
+                                                  &drawOffset[curRun.first], curRun.num,
+                                                  &drawBaseVertex[curRun.first]);
+                    stats.drawNum++;
+                } else {
+                    // GL 3.3 has no instanced multi-draw
+                    for (size_t k = curRun.first; k < curRun.first + curRun.num; k++) {
+                        glDrawElementsInstancedBaseVertex(GL_TRIANGLES, drawCount[k], p.type, drawOffset[k],
+                                                          packet[order[k]].instanceNum, drawBaseVertex[k]);
+                        stats.drawNum++;
+                    }
+                }
+            }
+
+            if (useIndirect) {
+                ring.fence();
+                glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+            }
+            glBindVertexArray(0);
+            packet.clear();
+        }
+
+        const RenderStats &getStats() const { return stats; }
+
+    private:
+        GLenum diffuseChannel;
+        std::string instanceBaseName;
+        std::map<GLuint, GLint> instanceBaseLocation;
+        std::vector<DrawPacket> packet;
+        std::vector<SortKey> key;
+        std::vector<size_t> order;
+        std::vector<DrawRun> run;
+        std::vector<IndirectCommand> command;
+        std::vector<GLsizei> drawCount;
+        std::vector<const void *> drawOffset;
+        std::vector<GLint> drawBaseVertex;
+        BufferRing ring;
+        bool ringFailed;
+        RenderStats stats;
+
+        // Forbid copying GL objects
+        RenderQueue(const RenderQueue &_copy);
+
+        RenderQueue &operator=(const RenderQueue &_copy);
+
+        static bool sameState(const DrawPacket &_a, const DrawPacket &_b) {
+            return _a.program == _b.program && _a.diffuse == _b.diffuse && _a.vao == _b.vao && _a.type == _b.type &&
+                   _a.instanceBase == _b.instanceBase;
+        }
+
+        // Grows the ring to a power of two of commands per region; waits for the old one to drain
+        bool reserveCommands(size_t _commandNum) {
+            size_t bytes = _commandNum * sizeof(IndirectCommand);
+            if (ring.available() && bytes <= ring.getRegionBytes()) return true;
+            size_t capacity = RENDER_QUEUE_MIN_COMMAND_NUM;
+            while (capacity < _commandNum) capacity *= 2;
+            if (!ring.create(GL_DRAW_INDIRECT_BUFFER, capacity * sizeof(IndirectCommand))) {
+                std::cout << "Error occured mapping the indirect buffer, falling back to multi-draw" << std::endl;
+                ringFailed = true;
+            }
+            return ring.available();
+        }
+
+        GLint instanceBaseUniform(GLuint _program) {
+            if (instanceBaseName.empty()) return -1;
+            std::map<GLuint, GLint>::iterator found = instanceBaseLocation.find(_program);
+            if (found != instanceBaseLocation.end()) return found->second;
+            GLint location = glGetUniformLocation(_program, instanceBaseName.c_str());
+            instanceBaseLocation.insert(std::make_pair(_program, location));
+            return location;
+        }
+
+        // Textures that are not loaded (the error texture) leave the channel empty
+        void bindDiffuse(const TextureImage::Texture *_diffuse) const {
+            if (_diffuse->bind(diffuseChannel)) return;
+            glActiveTexture(GL_TEXTURE0 + diffuseChannel);
+            glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+        }
+    };
+
+    bool RenderQueue::indirect = true;
+}
@@ -0,0 +1,517 @@
+// Scene Baking
+// Imports a file through Assimp once and serializes everything the renderer and the tools need into
+// the baked cache (see mesh_cache.h), then rebuilds skeletons and clips from it. Plain CPU code: nothing
+// here touches GL, so headless tools can bake and read scenes without a context.
+
+#pragma once
+
+#include <iostream>
+#include <vector>
+#include <string>
+#include <map>
+#include <algorithm>
+#include <cstring>
+
+#include "file_util.h"
+#include "mesh_cache.h"
+#include "skeleton.h"
+#include "job_system.h"
+#include "animation_clip.h"
+#include "dual_quat.h"
+#include "mesh_optimizer.h"
+#include "mesh_simplifier.h"
+
+#include <assimp/Importer.hpp>
+#include <assimp/scene.h>
+#include <assimp/postprocess.h>
+#include <assimp/config.h>
+#include <glm/glm.hpp>
+
+#define SCENE_RESOURCE_BONE_PER_VERTEX 4
+
+#define SCENE_RESOURCE_LOD_MAX_ERROR 0.02f
+
+namespace SkeletalMesh {
+    struct ParametricVertex {
+        float position[3];
+        float texcoord[2];
+        float normal[3];
+        unsigned int boneId[SCENE_RESOURCE_BONE_PER_VERTEX];
+        float boneWeight[SCENE_RESOURCE_BONE_PER_VERTEX];
+
+        ParametricVertex() { memset(this, 0, sizeof(ParametricVertex)); }
+
+        ParametricVertex(aiVector3D _p, aiVector2D _tc, aiVector3D _n) {
+            memcpy(position, &_p, sizeof(position));
+            memcpy(texcoord, &_tc, sizeof(texcoord));
+            memcpy(normal, &_n, sizeof(normal));
+            memset(boneId, 0, sizeof(boneId));
+            memset(boneWeight, 0, sizeof(boneWeight));
+        }
+
+        bool addBone(unsigned int _id, float _weight) {
+            if (_weight < 1e-6) return false;
+            int minWeightIndex = 0;
+            for (int i = 1; i < SCENE_RESOURCE_BONE_PER_VERTEX; i++) {
+                if (boneWeight[i] < boneWeight[minWeightIndex])
+                    minWeightIndex = i;
+            }
+            if (boneWeight[minWeightIndex] < _weight) {
+                boneId[minWeightIndex] = _id;
+                boneWeight[minWeightIndex] = _weight;
+                return true;
+            }
+            return false;
+        }
+    };
+
+    // Simplified levels baked after the full mesh: level l keeps about ratio[l - 1] of the triangles.
+    // maxError bounds the accumulated simplification error as a fraction of each mesh's bounding radius.
+    struct LodSettings {
+        std::vector<float> ratio;
+        float maxError;
+
+        LodSettings() : maxError(SCENE_RESOURCE_LOD_MAX_ERROR) {
+            ratio.push_back(0.5f);
+            ratio.push_back(0.25f);
+            ratio.push_back(0.125f);
+        }
+    };
+
+    // Bake and read side of Scene, usable without one
+    class SceneBaker {
+    public:
+        typedef std::vector<glm::fmat4> SkeletonTransf;
+        typedef std::map<std::string, unsigned int> Name2Bone;
+        // Read when a cache is baked; caches baked with other settings are rebaked
+        static LodSettings lodSettings;
+
+        // Maps the baked cache next to the source file, baking it first on a miss.
+        // Touches no GL state, so it can run without a context.
+        static bool openBaked(const std::string &_filename, MeshCache::BakedFile &_baked,
+                              Parallel::JobSystem *_jobs = NULL) {
+            MeshCache::SourceStamp stamp;
+            if (!MeshCache::SourceStamp::query(_filename, stamp)) return false;
+
+            std::string cacheFilename = _filename + MESH_CACHE_SUFFIX;
+            if (_baked.open(cacheFilename, stamp, sizeof(ParametricVertex)) && lodSettingsMatch(_baked)) return true;
+
+            std::vector<char> blob;
+            MeshOptimizer::Report report;
+            if (!bakeScene(_filename, stamp, blob, _jobs, &report)) return false;
+            char metrics[96];
+            snprintf(metrics, sizeof(metrics), "ACMR %.3f -> %.3f, ATVR %.3f -> %.3f", report.before.acmr(),
+                     report.after.acmr(), report.before.atvr(), report.after.atvr());
+            std::cout << "Baked " << _filename << ": " << metrics << std::endl;
+            if (!FileUtil::writeFile(cacheFilename, blob))
+                std::cout << "Error writing mesh cache " << cacheFilename << std::endl;
+            return _baked.adopt(blob, sizeof(ParametricVertex));
+        }
+
+        // Flattens the baked node table into _skeleton. Names are only resolved here,
+        // pose evaluation works on indices. Touches no GL state.
+        static bool buildSkeleton(const MeshCache::BakedFile &_baked, Skeleton &_skeleton, Name2Bone &_nameBoneMap) {
+            const MeshCache::Header &header = _baked.header();
+
+            std::vector<glm::fmat4> boneOffset(header.boneNum);
+            for (unsigned int i = 0; i < header.boneNum; i++) {
+                const MeshCache::BoneRecord &boneRecord = _baked.bones()[i];
+                boneOffset[i] = toGlm(boneRecord.offsetMatrix);
+                const char *boneName = _baked.string(boneRecord.nameOffset);
+                _nameBoneMap.insert(std::make_pair(std::string(boneName ? boneName : ""), i));
+            }
+
+            unsigned int nTotalNodes = header.nodeNum;
+            std::vector<int> nodeParent(nTotalNodes);
+            std::vector<glm::fmat4> nodeLocalTransf(nTotalNodes);
+            std::vector<int> nodeBone(nTotalNodes, -1);
+            for (unsigned int i = 0; i < nTotalNodes; i++) {
+                const MeshCache::NodeRecord &nodeRecord = _baked.nodes()[i];
+                nodeParent[i] = nodeRecord.parent;
+                nodeLocalTransf[i] = toGlm(nodeRecord.transformation);
+                const char *nodeName = _baked.string(nodeRecord.nameOffset);
+                Name2Bone::const_iterator boneFound = _nameBoneMap.find(std::string(nodeName ? nodeName : ""));
+                if (boneFound != _nameBoneMap.end()) nodeBone[i] = boneFound->second;
+            }
+            return _skeleton.build(nodeParent, nodeLocalTransf, nodeBone, boneOffset);
+        }
+
+        // Copies the baked clips out of the mapping and binds them to _skeleton, which must have been
+        // built from the same file. Tracks of bones the skeleton has no node for are dropped.
+        static void buildAnimationClips(const MeshCache::BakedFile &_baked, const Skeleton &_skeleton,
+                                        std::vector<AnimationClip> &_clips) {
+            const MeshCache::Header &header = _baked.header();
+            _clips.resize(header.clipNum);
+            for (uint32_t i = 0; i < header.clipNum; i++) {
+                const MeshCache::ClipRecord &clipRecord = _baked.clips()[i];
+                AnimationClip &clip = _clips[i];
+                const char *clipName = _baked.string(clipRecord.nameOffset);
+                clip.name = clipName ? clipName : "";
+                clip.duration = clipRecord.duration;
+                clip.tracks.clear();
+                clip.keyTime.clear();
+                clip.keyValue.clear();
+                for (uint32_t j = 0; j < clipRecord.trackNum; j++) {
+                    const MeshCache::TrackRecord &trackRecord = _baked.tracks()[clipRecord.trackOffset + j];
+                    if (trackRecord.bone < 0 || (size_t) trackRecord.bone >= _skeleton.boneNum()) continue;
+                    int node = _skeleton.boneNode[trackRecord.bone];
+                    if (node < 0) continue;
+
+                    AnimationTrack track;
+                    track.bone = trackRecord.bone;
+                    // The skeleton may hold pivot helpers between the bone and its parent bone, whose product
+                    // with the bone's own local transform is what the channels animate
+                    glm::fmat4 bindLocal = toGlm(trackRecord.bindLocal);
+                    track.invBindLocal = glm::inverse(bindLocal);
+                    DualQuat bindRotation = DualQuat::fromMatrix(bindLocal);
+                    track.bindValue[ChannelTranslation] = glm::fvec4(bindLocal[3][0], bindLocal[3][1], bindLocal[3][2], 0.0f);
+                    track.bindValue[ChannelRotation] = glm::fvec4(bindRotation.real[0], bindRotation.real[1],
+                                                                  bindRotation.real[2], bindRotation.real[3]);
+                    track.bindValue[ChannelScale] = glm::fvec4(glm::length(glm::fvec3(bindLocal[0])),
+                                                               glm::length(glm::fvec3(bindLocal[1])),
+                                                               glm::length(glm::fvec3(bindLocal[2])), 0.0f);
+                    for (int c = 0; c < ANIMATION_CHANNEL_NUM; c++) {
+                        track.keyOffset[c] = (uint32_t) clip.keyTime.size();
+                        track.keyNum[c] = trackRecord.keyNum[c];
+                        const float *times = _baked.keyTimes() + trackRecord.keyOffset[c];
+                        const float *values = _baked.keyValues() + 4 * (size_t) trackRecord.keyOffset[c];
+                        for (uint32_t k = 0; k < trackRecord.keyNum[c]; k++) {
+                            clip.keyTime.push_back(times[k]);
+                            clip.keyValue.push_back(glm::fvec4(values[4 * k], values[4 * k + 1],
+                                                               values[4 * k + 2], values[4 * k + 3]));
+                        }
+                    }
+                    clip.tracks.push_back(track);
+                }
+            }
+        }
+
+        // Imports a file through Assimp and serializes the result in the baked cache format.
+        // Meshes are assembled and reordered for the vertex cache in parallel when _jobs is given;
+        // the result does not depend on it. _report receives the cache statistics before and after.
+        // Touches no GL state, so it can run without a context.
+        static bool bakeScene(const std::string &_filename, const MeshCache::SourceStamp &_stamp,
+                              std::vector<char> &_blob, Parallel::JobSystem *_jobs = NULL,
+                              MeshOptimizer::Report *_report = NULL) {
+            Assimp::Importer importer;
+            const aiScene *scene = importer.ReadFile(_filename,
+                                                     aiProcess_Triangulate | aiProcess_GenSmoothNormals |
+                                                     aiProcess_FlipUVs | aiProcess_JoinIdenticalVertices);
+            if (!scene) return false;
+            // FBX pivot helper nodes take the channels of the bones below them. Only the clips are read from
+            // a second import with the helpers collapsed into their bones; the skeleton keeps them.
+            Assimp::Importer clipImporter;
+            const aiScene *clipScene = NULL;
+            if (scene->mNumAnimations > 0 && hasPivotNodes(scene->mRootNode)) {
+                clipImporter.SetPropertyBool(AI_CONFIG_IMPORT_FBX_PRESERVE_PIVOTS, false);
+                clipScene = clipImporter.ReadFile(_filename, 0);
+                if (!clipScene) return false;
+            }
+            return bakeScene(scene, _stamp, _blob, _jobs, _report, clipScene);
+        }
+
+        // Same as above for a scene already in memory (triangulated, with normals).
+        // Clips come from _clipScene when given, otherwise from _scene.
+        static bool bakeScene(const aiScene *_scene, const MeshCache::SourceStamp &_stamp,
+                              std::vector<char> &_blob, Parallel::JobSystem *_jobs = NULL,
+                              MeshOptimizer::Report *_report = NULL, const aiScene *_clipScene = NULL) {
+            if (_scene == NULL || _scene->mRootNode == NULL) return false;
+            if (_clipScene == NULL) _clipScene = _scene;
+
+            MeshCache::Builder builder;
+            Name2Bone nameBoneMap;
+
+            int nTotalMeshes = _scene->mNumMeshes;
+            builder.meshes.resize(nTotalMeshes);
+            // Bone IDs depend on the order bones are first met, so they are assigned serially.
+            // Only the first mesh referencing a bone contributes its weights (-1 for the others).
+            std::vector<std::vector<int> > meshBoneId(nTotalMeshes);
+
+            int nTotalVertices = 0;
+            int nTotalIndices = 0;
+            for (int i = 0; i < nTotalMeshes; i++) {
+                const aiMesh *curMesh = _scene->mMeshes[i];
+                int nMeshBones = curMesh->mNumBones;
+
+                builder.meshes[i].facetCornerNum = curMesh->mNumFaces * 3;
+                builder.meshes[i].indexOffset = nTotalIndices;
+                builder.meshes[i].vertexOffset = nTotalVertices;
+                builder.meshes[i].materialIndex = curMesh->mMaterialIndex;
+
+                nTotalVertices += curMesh->mNumVertices;
+                nTotalIndices += curMesh->mNumFaces * 3;
+
+                meshBoneId[i].assign(nMeshBones, -1);
+                for (int j = 0; j < nMeshBones; j++) {
+                    std::string boneName = curMesh->mBones[j]->mName.data;
+                    std::pair<std::map<std::string, unsigned int>::iterator, bool> insertResult;
+                    insertResult = nameBoneMap.insert(std::make_pair(boneName, builder.bones.size()));
+                    if (insertResult.second) {
+                        MeshCache::BoneRecord boneRecord;
+                        memset(&boneRecord, 0, sizeof(boneRecord));
+                        memcpy(boneRecord.offsetMatrix, &curMesh->mBones[j]->mOffsetMatrix,
+                               sizeof(boneRecord.offsetMatrix));
+                        boneRecord.nameOffset = builder.addString(boneName);
+                        builder.bones.push_back(boneRecord);
+                        meshBoneId[i][j] = insertResult.first->second;
+                    }
+                }
+            }
+
+            std::vector<ParametricVertex> vertexAssembly(nTotalVertices);
+            builder.indices.resize(nTotalIndices);
+            std::vector<MeshOptimizer::Report> meshReport(nTotalMeshes);
+            if (_jobs != NULL) {
+                _jobs->parallelFor(nTotalMeshes, 1, [&](size_t _begin, size_t _end, size_t _thread) {
+                    for (size_t i = _begin; i < _end; i++)
+                        meshReport[i] = assembleMesh(_scene->mMeshes[i], builder.meshes[i], meshBoneId[i],
+                                                     vertexAssembly.data(), builder.indices.data());
+                });
+            } else {
+                for (int i = 0; i < nTotalMeshes; i++)
+                    meshReport[i] = assembleMesh(_scene->mMeshes[i], builder.meshes[i], meshBoneId[i],
+                                                 vertexAssembly.data(), builder.indices.data());
+            }
+            if (_report != NULL) {
+                *_report = MeshOptimizer::Report();
+                for (int i = 0; i < nTotalMeshes; i++) _report->add(meshReport[i]);
+            }
+            bakeLods(builder, vertexAssembly, _jobs);
+            builder.vertexBlob.assign((const char *) vertexAssembly.data(),
+                                      (const char *) (vertexAssembly.data() + vertexAssembly.size()));
+
+            bakeNode(builder, _scene->mRootNode, -1);
+
+            int nTotalMaterials = _scene->mNumMaterials;
+            builder.materials.assign(nTotalMaterials, MESH_CACHE_NO_STRING);
+            for (int i = 0; i < nTotalMaterials; i++) {
+                const aiMaterial *curMaterial = _scene->mMaterials[i];
+
+                if (curMaterial->GetTextureCount(aiTextureType_DIFFUSE) > 0) {
+                    aiString ai_filepath;
+                    if (curMaterial->GetTexture(aiTextureType_DIFFUSE, 0, &ai_filepath, NULL, NULL, NULL, NULL, NULL) ==
+                        AI_SUCCESS)
+                        builder.materials[i] = builder.addString(ai_filepath.data);
+                }
+            }
+
+            bakeAnimations(builder, _clipScene, nameBoneMap);
+
+            builder.serialize(_stamp, sizeof(ParametricVertex), _blob);
+            return true;
+        }
+
+    private:
+        static bool lodSettingsMatch(const MeshCache::BakedFile &_baked) {
+            if (_baked.header().lodNum != lodSettings.ratio.size()) return false;
+            for (uint32_t l = 0; l < _baked.header().lodNum; l++) {
+                const MeshCache::LodRecord &lod = _baked.lods()[l];
+                if (lod.ratio != lodSettings.ratio[l] || lod.maxError != lodSettings.maxError) return false;
+            }
+            return true;
+        }
+
+        // aiMatrix4x4 is row-major, glm is column-major
+        static glm::fmat4 toGlm(const float *_aiMatrix) {
+            glm::fmat4 m;
+            memcpy(&m, _aiMatrix, sizeof(m));
+            return glm::transpose(m);
+        }
+
+        // Names of the helper nodes Assimp inserts above an FBX node for its pivots and pre-rotation
+        static bool hasPivotNodes(const aiNode *_node) {
+            if (strstr(_node->mName.data, "_$AssimpFbx$_") != NULL) return true;
+            for (unsigned int i = 0; i < _node->mNumChildren; i++)
+                if (hasPivotNodes(_node->mChildren[i])) return true;
+            return false;
+        }
+
+        // Channels are matched to bones by node name; channels of nodes without a bone cannot be
+        // expressed as bone modifiers and are skipped. Key times are converted to seconds.
+        // Each track keeps the local transform of its node in _scene, the bind pose its channels replace.
+        static void bakeAnimations(MeshCache::Builder &_builder, const aiScene *_scene, const Name2Bone &_nameBoneMap) {
+            for (unsigned int i = 0; i < _scene->mNumAnimations; i++) {
+                const aiAnimation *curAnimation = _scene->mAnimations[i];
+                double ticksPerSecond = curAnimation->mTicksPerSecond > 0.0 ? curAnimation->mTicksPerSecond : 25.0;
+
+                MeshCache::ClipRecord clipRecord;
+                clipRecord.nameOffset = _builder.addString(curAnimation->mName.data);
+                clipRecord.trackOffset = (uint32_t) _builder.tracks.size();
+                clipRecord.duration = (float) (curAnimation->mDuration / ticksPerSecond);
+
+                for (unsigned int j = 0; j < curAnimation->mNumChannels; j++) {
+                    const aiNodeAnim *curChannel = curAnimation->mChannels[j];
+                    Name2Bone::const_iterator boneFound = _nameBoneMap.find(curChannel->mNodeName.data);
+                    if (boneFound == _nameBoneMap.end()) continue;
+
+                    MeshCache::TrackRecord trackRecord;
+                    memset(&trackRecord, 0, sizeof(trackRecord));
+                    trackRecord.bone = (int32_t) boneFound->second;
+                    const aiNode *boneNode = _scene->mRootNode->FindNode(curChannel->mNodeName);
+                    if (boneNode == NULL) continue;
+                    memcpy(trackRecord.bindLocal, &boneNode->mTransformation, sizeof(trackRecord.bindLocal));
+
+                    trackRecord.keyOffset[ChannelTranslation] = (uint32_t) _builder.keyTimes.size();
+                    trackRecord.keyNum[ChannelTranslation] = curChannel->mNumPositionKeys;
+                    for (unsigned int k = 0; k < curChannel->mNumPositionKeys; k++) {
+                        const aiVectorKey &key = curChannel->mPositionKeys[k];
+                        addKey(_builder, key.mTime / ticksPerSecond, key.mValue.x, key.mValue.y, key.mValue.z, 0.0f);
+                    }
+
+                    trackRecord.keyOffset[ChannelRotation] = (uint32_t) _builder.keyTimes.size();
+                    trackRecord.keyNum[ChannelRotation] = curChannel->mNumRotationKeys;
+                    float previous[4] = {0.0f, 0.0f, 0.0f, 1.0f};
+                    for (unsigned int k = 0; k < curChannel->mNumRotationKeys; k++) {
+                        const aiQuatKey &key = curChannel->mRotationKeys[k];
+                        float q[4] = {key.mValue.x, key.mValue.y, key.mValue.z, key.mValue.w};
+                        float hemisphere = q[0] * previous[0] + q[1] * previous[1] + q[2] * previous[2] + q[3] * previous[3];
+                        if (k > 0 && hemisphere < 0.0f) {
+                            for (int c = 0; c < 4; c++)
+                                q[c] = -q[c];
+                        }
+                        memcpy(previous, q, sizeof(previous));
+                        addKey(_builder, key.mTime / ticksPerSecond, q[0], q[1], q[2], q[3]);
+                    }
+
+                    trackRecord.keyOffset[ChannelScale] = (uint32_t) _builder.keyTimes.size();
+                    trackRecord.keyNum[ChannelScale] = curChannel->mNumScalingKeys;
+                    for (unsigned int k = 0; k < curChannel->mNumScalingKeys; k++) {
+                        const aiVectorKey &key = curChannel->mScalingKeys[k];
+                        addKey(_builder, key.mTime / ticksPerSecond, key.mValue.x, key.mValue.y, key.mValue.z, 0.0f);
+                    }
+
+                    _builder.tracks.push_back(trackRecord);
+                }
+                clipRecord.trackNum = (uint32_t) _builder.tracks.size() - clipRecord.trackOffset;
+                _builder.clips.push_back(clipRecord);
+            }
+        }
+
+        static void addKey(MeshCache::Builder &_builder, double _time, float _x, float _y, float _z, float _w) {
+            _builder.keyTimes.push_back((float) _time);
+            _builder.keyValues.push_back(_x);
+            _builder.keyValues.push_back(_y);
+            _builder.keyValues.push_back(_z);
+            _builder.keyValues.push_back(_w);
+        }
+
+        // Fills one mesh's range of the vertex and index streams, reordered for the post-transform
+        // vertex cache, overdraw and vertex fetch
+        static MeshOptimizer::Report assembleMesh(const aiMesh *_mesh, const MeshCache::MeshRecord &_record,
+                                 const std::vector<int> &_boneId, ParametricVertex *_vertices, uint32_t *_indices) {
+            ParametricVertex *meshVertices = _vertices + _record.vertexOffset;
+            int nMeshVertices = _mesh->mNumVertices;
+            for (int j = 0; j < nMeshVertices; j++) {
+                aiVector2D curTexcoord(.0f, .0f);
+                if (_mesh->HasTextureCoords(0))
+                    curTexcoord = aiVector2D(_mesh->mTextureCoords[0][j].x, _mesh->mTextureCoords[0][j].y);
+                meshVertices[j] = ParametricVertex(_mesh->mVertices[j], curTexcoord, _mesh->mNormals[j]);
+            }
+            int nMeshBones = _mesh->mNumBones;
+            for (int j = 0; j < nMeshBones; j++) {
+                if (_boneId[j] < 0) continue;
+                int nBoneVertexWeight = _mesh->mBones[j]->mNumWeights;
+                for (int k = 0; k < nBoneVertexWeight; k++) {
+                    const aiVertexWeight &vertexWeight = _mesh->mBones[j]->mWeights[k];
+                    meshVertices[vertexWeight.mVertexId].addBone(_boneId[j], vertexWeight.mWeight);
+                }
+            }
+            uint32_t *meshIndices = _indices + _record.indexOffset;
+            int nMeshFaces = _mesh->mNumFaces;
+            for (int j = 0; j < nMeshFaces; j++) {
+                for (int k = 0; k < 3; k++)
+                    meshIndices[3 * j + k] = _mesh->mFaces[j].mIndices[k];
+            }
+            return MeshOptimizer::optimize(meshIndices, _record.facetCornerNum, meshVertices, nMeshVertices);
+        }
+
+        static void bakeNode(MeshCache::Builder &_builder, const aiNode *_node, int32_t _parent) {
+            MeshCache::NodeRecord record;
+            memset(&record, 0, sizeof(record));
+            memcpy(record.transformation, &_node->mTransformation, sizeof(record.transformation));
+            record.parent = _parent;
+            record.nameOffset = _builder.addString(_node->mName.data);
+            int32_t self = (int32_t) _builder.nodes.size();
+            _builder.nodes.push_back(record);
+            for (unsigned int i = 0; i < _node->mNumChildren; i++)
+                bakeNode(_builder, _node->mChildren[i], self);
+        }
+        // Simplifies every mesh into the levels of lodSettings, each level from the previous one, and
+        // appends them after the full meshes. Vertices where the dominant bone changes are kept, so
+        // the regions each bone deforms keep their outline.
+        static void bakeLods(MeshCache::Builder &_builder, const std::vector<ParametricVertex> &_vertices,
+                             Parallel::JobSystem *_jobs) {
+            size_t levelNum = lodSettings.ratio.size();
+            size_t meshNum = _builder.meshes.size();
+            std::vector<std::vector<uint32_t> > lodIndices(levelNum * meshNum);
+            std::vector<float> lodMeshError(levelNum * meshNum, 0.0f);
+            auto simplifyMesh = [&](size_t _mesh) {
+                const MeshCache::MeshRecord &mesh = _builder.meshes[_mesh];
+                const uint32_t *indices = &_builder.indices[mesh.indexOffset];
+                size_t vertexNum = 0;
+                for (uint32_t j = 0; j < mesh.facetCornerNum; j++)
+                    vertexNum = std::max(vertexNum, (size_t) indices[j] + 1);
+                if (vertexNum == 0) return;
+                const ParametricVertex *vertices = &_vertices[mesh.vertexOffset];
+
+                std::vector<uint32_t> region(vertexNum, MESH_SIMPLIFIER_NO_REGION);
+                glm::fvec3 lower(vertices[0].position[0], vertices[0].position[1], vertices[0].position[2]);
+                glm::fvec3 upper = lower;
+                for (size_t v = 0; v < vertexNum; v++) {
+                    int dominant = -1;
+                    for (int k = 0; k < SCENE_RESOURCE_BONE_PER_VERTEX; k++)
+                        if (vertices[v].boneWeight[k] > 0.0f &&
+                            (dominant < 0 || vertices[v].boneWeight[k] > vertices[v].boneWeight[dominant]))
+                            dominant = k;
+                    if (dominant >= 0) region[v] = vertices[v].boneId[dominant];
+                    glm::fvec3 p(vertices[v].position[0], vertices[v].position[1], vertices[v].position[2]);
+                    lower = glm::min(lower, p);
+                    upper = glm::max(upper, p);
+                }
+                double errorBudget = lodSettings.maxError * 0.5f * glm::length(upper - lower);
+
+                MeshSimplifier::Simplifier simplifier(vertices[0].position, sizeof(ParametricVertex), vertexNum,
+                                                      region.data());
+                const uint32_t *source = indices;
+                size_t sourceNum = mesh.facetCornerNum;
+                double error = 0.0;
+                for (size_t l = 0; l < levelNum; l++) {
+                    std::vector<uint32_t> &level = lodIndices[l * meshNum + _mesh];
+                    size_t target = (size_t) (mesh.facetCornerNum * lodSettings.ratio[l]);
+                    error += simplifier.simplify(source, sourceNum, target, std::max(errorBudget - error, 0.0), level);
+                    MeshOptimizer::optimizeTriangles(level.data(), level.size(), vertices[0].position,
+                                                     sizeof(ParametricVertex), vertexNum);
+                    lodMeshError[l * meshNum + _mesh] = (float) error;
+                    source = level.data();
+                    sourceNum = level.size();
+                }
+            };
+            if (_jobs != NULL) {
+                _jobs->parallelFor(meshNum, 1, [&](size_t _begin, size_t _end, size_t _thread) {
+                    for (size_t i = _begin; i < _end; i++) simplifyMesh(i);
+                });
+            } else {
+                for (size_t i = 0; i < meshNum; i++) simplifyMesh(i);
+            }
+
+            for (size_t l = 0; l < levelNum; l++) {
+                MeshCache::LodRecord lod;
+                memset(&lod, 0, sizeof(lod));
+                lod.ratio = lodSettings.ratio[l];
+                lod.maxError = lodSettings.maxError;
+                for (size_t i = 0; i < meshNum; i++) {
+                    const std::vector<uint32_t> &level = lodIndices[l * meshNum + i];
+                    MeshCache::MeshRecord record = _builder.meshes[i];
+                    record.facetCornerNum = (uint32_t) level.size();
+                    record.indexOffset = (uint32_t) _builder.indices.size();
+                    _builder.indices.insert(_builder.indices.end(), level.begin(), level.end());
+                    _builder.lodMeshes.push_back(record);
+                    lod.error = std::max(lod.error, lodMeshError[l * meshNum + i]);
+                }
+                _builder.lods.push_back(lod);
+            }
+        }
+    };
+
+    LodSettings SceneBaker::lodSettings;
+}
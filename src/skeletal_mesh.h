@@ -8,56 +8,29 @@
 #include <vector>
 #include <string>
 #include <map>
+#include <algorithm>
 
 #include "gl_env.h"
 
 #include "texture_image.h"
+#include "mesh_cache.h"
+#include "skeleton.h"
+#include "animation_clip.h"
+#include "compact_vertex.h"
+#include "render_queue.h"
+#include "scene_bake.h"
 
-#include <assimp/Importer.hpp>
-#include <assimp/scene.h>
-#include <assimp/postprocess.h>
 #include <glm/glm.hpp>
 
 #define SCENE_RESOURCE_SHADER_DIFFUSE_CHANNEL 0
 
-#define SCENE_RESOURCE_BONE_PER_VERTEX 4
+#define SCENE_RESOURCE_SHORT_INDEX_LIMIT 65536
+
+#define SCENE_RESOURCE_LOD_PIXEL_ERROR 1.0f
 
 namespace SkeletalMesh {
     typedef std::map<std::string, glm::fmat4> SkeletonModifier;
 
-    struct ParametricVertex {
-        float position[3];
-        float texcoord[2];
-        float normal[3];
-        unsigned int boneId[SCENE_RESOURCE_BONE_PER_VERTEX];
-        float boneWeight[SCENE_RESOURCE_BONE_PER_VERTEX];
-
-        ParametricVertex() { memset(this, 0, sizeof(ParametricVertex)); }
-
-        ParametricVertex(aiVector3D _p, aiVector2D _tc, aiVector3D _n) {
-            memcpy(position, &_p, sizeof(position));
-            memcpy(texcoord, &_tc, sizeof(texcoord));
-            memcpy(normal, &_n, sizeof(normal));
-            memset(boneId, 0, sizeof(boneId));
-            memset(boneWeight, 0, sizeof(boneWeight));
-        }
-
-        bool addBone(unsigned int _id, float _weight) {
-            if (_weight < 1e-6) return false;
-            int minWeightIndex = 0;
-            for (int i = 1; i < SCENE_RESOURCE_BONE_PER_VERTEX; i++) {
-                if (boneWeight[i] < boneWeight[minWeightIndex])
-                    minWeightIndex = i;
-            }
-            if (boneWeight[minWeightIndex] < _weight) {
-                boneId[minWeightIndex] = _id;
-                boneWeight[minWeightIndex] = _weight;
-                return true;
-            }
-            return false;
-        }
-    };
-
     struct MeshEntry {
         unsigned int facetCornerNum;
         unsigned int indexOffset;
@@ -65,31 +38,45 @@ namespace SkeletalMesh {
         unsigned int materialIndex;
     };
 
+    static_assert(sizeof(MeshEntry) == sizeof(MeshCache::MeshRecord), "MeshEntry must match the baked mesh table");
+
+    // Where a mesh's indices live in the element buffer. Meshes whose local indices fit 16 bits
+    // are uploaded as GL_UNSIGNED_SHORT, the rest stay GL_UNSIGNED_INT.
+    struct IndexRange {
+        GLenum type;
+        size_t byteOffset;
+    };
+
+    // Diffuse images of the same size share one texture array; each material owns a layer of it
     struct Material {
         const TextureImage::Texture *diffuse;
+        int diffuseLayer;
 
         Material()
-                : diffuse(&TextureImage::Texture::error) {}
-
-        bool setDiffuse(std::string _name, std::string _filename = std::string()) {
-            return (diffuse = &TextureImage::Texture::loadTexture(_name, _filename))
-                   != &TextureImage::Texture::error;
-        }
+                : diffuse(&TextureImage::Texture::error), diffuseLayer(0) {}
     };
 
-    struct Bone {
-        aiMatrix4x4 localTransf;
+    // Meshes of one level that share their diffuse array and index type.
+    // Their draws are [first, first + num) of the scene's draw tables.
+    struct DrawBatch {
+        const TextureImage::Texture *diffuse;
+        GLenum type;
+        size_t first;
+        GLsizei num;
+    };
 
-        //Bone() : localTransf() {}
-        Bone(const aiMatrix4x4 &_m) : localTransf(_m) {}
+    // Layout of the GPU vertex buffer; the baked cache always stores ParametricVertex
+    enum VertexFormat {
+        VertexFull = 0,
+        VertexCompact = 1
     };
 
-    class Scene {
+    // Baking and reading the cache is inherited from SceneBaker; Scene adds the GL side
+    class Scene : public SceneBaker {
 
     public:
         typedef std::map<std::string, Scene *> Name2Scene;
-        typedef std::vector<glm::fmat4> SkeletonTransf;
-        typedef std::map<std::string, unsigned int> Name2Bone;
+        typedef std::vector<std::pair<uint32_t, BoneId> > Hash2Bone;
         static Name2Scene allScene;
         static Scene error;
 
@@ -97,15 +84,31 @@ namespace SkeletalMesh {
         bool available;
         std::string name;
         std::string filename;
-        Assimp::Importer importer;
-        const aiScene *scene;
         GLuint vao;
         GLuint vbo;
         GLuint ebo;
+        // Diffuse layer of every vertex, taken from the material of the mesh it belongs to
+        GLuint layerVbo;
+        VertexFormat vertexFormat;
+        PositionDecode positionDecode;
         std::vector<MeshEntry> meshEntry;
+        std::vector<IndexRange> indexRange;
+        // Batches of every level, level-major; level l owns [lodBatchBegin[l], lodBatchBegin[l + 1])
+        std::vector<DrawBatch> drawBatch;
+        std::vector<size_t> lodBatchBegin;
+        std::vector<GLsizei> drawCount;
+        std::vector<const void *> drawOffset;
+        std::vector<GLint> drawBaseVertex;
+        // Levels 1.. of every mesh, level-major; lodError[0] is 0 for the full meshes
+        std::vector<MeshEntry> lodEntry;
+        std::vector<float> lodError;
+        glm::fvec3 boundCenter;
+        float boundRadius;
         std::vector<Material> material;
-        std::vector<Bone> skeleton;
+        Skeleton skeleton;
         Name2Bone nameBoneMap;
+        Hash2Bone hashBoneTable;
+        std::vector<AnimationClip> animationClip;
 
         // Forbid calling any constructor outside
         Scene(const Scene &_copy)
@@ -116,6 +119,10 @@ namespace SkeletalMesh {
             vao = 0;
             vbo = 0;
             ebo = 0;
+            layerVbo = 0;
+            vertexFormat = VertexFull;
+            boundCenter = glm::fvec3(0.0f);
+            boundRadius = 0.0f;
         }
 
         virtual ~Scene() { clear(); }
@@ -125,18 +132,33 @@ namespace SkeletalMesh {
             available = false;
             name = std::string();
             filename = std::string();
-            // importer..
-            scene = NULL;
-            glDeleteVertexArrays(1, &vao);
+            // Scenes that never reached the GPU (or headless tools) have no GL objects to free
+            if (vao) glDeleteVertexArrays(1, &vao);
             vao = 0;
-            glDeleteBuffers(1, &vbo);
+            if (vbo) glDeleteBuffers(1, &vbo);
             vbo = 0;
-            glDeleteBuffers(1, &ebo);
+            if (ebo) glDeleteBuffers(1, &ebo);
             ebo = 0;
+            if (layerVbo) glDeleteBuffers(1, &layerVbo);
+            layerVbo = 0;
+            vertexFormat = VertexFull;
+            positionDecode = PositionDecode();
             meshEntry.clear();
+            indexRange.clear();
+            drawBatch.clear();
+            lodBatchBegin.clear();
+            drawCount.clear();
+            drawOffset.clear();
+            drawBaseVertex.clear();
+            lodEntry.clear();
+            lodError.clear();
+            boundCenter = glm::fvec3(0.0f);
+            boundRadius = 0.0f;
             material.clear();
             skeleton.clear();
             nameBoneMap.clear();
+            hashBoneTable.clear();
+            animationClip.clear();
         }
 
         static std::string testAllSuffix(std::string no_suffix_name) {
@@ -158,7 +180,8 @@ namespace SkeletalMesh {
             return std::string();
         }
 
-        static Scene &loadScene(std::string _name, std::string _filename = std::string()) {
+        static Scene &loadScene(std::string _name, std::string _filename = std::string(),
+                                VertexFormat _format = VertexFull) {
             if (_filename.empty() || _filename == "") {
                 _filename = testAllSuffix(_name);
                 if (_filename.empty()) return error;
@@ -171,7 +194,7 @@ namespace SkeletalMesh {
                     allScene.insert(Name2Scene::value_type(_name, new Scene()));
             Scene &target = *(insertion.first->second);
             if (!insertion.second) {
-                if (target.filename == _filename && target.available) {
+                if (target.filename == _filename && target.vertexFormat == _format && target.available) {
                     return target;
                 } else {
                     target.clear();
@@ -181,58 +204,8 @@ namespace SkeletalMesh {
             target.name = _name;
             target.filename = _filename;
 
-            target.scene = target.importer.ReadFile(_filename,
-                                                    aiProcess_Triangulate | aiProcess_GenSmoothNormals |
-                                                    aiProcess_FlipUVs | aiProcess_JoinIdenticalVertices);
-            if (!target.scene) return error;
-
-            std::vector<ParametricVertex> vertexAssembly;
-            std::vector<unsigned int> indexAssembly;
-
-            int nTotalMeshes = target.scene->mNumMeshes;
-            target.meshEntry.resize(nTotalMeshes);
-
-            int nTotalVertices = 0;
-            int nTotalIndices = 0;
-            for (int i = 0; i < nTotalMeshes; i++) {
-                const aiMesh *curMesh = target.scene->mMeshes[i];
-                int nMeshVertices = curMesh->mNumVertices;
-                int nMeshBones = curMesh->mNumBones;
-                int nMeshFaces = curMesh->mNumFaces;
-
-                target.meshEntry[i].facetCornerNum = nMeshFaces * 3;
-                target.meshEntry[i].indexOffset = nTotalIndices;
-                target.meshEntry[i].vertexOffset = nTotalVertices;
-                target.meshEntry[i].materialIndex = curMesh->mMaterialIndex;
-
-                nTotalVertices += nMeshVertices;
-                nTotalIndices += nMeshFaces * 3;
-
-                for (int j = 0; j < nMeshVertices; j++) {
-                    aiVector2D curTexcoord(.0f, .0f);
-                    if (curMesh->HasTextureCoords(0))
-                        curTexcoord = aiVector2D(curMesh->mTextureCoords[0][j].x, curMesh->mTextureCoords[0][j].y);
-                    vertexAssembly.emplace_back(curMesh->mVertices[j], curTexcoord, curMesh->mNormals[j]);
-                }
-                for (int j = 0; j < nMeshBones; j++) {
-                    std::string boneName = curMesh->mBones[j]->mName.data;
-                    std::pair<std::map<std::string, unsigned int>::iterator, bool> insertResult;
-                    insertResult = target.nameBoneMap.insert(std::make_pair(boneName, target.skeleton.size()));
-                    if (insertResult.second) {
-                        target.skeleton.emplace_back(curMesh->mBones[j]->mOffsetMatrix);
-                        int nBoneVertexWeight = curMesh->mBones[j]->mNumWeights;
-                        for (int k = 0; k < nBoneVertexWeight; k++) {
-                            int vertexId = target.meshEntry[i].vertexOffset + curMesh->mBones[j]->mWeights[k].mVertexId;
-                            float weight = curMesh->mBones[j]->mWeights[k].mWeight;
-                            vertexAssembly[vertexId].addBone(insertResult.first->second, weight);
-                        }
-                    }
-                }
-                for (int j = 0; j < nMeshFaces; j++) {
-                    for (int k = 0; k < 3; k++)
-                        indexAssembly.push_back(curMesh->mFaces[j].mIndices[k]);
-                }
-            }
+            MeshCache::BakedFile baked;
+            if (!openBaked(_filename, baked)) return error;
 
             std::string filepath_prefix;
             {
@@ -246,50 +219,7 @@ namespace SkeletalMesh {
                     filepath_prefix = _filename.substr(0, slashpos + 1);
                 }
             }
-            int nTotalMaterials = target.scene->mNumMaterials;
-            target.material.resize(nTotalMaterials);
-            for (int i = 0; i < nTotalMaterials; i++) {
-                const aiMaterial *curMaterial = target.scene->mMaterials[i];
-
-                if (curMaterial->GetTextureCount(aiTextureType_DIFFUSE) > 0) {
-                    aiString ai_filepath;
-                    if (curMaterial->GetTexture(aiTextureType_DIFFUSE, 0, &ai_filepath, NULL, NULL, NULL, NULL, NULL) ==
-                        AI_SUCCESS) {
-                        std::string filepath(filepath_prefix + ai_filepath.data);
-                        std::string dirpath, filename;
-                        size_t slashpos = filepath.rfind('/');
-                        size_t conslashpos = filepath.rfind('\\');
-                        if (conslashpos != std::string::npos) {
-                            if (slashpos == std::string::npos || slashpos < conslashpos)
-                                slashpos = conslashpos;
-                        }
-                        if (slashpos != std::string::npos) {
-                            dirpath = filepath.substr(0, slashpos + 1);
-                            filename = filepath.substr(slashpos + 1, std::string::npos);
-                        } else {
-                            dirpath = std::string();
-                            filename = filepath;
-                        }
-                        if (!target.material[i].setDiffuse(filename, dirpath + filename))
-                            std::cout << "Error loading diffuse " << filepath << std::endl;
-                    }
-                }
-            }
-
-            glGenVertexArrays(1, &target.vao);
-            glBindVertexArray(target.vao);
-
-            glGenBuffers(1, &target.vbo);
-            glBindBuffer(GL_ARRAY_BUFFER, target.vbo);
-            glBufferData(GL_ARRAY_BUFFER, sizeof(ParametricVertex) * vertexAssembly.size(), vertexAssembly.data(),
-                         GL_STATIC_DRAW);
-
-            glGenBuffers(1, &target.ebo);
-            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, target.ebo);
-            glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(unsigned int) * indexAssembly.size(), indexAssembly.data(),
-                         GL_STATIC_DRAW);
-
-            glBindVertexArray(0);
+            if (!target.loadBaked(baked, filepath_prefix, _format)) return error;
 
             target.available = true;
             return target;
@@ -305,109 +235,446 @@ namespace SkeletalMesh {
             return *(find_result->second);
         }
 
-        void recursivelyGetTransf(SkeletonTransf &skTransf, SkeletonModifier &modifier, aiNode *node,
-                                  aiMatrix4x4 parentTransf, const aiMatrix4x4 &invTransf) const {
-            aiMatrix4x4 globalTransf = parentTransf * node->mTransformation;
-            Name2Bone::const_iterator boneFound = nameBoneMap.find(std::string(node->mName.data));
-            if (boneFound != nameBoneMap.end()) {
-                SkeletonModifier::const_iterator boneModFound = modifier.find(std::string(node->mName.data));
-                aiMatrix4x4 boneMod;
-                if (boneModFound != modifier.end()) {
-                    auto trans = glm::transpose(boneModFound->second);
-                    memcpy(&boneMod, &trans, 16 * sizeof(float));
-                    globalTransf *= boneMod;
-                }
-                aiMatrix4x4 finalMtrx = invTransf * globalTransf * skeleton[boneFound->second].localTransf;
-                memcpy(&skTransf[boneFound->second], &finalMtrx.Transpose(), sizeof(skTransf[boneFound->second]));
+        const Skeleton &getSkeleton() const { return skeleton; }
+
+        size_t getAnimationClipNum() const { return animationClip.size(); }
+
+        const AnimationClip &getAnimationClip(size_t _index) const { return animationClip[_index]; }
+
+        // NULL if the scene has no clip of that name
+        const AnimationClip *findAnimationClip(const std::string &_name) const {
+            for (size_t i = 0; i < animationClip.size(); i++) {
+                if (animationClip[i].name == _name) return &animationClip[i];
             }
-            for (int i = 0; i < node->mNumChildren; i++) {
-                recursivelyGetTransf(skTransf, modifier, node->mChildren[i], globalTransf, invTransf);
+            return NULL;
+        }
+
+        const Name2Bone &getNameBoneMap() const { return nameBoneMap; }
+
+        // Name -> ID resolvers, meant to run once at setup
+        BoneId getBoneId(const std::string &_boneName) const {
+            Name2Bone::const_iterator boneFound = nameBoneMap.find(_boneName);
+            return boneFound == nameBoneMap.end() ? SKELETON_INVALID_BONE : (BoneId) boneFound->second;
+        }
+
+        BoneId getBoneId(uint32_t _boneNameHash) const {
+            Hash2Bone::const_iterator boneFound =
+                    std::lower_bound(hashBoneTable.begin(), hashBoneTable.end(),
+                                     std::make_pair(_boneNameHash, (BoneId) SKELETON_INVALID_BONE));
+            if (boneFound == hashBoneTable.end() || boneFound->first != _boneNameHash) return SKELETON_INVALID_BONE;
+            return boneFound->second;
+        }
+
+        // Allocation-free per-frame path: transf keeps its capacity and pose must be bound to this skeleton.
+        // Passing the same transf every frame, only bones below a changed modifier are recomputed;
+        // pose.boneChanged then flags the entries of transf that were rewritten.
+        bool getSkeletonTransform(SkeletonTransf &transf, PoseBuffer &pose) const {
+            if (!available || !pose.boundTo(skeleton)) return false;
+
+            // A vector that just got its size cannot hold the previous result, even at the same address
+            if (transf.size() != skeleton.boneNum()) {
+                transf.assign(skeleton.boneNum(), glm::fmat4(1.0f));
+                pose.invalidate();
             }
+            pose.evaluate(skeleton, transf.data());
+            return !transf.empty();
         }
 
+        // Compatibility wrapper over Skeleton::evaluate() for string-keyed modifiers
         bool getSkeletonTransform(SkeletonTransf &transf, SkeletonModifier &modifier) const {
             if (!available) return false;
 
-            transf.resize(skeleton.size());
+            PoseBuffer pose;
+            pose.bind(skeleton);
+            resolveModifier(nameBoneMap, modifier, pose);
+            transf.assign(skeleton.boneNum(), glm::fmat4(1.0f));
+            return getSkeletonTransform(transf, pose);
+        }
 
-            aiMatrix4x4 identityMtrx, invTransf = scene->mRootNode->mTransformation;
-            invTransf.Inverse();
-            recursivelyGetTransf(transf, modifier, scene->mRootNode, identityMtrx, invTransf);
-            return !transf.empty();
+        // Writes string-keyed modifiers into pose; names missing from _nameBoneMap are skipped
+        static void resolveModifier(const Name2Bone &_nameBoneMap, const SkeletonModifier &_modifier, PoseBuffer &_pose) {
+            // Both maps are sorted by name, so resolve them with a single merge pass
+            SkeletonModifier::const_iterator modIt = _modifier.begin();
+            Name2Bone::const_iterator boneIt = _nameBoneMap.begin();
+            while (modIt != _modifier.end() && boneIt != _nameBoneMap.end()) {
+                if (modIt->first < boneIt->first) {
+                    ++modIt;
+                } else if (boneIt->first < modIt->first) {
+                    ++boneIt;
+                } else {
+                    _pose.set(boneIt->second, modIt->second);
+                    ++modIt;
+                    ++boneIt;
+                }
+            }
         }
 
+        // layerName receives the diffuse array layer as a float
         bool setShaderInput(GLuint program,
                             std::string posiName, std::string texcName, std::string normName,
-                            std::string bnidName, std::string bnwtName) {
+                            std::string bnidName, std::string bnwtName, std::string layerName = std::string()) {
             if (!available) return false;
 
-            ParametricVertex example;
-
             glBindVertexArray(vao);
             glBindBuffer(GL_ARRAY_BUFFER, vbo);
 
-            {
-                GLint posiLoc = glGetAttribLocation(program, posiName.c_str());
-                if (posiLoc >= 0) {
-                    glEnableVertexAttribArray(posiLoc);
-                    glVertexAttribPointer(posiLoc, 3, GL_FLOAT, GL_FALSE, sizeof(ParametricVertex),
-                                          (const void *) ((char *) example.position - (char *) &example));
-                }
+            GLint posiLoc = glGetAttribLocation(program, posiName.c_str());
+            GLint texcLoc = glGetAttribLocation(program, texcName.c_str());
+            GLint normLoc = glGetAttribLocation(program, normName.c_str());
+            GLint bnidLoc = glGetAttribLocation(program, bnidName.c_str());
+            GLint bnwtLoc = glGetAttribLocation(program, bnwtName.c_str());
+            if (vertexFormat == VertexCompact) {
+                CompactVertex example;
+                // Normals are two octahedral components, the shader reconstructs the third
+                setAttribute(posiLoc, 3, GL_UNSIGNED_SHORT, GL_TRUE, sizeof(CompactVertex), &example, example.position);
+                setAttribute(texcLoc, 2, GL_HALF_FLOAT, GL_FALSE, sizeof(CompactVertex), &example, example.texcoord);
+                setAttribute(normLoc, 2, GL_SHORT, GL_TRUE, sizeof(CompactVertex), &example, example.normal);
+                setAttributeI(bnidLoc, SCENE_RESOURCE_BONE_PER_VERTEX, GL_UNSIGNED_BYTE, sizeof(CompactVertex),
+                              &example, example.boneId);
+                setAttribute(bnwtLoc, SCENE_RESOURCE_BONE_PER_VERTEX, GL_UNSIGNED_BYTE, GL_TRUE,
+                             sizeof(CompactVertex), &example, example.boneWeight);
+            } else {
+                ParametricVertex example;
+                setAttribute(posiLoc, 3, GL_FLOAT, GL_FALSE, sizeof(ParametricVertex), &example, example.position);
+                setAttribute(texcLoc, 2, GL_FLOAT, GL_FALSE, sizeof(ParametricVertex), &example, example.texcoord);
+                setAttribute(normLoc, 3, GL_FLOAT, GL_FALSE, sizeof(ParametricVertex), &example, example.normal);
+                setAttributeI(bnidLoc, SCENE_RESOURCE_BONE_PER_VERTEX, GL_INT, sizeof(ParametricVertex),
+                              &example, example.boneId);
+                setAttribute(bnwtLoc, SCENE_RESOURCE_BONE_PER_VERTEX, GL_FLOAT, GL_FALSE, sizeof(ParametricVertex),
+                             &example, example.boneWeight);
             }
-            {
-                GLint texcLoc = glGetAttribLocation(program, texcName.c_str());
-                if (texcLoc >= 0) {
-                    glEnableVertexAttribArray(texcLoc);
-                    glVertexAttribPointer(texcLoc, 2, GL_FLOAT, GL_FALSE, sizeof(ParametricVertex),
-                                          (const void *) ((char *) example.texcoord - (char *) &example));
+            if (!layerName.empty()) {
+                GLint layerLoc = glGetAttribLocation(program, layerName.c_str());
+                uint16_t layer = 0;
+                glBindBuffer(GL_ARRAY_BUFFER, layerVbo);
+                setAttribute(layerLoc, 1, GL_UNSIGNED_SHORT, GL_FALSE, sizeof(uint16_t), &layer, &layer);
+            }
+
+            glBindVertexArray(0);
+
+            return true;
+        }
+
+        // Uploads the bind-position decode (identity for the full format) to the
+        // vec3 uniforms the vertex shader applies to its position attribute
+        bool setPositionDecode(GLuint program, std::string minName, std::string extentName) const {
+            if (!available) return false;
+
+            glUseProgram(program);
+            glUniform3fv(glGetUniformLocation(program, minName.c_str()), 1, (const GLfloat *) &positionDecode.min);
+            glUniform3fv(glGetUniformLocation(program, extentName.c_str()), 1,
+                         (const GLfloat *) &positionDecode.extent);
+            glUseProgram(0);
+            return true;
+        }
+
+        VertexFormat getVertexFormat() const { return vertexFormat; }
+
+        // Quantizes _vertices against their bounding box, which is returned in _decode.
+        // Bone IDs must fit COMPACT_VERTEX_MAX_BONES. Touches no GL state.
+        static void packVertices(const ParametricVertex *_vertices, size_t _vertexNum,
+                                 std::vector<CompactVertex> &_compact, PositionDecode &_decode) {
+            _decode = PositionDecode();
+            if (_vertexNum > 0) {
+                glm::fvec3 lower(_vertices[0].position[0], _vertices[0].position[1], _vertices[0].position[2]);
+                glm::fvec3 upper = lower;
+                for (size_t i = 1; i < _vertexNum; i++) {
+                    glm::fvec3 p(_vertices[i].position[0], _vertices[i].position[1], _vertices[i].position[2]);
+                    lower = glm::min(lower, p);
+                    upper = glm::max(upper, p);
                 }
+                _decode.min = lower;
+                _decode.extent = upper - lower;
             }
-            {
-                GLint normLoc = glGetAttribLocation(program, normName.c_str());
-                if (normLoc >= 0) {
-                    glEnableVertexAttribArray(normLoc);
-                    glVertexAttribPointer(normLoc, 3, GL_FLOAT, GL_FALSE, sizeof(ParametricVertex),
-                                          (const void *) ((char *) example.normal - (char *) &example));
+
+            _compact.resize(_vertexNum);
+            for (size_t i = 0; i < _vertexNum; i++) {
+                const ParametricVertex &v = _vertices[i];
+                _compact[i] = CompactVertexCodec::encode(_decode, v.position, v.texcoord, v.normal, v.boneId,
+                                                         v.boneWeight);
+            }
+        }
+
+        // Picks the narrowest index type of every baked mesh and lays them out in one element buffer,
+        // 32-bit ranges 4-byte aligned. LOD levels follow the full meshes with the same types, ranges
+        // are level-major. Returns the buffer size in bytes. Touches no GL state.
+        static size_t planIndexRanges(const MeshCache::BakedFile &_baked, std::vector<IndexRange> &_ranges) {
+            const MeshCache::Header &header = _baked.header();
+            const uint32_t *indices = _baked.indices();
+            _ranges.resize((size_t) header.meshNum * (header.lodNum + 1));
+            size_t bytes = 0;
+            for (uint32_t l = 0; l <= header.lodNum; l++) {
+                const MeshCache::MeshRecord *meshes = l == 0 ? _baked.meshes() : _baked.lodMeshes(l);
+                for (uint32_t i = 0; i < header.meshNum; i++) {
+                    const MeshCache::MeshRecord &mesh = meshes[i];
+                    IndexRange &range = _ranges[(size_t) l * header.meshNum + i];
+                    if (l == 0) {
+                        uint32_t maxIndex = 0;
+                        for (uint32_t j = 0; j < mesh.facetCornerNum; j++)
+                            maxIndex = std::max(maxIndex, indices[mesh.indexOffset + j]);
+                        range.type = maxIndex < SCENE_RESOURCE_SHORT_INDEX_LIMIT ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+                    } else {
+                        range.type = _ranges[i].type;
+                    }
+                    if (range.type == GL_UNSIGNED_SHORT) {
+                        range.byteOffset = bytes;
+                        bytes += sizeof(uint16_t) * mesh.facetCornerNum;
+                    } else {
+                        bytes = (bytes + sizeof(uint32_t) - 1) & ~(sizeof(uint32_t) - 1);
+                        range.byteOffset = bytes;
+                        bytes += sizeof(uint32_t) * mesh.facetCornerNum;
+                    }
                 }
             }
-            {
-                GLint bnidLoc = glGetAttribLocation(program, bnidName.c_str());
-                if (bnidLoc >= 0) {
-                    glEnableVertexAttribArray(bnidLoc);
-                    glVertexAttribIPointer(bnidLoc, SCENE_RESOURCE_BONE_PER_VERTEX, GL_INT, sizeof(ParametricVertex),
-                                           (const void *) ((char *) example.boneId - (char *) &example));
+            return bytes;
+        }
+
+        // Levels including the full mesh
+        int getLodNum() const { return (int) lodError.size(); }
+
+        float getLodError(int _lod) const { return lodError[_lod]; }
+
+        // Coarsest level whose simplification error stays under _pixelError pixels at the nearest
+        // depth of the scene's bind-pose bounding sphere. _modelView maps the scene into view space.
+        int selectLod(const glm::fmat4 &_projection, const glm::fmat4 &_modelView, float _viewportHeight,
+                      float _pixelError = SCENE_RESOURCE_LOD_PIXEL_ERROR) const {
+            if (lodError.size() <= 1) return 0;
+            float scale = std::max(glm::length(glm::fvec3(_modelView[0])),
+                                   std::max(glm::length(glm::fvec3(_modelView[1])),
+                                            glm::length(glm::fvec3(_modelView[2]))));
+            float pixelPerUnit = _projection[1][1] * 0.5f * _viewportHeight;
+            // Perspective projections divide by view depth, orthographic ones do not
+            if (_projection[2][3] != 0.0f) {
+                glm::fvec4 center = _modelView * glm::fvec4(boundCenter, 1.0f);
+                float depth = -center.z - boundRadius * scale;
+                if (depth <= 0.0f) return 0;
+                pixelPerUnit /= depth;
+            }
+            for (int l = (int) lodError.size() - 1; l > 0; l--)
+                if (lodError[l] * scale * pixelPerUnit <= _pixelError) return l;
+            return 0;
+        }
+
+        // Adds a packet per mesh of level _lod. Instanced programs draw _instanceNum instances starting
+        // at _instanceBase, see RenderQueue.
+        void enqueue(RenderQueue &_queue, GLuint _program, int _lod = 0, GLsizei _instanceNum = 1,
+                     GLint _instanceBase = 0) const {
+            if (!available || _instanceNum <= 0) return;
+            _lod = std::min(std::max(_lod, 0), getLodNum() - 1);
+            for (size_t b = lodBatchBegin[_lod]; b < lodBatchBegin[_lod + 1]; b++) {
+                const DrawBatch &batch = drawBatch[b];
+                for (size_t d = batch.first; d < batch.first + batch.num; d++) {
+                    DrawPacket packet = {_program, batch.diffuse, vao, batch.type, _instanceBase, _instanceNum,
+                                         drawCount[d], (size_t) drawOffset[d], drawBaseVertex[d]};
+                    _queue.add(packet);
                 }
             }
-            {
-                GLint bnwtLoc = glGetAttribLocation(program, bnwtName.c_str());
-                if (bnwtLoc >= 0) {
-                    glEnableVertexAttribArray(bnwtLoc);
-                    glVertexAttribPointer(bnwtLoc, SCENE_RESOURCE_BONE_PER_VERTEX, GL_FLOAT, GL_FALSE,
-                                          sizeof(ParametricVertex),
-                                          (const void *) ((char *) example.boneWeight - (char *) &example));
+        }
+
+    private:
+        // Sorts every level's meshes by diffuse array and index type and cuts them into batches
+        void planDrawBatches() {
+            size_t meshNum = meshEntry.size();
+            std::vector<size_t> order(meshNum);
+            lodBatchBegin.assign(1, 0);
+            for (int l = 0; l < getLodNum(); l++) {
+                for (size_t i = 0; i < meshNum; i++) order[i] = i;
+                std::stable_sort(order.begin(), order.end(), [this, l, meshNum](size_t a, size_t b) {
+                    const TextureImage::Texture *da = meshDiffuse(a);
+                    const TextureImage::Texture *db = meshDiffuse(b);
+                    if (da != db) return std::less<const TextureImage::Texture *>()(da, db);
+                    return indexRange[l * meshNum + a].type < indexRange[l * meshNum + b].type;
+                });
+                for (size_t k = 0; k < meshNum; k++) {
+                    size_t i = order[k];
+                    const MeshEntry &entry = levelEntry(l, i);
+                    const IndexRange &range = indexRange[l * meshNum + i];
+                    const TextureImage::Texture *diffuse = meshDiffuse(i);
+                    if (drawBatch.size() == lodBatchBegin.back() || drawBatch.back().diffuse != diffuse ||
+                        drawBatch.back().type != range.type) {
+                        DrawBatch batch = {diffuse, range.type, drawCount.size(), 0};
+                        drawBatch.push_back(batch);
+                    }
+                    drawBatch.back().num++;
+                    drawCount.push_back((GLsizei) entry.facetCornerNum);
+                    drawOffset.push_back((const void *) range.byteOffset);
+                    drawBaseVertex.push_back((GLint) entry.vertexOffset);
                 }
+                lodBatchBegin.push_back(drawBatch.size());
             }
+        }
 
-            glBindVertexArray(0);
+        // Meshes whose material index is out of range draw untextured, like meshes without a diffuse map
+        const TextureImage::Texture *meshDiffuse(size_t _mesh) const {
+            unsigned int index = meshEntry[_mesh].materialIndex;
+            return index < material.size() ? material[index].diffuse : NULL;
+        }
 
-            return true;
+        const MeshEntry &levelEntry(int _lod, size_t _mesh) const {
+            return _lod == 0 ? meshEntry[_mesh] : lodEntry[(_lod - 1) * meshEntry.size() + _mesh];
+        }
+
+        // Points an attribute at _member of the vertex struct _example, whatever its layout
+        static void setAttribute(GLint _location, GLint _size, GLenum _type, GLboolean _normalized,
+                                 GLsizei _stride, const void *_example, const void *_member) {
+            if (_location < 0) return;
+            glEnableVertexAttribArray(_location);
+            glVertexAttribPointer(_location, _size, _type, _normalized, _stride,
+                                  (const void *) ((const char *) _member - (const char *) _example));
+        }
+
+        static void setAttributeI(GLint _location, GLint _size, GLenum _type, GLsizei _stride,
+                                  const void *_example, const void *_member) {
+            if (_location < 0) return;
+            glEnableVertexAttribArray(_location);
+            glVertexAttribIPointer(_location, _size, _type, _stride,
+                                   (const void *) ((const char *) _member - (const char *) _example));
         }
 
-        void render() const {
-            if (!available) return;
+        // Fills the scene from a baked cache and uploads the buffers straight from it
+        bool loadBaked(const MeshCache::BakedFile &_baked, const std::string &_filepathPrefix,
+                       VertexFormat _format = VertexFull) {
+            const MeshCache::Header &header = _baked.header();
+
+            meshEntry.resize(header.meshNum);
+            if (header.meshNum > 0)
+                memcpy(meshEntry.data(), _baked.meshes(), sizeof(MeshEntry) * header.meshNum);
+            lodEntry.resize((size_t) header.lodNum * header.meshNum);
+            if (!lodEntry.empty())
+                memcpy(lodEntry.data(), _baked.lodMeshes(1), sizeof(MeshEntry) * lodEntry.size());
+            lodError.assign(1, 0.0f);
+            for (uint32_t l = 0; l < header.lodNum; l++) lodError.push_back(_baked.lods()[l].error);
+
+            const ParametricVertex *bakedVertices = (const ParametricVertex *) _baked.vertices();
+            if (header.vertexNum > 0) {
+                glm::fvec3 lower(bakedVertices[0].position[0], bakedVertices[0].position[1],
+                                 bakedVertices[0].position[2]);
+                glm::fvec3 upper = lower;
+                for (uint32_t i = 1; i < header.vertexNum; i++) {
+                    glm::fvec3 p(bakedVertices[i].position[0], bakedVertices[i].position[1],
+                                 bakedVertices[i].position[2]);
+                    lower = glm::min(lower, p);
+                    upper = glm::max(upper, p);
+                }
+                boundCenter = (lower + upper) * 0.5f;
+                boundRadius = glm::length(upper - lower) * 0.5f;
+            }
+
+            if (!buildSkeleton(_baked, skeleton, nameBoneMap)) return false;
+            for (Name2Bone::const_iterator it = nameBoneMap.begin(); it != nameBoneMap.end(); ++it)
+                hashBoneTable.push_back(std::make_pair(boneNameHash(it->first.c_str()), (BoneId) it->second));
+            std::sort(hashBoneTable.begin(), hashBoneTable.end());
+            buildAnimationClips(_baked, skeleton, animationClip);
+
+            // Materials whose images share a size become layers of one texture array, so batches of
+            // meshes draw without rebinding textures in between
+            int nTotalMaterials = header.materialNum;
+            material.resize(nTotalMaterials);
+            typedef std::map<std::pair<uint32_t, uint32_t>, std::vector<std::string> > Size2Layers;
+            Size2Layers sizeLayers;
+            std::vector<std::pair<uint32_t, uint32_t> > materialSize(nTotalMaterials);
+            std::vector<std::string> materialFile(nTotalMaterials);
+            for (int i = 0; i < nTotalMaterials; i++) {
+                const char *ai_filepath = _baked.string(_baked.materials()[i]);
+                if (ai_filepath == NULL) continue;
+
+                std::string filepath(_filepathPrefix + ai_filepath);
+                std::string dirpath, filename;
+                size_t slashpos = filepath.rfind('/');
+                size_t conslashpos = filepath.rfind('\\');
+                if (conslashpos != std::string::npos) {
+                    if (slashpos == std::string::npos || slashpos < conslashpos)
+                        slashpos = conslashpos;
+                }
+                if (slashpos != std::string::npos) {
+                    dirpath = filepath.substr(0, slashpos + 1);
+                    filename = filepath.substr(slashpos + 1, std::string::npos);
+                } else {
+                    dirpath = std::string();
+                    filename = filepath;
+                }
+                if (!TextureCache::probe(dirpath + filename, materialSize[i].first, materialSize[i].second)) {
+                    std::cout << "Error loading diffuse " << filepath << std::endl;
+                    continue;
+                }
+                materialFile[i] = dirpath + filename;
+                std::vector<std::string> &layers = sizeLayers[materialSize[i]];
+                if (std::find(layers.begin(), layers.end(), materialFile[i]) == layers.end())
+                    layers.push_back(materialFile[i]);
+            }
+            for (Size2Layers::const_iterator it = sizeLayers.begin(); it != sizeLayers.end(); ++it) {
+                std::string arrayName = name + "#" + std::to_string((unsigned long long) it->first.first) + "x" +
+                                        std::to_string((unsigned long long) it->first.second);
+                const TextureImage::Texture &array = TextureImage::Texture::loadTextureArray(arrayName, it->second);
+                for (int i = 0; i < nTotalMaterials; i++) {
+                    if (materialFile[i].empty() || materialSize[i] != it->first) continue;
+                    if (&array == &TextureImage::Texture::error) {
+                        std::cout << "Error loading diffuse " << materialFile[i] << std::endl;
+                        continue;
+                    }
+                    std::vector<std::string>::const_iterator layer =
+                            std::find(it->second.begin(), it->second.end(), materialFile[i]);
+                    material[i].diffuse = &array;
+                    material[i].diffuseLayer = (int) (layer - it->second.begin());
+                }
+            }
+
+            glGenVertexArrays(1, &vao);
             glBindVertexArray(vao);
-            for (int i = 0; i < meshEntry.size(); i++) {
-                if (!material[meshEntry[i].materialIndex].diffuse->bind(
-                        SCENE_RESOURCE_SHADER_DIFFUSE_CHANNEL))
-                    glBindTexture(GL_TEXTURE_2D, 0);
-
-                glDrawElementsBaseVertex(GL_TRIANGLES,
-                                         meshEntry[i].facetCornerNum,
-                                         GL_UNSIGNED_INT,
-                                         (void *) (sizeof(unsigned int) * meshEntry[i].indexOffset),
-                                         meshEntry[i].vertexOffset);
+
+            glGenBuffers(1, &vbo);
+            glBindBuffer(GL_ARRAY_BUFFER, vbo);
+            vertexFormat = _format;
+            if (vertexFormat == VertexCompact && header.boneNum > COMPACT_VERTEX_MAX_BONES) {
+                std::cout << "Scene " << name << " has " << header.boneNum
+                          << " bones, too many for compact vertices" << std::endl;
+                vertexFormat = VertexFull;
+            }
+            if (vertexFormat == VertexCompact) {
+                std::vector<CompactVertex> compact;
+                packVertices((const ParametricVertex *) _baked.vertices(), header.vertexNum, compact, positionDecode);
+                glBufferData(GL_ARRAY_BUFFER, sizeof(CompactVertex) * compact.size(), compact.data(), GL_STATIC_DRAW);
+            } else {
+                glBufferData(GL_ARRAY_BUFFER, _baked.vertexBytes(), _baked.vertices(), GL_STATIC_DRAW);
             }
+
+            // 32-bit meshes are uploaded straight from the mapping, 16-bit ones narrowed through
+            // one scratch buffer, so no full-size copy of the indices is made
+            size_t indexBytes = planIndexRanges(_baked, indexRange);
+            glGenBuffers(1, &ebo);
+            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
+            glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexBytes, NULL, GL_STATIC_DRAW);
+            std::vector<uint16_t> narrowed;
+            for (size_t r = 0; r < indexRange.size(); r++) {
+                const MeshEntry &entry = levelEntry((int) (r / header.meshNum), r % header.meshNum);
+                const uint32_t *meshIndices = _baked.indices() + entry.indexOffset;
+                unsigned int cornerNum = entry.facetCornerNum;
+                if (indexRange[r].type == GL_UNSIGNED_INT) {
+                    glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, indexRange[r].byteOffset, sizeof(uint32_t) * cornerNum,
+                                    meshIndices);
+                } else {
+                    narrowed.assign(meshIndices, meshIndices + cornerNum);
+                    glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, indexRange[r].byteOffset, sizeof(uint16_t) * cornerNum,
+                                    narrowed.data());
+                }
+            }
+            planDrawBatches();
+
+            std::vector<uint16_t> vertexLayer(header.vertexNum, 0);
+            for (uint32_t i = 0; i < header.meshNum; i++) {
+                const MeshEntry &entry = meshEntry[i];
+                if (entry.materialIndex >= material.size()) continue;
+                const uint32_t *meshIndices = _baked.indices() + entry.indexOffset;
+                uint16_t layer = (uint16_t) material[entry.materialIndex].diffuseLayer;
+                for (unsigned int j = 0; j < entry.facetCornerNum; j++)
+                    vertexLayer[entry.vertexOffset + meshIndices[j]] = layer;
+            }
+            glGenBuffers(1, &layerVbo);
+            glBindBuffer(GL_ARRAY_BUFFER, layerVbo);
+            glBufferData(GL_ARRAY_BUFFER, sizeof(uint16_t) * vertexLayer.size(), vertexLayer.data(), GL_STATIC_DRAW);
+
             glBindVertexArray(0);
+            return true;
         }
     };
 
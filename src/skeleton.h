@@ -0,0 +1,252 @@
+// Flattened Skeleton Hierarchy
+// The node tree is flattened once at load time so that evaluating a pose
+// is a single linear pass without strings, maps or recursion.
+
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+#include <glm/glm.hpp>
+
+#include "pose_kernel.h"
+
+#define SKELETON_INVALID_BONE (-1)
+
+namespace SkeletalMesh {
+    typedef int BoneId;
+
+    // 32-bit FNV-1a of a bone name, usable in constant expressions
+    constexpr uint32_t boneNameHash(const char *_name, uint32_t _hash = 2166136261u) {
+        return *_name ? boneNameHash(_name + 1, (_hash ^ (uint32_t) (unsigned char) *_name) * 16777619u) : _hash;
+    }
+
+    // Node hierarchy stored struct-of-arrays in the topological order it was built from (every parent
+    // precedes its children), so one front-to-back pass composes it.
+    // All matrices are glm (column-major), i.e. already in the layout the shader expects.
+    class Skeleton {
+    public:
+        std::vector<int> nodeParent;
+        std::vector<glm::fmat4> nodeLocalTransf;
+        std::vector<int> nodeBone;
+        std::vector<glm::fmat4> boneOffset;
+        std::vector<int> boneNode;
+        glm::fmat4 invRootTransf;
+
+        Skeleton() : invRootTransf(1.0f) {}
+
+        void clear() {
+            nodeParent.clear();
+            nodeLocalTransf.clear();
+            nodeBone.clear();
+            boneOffset.clear();
+            boneNode.clear();
+            invRootTransf = glm::fmat4(1.0f);
+        }
+
+        size_t nodeNum() const { return nodeParent.size(); }
+
+        size_t boneNum() const { return boneOffset.size(); }
+
+        // Builds the flattened hierarchy from nodes in topological order, which it keeps
+        // (parent index < own index, node 0 is the root). _bone maps each node to a bone or -1.
+        bool build(const std::vector<int> &_parent, const std::vector<glm::fmat4> &_localTransf,
+                   const std::vector<int> &_bone, const std::vector<glm::fmat4> &_boneOffset) {
+            clear();
+            size_t nTotalNodes = _parent.size();
+            if (nTotalNodes == 0 || _parent[0] != -1) return false;
+            if (_localTransf.size() != nTotalNodes || _bone.size() != nTotalNodes) return false;
+
+            for (size_t i = 1; i < nTotalNodes; i++)
+                if (_parent[i] < 0 || _parent[i] >= (int) i) return false;
+
+            nodeParent = _parent;
+            nodeLocalTransf = _localTransf;
+            nodeBone.resize(nTotalNodes);
+            boneOffset = _boneOffset;
+            boneNode.assign(_boneOffset.size(), -1);
+            for (size_t i = 0; i < nTotalNodes; i++) {
+                int bone = _bone[i];
+                if (bone >= (int) _boneOffset.size()) bone = -1;
+                nodeBone[i] = bone;
+                if (bone >= 0) boneNode[bone] = (int) i;
+            }
+            invRootTransf = glm::inverse(nodeLocalTransf[0]);
+            return true;
+        }
+
+        // Computes the final bone matrices (invRoot * global * offset) in one front-to-back pass with the given
+        // kernel; parents precede children, so no level boundaries are needed.
+        // _boneModifier is a per-bone local modifier (may be NULL for the bind pose),
+        // _nodeGlobal is caller-provided scratch of nodeNum() matrices and receives root-relative transforms.
+        // Bones without a node are left untouched.
+        void evaluate(const PoseKernel::Kernel &_kernel, const glm::fmat4 *_boneModifier,
+                      glm::fmat4 *_boneTransf, glm::fmat4 *_nodeGlobal) const {
+            if (nodeParent.empty()) return;
+            PoseKernel::ComposeArgs args = composeArgs(_boneModifier, _boneTransf, _nodeGlobal);
+            _kernel.compose(args, 0, nodeParent.size());
+        }
+
+        void evaluate(const glm::fmat4 *_boneModifier, glm::fmat4 *_boneTransf, glm::fmat4 *_nodeGlobal) const {
+            evaluate(PoseKernel::activeKernel(), _boneModifier, _boneTransf, _nodeGlobal);
+        }
+
+        // Flags every node whose bone is flagged in _boneDirty, and every descendant of a flagged node.
+        // Returns the number of nodes flagged.
+        size_t markDirty(const uint8_t *_boneDirty, uint8_t *_nodeDirty) const {
+            size_t dirtyNum = 0;
+            for (size_t i = 0; i < nodeParent.size(); i++) {
+                int parent = nodeParent[i];
+                int bone = nodeBone[i];
+                bool dirty = (bone >= 0 && _boneDirty[bone]) || (parent >= 0 && _nodeDirty[parent]);
+                _nodeDirty[i] = (uint8_t) dirty;
+                dirtyNum += dirty;
+            }
+            return dirtyNum;
+        }
+
+        // evaluate() restricted to the nodes flagged in _nodeDirty, whose parents must be flagged or hold
+        // their composed transform in _nodeGlobal. Parents precede children, so runs go front to back.
+        void evaluateDirty(const PoseKernel::Kernel &_kernel, const glm::fmat4 *_boneModifier,
+                           const uint8_t *_nodeDirty, glm::fmat4 *_boneTransf, glm::fmat4 *_nodeGlobal) const {
+            PoseKernel::ComposeArgs args = composeArgs(_boneModifier, _boneTransf, _nodeGlobal);
+            size_t nTotalNodes = nodeParent.size();
+            for (size_t begin = 0; begin < nTotalNodes;) {
+                if (!_nodeDirty[begin]) {
+                    begin++;
+                    continue;
+                }
+                size_t end = begin + 1;
+                while (end < nTotalNodes && _nodeDirty[end]) end++;
+                _kernel.compose(args, begin, end);
+                begin = end;
+            }
+        }
+
+        PoseKernel::ComposeArgs composeArgs(const glm::fmat4 *_boneModifier, glm::fmat4 *_boneTransf,
+                                            glm::fmat4 *_nodeGlobal) const {
+            PoseKernel::ComposeArgs args;
+            args.nodeParent = nodeParent.data();
+            args.nodeLocalTransf = (const float *) nodeLocalTransf.data();
+            args.nodeBone = nodeBone.data();
+            args.boneModifier = (const float *) _boneModifier;
+            args.boneOffset = (const float *) boneOffset.data();
+            args.rootParent = (const float *) &invRootTransf;
+            args.nodeGlobal = (float *) _nodeGlobal;
+            args.boneTransf = (float *) _boneTransf;
+            return args;
+        }
+
+        // Straightforward glm version of evaluate(), kept as the reference the kernels are checked against.
+        // _nodeGlobal receives global (not root-relative) transforms here.
+        void evaluateReference(const glm::fmat4 *_boneModifier, glm::fmat4 *_boneTransf,
+                               glm::fmat4 *_nodeGlobal) const {
+            size_t nTotalNodes = nodeParent.size();
+            for (size_t i = 0; i < nTotalNodes; i++) {
+                int parent = nodeParent[i];
+                glm::fmat4 globalTransf = parent < 0 ? nodeLocalTransf[i] : _nodeGlobal[parent] * nodeLocalTransf[i];
+                int bone = nodeBone[i];
+                if (bone >= 0) {
+                    if (_boneModifier != NULL) globalTransf *= _boneModifier[bone];
+                    _boneTransf[bone] = invRootTransf * globalTransf * boneOffset[bone];
+                }
+                _nodeGlobal[i] = globalTransf;
+            }
+        }
+    };
+
+    // Dense per-bone modifiers plus the state of the last evaluation.
+    // Bind once at setup; reset() and set() never allocate. Write modifiers through them: a bone is flagged
+    // while its modifier differs from the one the last evaluate() composed, and evaluate() then recomposes
+    // only the flagged subtrees. Clearing and rewriting the same pose every frame flags nothing.
+    // Every evaluate() after the first assumes its output still holds the previous one; call invalidate()
+    // whenever the caller replaces, resizes or overwrites that output.
+    class PoseBuffer {
+    public:
+        std::vector<glm::fmat4> boneModifier;
+        std::vector<glm::fmat4> nodeGlobal;
+        // Bones whose modifier differs from the one the last evaluate() composed
+        std::vector<uint8_t> boneDirty;
+        // Nodes the last evaluate() composed, and the bones whose transform it rewrote
+        std::vector<uint8_t> nodeDirty;
+        std::vector<uint8_t> boneChanged;
+
+        PoseBuffer() : version(1), evaluatedVersion(0) {}
+
+        void bind(const Skeleton &_skeleton) {
+            boneModifier.assign(_skeleton.boneNum(), glm::fmat4(1.0f));
+            evaluatedModifier.assign(_skeleton.boneNum(), glm::fmat4(1.0f));
+            nodeGlobal.assign(_skeleton.nodeNum(), glm::fmat4(1.0f));
+            boneDirty.assign(_skeleton.boneNum(), 1);
+            nodeDirty.assign(_skeleton.nodeNum(), 0);
+            boneChanged.assign(_skeleton.boneNum(), 0);
+            evaluatedVersion = 0;
+        }
+
+        void reset() {
+            const glm::fmat4 identity(1.0f);
+            for (size_t i = 0; i < boneModifier.size(); i++)
+                set((BoneId) i, identity);
+        }
+
+        // Writes to unresolved bones (SKELETON_INVALID_BONE) are ignored
+        void set(BoneId _bone, const glm::fmat4 &_modifier) {
+            if (_bone < 0 || (size_t) _bone >= boneModifier.size()) return;
+            boneModifier[_bone] = _modifier;
+            boneDirty[_bone] = (uint8_t) (memcmp(&evaluatedModifier[_bone], &_modifier, sizeof(glm::fmat4)) != 0);
+            if (boneDirty[_bone]) version++;
+        }
+
+        const glm::fmat4 &get(BoneId _bone) const { return boneModifier[_bone]; }
+
+        bool boundTo(const Skeleton &_skeleton) const {
+            return boneModifier.size() == _skeleton.boneNum() && nodeGlobal.size() == _skeleton.nodeNum();
+        }
+
+        // Bumped by every set() that flags a bone
+        uint64_t getVersion() const { return version; }
+
+        // Makes the next evaluate() compose every node
+        void invalidate() { evaluatedVersion = 0; }
+
+        // Evaluates _skeleton into _boneTransf (boneNum() matrices). Once evaluated and not invalidated, only
+        // subtrees with a changed modifier are recomposed, and nothing at all while the version is unchanged.
+        // Returns the number of nodes composed.
+        size_t evaluate(const Skeleton &_skeleton, glm::fmat4 *_boneTransf) {
+            size_t composedNum;
+            if (evaluatedVersion == 0) {
+                std::fill(nodeDirty.begin(), nodeDirty.end(), (uint8_t) 1);
+                composedNum = nodeDirty.size();
+                evaluatedModifier = boneModifier;
+            } else if (evaluatedVersion == version) {
+                std::fill(nodeDirty.begin(), nodeDirty.end(), (uint8_t) 0);
+                composedNum = 0;
+            } else {
+                composedNum = _skeleton.markDirty(boneDirty.data(), nodeDirty.data());
+                for (size_t i = 0; i < boneDirty.size(); i++)
+                    if (boneDirty[i]) evaluatedModifier[i] = boneModifier[i];
+            }
+            std::fill(boneChanged.begin(), boneChanged.end(), (uint8_t) 0);
+            if (composedNum > 0) {
+                _skeleton.evaluateDirty(PoseKernel::activeKernel(), boneModifier.data(), nodeDirty.data(),
+                                        _boneTransf, nodeGlobal.data());
+                for (size_t i = 0; i < nodeDirty.size(); i++) {
+                    int bone = _skeleton.nodeBone[i];
+                    if (nodeDirty[i] && bone >= 0) boneChanged[bone] = 1;
+                }
+            }
+            std::fill(boneDirty.begin(), boneDirty.end(), (uint8_t) 0);
+            evaluatedVersion = version;
+            return composedNum;
+        }
+
+    private:
+        // Modifiers as of the last evaluate()
+        std::vector<glm::fmat4> evaluatedModifier;
+        uint64_t version;
+        // Version the last evaluate() composed, 0 until evaluated or after invalidate()
+        uint64_t evaluatedVersion;
+    };
+}
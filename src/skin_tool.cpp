@@ -0,0 +1,266 @@
+// Hand Headless Skinning
+// Evaluates the pose presets and skins the Hand mesh on the CPU, writing one OBJ per frame.
+// Runs without a window or GL context.
+
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <config.h>
+
+#include <iostream>
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "scene_bake.h"
+#include "hand_rig.h"
+#include "hand_pose.h"
+#include "cpu_skinning.h"
+#include "animation_compression.h"
+#include "cpu_profiler.h"
+
+typedef std::chrono::steady_clock SkinClock;
+
+struct SkinOptions {
+    int mode;
+    float time;
+    int frames;
+    float fps;
+    size_t threads;
+    bool dualQuat;
+    float clipError;
+    std::string clipFile;
+    std::string trace;
+    std::string input;
+    std::string output;
+
+    SkinOptions()
+            : mode(1), time(0.0f), frames(1), fps(30.0f), threads(0), dualQuat(false), clipError(0.0f),
+              clipFile(), trace(), input(DATA_DIR"/Hand.fbx"), output("hand") {}
+};
+
+static void print_usage() {
+    std::cout << "Usage: HandSkin [options]" << std::endl;
+    std::cout << "  --mode N     pose preset: 0 default, 1/2/3 completions, 4 first clip, 9 rotate (default 1)" << std::endl;
+    std::cout << "  --time T     time of the first frame in seconds (default 0)" << std::endl;
+    std::cout << "  --frames N   number of frames (default 1)" << std::endl;
+    std::cout << "  --fps R      frame rate for multiple frames (default 30)" << std::endl;
+    std::cout << "  --threads N  skinning threads, 0 for all hardware threads (default 0)" << std::endl;
+    std::cout << "  --skinning S lbs (linear blend) or dqs (dual quaternion) (default lbs)" << std::endl;
+    std::cout << "  --clip-error E  compress clips with at most E model units of fingertip error (default off)" << std::endl;
+    std::cout << "  --clip-file F   load compressed clips from F, or compress and write them there" << std::endl;
+    std::cout << "  --trace F    write per-frame stage times to F (.json for JSON, CSV otherwise)" << std::endl;
+    std::cout << "  --input F    scene file (default Hand.fbx)" << std::endl;
+    std::cout << "  --output P   output prefix, frames go to P_0000.obj ... (default hand)" << std::endl;
+}
+
+static bool parse_options(int argc, char *argv[], SkinOptions &options) {
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--help" || arg == "-h") return false;
+        if (i + 1 >= argc) {
+            std::cout << "Missing value for " << arg << std::endl;
+            return false;
+        }
+        const char *value = argv[++i];
+        if (arg == "--mode") options.mode = atoi(value);
+        else if (arg == "--time") options.time = (float) atof(value);
+        else if (arg == "--frames") options.frames = atoi(value);
+        else if (arg == "--fps") options.fps = (float) atof(value);
+        else if (arg == "--threads") options.threads = (size_t) atoi(value);
+        else if (arg == "--skinning") {
+            if (strcmp(value, "lbs") != 0 && strcmp(value, "dqs") != 0) {
+                std::cout << "Unknown skinning " << value << std::endl;
+                return false;
+            }
+            options.dualQuat = strcmp(value, "dqs") == 0;
+        } else if (arg == "--clip-error") options.clipError = (float) atof(value);
+        else if (arg == "--clip-file") options.clipFile = value;
+        else if (arg == "--trace") options.trace = value;
+        else if (arg == "--input") options.input = value;
+        else if (arg == "--output") options.output = value;
+        else {
+            std::cout << "Unknown option " << arg << std::endl;
+            return false;
+        }
+    }
+    return options.frames > 0 && options.fps > 0.0f;
+}
+
+static bool apply_mode(SkeletalMesh::PoseBuffer &pose, const HandRig::Binding &rig,
+                       const std::vector<SkeletalMesh::AnimationClip> &clips,
+                       const std::vector<SkeletalMesh::CompressedClip> &compressed,
+                       SkeletalMesh::AnimationCursor &cursor, int mode, float passed_time) {
+    switch (mode) {
+        case 0:
+            HandPose::finger_move_clear(pose);
+            return true;
+        case 1:
+            HandPose::completion_1(pose, rig, passed_time);
+            return true;
+        case 2:
+            HandPose::completion_2(pose, rig, passed_time);
+            return true;
+        case 3:
+            HandPose::completion_3(pose, rig, passed_time);
+            return true;
+        case 4:
+            HandPose::finger_move_clear(pose);
+            if (!compressed.empty()) {
+                compressed[0].sample(passed_time, cursor, pose);
+                return true;
+            }
+            if (clips.empty()) return false;
+            clips[0].sample(passed_time, cursor, pose);
+            return true;
+        case 9:
+            HandPose::default_rotate(pose, rig, passed_time);
+            return true;
+        default:
+            return false;
+    }
+}
+
+// Indices are relative to each mesh's vertexOffset, OBJ indices are global and 1-based
+static bool write_obj(const std::string &filename, const MeshCache::BakedFile &baked,
+                      const std::vector<float> &positions, const std::vector<float> &normals) {
+    FILE *fo = fopen(filename.c_str(), "w");
+    if (fo == NULL) return false;
+    const SkeletalMesh::ParametricVertex *vertices = (const SkeletalMesh::ParametricVertex *) baked.vertices();
+    size_t vertexNum = baked.header().vertexNum;
+    for (size_t i = 0; i < vertexNum; i++)
+        fprintf(fo, "v %.6f %.6f %.6f\n", positions[3 * i], positions[3 * i + 1], positions[3 * i + 2]);
+    for (size_t i = 0; i < vertexNum; i++)
+        fprintf(fo, "vt %.6f %.6f\n", vertices[i].texcoord[0], vertices[i].texcoord[1]);
+    for (size_t i = 0; i < vertexNum; i++)
+        fprintf(fo, "vn %.6f %.6f %.6f\n", normals[3 * i], normals[3 * i + 1], normals[3 * i + 2]);
+
+    const uint32_t *indices = baked.indices();
+    const MeshCache::MeshRecord *meshes = baked.meshes();
+    for (uint32_t m = 0; m < baked.header().meshNum; m++) {
+        fprintf(fo, "g mesh_%u\n", m);
+        const MeshCache::MeshRecord &mesh = meshes[m];
+        for (uint32_t c = 0; c + 2 < mesh.facetCornerNum; c += 3) {
+            fprintf(fo, "f");
+            for (int k = 0; k < 3; k++) {
+                uint64_t index = (uint64_t) mesh.vertexOffset + indices[mesh.indexOffset + c + k] + 1;
+                fprintf(fo, " %llu/%llu/%llu", (unsigned long long) index, (unsigned long long) index,
+                        (unsigned long long) index);
+            }
+            fprintf(fo, "\n");
+        }
+    }
+    return fclose(fo) == 0;
+}
+
+int main(int argc, char *argv[]) {
+    SkinOptions options;
+    if (!parse_options(argc, argv, options)) {
+        print_usage();
+        exit(EXIT_FAILURE);
+    }
+
+    Parallel::JobSystem jobs(options.threads);
+
+    MeshCache::BakedFile baked;
+    if (!SkeletalMesh::SceneBaker::openBaked(options.input, baked, &jobs)) {
+        std::cout << "Error occured in openBaked()" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    SkeletalMesh::Skeleton skeleton;
+    SkeletalMesh::SceneBaker::Name2Bone nameBoneMap;
+    if (!SkeletalMesh::SceneBaker::buildSkeleton(baked, skeleton, nameBoneMap)) {
+        std::cout << "Error occured in buildSkeleton()" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    std::vector<SkeletalMesh::AnimationClip> clips;
+    SkeletalMesh::SceneBaker::buildAnimationClips(baked, skeleton, clips);
+    SkeletalMesh::AnimationCursor cursor;
+
+    HandRig::Binding rig;
+    if (!rig.bind(nameBoneMap))
+        std::cout << "Warning: some bones of the hand rig are missing" << std::endl;
+
+    std::vector<SkeletalMesh::CompressedClip> compressed;
+    if (!options.clipFile.empty() && SkeletalMesh::AnimationCompression::readFile(options.clipFile, compressed)) {
+        std::cout << "Loaded " << compressed.size() << " compressed clips from " << options.clipFile << std::endl;
+    } else if (options.clipError > 0.0f || !options.clipFile.empty()) {
+        SkeletalMesh::CompressionSettings settings;
+        if (options.clipError > 0.0f) settings.maxError = options.clipError;
+        settings.measuredBones = rig.fingertips();
+        compressed.resize(clips.size());
+        for (size_t i = 0; i < clips.size(); i++) {
+            SkeletalMesh::CompressionReport report;
+            bool bounded = SkeletalMesh::AnimationCompression::compress(clips[i], skeleton, settings,
+                                                                        compressed[i], &report);
+            printf("clip %s: %zu -> %zu keys, %zu constant channels, %zu -> %zu bytes (x%.2f), "
+                   "max fingertip error %.5f%s\n", clips[i].name.c_str(), report.originalKeyNum,
+                   report.compressedKeyNum, report.constantChannelNum, report.originalBytes, report.compressedBytes,
+                   (double) report.originalBytes / std::max<size_t>(report.compressedBytes, 1), report.maxError,
+                   bounded ? "" : " (above bound)");
+        }
+        if (!options.clipFile.empty() && !SkeletalMesh::AnimationCompression::writeFile(options.clipFile, compressed))
+            std::cout << "Warning: could not write " << options.clipFile << std::endl;
+    }
+
+    SkeletalMesh::CpuSkinner skinner(&jobs);
+    const char *kernelName = options.dualQuat ? SkeletalMesh::SkinKernel::dualQuatKernel().name
+                                              : skinner.getKernel().name;
+    std::cout << "Skin kernel: " << kernelName << ", threads: " << jobs.threadNum() << std::endl;
+
+    SkeletalMesh::PoseBuffer pose;
+    pose.bind(skeleton);
+    SkeletalMesh::SceneBaker::SkeletonTransf bonesTransf(skeleton.boneNum());
+    SkeletalMesh::SkeletonDualQuat bonesDualQuat;
+    const SkeletalMesh::ParametricVertex *vertices = (const SkeletalMesh::ParametricVertex *) baked.vertices();
+    size_t vertexNum = baked.header().vertexNum;
+    std::vector<float> positions(3 * vertexNum), normals(3 * vertexNum);
+
+    Profiling::CpuProfiler profiler;
+    Profiling::StageId poseStage = profiler.addStage("pose");
+    Profiling::StageId skinStage = profiler.addStage("skin");
+    Profiling::StageId writeStage = profiler.addStage("write");
+    profiler.setTracing(!options.trace.empty());
+
+    for (int frame = 0; frame < options.frames; frame++) {
+        profiler.beginFrame();
+        float passed_time = options.time + (float) frame / options.fps;
+        profiler.beginStage(poseStage);
+        if (!apply_mode(pose, rig, clips, compressed, cursor, options.mode, passed_time)) {
+            std::cout << "Unknown mode " << options.mode << " or no clip to play" << std::endl;
+            exit(EXIT_FAILURE);
+        }
+        skeleton.evaluate(pose.boneModifier.data(), bonesTransf.data(), pose.nodeGlobal.data());
+        profiler.endStage(poseStage);
+
+        profiler.beginStage(skinStage);
+        SkinClock::time_point start = SkinClock::now();
+        if (options.dualQuat) {
+            SkeletalMesh::toDualQuat(bonesTransf, bonesDualQuat);
+            skinner.skinDualQuat(vertices, vertexNum, bonesDualQuat, positions.data(), normals.data());
+        } else {
+            skinner.skin(vertices, vertexNum, bonesTransf, positions.data(), normals.data());
+        }
+        double skinMs = std::chrono::duration<double, std::milli>(SkinClock::now() - start).count();
+        profiler.endStage(skinStage);
+
+        profiler.beginStage(writeStage);
+        char suffix[32];
+        snprintf(suffix, sizeof(suffix), "_%04d.obj", frame);
+        std::string filename = options.output + suffix;
+        if (!write_obj(filename, baked, positions, normals)) {
+            std::cout << "Error occured writing " << filename << std::endl;
+            exit(EXIT_FAILURE);
+        }
+        profiler.endStage(writeStage);
+        profiler.endFrame();
+        printf("%s  t=%.3fs  %zu vertices skinned in %.3f ms\n", filename.c_str(), passed_time, vertexNum, skinMs);
+    }
+
+    if (!options.trace.empty() && !profiler.writeTrace(options.trace)) {
+        std::cout << "Error occured writing " << options.trace << std::endl;
+        exit(EXIT_FAILURE);
+    }
+
+    exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,56 @@
+// SPSC Queue
+// Bounded FIFO between exactly one producer thread and one consumer thread, without locks. The head
+// and tail live on separate cache lines so the two threads do not contend for them.
+
+#pragma once
+
+#include <cstddef>
+#include <vector>
+#include <atomic>
+
+#define SPSC_QUEUE_CACHE_LINE 64
+
+namespace Parallel {
+    template<typename T>
+    class SpscQueue {
+    public:
+        // Capacity is rounded up to a power of two
+        explicit SpscQueue(size_t _capacity) : head(0), tail(0) {
+            size_t capacity = 1;
+            while (capacity < _capacity) capacity *= 2;
+            item.resize(capacity);
+            mask = capacity - 1;
+        }
+
+        size_t capacity() const { return item.size(); }
+
+        // Producer: false when the queue is full, leaving it unchanged
+        bool push(const T &_item) {
+            size_t t = tail.load(std::memory_order_relaxed);
+            if (t - head.load(std::memory_order_acquire) == item.size()) return false;
+            item[t & mask] = _item;
+            tail.store(t + 1, std::memory_order_release);
+            return true;
+        }
+
+        // Consumer: false when the queue is empty
+        bool pop(T &_item) {
+            size_t h = head.load(std::memory_order_relaxed);
+            if (h == tail.load(std::memory_order_acquire)) return false;
+            _item = item[h & mask];
+            head.store(h + 1, std::memory_order_release);
+            return true;
+        }
+
+    private:
+        std::vector<T> item;
+        size_t mask;
+        alignas(SPSC_QUEUE_CACHE_LINE) std::atomic<size_t> head;
+        alignas(SPSC_QUEUE_CACHE_LINE) std::atomic<size_t> tail;
+
+        // Forbid copying
+        SpscQueue(const SpscQueue &_copy);
+
+        SpscQueue &operator=(const SpscQueue &_copy);
+    };
+}
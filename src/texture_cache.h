@@ -0,0 +1,471 @@
+// Baked Texture Cache
+// Decoded images with a precomputed mip chain, block-compressed to BC1 / BC3 (S3TC) or kept as
+// RGBA8, stored next to the source image and memory-mapped on later loads.
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include "file_util.h"
+#include "mesh_cache.h"
+
+#include <stb_image.h>
+
+#define TEXTURE_CACHE_MAGIC 0x58544E48u // "HNTX"
+#define TEXTURE_CACHE_VERSION 1
+#define TEXTURE_CACHE_SUFFIX ".texbake"
+#define TEXTURE_CACHE_MAX_LEVELS 16
+
+namespace TextureCache {
+    // BC1 for opaque images, BC3 when any texel is translucent
+    enum Format {
+        FormatRGBA8 = 0,
+        FormatBC1 = 1,
+        FormatBC3 = 2
+    };
+
+    struct LevelRecord {
+        uint32_t width;
+        uint32_t height;
+        uint64_t offset;
+        uint64_t bytes;
+    };
+
+    struct Header {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t headerSize;
+        uint32_t format;
+        MeshCache::SourceStamp source;
+        uint32_t width;
+        uint32_t height;
+        uint32_t levelNum;
+        uint32_t padding;
+        LevelRecord levels[TEXTURE_CACHE_MAX_LEVELS];
+    };
+
+    // Levels are stored and uploaded in row groups: one texel row uncompressed, one row of 4x4 blocks compressed
+    inline uint32_t rowGroupHeight(Format _format) { return _format == FormatRGBA8 ? 1 : 4; }
+
+    inline uint64_t rowGroupBytes(Format _format, uint32_t _width) {
+        if (_format == FormatRGBA8) return (uint64_t) _width * 4;
+        return (uint64_t) ((_width + 3) / 4) * (_format == FormatBC1 ? 8 : 16);
+    }
+
+    inline uint32_t rowGroupNum(Format _format, uint32_t _height) {
+        return (_height + rowGroupHeight(_format) - 1) / rowGroupHeight(_format);
+    }
+
+    inline uint64_t levelBytes(Format _format, uint32_t _width, uint32_t _height) {
+        return rowGroupBytes(_format, _width) * rowGroupNum(_format, _height);
+    }
+
+    // 2x2 box filter, odd edges drop their last row / column like glGenerateMipmap's usual box
+    inline void downsample(const std::vector<uint8_t> &_source, uint32_t _width, uint32_t _height,
+                           std::vector<uint8_t> &_target, uint32_t &_targetWidth, uint32_t &_targetHeight) {
+        _targetWidth = std::max(_width / 2, 1u);
+        _targetHeight = std::max(_height / 2, 1u);
+        _target.resize((size_t) _targetWidth * _targetHeight * 4);
+        for (uint32_t y = 0; y < _targetHeight; y++) {
+            uint32_t y0 = std::min(y * 2, _height - 1), y1 = std::min(y * 2 + 1, _height - 1);
+            for (uint32_t x = 0; x < _targetWidth; x++) {
+                uint32_t x0 = std::min(x * 2, _width - 1), x1 = std::min(x * 2 + 1, _width - 1);
+                for (int c = 0; c < 4; c++) {
+                    unsigned int sum = _source[((size_t) y0 * _width + x0) * 4 + c] +
+                                       _source[((size_t) y0 * _width + x1) * 4 + c] +
+                                       _source[((size_t) y1 * _width + x0) * 4 + c] +
+                                       _source[((size_t) y1 * _width + x1) * 4 + c];
+                    _target[((size_t) y * _targetWidth + x) * 4 + c] = (uint8_t) ((sum + 2) / 4);
+                }
+            }
+        }
+    }
+
+    namespace Block {
+        inline uint16_t pack565(const float *_color) {
+            int r = (int) std::floor(std::min(std::max(_color[0], 0.0f), 255.0f) * 31.0f / 255.0f + 0.5f);
+            int g = (int) std::floor(std::min(std::max(_color[1], 0.0f), 255.0f) * 63.0f / 255.0f + 0.5f);
+            int b = (int) std::floor(std::min(std::max(_color[2], 0.0f), 255.0f) * 31.0f / 255.0f + 0.5f);
+            return (uint16_t) ((r << 11) | (g << 5) | b);
+        }
+
+        inline void unpack565(uint16_t _packed, float *_color) {
+            int r = (_packed >> 11) & 31, g = (_packed >> 5) & 63, b = _packed & 31;
+            _color[0] = (float) ((r << 3) | (r >> 2));
+            _color[1] = (float) ((g << 2) | (g >> 4));
+            _color[2] = (float) ((b << 3) | (b >> 2));
+        }
+
+        // 4-colour palette of a block whose endpoints are ordered c0 > c1
+        inline void colorPalette(uint16_t _c0, uint16_t _c1, float _palette[4][3]) {
+            unpack565(_c0, _palette[0]);
+            unpack565(_c1, _palette[1]);
+            for (int c = 0; c < 3; c++) {
+                _palette[2][c] = (2.0f * _palette[0][c] + _palette[1][c]) / 3.0f;
+                _palette[3][c] = (_palette[0][c] + 2.0f * _palette[1][c]) / 3.0f;
+            }
+        }
+
+        inline float fitIndices(const uint8_t *_texels, uint16_t _c0, uint16_t _c1, uint8_t *_index) {
+            float palette[4][3];
+            colorPalette(_c0, _c1, palette);
+            float error = 0.0f;
+            for (int i = 0; i < 16; i++) {
+                float best = 1e30f;
+                for (int p = 0; p < 4; p++) {
+                    float d = 0.0f;
+                    for (int c = 0; c < 3; c++) {
+                        float diff = _texels[i * 4 + c] - palette[p][c];
+                        d += diff * diff;
+                    }
+                    if (d < best) {
+                        best = d;
+                        _index[i] = (uint8_t) p;
+                    }
+                }
+                error += best;
+            }
+            return error;
+        }
+
+        // Endpoints on the principal axis of the block's colours, then one least-squares refit of the
+        // endpoints to the chosen indices. Always emits the 4-colour mode, which BC3 also assumes.
+        inline void encodeColor(const uint8_t *_texels, uint8_t *_out) {
+            float mean[3] = {0.0f, 0.0f, 0.0f};
+            for (int i = 0; i < 16; i++)
+                for (int c = 0; c < 3; c++) mean[c] += _texels[i * 4 + c] / 16.0f;
+            float cov[6] = {0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f};
+            for (int i = 0; i < 16; i++) {
+                float d[3];
+                for (int c = 0; c < 3; c++) d[c] = _texels[i * 4 + c] - mean[c];
+                cov[0] += d[0] * d[0];
+                cov[1] += d[0] * d[1];
+                cov[2] += d[0] * d[2];
+                cov[3] += d[1] * d[1];
+                cov[4] += d[1] * d[2];
+                cov[5] += d[2] * d[2];
+            }
+            float axis[3] = {1.0f, 1.0f, 1.0f};
+            for (int iteration = 0; iteration < 8; iteration++) {
+                float next[3] = {cov[0] * axis[0] + cov[1] * axis[1] + cov[2] * axis[2],
+                                 cov[1] * axis[0] + cov[3] * axis[1] + cov[4] * axis[2],
+                                 cov[2] * axis[0] + cov[4] * axis[1] + cov[5] * axis[2]};
+                float length = std::sqrt(next[0] * next[0] + next[1] * next[1] + next[2] * next[2]);
+                if (length < 1e-6f) break;
+                for (int c = 0; c < 3; c++) axis[c] = next[c] / length;
+            }
+            float tMin = 1e30f, tMax = -1e30f;
+            for (int i = 0; i < 16; i++) {
+                float t = 0.0f;
+                for (int c = 0; c < 3; c++) t += (_texels[i * 4 + c] - mean[c]) * axis[c];
+                tMin = std::min(tMin, t);
+                tMax = std::max(tMax, t);
+            }
+            // Inset so the quantized endpoints land inside the colour range
+            float inset = (tMax - tMin) / 16.0f;
+            float e0[3], e1[3];
+            for (int c = 0; c < 3; c++) {
+                e0[c] = mean[c] + (tMax - inset) * axis[c];
+                e1[c] = mean[c] + (tMin + inset) * axis[c];
+            }
+            uint16_t p0 = pack565(e0), p1 = pack565(e1);
+            uint16_t c0 = std::max(p0, p1), c1 = std::min(p0, p1);
+            uint8_t index[16];
+            float error = fitIndices(_texels, c0, c1, index);
+
+            if (c0 != c1) {
+                // Solve for the endpoints that minimise the error of the current indices
+                const float weight[4] = {1.0f, 0.0f, 2.0f / 3.0f, 1.0f / 3.0f};
+                float aa = 0.0f, bb = 0.0f, ab = 0.0f, ax[3] = {0.0f, 0.0f, 0.0f}, bx[3] = {0.0f, 0.0f, 0.0f};
+                for (int i = 0; i < 16; i++) {
+                    float a = weight[index[i]], b = 1.0f - a;
+                    aa += a * a;
+                    bb += b * b;
+                    ab += a * b;
+                    for (int c = 0; c < 3; c++) {
+                        ax[c] += a * _texels[i * 4 + c];
+                        bx[c] += b * _texels[i * 4 + c];
+                    }
+                }
+                float det = aa * bb - ab * ab;
+                if (std::abs(det) > 1e-6f) {
+                    float r0[3], r1[3];
+                    for (int c = 0; c < 3; c++) {
+                        r0[c] = (ax[c] * bb - bx[c] * ab) / det;
+                        r1[c] = (bx[c] * aa - ax[c] * ab) / det;
+                    }
+                    uint16_t q0 = pack565(r0), q1 = pack565(r1);
+                    uint16_t r0Packed = std::max(q0, q1), r1Packed = std::min(q0, q1);
+                    uint8_t refitIndex[16];
+                    if (r0Packed != r1Packed) {
+                        float refitError = fitIndices(_texels, r0Packed, r1Packed, refitIndex);
+                        if (refitError < error) {
+                            c0 = r0Packed;
+                            c1 = r1Packed;
+                            memcpy(index, refitIndex, sizeof(index));
+                        }
+                    }
+                }
+            } else {
+                // Equal endpoints decode as the 3-colour mode, keep to index 0 there
+                memset(index, 0, sizeof(index));
+            }
+
+            uint32_t bits = 0;
+            for (int i = 0; i < 16; i++) bits |= (uint32_t) index[i] << (2 * i);
+            _out[0] = (uint8_t) (c0 & 0xFF);
+            _out[1] = (uint8_t) (c0 >> 8);
+            _out[2] = (uint8_t) (c1 & 0xFF);
+            _out[3] = (uint8_t) (c1 >> 8);
+            for (int k = 0; k < 4; k++) _out[4 + k] = (uint8_t) (bits >> (8 * k));
+        }
+
+        // 8-value mode between the block's extreme alphas
+        inline void encodeAlpha(const uint8_t *_texels, uint8_t *_out) {
+            uint8_t a0 = 0, a1 = 255;
+            for (int i = 0; i < 16; i++) {
+                a0 = std::max(a0, _texels[i * 4 + 3]);
+                a1 = std::min(a1, _texels[i * 4 + 3]);
+            }
+            uint64_t bits = 0;
+            if (a0 > a1) {
+                float palette[8];
+                palette[0] = a0;
+                palette[1] = a1;
+                for (int p = 1; p < 7; p++) palette[p + 1] = ((7 - p) * a0 + p * a1) / 7.0f;
+                for (int i = 0; i < 16; i++) {
+                    int best = 0;
+                    for (int p = 1; p < 8; p++)
+                        if (std::abs(_texels[i * 4 + 3] - palette[p]) < std::abs(_texels[i * 4 + 3] - palette[best]))
+                            best = p;
+                    bits |= (uint64_t) best << (3 * i);
+                }
+            }
+            _out[0] = a0;
+            _out[1] = a1;
+            for (int k = 0; k < 6; k++) _out[2 + k] = (uint8_t) (bits >> (8 * k));
+        }
+
+        inline void decodeColor(const uint8_t *_block, uint8_t *_texels) {
+            uint16_t c0 = (uint16_t) (_block[0] | (_block[1] << 8)), c1 = (uint16_t) (_block[2] | (_block[3] << 8));
+            float palette[4][3];
+            colorPalette(c0, c1, palette);
+            uint32_t bits = _block[4] | (_block[5] << 8) | (_block[6] << 16) | ((uint32_t) _block[7] << 24);
+            for (int i = 0; i < 16; i++) {
+                const float *color = palette[(bits >> (2 * i)) & 3];
+                for (int c = 0; c < 3; c++) _texels[i * 4 + c] = (uint8_t) (color[c] + 0.5f);
+                _texels[i * 4 + 3] = 255;
+            }
+        }
+
+        inline void decodeAlpha(const uint8_t *_block, uint8_t *_texels) {
+            float palette[8];
+            palette[0] = _block[0];
+            palette[1] = _block[1];
+            for (int p = 1; p < 7; p++) palette[p + 1] = ((7 - p) * _block[0] + p * _block[1]) / 7.0f;
+            uint64_t bits = 0;
+            for (int k = 0; k < 6; k++) bits |= (uint64_t) _block[2 + k] << (8 * k);
+            for (int i = 0; i < 16; i++) {
+                float alpha = _block[0] > _block[1] ? palette[(bits >> (3 * i)) & 7] : _block[0];
+                _texels[i * 4 + 3] = (uint8_t) (alpha + 0.5f);
+            }
+        }
+    }
+
+    // Copies _groupNum row groups of a level _width texels wide. Only RGBA8 -> RGBA8, BCn -> same BCn
+    // and BC1 -> BC3 are possible; the latter prefixes every colour block with an opaque alpha block,
+    // which is lossless because bake() only emits 4-colour BC1 blocks.
+    inline void copyRowGroups(Format _from, Format _to, uint32_t _width, uint32_t _groupNum, const uint8_t *_source,
+                              uint8_t *_target) {
+        if (_from == _to) {
+            memcpy(_target, _source, (size_t) (rowGroupBytes(_from, _width) * _groupNum));
+            return;
+        }
+        const uint8_t opaque[8] = {255, 255, 0, 0, 0, 0, 0, 0};
+        size_t blockNum = (size_t) ((_width + 3) / 4) * _groupNum;
+        for (size_t i = 0; i < blockNum; i++, _source += 8, _target += 16) {
+            memcpy(_target, opaque, 8);
+            memcpy(_target + 8, _source, 8);
+        }
+    }
+
+    // Writes one level of _format into _out, which holds levelBytes() bytes
+    inline void encodeLevel(const uint8_t *_rgba, uint32_t _width, uint32_t _height, Format _format, uint8_t *_out) {
+        if (_format == FormatRGBA8) {
+            memcpy(_out, _rgba, (size_t) _width * _height * 4);
+            return;
+        }
+        size_t blockSize = _format == FormatBC1 ? 8 : 16;
+        uint8_t texels[64];
+        for (uint32_t by = 0; by < _height; by += 4) {
+            for (uint32_t bx = 0; bx < _width; bx += 4) {
+                // Edge blocks repeat the last row / column
+                for (int i = 0; i < 16; i++) {
+                    uint32_t x = std::min(bx + (i & 3), _width - 1), y = std::min(by + (i >> 2), _height - 1);
+                    memcpy(texels + i * 4, _rgba + ((size_t) y * _width + x) * 4, 4);
+                }
+                if (_format == FormatBC3) {
+                    Block::encodeAlpha(texels, _out);
+                    Block::encodeColor(texels, _out + 8);
+                } else {
+                    Block::encodeColor(texels, _out);
+                }
+                _out += blockSize;
+            }
+        }
+    }
+
+    // Builds the whole mip chain down to 1x1 from tightly packed RGBA8 texels
+    inline void bake(const uint8_t *_rgba, uint32_t _width, uint32_t _height, bool _compress,
+                     const MeshCache::SourceStamp &_source, std::vector<char> &_blob) {
+        Format format = FormatRGBA8;
+        if (_compress) {
+            format = FormatBC1;
+            for (size_t i = 0; i < (size_t) _width * _height; i++) {
+                if (_rgba[i * 4 + 3] != 255) {
+                    format = FormatBC3;
+                    break;
+                }
+            }
+        }
+
+        Header header = Header();
+        header.magic = TEXTURE_CACHE_MAGIC;
+        header.version = TEXTURE_CACHE_VERSION;
+        header.headerSize = sizeof(Header);
+        header.format = format;
+        header.source = _source;
+        header.width = _width;
+        header.height = _height;
+        uint64_t cursor = MeshCache::Builder::align(sizeof(Header));
+        uint32_t width = _width, height = _height;
+        for (;;) {
+            LevelRecord &level = header.levels[header.levelNum++];
+            level.width = width;
+            level.height = height;
+            level.offset = cursor;
+            level.bytes = levelBytes(format, width, height);
+            cursor = MeshCache::Builder::align(cursor + level.bytes);
+            if ((width == 1 && height == 1) || header.levelNum == TEXTURE_CACHE_MAX_LEVELS) break;
+            width = std::max(width / 2, 1u);
+            height = std::max(height / 2, 1u);
+        }
+
+        _blob.assign(cursor, 0);
+        memcpy(&_blob[0], &header, sizeof(header));
+        std::vector<uint8_t> level(_rgba, _rgba + (size_t) _width * _height * 4), next;
+        for (uint32_t l = 0; l < header.levelNum; l++) {
+            const LevelRecord &record = header.levels[l];
+            if (l > 0) {
+                uint32_t nextWidth, nextHeight;
+                downsample(level, header.levels[l - 1].width, header.levels[l - 1].height, next, nextWidth, nextHeight);
+                level.swap(next);
+            }
+            encodeLevel(level.data(), record.width, record.height, format, (uint8_t *) &_blob[record.offset]);
+        }
+    }
+
+    // Read-only view over a baked texture, memory-mapped from disk or adopted from a fresh bake
+    class File {
+    public:
+        File() : file() {}
+
+        void close() { file.close(); }
+
+        // Rejects stale caches and caches baked for the other choice of _compress
+        bool open(const std::string &_filename, const MeshCache::SourceStamp &_source, bool _compress) {
+            if (!file.open(_filename, sizeof(Header))) return false;
+            if (!validate() || !(header().source == _source) || (header().format != FormatRGBA8) != _compress) {
+                close();
+                return false;
+            }
+            return true;
+        }
+
+        bool adopt(std::vector<char> &_blob) {
+            file.adopt(_blob);
+            if (!validate()) {
+                close();
+                return false;
+            }
+            return true;
+        }
+
+        bool available() const { return file.data() != NULL; }
+
+        const Header &header() const { return *(const Header *) file.data(); }
+
+        Format format() const { return (Format) header().format; }
+
+        const LevelRecord &levelRecord(uint32_t _level) const { return header().levels[_level]; }
+
+        const uint8_t *level(uint32_t _level) const {
+            return (const uint8_t *) file.data() + header().levels[_level].offset;
+        }
+
+        // Bytes of every level together
+        uint64_t dataBytes() const {
+            uint64_t bytes = 0;
+            for (uint32_t l = 0; l < header().levelNum; l++) bytes += header().levels[l].bytes;
+            return bytes;
+        }
+
+    private:
+        MeshCache::MappedFile file;
+
+        // Forbid copying a mapping
+        File(const File &_copy);
+
+        File &operator=(const File &_copy);
+
+        bool validate() const {
+            if (file.bytes() < sizeof(Header)) return false;
+            const Header &h = header();
+            if (h.magic != TEXTURE_CACHE_MAGIC || h.version != TEXTURE_CACHE_VERSION) return false;
+            if (h.headerSize != sizeof(Header) || h.format > FormatBC3) return false;
+            if (h.levelNum == 0 || h.levelNum > TEXTURE_CACHE_MAX_LEVELS) return false;
+            for (uint32_t l = 0; l < h.levelNum; l++) {
+                const LevelRecord &level = h.levels[l];
+                if (level.width == 0 || level.height == 0) return false;
+                if (level.bytes != levelBytes((Format) h.format, level.width, level.height)) return false;
+                if (!file.fits(level.offset, level.bytes)) return false;
+            }
+            return true;
+        }
+    };
+
+    // Size of the image without decoding it
+    inline bool probe(const std::string &_filename, uint32_t &_width, uint32_t &_height) {
+        int width, height, channels;
+        if (!stbi_info(_filename.c_str(), &width, &height, &channels)) return false;
+        _width = (uint32_t) width;
+        _height = (uint32_t) height;
+        return true;
+    }
+
+    // Maps the cache next to _filename, decoding and baking it on a miss. Touches no GL state, so it can
+    // run on any thread. Rows keep the orientation of stb_image's current flip setting.
+    inline bool load(const std::string &_filename, bool _compress, File &_file) {
+        MeshCache::SourceStamp stamp;
+        if (!MeshCache::SourceStamp::query(_filename, stamp)) return false;
+
+        std::string cacheFilename = _filename + TEXTURE_CACHE_SUFFIX;
+        if (_file.open(cacheFilename, stamp, _compress)) return true;
+
+        int width, height, channels;
+        unsigned char *data = stbi_load(_filename.c_str(), &width, &height, &channels, 4);
+        if (!data) return false;
+        std::vector<char> blob;
+        bake(data, (uint32_t) width, (uint32_t) height, _compress, stamp, blob);
+        stbi_image_free(data);
+        if (!FileUtil::writeFile(cacheFilename, blob))
+            std::cout << "Error writing texture cache " << cacheFilename << std::endl;
+        return _file.adopt(blob);
+    }
+}
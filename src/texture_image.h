@@ -7,26 +7,57 @@
 #include <iostream>
 
 #include <vector>
+#include <deque>
 #include <sstream>
 #include <stdexcept>
 #include <string>
 #include <map>
+#include <mutex>
+#include <chrono>
+#include <cstring>
+#include <memory>
 
 #include "gl_env.h"
+#include "job_system.h"
+#include "texture_cache.h"
 
 #include <stb_image.h>
 
+#define TEXTURE_STREAMER_DECODE_THREADS 2
+#define TEXTURE_STREAMER_PBO_NUM 3
+#define TEXTURE_STREAMER_STRIP_BYTES (1 << 20)
+
 namespace TextureImage {
+    class Streamer;
+
     class Texture {
     public:
         typedef std::map<std::string, Texture *> Name2Texture;
         static Name2Texture allTexture;
         static Texture error;
+        // Bound in place of textures that are still streaming in, one per target
+        static Texture placeholder;
+        static Texture placeholderArray;
+        // When set, loadTexture queues the file here and returns at once
+        static Streamer *streamer;
+        // Bake block-compressed caches where the driver supports S3TC, RGBA8 otherwise
+        static bool compression;
+
+        typedef std::vector<std::unique_ptr<TextureCache::File> > LayerFiles;
 
     private:
+        friend class Streamer;
+
         bool available;
+        // Decoding or uploading through the streamer
+        bool pending;
+        // Bumped by clear(), so in-flight streamer work for an older request is dropped
+        unsigned int ticket;
         std::string name;
         std::string filename;
+        // One image per layer of a GL_TEXTURE_2D_ARRAY, just filename for a GL_TEXTURE_2D
+        std::vector<std::string> layerFilename;
+        GLenum target;
         int width;
         int height;
         GLuint tex;
@@ -36,16 +67,21 @@ namespace TextureImage {
                 : Texture() {}
 
         Texture()
-                : available(false), name(), filename(), width(0), height(0), tex(0) {}
+                : available(false), pending(false), ticket(0), name(), filename(), layerFilename(),
+                  target(GL_TEXTURE_2D), width(0), height(0), tex(0) {}
 
         virtual ~Texture() { clear(); }
 
     public:
         void clear() {
             available = false;
+            pending = false;
+            ticket++;
             name = std::string();
             filename = std::string();
-            glDeleteTextures(1, &tex);
+            layerFilename.clear();
+            target = GL_TEXTURE_2D;
+            if (tex) glDeleteTextures(1, &tex);
             tex = 0;
         }
 
@@ -85,11 +121,55 @@ namespace TextureImage {
             if (fi == NULL) return error;
             fclose(fi);
 
+            return request(_name, std::vector<std::string>(1, _filename), GL_TEXTURE_2D);
+        }
+
+        // Every image becomes one layer of a GL_TEXTURE_2D_ARRAY, in order. They must share their size.
+        static Texture &loadTextureArray(std::string _name, const std::vector<std::string> &_filenames) {
+            if (_filenames.empty()) return error;
+            for (size_t i = 0; i < _filenames.size(); i++) {
+                FILE *fi = fopen(_filenames[i].c_str(), "r");
+                if (fi == NULL) return error;
+                fclose(fi);
+            }
+            return request(_name, _filenames, GL_TEXTURE_2D_ARRAY);
+        }
+
+        static bool unloadTexture(std::string _name) {
+            return allTexture.erase(_name) != 0;
+        }
+
+        static Texture &getTexture(const std::string &_name) {
+            Name2Texture::iterator find_result = allTexture.find(_name);
+            if (find_result == allTexture.end()) return error;
+            return *(find_result->second);
+        }
+
+        bool isPending() const { return pending; }
+
+        GLenum getTarget() const { return target; }
+
+        int getLayerNum() const { return (int) layerFilename.size(); }
+
+        bool bind(GLenum textureChannel) const {
+            if (!available) {
+                const Texture &fallback = target == GL_TEXTURE_2D_ARRAY ? placeholderArray : placeholder;
+                return pending && this != &fallback && fallback.bind(textureChannel);
+            }
+            glActiveTexture(GL_TEXTURE0 + textureChannel);
+            glBindTexture(target, tex);
+            return true;
+        }
+
+    private:
+        static Texture &request(const std::string &_name, const std::vector<std::string> &_filenames,
+                                GLenum _target) {
             std::pair<Name2Texture::iterator, bool> insertion =
                     allTexture.insert(Name2Texture::value_type(_name, new Texture()));
             Texture &target = *(insertion.first->second);
             if (!insertion.second) {
-                if (target.filename == _filename && target.available) {
+                if (target.layerFilename == _filenames && target.target == _target &&
+                    (target.available || target.pending)) {
                     return target;
                 } else {
                     target.clear();
@@ -97,40 +177,44 @@ namespace TextureImage {
             }
 
             target.name = _name;
-            target.filename = _filename;
+            target.filename = _filenames[0];
+            target.layerFilename = _filenames;
+            target.target = _target;
+
+            bool compress = compressionSupported();
+            if (streamer) {
+                target.pending = true;
+                requestStream(target, compress);
+                return target;
+            }
 
             stbi_set_flip_vertically_on_load(true);
-            int channels;
-            unsigned char *data =
-                    stbi_load(_filename.c_str(), &target.width, &target.height, &channels, 0);
-            if (!data) {
+            LayerFiles files;
+            TextureCache::Format format;
+            if (!loadLayers(_filenames, compress, files) || !layerFormat(files, format)) {
                 return error;
             }
 
-            GLenum format = GL_RGBA;
-            if (channels == 1) {
-                format = GL_R;
-            }
-            if (channels == 2) {
-                format = GL_RG;
-            }
-            if (channels == 3) {
-                format = GL_RGB;
+            target.allocate(format, files[0]->header(), (uint32_t) files.size());
+            std::vector<uint8_t> converted;
+            for (uint32_t layer = 0; layer < files.size(); layer++) {
+                const TextureCache::File &file = *files[layer];
+                for (uint32_t l = 0; l < file.header().levelNum; l++) {
+                    const TextureCache::LevelRecord &level = file.levelRecord(l);
+                    uint32_t groupNum = TextureCache::rowGroupNum(format, level.height);
+                    const uint8_t *data = file.level(l);
+                    if (file.format() != format) {
+                        converted.resize((size_t) (TextureCache::rowGroupBytes(format, level.width) * groupNum));
+                        TextureCache::copyRowGroups(file.format(), format, level.width, groupNum, data,
+                                                    converted.data());
+                        data = converted.data();
+                    }
+                    target.uploadRowGroups(format, level, l, layer, 0, groupNum, data);
+                }
             }
+            glBindTexture(target.target, 0);
 
-            glGenTextures(1, &target.tex);
-            glBindTexture(GL_TEXTURE_2D, target.tex);
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, target.width, target.height,
-                         0, format, GL_UNSIGNED_BYTE, data);
-            glGenerateMipmap(GL_TEXTURE_2D);
-            glBindTexture(GL_TEXTURE_2D, 0);
-
-            stbi_image_free(data);
-
+            GLenum gl_error_code;
             if ((gl_error_code = glGetError()) != GL_NO_ERROR) {
                 const GLubyte *errString = glewGetErrorString(gl_error_code);
                 std::cout << "ERROR in loadTexture():" << std::endl;
@@ -142,24 +226,335 @@ namespace TextureImage {
             return target;
         }
 
-        static bool unloadTexture(std::string _name) {
-            return allTexture.erase(_name) != 0;
+        static void requestStream(Texture &_target, bool _compress);
+
+        // Maps (baking on a miss) the cache of every layer. Touches no GL state.
+        static bool loadLayers(const std::vector<std::string> &_filenames, bool _compress, LayerFiles &_files) {
+            _files.clear();
+            for (size_t i = 0; i < _filenames.size(); i++) {
+                _files.push_back(std::unique_ptr<TextureCache::File>(new TextureCache::File()));
+                if (!TextureCache::load(_filenames[i], _compress, *_files.back())) return false;
+            }
+            return true;
         }
 
-        static Texture &getTexture(const std::string &_name) {
-            Name2Texture::iterator find_result = allTexture.find(_name);
-            if (find_result == allTexture.end()) return error;
-            return *(find_result->second);
+        // Layers must match in size; a mix of BC1 and BC3 layers is stored as BC3
+        static bool layerFormat(const LayerFiles &_files, TextureCache::Format &_format) {
+            const TextureCache::Header &first = _files[0]->header();
+            _format = _files[0]->format();
+            for (size_t i = 1; i < _files.size(); i++) {
+                const TextureCache::Header &header = _files[i]->header();
+                if (header.width != first.width || header.height != first.height ||
+                    header.levelNum != first.levelNum)
+                    return false;
+                if ((_files[i]->format() == TextureCache::FormatRGBA8) != (_format == TextureCache::FormatRGBA8))
+                    return false;
+                if (_files[i]->format() == TextureCache::FormatBC3) _format = TextureCache::FormatBC3;
+            }
+            return true;
         }
 
-        bool bind(GLenum textureChannel) const {
-            if (!available) return false;
-            glActiveTexture(GL_TEXTURE0 + textureChannel);
-            glBindTexture(GL_TEXTURE_2D, tex);
+        static bool compressionSupported() {
+            return compression && GLEW_EXT_texture_compression_s3tc;
+        }
+
+        static GLenum internalFormat(TextureCache::Format _format) {
+            if (_format == TextureCache::FormatBC1) return GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+            if (_format == TextureCache::FormatBC3) return GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+            return GL_RGBA8;
+        }
+
+        // Creates the texture with storage for every level and layer and leaves it bound
+        void allocate(TextureCache::Format _format, const TextureCache::Header &_header, uint32_t _layerNum) {
+            width = (int) _header.width;
+            height = (int) _header.height;
+            GLenum format = internalFormat(_format);
+            glGenTextures(1, &tex);
+            glBindTexture(target, tex);
+            glTexParameteri(target, GL_TEXTURE_WRAP_S, GL_REPEAT);
+            glTexParameteri(target, GL_TEXTURE_WRAP_T, GL_REPEAT);
+            glTexParameteri(target, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+            glTexParameteri(target, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+            glTexParameteri(target, GL_TEXTURE_BASE_LEVEL, 0);
+            glTexParameteri(target, GL_TEXTURE_MAX_LEVEL, (GLint) _header.levelNum - 1);
+            for (uint32_t l = 0; l < _header.levelNum; l++) {
+                const TextureCache::LevelRecord &level = _header.levels[l];
+                GLsizei bytes = (GLsizei) (TextureCache::levelBytes(_format, level.width, level.height) * _layerNum);
+                if (target == GL_TEXTURE_2D_ARRAY) {
+                    if (_format == TextureCache::FormatRGBA8)
+                        glTexImage3D(target, (GLint) l, format, level.width, level.height, _layerNum, 0, GL_RGBA,
+                                     GL_UNSIGNED_BYTE, NULL);
+                    else
+                        glCompressedTexImage3D(target, (GLint) l, format, level.width, level.height, _layerNum, 0,
+                                               bytes, NULL);
+                } else {
+                    if (_format == TextureCache::FormatRGBA8)
+                        glTexImage2D(target, (GLint) l, format, level.width, level.height, 0, GL_RGBA,
+                                     GL_UNSIGNED_BYTE, NULL);
+                    else
+                        glCompressedTexImage2D(target, (GLint) l, format, level.width, level.height, 0, bytes, NULL);
+                }
+            }
+        }
+
+        // Uploads row groups [_begin, _end) of one level and layer into the bound texture. _data points at
+        // _begin's group in _format, or is an offset into the bound pixel unpack buffer.
+        void uploadRowGroups(TextureCache::Format _format, const TextureCache::LevelRecord &_level, uint32_t _levelIndex,
+                             uint32_t _layer, uint32_t _begin, uint32_t _end, const void *_data) const {
+            GLint y = (GLint) (_begin * TextureCache::rowGroupHeight(_format));
+            GLsizei rows = std::min((GLsizei) (_end * TextureCache::rowGroupHeight(_format)),
+                                    (GLsizei) _level.height) - y;
+            GLsizei bytes = (GLsizei) (TextureCache::rowGroupBytes(_format, _level.width) * (_end - _begin));
+            if (target == GL_TEXTURE_2D_ARRAY) {
+                if (_format == TextureCache::FormatRGBA8)
+                    glTexSubImage3D(target, (GLint) _levelIndex, 0, y, (GLint) _layer, _level.width, rows, 1, GL_RGBA,
+                                    GL_UNSIGNED_BYTE, _data);
+                else
+                    glCompressedTexSubImage3D(target, (GLint) _levelIndex, 0, y, (GLint) _layer, _level.width, rows, 1,
+                                              internalFormat(_format), bytes, _data);
+            } else {
+                if (_format == TextureCache::FormatRGBA8)
+                    glTexSubImage2D(target, (GLint) _levelIndex, 0, y, _level.width, rows, GL_RGBA, GL_UNSIGNED_BYTE,
+                                    _data);
+                else
+                    glCompressedTexSubImage2D(target, (GLint) _levelIndex, 0, y, _level.width, rows,
+                                              internalFormat(_format), bytes, _data);
+            }
+        }
+    };
+
+    // Loads queued images from the texture cache on its own worker threads and uploads their mip chains on
+    // the GL thread through a ring of pixel buffer objects, a strip of rows at a time, so each frame spends
+    // a bounded time on textures.
+    // Everything except the decoding runs on the thread that owns the GL context.
+    class Streamer {
+    public:
+        explicit Streamer(size_t _decodeThreadNum = TEXTURE_STREAMER_DECODE_THREADS)
+                : jobs(1 + std::max(_decodeThreadNum, (size_t) 1)), current(NULL), pboIndex(0), queuedNum(0),
+                  released(false) {
+            glGenBuffers(TEXTURE_STREAMER_PBO_NUM, pbo);
+            createPlaceholder(Texture::placeholder, GL_TEXTURE_2D);
+            createPlaceholder(Texture::placeholderArray, GL_TEXTURE_2D_ARRAY);
+        }
+
+        ~Streamer() { release(); }
+
+        // Waits for the decoders and frees every GL object, call while the context is still current
+        void release() {
+            if (released) return;
+            released = true;
+            jobs.wait(group);
+            if (current) drop(current);
+            current = NULL;
+            for (size_t i = 0; i < decoded.size(); i++)
+                drop(decoded[i]);
+            decoded.clear();
+            queuedNum = 0;
+            glDeleteBuffers(TEXTURE_STREAMER_PBO_NUM, pbo);
+            Texture::placeholder.clear();
+            Texture::placeholderArray.clear();
+            if (Texture::streamer == this) Texture::streamer = NULL;
+        }
+
+        // Images requested but not yet uploaded
+        size_t getPendingNum() const { return queuedNum; }
+
+        // Uploads decoded images until _budgetMs has passed, at least one strip per call if any is ready.
+        // Returns how many textures became available.
+        size_t update(double _budgetMs) {
+            Clock::time_point start = Clock::now();
+            size_t completed = 0;
+            while (queuedNum > 0) {
+                if (!current) {
+                    {
+                        std::lock_guard<std::mutex> lock(mutex);
+                        if (decoded.empty()) break;
+                        current = decoded.front();
+                        decoded.pop_front();
+                    }
+                    if (!begin(*current)) {
+                        drop(current);
+                        current = NULL;
+                        continue;
+                    }
+                }
+                if (uploadStrip(*current)) {
+                    completed += finish(*current);
+                    drop(current);
+                    current = NULL;
+                }
+                if (std::chrono::duration<double, std::milli>(Clock::now() - start).count() >= _budgetMs) break;
+            }
+            return completed;
+        }
+
+    private:
+        friend class Texture;
+
+        typedef std::chrono::steady_clock Clock;
+
+        // Layers are uploaded one after another, each from its largest level down
+        struct Image {
+            Texture *target;
+            unsigned int ticket;
+            std::vector<std::string> filenames;
+            bool compress;
+            bool loaded;
+            Texture::LayerFiles files;
+            TextureCache::Format format;
+            uint32_t layer;
+            uint32_t level;
+            uint32_t uploadedGroups;
+        };
+
+        Parallel::JobSystem jobs;
+        Parallel::JobGroup group;
+        std::mutex mutex;
+        std::deque<Image *> decoded;
+        Image *current;
+        GLuint pbo[TEXTURE_STREAMER_PBO_NUM];
+        size_t pboIndex;
+        size_t queuedNum;
+        bool released;
+
+        // Forbid copying
+        Streamer(const Streamer &_copy);
+
+        Streamer &operator=(const Streamer &_copy);
+
+        static void createPlaceholder(Texture &_target, GLenum _textureTarget) {
+            const unsigned char grey[4] = {128, 128, 128, 255};
+            _target.clear();
+            _target.target = _textureTarget;
+            glGenTextures(1, &_target.tex);
+            glBindTexture(_textureTarget, _target.tex);
+            glTexParameteri(_textureTarget, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+            glTexParameteri(_textureTarget, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+            if (_textureTarget == GL_TEXTURE_2D_ARRAY)
+                glTexImage3D(_textureTarget, 0, GL_RGBA, 1, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, grey);
+            else
+                glTexImage2D(_textureTarget, 0, GL_RGBA, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, grey);
+            glBindTexture(_textureTarget, 0);
+            _target.width = _target.height = 1;
+            _target.available = true;
+        }
+
+        void request(Texture &_target, bool _compress) {
+            Image *image = new Image();
+            image->target = &_target;
+            image->ticket = _target.ticket;
+            image->filenames = _target.layerFilename;
+            image->compress = _compress;
+            image->loaded = false;
+            image->format = TextureCache::FormatRGBA8;
+            image->layer = 0;
+            image->level = 0;
+            image->uploadedGroups = 0;
+            queuedNum++;
+            // Set once here rather than from the decoders, stb keeps it in a global
+            stbi_set_flip_vertically_on_load(true);
+            jobs.run(group, [this, image] {
+                // Maps the baked mip chains, decoding and baking them first on a miss
+                image->loaded = Texture::loadLayers(image->filenames, image->compress, image->files) &&
+                                Texture::layerFormat(image->files, image->format);
+                std::lock_guard<std::mutex> lock(mutex);
+                decoded.push_back(image);
+            });
+        }
+
+        // False once the texture was cleared or asked for again since this image was queued
+        static bool stillRequested(const Image &_image) {
+            return _image.target->ticket == _image.ticket;
+        }
+
+        bool begin(Image &_image) {
+            if (!stillRequested(_image)) return false;
+            Texture &target = *_image.target;
+            if (!_image.loaded) {
+                std::cout << "Error loading texture " << target.name << std::endl;
+                target.pending = false;
+                return false;
+            }
+            target.allocate(_image.format, _image.files[0]->header(), (uint32_t) _image.files.size());
+            glBindTexture(target.target, 0);
             return true;
         }
+
+        // Copies the next row groups of the current level into an orphaned PBO and sources the texture
+        // update from it, so the driver can transfer them without stalling on the previous strip.
+        // True once every level of every layer is in.
+        bool uploadStrip(Image &_image) {
+            if (!stillRequested(_image)) return true;
+            const Texture &target = *_image.target;
+            const TextureCache::File &file = *_image.files[_image.layer];
+            const TextureCache::LevelRecord &level = file.levelRecord(_image.level);
+            uint64_t groupBytes = TextureCache::rowGroupBytes(_image.format, level.width);
+            uint32_t groupNum = TextureCache::rowGroupNum(_image.format, level.height);
+            uint32_t groups = (uint32_t) std::max((uint64_t) 1, TEXTURE_STREAMER_STRIP_BYTES / groupBytes);
+            groups = std::min(groups, groupNum - _image.uploadedGroups);
+            size_t bytes = (size_t) (groupBytes * groups);
+            const uint8_t *source = file.level(_image.level) +
+                                    TextureCache::rowGroupBytes(file.format(), level.width) * _image.uploadedGroups;
+
+            glBindTexture(target.target, target.tex);
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo[pboIndex]);
+            pboIndex = (pboIndex + 1) % TEXTURE_STREAMER_PBO_NUM;
+            glBufferData(GL_PIXEL_UNPACK_BUFFER, bytes, NULL, GL_STREAM_DRAW);
+            void *mapped = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, bytes,
+                                            GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+            if (mapped) {
+                TextureCache::copyRowGroups(file.format(), _image.format, level.width, groups, source,
+                                            (uint8_t *) mapped);
+                glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+                target.uploadRowGroups(_image.format, level, _image.level, _image.layer, _image.uploadedGroups,
+                                       _image.uploadedGroups + groups, (const void *) 0);
+                glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+            } else {
+                glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+                std::vector<uint8_t> converted(bytes);
+                TextureCache::copyRowGroups(file.format(), _image.format, level.width, groups, source,
+                                            converted.data());
+                target.uploadRowGroups(_image.format, level, _image.level, _image.layer, _image.uploadedGroups,
+                                       _image.uploadedGroups + groups, converted.data());
+            }
+            glBindTexture(target.target, 0);
+
+            _image.uploadedGroups += groups;
+            if (_image.uploadedGroups < groupNum) return false;
+            _image.uploadedGroups = 0;
+            if (++_image.level < file.header().levelNum) return false;
+            _image.level = 0;
+            return ++_image.layer >= _image.files.size();
+        }
+
+        size_t finish(Image &_image) {
+            if (!stillRequested(_image)) return 0;
+            Texture &target = *_image.target;
+            GLenum gl_error_code = glGetError();
+            target.pending = false;
+            if (gl_error_code != GL_NO_ERROR) {
+                std::cout << "ERROR streaming " << target.name << ":" << std::endl;
+                std::cout << glewGetErrorString(gl_error_code) << std::endl;
+                return 0;
+            }
+            target.available = true;
+            return 1;
+        }
+
+        void drop(Image *_image) {
+            delete _image;
+            queuedNum--;
+        }
     };
 
+    void Texture::requestStream(Texture &_target, bool _compress) {
+        streamer->request(_target, _compress);
+    }
+
     Texture::Name2Texture Texture::allTexture;
     Texture Texture::error;
+    Texture Texture::placeholder;
+    Texture Texture::placeholderArray;
+    Streamer *Texture::streamer = NULL;
+    bool Texture::compression = true;
 }
\ No newline at end of file
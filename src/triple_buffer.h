@@ -0,0 +1,49 @@
+// Triple Buffer
+// Hands the latest value from one producer thread to one consumer thread without locks. Each side
+// owns a slot, the third is exchanged atomically, so neither side ever waits and the consumer always
+// sees a complete value; values the consumer had no time to take are simply replaced.
+
+#pragma once
+
+#include <cstdint>
+#include <atomic>
+
+namespace Parallel {
+    template<typename T>
+    class TripleBuffer {
+    public:
+        TripleBuffer() : back(0), middle(1 | FRESH_BIT), front(2) {}
+
+        // Producer: the slot to fill, holding whatever the producer wrote into it two publishes ago
+        T &write() { return slot[back]; }
+
+        // Producer: makes the written slot the latest value
+        void publish() { back = middle.exchange(back | FRESH_BIT) & INDEX_MASK; }
+
+        // Consumer: takes the latest value if one was published since the last call
+        bool update() {
+            if (!(middle.load(std::memory_order_relaxed) & FRESH_BIT)) return false;
+            front = middle.exchange(front) & INDEX_MASK;
+            return true;
+        }
+
+        // Consumer: the value taken by the last successful update()
+        const T &read() const { return slot[front]; }
+
+    private:
+        static const uint8_t FRESH_BIT = 4;
+        static const uint8_t INDEX_MASK = 3;
+
+        T slot[3];
+        uint8_t back;
+        // Index of the exchanged slot, with FRESH_BIT while it holds a value the consumer has not taken.
+        // exchange() is sequentially consistent, which orders the slot contents around it.
+        std::atomic<uint8_t> middle;
+        uint8_t front;
+
+        // Forbid copying
+        TripleBuffer(const TripleBuffer &_copy);
+
+        TripleBuffer &operator=(const TripleBuffer &_copy);
+    };
+}